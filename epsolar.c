@@ -2,30 +2,69 @@
  */
 #include <stdio.h>
 #include <errno.h>
+#include <stdlib.h>
 #include <string.h>
+#include <assert.h>
+#include <time.h>
 #include <unistd.h>
 #include <modbus/modbus.h>
 
 #include "log4c.h"
 #include "libepsolar.h"
+#include "epsolarsim.h"
 
 
 static char         *version = "libepsolar v1.5 - strerror";
 
 
-//static  char    *defaultPortName = "/dev/ttyXRUSB0";
-static  char    *defaultPortName = "/dev/ttyACM1";
-static  int     defaultBaudRate = 115200;
-static  char    defaultParity = 'N';
-static  int     defaultDataBits = 8;
-static  int     defaultStopBits = 1;
-
-static  modbus_t    *ctx = NULL;
+//
+// The controller behind epsolarModbusConnect() and the eps_* macros
+static  epsolarController_t defaultController = {
+    //.portName = "/dev/ttyXRUSB0",
+    .portName = "/dev/ttyACM1",
+    .baudRate = 115200,
+    .parity = 'N',
+    .dataBits = 8,
+    .stopBits = 1,
+    .slaveNumber = 1,
+    .useBlockReads = TRUE,
+    .adaptiveTimeouts = FALSE,
+    .ctx = NULL
+};
+
+//
+// Where findController() remembers what it found - NULL, it always scans
+static  char        *discoveryStateFile = NULL;
+
+//
+// Every register in a real time snapshot, for the read planner
+static const int    snapshotFields[] = {
+    TRACER_PV_ARRAY_INPUT_VOLTAGE, TRACER_PV_ARRAY_INPUT_CURRENT, TRACER_PV_ARRAY_INPUT_POWER,
+    TRACER_LOAD_VOLTAGE, TRACER_LOAD_CURRENT, TRACER_LOAD_POWER,
+    TRACER_BATTERY_TEMPERATURE, TRACER_DEVICE_TEMPERATURE, TRACER_BATTERY_STATE_OF_CHARGE,
+    TRACER_BATTERY_STATUS, TRACER_CHARGING_EQUIPMENT_STATUS, TRACER_DISCHARGING_EQUIPMENT_STATUS,
+    TRACER_MAXIMUM_BATTERY_VOLTAGE_TODAY, TRACER_MINIMUM_BATTERY_VOLTAGE_TODAY,
+    TRACER_CONSUMED_ENERGY_TODAY, TRACER_CONSUMED_ENERGY_MONTH, TRACER_CONSUMED_ENERGY_YEAR, TRACER_CONSUMED_ENERGY_TOTAL,
+    TRACER_GENERATED_ENERGY_TODAY, TRACER_GENERATED_ENERGY_MONTH, TRACER_GENERATED_ENERGY_YEAR, TRACER_GENERATED_ENERGY_TOTAL,
+    TRACER_BATTERY_VOLTAGE, TRACER_BATTERY_CURRENT,
+    TRACER_NIGHT_TIME, TRACER_REALTIME_CLOCK, TRACER_LOAD_CONTROLLING_MODE
+};
+#define NUM_SNAPSHOT_FIELDS     ((int) (sizeof( snapshotFields ) / sizeof( snapshotFields[ 0 ] )))
 
 
 static  const char  *getPVStatus( const uint16_t chargingEquipmentStatusBits );
 static  const char  *getControllerStatus( const uint16_t chargingEquipmentStatusBits );
-static  const char  *getLoadControlMode();
+static  const char  *getLoadControlMode( modbus_t *ctx );
+static  const char  *loadControlModeToString( const int lcm );
+static  void        getRealTimeDataByRegister( modbus_t *ctx, epsolarRealTimeData_t *rtData );
+static  void        getRealTimeDataByBlock( modbus_t *ctx, epsolarRealTimeData_t *rtData );
+static  int         finishConnect( epsolarController_t *controller, modbus_t *ctx );
+static  int         reconnectLocked( epsolarController_t *controller );
+static  int         checkConnection( epsolarController_t *controller );
+static  void        noteReadStatus( epsolarController_t *controller, const int readStatus );
+static  uint16_t    rawWord( const tracerReadPlan_t *plan, const tracerReadResult_t *result, const int regId );
+static  uint32_t    rawLong( const tracerReadPlan_t *plan, const tracerReadResult_t *result, const int regId );
+static  void        getDefaultTimeoutPolicy( const epsolarController_t *controller, tracerTimeoutPolicy_t *policy );
 
 
 
@@ -39,38 +78,120 @@ char    *epsolarGetVersion (void)
 // -----------------------------------------------------------------------------
 int epsolarModbusConnect (const char *portName, const int slaveNumber)
 {
-    Logger_LogInfo( "Compiled against libmodbus version %s\n", LIBMODBUS_VERSION_STRING );
-        //
+    //
     // Use the passed in port name, unless it's null.
     if (portName != NULL)
-        defaultPortName = (char *) portName;
-        
+        epsolarSetDefaultPortName( portName );
+    defaultController.slaveNumber = slaveNumber;
+
+    return epsolarControllerConnect( &defaultController );
+}
+
+// -----------------------------------------------------------------------------
+int epsolarControllerConnect (epsolarController_t *controller)
+{
+    modbus_t    *ctx;
+
+    assert( controller != NULL );
+    Logger_LogInfo( "Compiled against libmodbus version %s\n", LIBMODBUS_VERSION_STRING );
+
+    char    host[ sizeof( controller->portName ) ];
+    int     tcpPort;
+    controller->transport = epsolarParsePortName( controller->portName, host, sizeof( host ), &tcpPort );
+    if (controller->transport < 0) {
+        Logger_LogFatal( "Unable to make sense of the port name [%s]\n", controller->portName );
+        return FALSE;
+    }
+    controller->needsReconnect = FALSE;
+    controller->reconnectBackoffMillis = 0;
+
+    if (controller->transport == EPSOLAR_TRANSPORT_TCP) {
+        Logger_LogInfo( "Opening Modbus TCP to %s:%d\n", host, tcpPort );
+        char    service[ 8 ];
+        snprintf( service, sizeof( service ), "%d", tcpPort );
+        ctx = modbus_new_tcp_pi( host, service );
+        if (ctx == NULL) {
+            Logger_LogFatal( "Unable to create the libmodbus context [%s]\n", modbus_strerror( errno ) );
+            return FALSE;
+        }
+        return finishConnect( controller, ctx );
+    }
+
     //
     // Modbus - open the SCC port
     Logger_LogInfo( "Opening %s, %d %d%c%d\n", 
-            defaultPortName, defaultBaudRate,
-            defaultDataBits, defaultParity, defaultStopBits );
+            controller->portName, controller->baudRate,
+            controller->dataBits, controller->parity, controller->stopBits );
+    const char  *portName = controller->portName;
+    if (controller->transport == EPSOLAR_TRANSPORT_RTU_OVER_TCP) {
+        //
+        // RTU frames through a gateway - libmodbus opens the bridge's pty
+        controller->bridge = epsolarTcpBridgeStart( host, tcpPort, controller->keepaliveSeconds );
+        if (controller->bridge == NULL)
+            return FALSE;
+        portName = epsolarTcpBridgeGetPortName( controller->bridge );
+    }
 #ifdef FAKEOUT
-    Logger_LogError( "USING FAKED OUT LIBRARY CALLS!" );
-    return;
+    //
+    // No hardware - talk to a simulated controller on a pty instead. One per
+    //  process, it lives until we exit.
+    static epsolarSimulator_t   *simulator = NULL;
+    if (simulator == NULL) {
+        epsolarSimulatorConfig_t    config = {
+            .slaveId = controller->slaveNumber,
+            .baudRate = controller->baudRate,
+            .bitsPerChar = 1 + controller->dataBits + (controller->parity == 'N' ? 0 : 1) + controller->stopBits,
+            .turnaroundMicros = 2000
+        };
+        simulator = epsolarSimulatorStart( &config );
+        if (simulator == NULL)
+            return FALSE;
+    }
+    portName = epsolarSimulatorGetPortName( simulator );
+    Logger_LogError( "USING THE SIMULATOR ON [%s] INSTEAD OF [%s]!\n", portName, controller->portName );
 #endif
     
-    ctx = modbus_new_rtu( defaultPortName, defaultBaudRate, defaultParity, defaultDataBits, defaultStopBits );
+    ctx = modbus_new_rtu( portName, controller->baudRate, controller->parity, controller->dataBits, controller->stopBits );
     if (ctx == NULL) {
         Logger_LogFatal( "Unable to create the libmodbus context [%s]\n", modbus_strerror( errno ) );
+        epsolarTcpBridgeStop( controller->bridge );
+        controller->bridge = NULL;
         return FALSE;
     }
-    
-    Logger_LogInfo( "Setting slave ID to 0x%X\n", slaveNumber );
-    modbus_set_slave( ctx, slaveNumber );
+
+    return finishConnect( controller, ctx );
+}
+
+// -----------------------------------------------------------------------------
+static
+int finishConnect (epsolarController_t *controller, modbus_t *ctx)
+{
+    //
+    //  Whatever the transport, from a fresh context on
+    Logger_LogInfo( "Setting slave ID to 0x%X\n", controller->slaveNumber );
+    modbus_set_slave( ctx, controller->slaveNumber );
 
     if (modbus_connect( ctx ) == -1) {
         Logger_LogFatal( "Connection failed: %s\n", modbus_strerror( errno ) );
         modbus_free( ctx );
+        epsolarTcpBridgeStop( controller->bridge );
+        controller->bridge = NULL;
         return FALSE;
     }
+    if (controller->transport == EPSOLAR_TRANSPORT_TCP)
+        epsolarSetKeepalive( modbus_get_socket( ctx ), controller->keepaliveSeconds );
     
-    Logger_LogInfo( "Port to Solar Charge Controller is open.\n", defaultPortName );
+    Logger_LogInfo( "Port %s to Solar Charge Controller is open.\n", controller->portName );
+
+    //
+    // Its own bus lock and read cache - if the registry is full it falls
+    //  back to sharing the default one, which still works
+    tracerAttachContext( ctx );
+    controller->ctx = ctx;
+    if (controller->adaptiveTimeouts)
+        epsolarControllerSetAdaptiveTimeouts( controller, TRUE );
+    if (controller->pipelineDepth > 1)
+        epsolarControllerSetPipelining( controller, controller->pipelineDepth );
 
 #ifdef RPI
     
@@ -109,217 +230,712 @@ int epsolarModbusConnect (const char *portName, const int slaveNumber)
 // -----------------------------------------------------------------------------
 char    *findController (const char *deviceNameBase, int maxDevNum, const int leaveOpen)
 {
-    int             done = FALSE;
-    int             found = FALSE;
-    char            devBuffer[ 40 ];
+    epsolarFoundController_t    found;
     
     //
     //  With the CH341 adapter, the device appears on /dev/ttyACMx
-    //  We're going to see if we can find it.
+    //  We're going to see if we can find it - every device at once, with the
+    //  default controller's serial settings and slave ID.
 
     //
     //  Sanity check some of the input values
     if (maxDevNum > 255)
         maxDevNum = 255;
 
+#ifdef FAKEOUT
     //
-    //  loop thru making device names, try to see if there's a WS2300 there
-    int devNum = 0;
-    while (!done) {
-        //  make a string like "/dev/ttyACM0"
-        snprintf( devBuffer, sizeof devBuffer, "%s%d", deviceNameBase, devNum );
-
-        Logger_LogDebug( "findController - trying to open [%s]\n", devBuffer );
-        if (epsolarModbusConnect( devBuffer, 1 )) {
-            Logger_LogDebug( "findController - port opened, seeing if it's a controller\n" );
-
-            //
-            // module level var 'ctx' will be set for us by Connect()
-            
-            // See if we can read the controller clock
-            int seconds = -99;              // Set them to something obviously impossible
-            int minutes = -99;
-            int hours = -99;
-            int day = -99;
-            int month = -99;
-            int year = -99;
-            
-            getRealtimeClock( ctx, &seconds, &minutes, &hours, &day, &month, &year );
-            
-            if ( (seconds >= 0 && seconds < 60) &&
-                 (minutes >= 0 && minutes < 60) &&
-                 (hours >= 0 && hours < 24)) {
-                Logger_LogInfo( "findController - found a controller on device [%s]\n", devBuffer );
-                found = TRUE;
-                done = TRUE;
-                
-                //
-                // Connect sets the static var 'defaultPortName' for us
-                if (!leaveOpen) {
-                    Logger_LogInfo( "findController - leave open param is false, so closing device [%s]\n", defaultPortName );
-                    epsolarModbusDisconnect();
-                }
-            } else {
-                Logger_LogInfo( "findController - set clock call on device [%s] failed\n", devBuffer );
-                devNum += 1;
-            }
-        }   // ConnectCall failed - keep going
-        
-        done = (found || (devNum > maxDevNum));
-        if (!done)
-            sleep( 2 );
-    }
+    //  Nothing to probe - Connect() swaps the simulator in for the first device
+    snprintf( found.portName, sizeof found.portName, "%s%d", deviceNameBase, 0 );
+#else
+    epsolarProbeConfig_t    config = {
+        .deviceNameBase = deviceNameBase,
+        .maxDevNum = maxDevNum,
+        .slaveIds = &defaultController.slaveNumber,
+        .numSlaveIds = 1,
+        .baudRates = &defaultController.baudRate,
+        .numBaudRates = 1,
+        .parity = defaultController.parity,
+        .dataBits = defaultController.dataBits,
+        .stopBits = defaultController.stopBits,
+        .probeTimeoutMicros = EPSOLAR_DEFAULT_PROBE_TIMEOUT
+    };
     
-    if (found)
-        Logger_LogInfo( "findController - found a controller on port [%s]\n", defaultPortName );
-    else {
+    int ok = (discoveryStateFile != NULL ? epsolarFindControllerCached( discoveryStateFile, &config, &found )
+                                         : (epsolarFindControllers( &config, &found, 1 ) > 0));
+    if (!ok) {
         Logger_LogWarning( "findController - could NOT find a controller on port with a base of [%s]\n", deviceNameBase );
-        defaultPortName = NULL;
+        return NULL;
     }
-    
-    return defaultPortName;
+#endif
+
+    Logger_LogInfo( "findController - found a controller on device [%s]\n", found.portName );
+    epsolarSetDefaultPortName( found.portName );
+    if (leaveOpen && !epsolarModbusConnect( found.portName, defaultController.slaveNumber )) {
+        Logger_LogWarning( "findController - unable to reopen device [%s]\n", found.portName );
+        return NULL;
+    }
+
+    Logger_LogInfo( "findController - found a controller on port [%s]\n", defaultController.portName );
+    return defaultController.portName;
+}
+
+// -----------------------------------------------------------------------------
+void    epsolarSetDiscoveryStateFile (const char *stateFile)
+{
+    free( discoveryStateFile );
+    discoveryStateFile = (stateFile != NULL ? strdup( stateFile ) : NULL);
 }
 
 // -----------------------------------------------------------------------------
 int epsolarModbusDisconnect (void)
 {
-    if (ctx == NULL)
+    return epsolarControllerDisconnect( &defaultController );
+}
+
+// -----------------------------------------------------------------------------
+int epsolarControllerDisconnect (epsolarController_t *controller)
+{
+    assert( controller != NULL );
+    if (controller->ctx == NULL)
         return TRUE;
     
-    modbus_close( ctx );
-    modbus_free( ctx );
+    tracerDetachContext( controller->ctx );
+    modbus_close( controller->ctx );
+    modbus_free( controller->ctx );
+    epsolarTcpBridgeStop( controller->bridge );
     
-    ctx = NULL;
+    controller->ctx = NULL;
+    controller->bridge = NULL;
     return TRUE;
 }
 
+// -----------------------------------------------------------------------------
+int epsolarControllerReconnect (epsolarController_t *controller)
+{
+    //
+    //  Drop the link and bring it back up on the same context, so its bus
+    //  lock, read cache and timeouts carry on as they were. A bridge looks
+    //  after its own socket - all there is to do is ask how it's getting on.
+    assert( controller != NULL );
+    if (controller->ctx == NULL)
+        return FALSE;
+
+    if (controller->transport == EPSOLAR_TRANSPORT_RTU_OVER_TCP)
+        return epsolarTcpBridgeIsConnected( controller->bridge );
+
+    tracerBus_t *bus = tracerLockContext( controller->ctx );
+    int status = reconnectLocked( controller );
+    tracerUnlockContext( bus );
+
+    return status;
+}
+
+// -----------------------------------------------------------------------------
+static
+int reconnectLocked (epsolarController_t *controller)
+{
+    //
+    //  Caller holds the context's bus lock - nobody else can be half way
+    //  through a transaction on the socket we're about to close, and the
+    //  reconnect state is only touched under that lock
+    modbus_close( controller->ctx );
+    if (modbus_connect( controller->ctx ) == -1) {
+        //
+        //  Don't hammer a gateway that's down - back off up to 30 seconds
+        int backoff = controller->reconnectBackoffMillis;
+        controller->reconnectBackoffMillis = (backoff == 0 ? 250 : (backoff * 2 < 30000 ? backoff * 2 : 30000));
+        controller->nextReconnectMillis = epsolarMonotonicMillis() + controller->reconnectBackoffMillis;
+        controller->needsReconnect = TRUE;
+        Logger_LogWarning( "Reconnecting to [%s] failed: %s - next try in %d ms\n",
+                controller->portName, modbus_strerror( errno ), controller->reconnectBackoffMillis );
+        return FALSE;
+    }
+
+    if (controller->transport == EPSOLAR_TRANSPORT_TCP)
+        epsolarSetKeepalive( modbus_get_socket( controller->ctx ), controller->keepaliveSeconds );
+    controller->needsReconnect = FALSE;
+    controller->reconnectBackoffMillis = 0;
+    Logger_LogInfo( "Reconnected to [%s]\n", controller->portName );
+    return TRUE;
+}
+
+// -----------------------------------------------------------------------------
+epsolarController_t *epsolarControllerNew (const char *portName, const int baudRate, const char parity, const int dataBits, const int stopBits, const int slaveNumber)
+{
+    //
+    //  Not connected yet - call epsolarControllerConnect() when ready
+    epsolarController_t *controller = calloc( 1, sizeof( epsolarController_t ) );
+    if (controller == NULL) {
+        Logger_LogError( "Unable to allocate a controller for [%s]\n", portName );
+        return NULL;
+    }
+
+    strncpy( controller->portName, portName, sizeof( controller->portName ) - 1 );
+    controller->baudRate = baudRate;
+    controller->parity = parity;
+    controller->dataBits = dataBits;
+    controller->stopBits = stopBits;
+    controller->slaveNumber = slaveNumber;
+    controller->useBlockReads = TRUE;
+    controller->adaptiveTimeouts = FALSE;
+    controller->ctx = NULL;
+
+    return controller;
+}
+
+// -----------------------------------------------------------------------------
+void epsolarControllerFree (epsolarController_t *controller)
+{
+    if (controller == NULL || controller == &defaultController)
+        return;
+
+    epsolarControllerDisconnect( controller );
+    free( controller );
+}
+
+// -----------------------------------------------------------------------------
+epsolarController_t *epsolarGetDefaultController (void)
+{
+    return &defaultController;
+}
+
+// -----------------------------------------------------------------------------
+modbus_t    *epsolarControllerGetContext (const epsolarController_t *controller)
+{
+    return controller->ctx;
+}
+
 // -----------------------------------------------------------------------------
 modbus_t    *epsolarModbusGetContext (void)
 {
-    return ctx;
+    return defaultController.ctx;
 }
 
 // -----------------------------------------------------------------------------
 const   char    *epsolarGetDefaultPortName (void)
 { 
-    return defaultPortName;
+    return defaultController.portName;
 }
 
 // -----------------------------------------------------------------------------
 void    epsolarSetDefaultPortName (const char *newName)
 { 
-    defaultPortName = (char *) newName;
+    //
+    //  findController() hands us the controller's own buffer back sometimes
+    if (newName != defaultController.portName) {
+        memset( defaultController.portName, '\0', sizeof( defaultController.portName ) );
+        strncpy( defaultController.portName, newName, sizeof( defaultController.portName ) - 1 );
+    }
 }
 
 // -----------------------------------------------------------------------------
 const   int epsolarGetDefaultBaudRate (void)
 {
-    return defaultBaudRate;
+    return defaultController.baudRate;
 }
 
 // -----------------------------------------------------------------------------
 void    epsolarSetDefaultBaudRate (const int newRate)
 {
-    defaultBaudRate = newRate;
+    defaultController.baudRate = newRate;
 }
 
 // -----------------------------------------------------------------------------
 const   char    epsolarGetDefaultParity (void)
 { 
-    return defaultParity;
+    return defaultController.parity;
 }
 
 // -----------------------------------------------------------------------------
 void    epsolarSetDefaultParity (const char newParity)
 { 
-    defaultParity = newParity;
+    defaultController.parity = newParity;
 }
 
 // -----------------------------------------------------------------------------
 const   int epsolarGetDataBits (void)
 {
-    return defaultDataBits;
+    return defaultController.dataBits;
 }
 
 // -----------------------------------------------------------------------------
 void epsolarSetDefaultDataBits (const int newBits)
 {
-    defaultDataBits = newBits;
+    defaultController.dataBits = newBits;
 }
 
 // -----------------------------------------------------------------------------
 const   int epsolarGetStopBits (void)
 {
-    return defaultStopBits;
+    return defaultController.stopBits;
 }
 
 // -----------------------------------------------------------------------------
 void    epsolarSetDefaultStopBits (const int newBits)
 {
-    defaultStopBits = newBits;
+    defaultController.stopBits = newBits;
+}
+
+// -----------------------------------------------------------------------------
+void    epsolarSetBlockReads (const int enable)
+{
+    defaultController.useBlockReads = (enable ? TRUE : FALSE);
+}
+
+// -----------------------------------------------------------------------------
+int     epsolarGetBlockReads (void)
+{
+    return defaultController.useBlockReads;
+}
+
+// -----------------------------------------------------------------------------
+void    epsolarSetAdaptiveTimeouts (const int enable)
+{
+    epsolarControllerSetAdaptiveTimeouts( &defaultController, enable );
+}
+
+// -----------------------------------------------------------------------------
+int     epsolarGetAdaptiveTimeouts (void)
+{
+    return defaultController.adaptiveTimeouts;
+}
+
+// -----------------------------------------------------------------------------
+void    epsolarControllerSetAdaptiveTimeouts (epsolarController_t *controller, const int enable)
+{
+    //
+    //  Sticks across reconnects. Takes effect now if we're connected.
+    tracerTimeoutPolicy_t   policy;
+
+    assert( controller != NULL );
+    controller->adaptiveTimeouts = (enable ? TRUE : FALSE);
+    if (controller->ctx == NULL)
+        return;
+
+    if (enable) {
+        getDefaultTimeoutPolicy( controller, &policy );
+        tracerSetAdaptiveTimeouts( controller->ctx, &policy );
+    } else {
+        tracerSetAdaptiveTimeouts( controller->ctx, NULL );
+    }
+}
+
+// -----------------------------------------------------------------------------
+void    epsolarControllerSetPipelining (epsolarController_t *controller, const int maxInFlight)
+{
+    //
+    //  Sticks across reconnects, like the timeouts. Only Modbus TCP can do it -
+    //  RTU frames, through a gateway or not, carry nothing to match the
+    //  replies up by - so anything else stays one request at a time.
+    assert( controller != NULL );
+    controller->pipelineDepth = maxInFlight;
+    if (controller->ctx == NULL)
+        return;
+
+    if (controller->transport != EPSOLAR_TRANSPORT_TCP) {
+        if (maxInFlight > 1)
+            Logger_LogWarning( "Pipelining needs Modbus TCP - [%s] stays one request at a time\n", controller->portName );
+        return;
+    }
+    tracerSetPipelining( controller->ctx, maxInFlight );
 }
 
 // -----------------------------------------------------------------------------
 void    epsolarGetRealTimeData (epsolarRealTimeData_t *rtData)
+{
+    epsolarControllerGetRealTimeData( &defaultController, rtData );
+}
+
+// -----------------------------------------------------------------------------
+void    epsolarControllerGetRealTimeData (epsolarController_t *controller, epsolarRealTimeData_t *rtData)
 {
     memset( rtData, '\0', sizeof( epsolarRealTimeData_t ) );
     
-    if (epsolarModbusGetContext() == NULL) {
+    if (controller->ctx == NULL) {
+        Logger_LogError( "Modbus Context is Zero - did you forget to connect?\n" );
+        rtData->readStatus = TRACER_STATUS_IO_ERROR;
+        return;
+    }
+
+    if (!checkConnection( controller )) {
+        rtData->readStatus = TRACER_STATUS_IO_ERROR;
+        return;
+    }
+
+    //
+    //  Transient errors have already been retried by the time a getter gives
+    //  up, so anything that shows up here is worth throwing the sample away for
+    tracerClearStatus();
+    if (controller->useBlockReads)
+        getRealTimeDataByBlock( controller->ctx, rtData );
+    else
+        getRealTimeDataByRegister( controller->ctx, rtData );
+    tracerDecodeStatus( rtData->batteryStatusBits, rtData->controllerStatusBits, rtData->dischargingStatusBits, &rtData->status );
+    rtData->readStatus = tracerGetFirstFailure();
+    noteReadStatus( controller, rtData->readStatus );
+}
+
+// -----------------------------------------------------------------------------
+void    epsolarGetRawSnapshot (epsolarRawSnapshot_t *raw)
+{
+    epsolarControllerGetRawSnapshot( &defaultController, raw );
+}
+
+// -----------------------------------------------------------------------------
+void    epsolarControllerGetRawSnapshot (epsolarController_t *controller, epsolarRawSnapshot_t *raw)
+{
+    //
+    //  The registers getRealTimeDataByBlock() reads, kept as they came off
+    //  the wire. Always block reads - one at a time would defeat the point.
+    tracerReadPlan_t    plan;
+    tracerReadResult_t  result;
+
+    assert( controller != NULL );
+    assert( raw != NULL );
+    memset( raw, '\0', sizeof( epsolarRawSnapshot_t ) );
+
+    if (controller->ctx == NULL) {
         Logger_LogError( "Modbus Context is Zero - did you forget to connect?\n" );
+        raw->readStatus = TRACER_STATUS_IO_ERROR;
+        return;
+    }
+    if (!planRegisterReads( snapshotFields, NUM_SNAPSHOT_FIELDS, TRACER_DEFAULT_GAP_FILL, &plan )) {
+        Logger_LogError( "Unable to plan the real time data reads\n" );
+        raw->readStatus = TRACER_STATUS_IO_ERROR;
+        return;
+    }
+    if (!checkConnection( controller )) {
+        raw->readStatus = TRACER_STATUS_IO_ERROR;
         return;
     }
-        
+
+    tracerClearStatus();
+    executeReadPlan( controller->ctx, &plan, &result );
+    raw->timeMillis = epsolarNowMillis();
+    raw->readStatus = (int8_t) tracerGetFirstFailure();
+    noteReadStatus( controller, raw->readStatus );
+
+    raw->pvVoltage = rawWord( &plan, &result, TRACER_PV_ARRAY_INPUT_VOLTAGE );
+    raw->pvCurrent = rawWord( &plan, &result, TRACER_PV_ARRAY_INPUT_CURRENT );
+    raw->pvPower = rawLong( &plan, &result, TRACER_PV_ARRAY_INPUT_POWER );
+    raw->loadVoltage = rawWord( &plan, &result, TRACER_LOAD_VOLTAGE );
+    raw->loadCurrent = rawWord( &plan, &result, TRACER_LOAD_CURRENT );
+    raw->loadPower = rawLong( &plan, &result, TRACER_LOAD_POWER );
+    raw->batteryTemperature = (int16_t) rawWord( &plan, &result, TRACER_BATTERY_TEMPERATURE );
+    raw->controllerTemp = (int16_t) rawWord( &plan, &result, TRACER_DEVICE_TEMPERATURE );
+    raw->batteryStateOfCharge = rawWord( &plan, &result, TRACER_BATTERY_STATE_OF_CHARGE );
+    raw->batteryVoltage = rawWord( &plan, &result, TRACER_BATTERY_VOLTAGE );
+    raw->batteryCurrent = (int32_t) rawLong( &plan, &result, TRACER_BATTERY_CURRENT );
+    raw->batteryMaxVoltage = rawWord( &plan, &result, TRACER_MAXIMUM_BATTERY_VOLTAGE_TODAY );
+    raw->batteryMinVoltage = rawWord( &plan, &result, TRACER_MINIMUM_BATTERY_VOLTAGE_TODAY );
+
+    raw->energyConsumedToday = rawLong( &plan, &result, TRACER_CONSUMED_ENERGY_TODAY );
+    raw->energyConsumedMonth = rawLong( &plan, &result, TRACER_CONSUMED_ENERGY_MONTH );
+    raw->energyConsumedYear = rawLong( &plan, &result, TRACER_CONSUMED_ENERGY_YEAR );
+    raw->energyConsumedTotal = rawLong( &plan, &result, TRACER_CONSUMED_ENERGY_TOTAL );
+    raw->energyGeneratedToday = rawLong( &plan, &result, TRACER_GENERATED_ENERGY_TODAY );
+    raw->energyGeneratedMonth = rawLong( &plan, &result, TRACER_GENERATED_ENERGY_MONTH );
+    raw->energyGeneratedYear = rawLong( &plan, &result, TRACER_GENERATED_ENERGY_YEAR );
+    raw->energyGeneratedTotal = rawLong( &plan, &result, TRACER_GENERATED_ENERGY_TOTAL );
+
+    raw->batteryStatusBits = rawWord( &plan, &result, TRACER_BATTERY_STATUS );
+    raw->controllerStatusBits = rawWord( &plan, &result, TRACER_CHARGING_EQUIPMENT_STATUS );
+    raw->dischargingStatusBits = rawWord( &plan, &result, TRACER_DISCHARGING_EQUIPMENT_STATUS );
+    raw->loadControlMode = rawWord( &plan, &result, TRACER_LOAD_CONTROLLING_MODE );
+    raw->isNightTime = (uint8_t) rawWord( &plan, &result, TRACER_NIGHT_TIME );
+
+    const uint16_t *words = planResultWords( &plan, &result, TRACER_REALTIME_CLOCK );
+    if (words != NULL)
+        memcpy( raw->clock, words, sizeof( raw->clock ) );
+}
+
+// -----------------------------------------------------------------------------
+int64_t     epsolarNowMillis (void)
+{
+    //
+    //  Wall clock - what gets stored and shown. It can step either way when
+    //  NTP or a person sets the time, so don't use it to measure intervals
+    struct timespec ts;
+
+    clock_gettime( CLOCK_REALTIME, &ts );
+    return ((int64_t) ts.tv_sec * 1000) + (ts.tv_nsec / 1000000L);
+}
+
+// -----------------------------------------------------------------------------
+float   epsolarMetricValue (const epsolarRealTimeData_t *rtData, const int metric)
+{
+    switch (metric) {
+        case EPSOLAR_METRIC_PV_VOLTAGE:             return (float) rtData->pvVoltage;
+        case EPSOLAR_METRIC_PV_CURRENT:             return (float) rtData->pvCurrent;
+        case EPSOLAR_METRIC_PV_POWER:               return (float) rtData->pvPower;
+        case EPSOLAR_METRIC_BATTERY_VOLTAGE:        return (float) rtData->batteryVoltage;
+        case EPSOLAR_METRIC_BATTERY_CURRENT:        return (float) rtData->batteryCurrent;
+        case EPSOLAR_METRIC_BATTERY_SOC:            return (float) rtData->batteryStateOfCharge;
+        case EPSOLAR_METRIC_BATTERY_MAX_VOLTAGE:    return (float) rtData->batteryMaxVoltage;
+        case EPSOLAR_METRIC_BATTERY_MIN_VOLTAGE:    return (float) rtData->batteryMinVoltage;
+        case EPSOLAR_METRIC_BATTERY_TEMPERATURE:    return (float) rtData->batteryTemperature;
+        case EPSOLAR_METRIC_LOAD_VOLTAGE:           return (float) rtData->loadVoltage;
+        case EPSOLAR_METRIC_LOAD_CURRENT:           return (float) rtData->loadCurrent;
+        case EPSOLAR_METRIC_LOAD_POWER:             return (float) rtData->loadPower;
+        case EPSOLAR_METRIC_CONTROLLER_TEMP:        return (float) rtData->controllerTemp;
+        case EPSOLAR_METRIC_ENERGY_GENERATED_TODAY: return (float) rtData->energyGeneratedToday;
+        case EPSOLAR_METRIC_ENERGY_GENERATED_TOTAL: return (float) rtData->energyGeneratedTotal;
+        case EPSOLAR_METRIC_ENERGY_CONSUMED_TODAY:  return (float) rtData->energyConsumedToday;
+        case EPSOLAR_METRIC_ENERGY_CONSUMED_TOTAL:  return (float) rtData->energyConsumedTotal;
+    }
+
+    return 0.0f;
+}
+
+// -----------------------------------------------------------------------------
+uint8_t epsolarSnapshotFlags (const epsolarRealTimeData_t *rtData)
+{
+    //
+    //  The yes/no fields of a snapshot as EPSOLAR_LOG_* bits
+    return (rtData->loadIsOn ? EPSOLAR_LOG_LOAD_ON : 0) |
+           (rtData->isNightTime ? EPSOLAR_LOG_NIGHT : 0) |
+           (rtData->chargerRunning ? EPSOLAR_LOG_CHARGER_RUNNING : 0) |
+           (rtData->chargerStatusNormal ? EPSOLAR_LOG_CHARGER_NORMAL : 0);
+}
+
+// -----------------------------------------------------------------------------
+int64_t     epsolarMonotonicMillis (void)
+{
+    //
+    //  Never goes backwards, but means nothing outside this boot - for
+    //  timeouts, backoffs and spacing
+    struct timespec ts;
+
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return ((int64_t) ts.tv_sec * 1000) + (ts.tv_nsec / 1000000L);
+}
+
+// -----------------------------------------------------------------------------
+static
+void    getRealTimeDataByRegister (modbus_t *ctx, epsolarRealTimeData_t *rtData)
+{
     //
     //  NB: The PVArray, Charging and Controller Status are all crammed into
     //      register 0x3201
     //
-    uint16_t  chargingEquipmentStatusBits = eps_getChargingEquipmentStatusBits();
+    uint16_t  chargingEquipmentStatusBits = getChargingEquipmentStatusBits( ctx );
     
-    rtData->pvPower     = eps_getPVArrayInputPower();
-    rtData->pvCurrent   = eps_getPVArrayInputCurrent();
-    rtData->pvVoltage   = eps_getPVArrayInputVoltage();
+    rtData->pvPower     = getPVArrayInputPower( ctx );
+    rtData->pvCurrent   = getPVArrayInputCurrent( ctx );
+    rtData->pvVoltage   = getPVArrayInputVoltage( ctx );
     rtData->pvStatus    = getChargingEquipmentStatusInputVoltageStatus( chargingEquipmentStatusBits );
     
     //
-    uint16_t     batteryStatusBits = eps_getBatteryStatusBits();
-    rtData->batteryVoltage  = eps_getBatteryVoltage();
-    rtData->batteryCurrent   = eps_getBatteryCurrent();
-    rtData->batteryStateOfCharge = eps_getBatteryStateOfCharge();
-    rtData->batteryTemperature = eps_getBatteryTemperature();
-    rtData->batteryStatus = eps_getBatteryStatusVoltage( batteryStatusBits );
-    rtData->batteryMinVoltage = eps_getMinimumBatteryVoltageToday();
-    rtData->batteryMaxVoltage = eps_getMaximumBatteryVoltageToday();
-    rtData->batteryChargingStatus = eps_getChargingStatus( chargingEquipmentStatusBits );       // Not BatteryStatusBits!
+    uint16_t     batteryStatusBits = getBatteryStatusBits( ctx );
+    rtData->batteryVoltage  = getBatteryVoltage( ctx );
+    rtData->batteryCurrent   = getBatteryCurrent( ctx );
+    rtData->batteryStateOfCharge = getBatteryStateOfCharge( ctx );
+    rtData->batteryTemperature = getBatteryTemperature( ctx );
+    rtData->batteryStatus = getBatteryStatusVoltage( batteryStatusBits );
+    rtData->batteryMinVoltage = getMinimumBatteryVoltageToday( ctx );
+    rtData->batteryMaxVoltage = getMaximumBatteryVoltageToday( ctx );
+    rtData->batteryChargingStatus = getChargingStatus( chargingEquipmentStatusBits );       // Not BatteryStatusBits!
     
     //
-    uint16_t dischargingStatusBits = eps_getDischargingEquipmentStatusBits();
-    rtData->loadVoltage = eps_getLoadVoltage();
-    rtData->loadCurrent = eps_getLoadCurrent();
-    rtData->loadPower = eps_getLoadPower();
+    uint16_t dischargingStatusBits = getDischargingEquipmentStatusBits( ctx );
+    rtData->loadVoltage = getLoadVoltage( ctx );
+    rtData->loadCurrent = getLoadCurrent( ctx );
+    rtData->loadPower = getLoadPower( ctx );
     rtData->loadLevel = getDischargingStatusOutputPower( dischargingStatusBits );
-    rtData->loadIsOn = (eps_isDischargeStatusRunning( dischargingStatusBits ) ? TRUE : FALSE );
-    rtData->loadControlMode = (char *) getLoadControlMode();
+    rtData->loadIsOn = (isDischargeStatusRunning( dischargingStatusBits ) ? TRUE : FALSE );
+    rtData->loadControlMode = (char *) getLoadControlMode( ctx );
     
-    rtData->controllerTemp = eps_getDeviceTemperature();
+    rtData->controllerTemp = getDeviceTemperature( ctx );
     rtData->chargerStatusNormal = isChargingStatusNormal( chargingEquipmentStatusBits );
     rtData->chargerRunning = isChargingStatusRunning( chargingEquipmentStatusBits );
 
     rtData ->controllerStatusBits = chargingEquipmentStatusBits;
+    rtData->batteryStatusBits = batteryStatusBits;
+    rtData->dischargingStatusBits = dischargingStatusBits;
     
-    rtData->isNightTime = eps_isNightTime();
-    eps_getRealtimeClockStr(&(rtData->controllerClock[ 0 ]), sizeof( rtData->controllerClock ) );
+    rtData->isNightTime = isNightTime( ctx );
+    getRealtimeClockStr( ctx, &(rtData->controllerClock[ 0 ]), sizeof( rtData->controllerClock ) );
+
+    rtData->energyConsumedToday = getConsumedEnergyToday( ctx );
+    rtData->energyConsumedMonth = getConsumedEnergyMonth( ctx );
+    rtData->energyConsumedYear = getConsumedEnergyYear( ctx );
+    rtData->energyConsumedTotal = getConsumedEnergyTotal( ctx );
+    rtData->energyGeneratedToday = getGeneratedEnergyToday( ctx );
+    rtData->energyGeneratedMonth = getGeneratedEnergyMonth( ctx );
+    rtData->energyGeneratedYear = getGeneratedEnergyYear( ctx );
+    rtData->energyGeneratedTotal = getGeneratedEnergyTotal( ctx );   
+}
 
-    rtData->energyConsumedToday = eps_getConsumedEnergyToday();
-    rtData->energyConsumedMonth = eps_getConsumedEnergyMonth();
-    rtData->energyConsumedYear = eps_getConsumedEnergyYear();
-    rtData->energyConsumedTotal = eps_getConsumedEnergyTotal();
-    rtData->energyGeneratedToday = eps_getGeneratedEnergyToday();
-    rtData->energyGeneratedMonth = eps_getGeneratedEnergyMonth();
-    rtData->energyGeneratedYear = eps_getGeneratedEnergyYear();
-    rtData->energyGeneratedTotal = eps_getGeneratedEnergyTotal();   
+
+// -----------------------------------------------------------------------------
+static
+void    getRealTimeDataByBlock (modbus_t *ctx, epsolarRealTimeData_t *rtData)
+{
+    //
+    //  The same snapshot as getRealTimeDataByRegister(), but the read planner
+    //  folds every register we need into a handful of block requests:
+    //      0x3100..0x3111  PV, Load and Temperatures
+    //      0x311A          Battery SoC
+    //      0x3200..0x3202  Battery, Charging and Discharging Status
+    //      0x3302..0x3313  Daily min/max and Energy Statistics
+    //      0x331A..0x331C  Battery Voltage and Current
+    //  plus the night flag, the clock and the load control mode. They all go
+    //  out back to back under one lock.
+    //
+    //  If a request fails, the fields in it get the same "bad read" values
+    //  the one-at-a-time getters would have returned.
+    static const uint16_t noClock[ 3 ] = { 0, 0, 0 };       // a failed clock read decodes as all zeros
+    tracerReadPlan_t    plan;
+    tracerReadResult_t  result;
+
+    if (!planRegisterReads( snapshotFields, NUM_SNAPSHOT_FIELDS, TRACER_DEFAULT_GAP_FILL, &plan )) {
+        Logger_LogError( "Unable to plan the real time data reads\n" );
+        return;
+    }
+    executeReadPlan( ctx, &plan, &result );
+
+    //
+    //  NB: The PVArray, Charging and Controller Status are all crammed into
+    //      register 0x3201
+    uint16_t    batteryStatusBits = planResultAsInt( &plan, &result, TRACER_BATTERY_STATUS );
+    uint16_t    chargingEquipmentStatusBits = planResultAsInt( &plan, &result, TRACER_CHARGING_EQUIPMENT_STATUS );
+    uint16_t    dischargingStatusBits = planResultAsInt( &plan, &result, TRACER_DISCHARGING_EQUIPMENT_STATUS );
+    const uint16_t  *words;
+
+    rtData->pvVoltage   = planResultAsFloat( &plan, &result, TRACER_PV_ARRAY_INPUT_VOLTAGE );
+    rtData->pvCurrent   = planResultAsFloat( &plan, &result, TRACER_PV_ARRAY_INPUT_CURRENT );
+    rtData->pvPower     = planResultAsFloat( &plan, &result, TRACER_PV_ARRAY_INPUT_POWER );
+    rtData->pvStatus    = getChargingEquipmentStatusInputVoltageStatus( chargingEquipmentStatusBits );
+
+    rtData->batteryVoltage  = planResultAsFloat( &plan, &result, TRACER_BATTERY_VOLTAGE );
+    rtData->batteryCurrent  = planResultAsFloat( &plan, &result, TRACER_BATTERY_CURRENT );
+    rtData->batteryStateOfCharge = planResultAsInt( &plan, &result, TRACER_BATTERY_STATE_OF_CHARGE );
+    words = planResultWords( &plan, &result, TRACER_BATTERY_TEMPERATURE );
+    rtData->batteryTemperature = (words != NULL ? decodeTemperatureRegister( TRACER_BATTERY_TEMPERATURE, words ) : -148.0);
+    rtData->batteryStatus = eps_getBatteryStatusVoltage( batteryStatusBits );
+    rtData->batteryMaxVoltage = planResultAsFloat( &plan, &result, TRACER_MAXIMUM_BATTERY_VOLTAGE_TODAY );
+    rtData->batteryMinVoltage = planResultAsFloat( &plan, &result, TRACER_MINIMUM_BATTERY_VOLTAGE_TODAY );
+    rtData->batteryChargingStatus = eps_getChargingStatus( chargingEquipmentStatusBits );       // Not BatteryStatusBits!
+
+    rtData->loadVoltage = planResultAsFloat( &plan, &result, TRACER_LOAD_VOLTAGE );
+    rtData->loadCurrent = planResultAsFloat( &plan, &result, TRACER_LOAD_CURRENT );
+    rtData->loadPower   = planResultAsFloat( &plan, &result, TRACER_LOAD_POWER );
+    rtData->loadLevel = getDischargingStatusOutputPower( dischargingStatusBits );
+    rtData->loadIsOn = (eps_isDischargeStatusRunning( dischargingStatusBits ) ? TRUE : FALSE );
+    rtData->loadControlMode = (char *) loadControlModeToString( planResultAsInt( &plan, &result, TRACER_LOAD_CONTROLLING_MODE ) );
+
+    words = planResultWords( &plan, &result, TRACER_DEVICE_TEMPERATURE );
+    rtData->controllerTemp = (words != NULL ? decodeTemperatureRegister( TRACER_DEVICE_TEMPERATURE, words ) : -148.0);
+    rtData->chargerStatusNormal = isChargingStatusNormal( chargingEquipmentStatusBits );
+    rtData->chargerRunning = isChargingStatusRunning( chargingEquipmentStatusBits );
+
+    rtData->controllerStatusBits = chargingEquipmentStatusBits;
+    rtData->batteryStatusBits = batteryStatusBits;
+    rtData->dischargingStatusBits = dischargingStatusBits;
+
+    rtData->isNightTime = (planResultAsInt( &plan, &result, TRACER_NIGHT_TIME ) == 1);
+    words = planResultWords( &plan, &result, TRACER_REALTIME_CLOCK );
+    decodeRealtimeClockStr( (words != NULL ? words : noClock), &(rtData->controllerClock[ 0 ]), sizeof( rtData->controllerClock ) );
+
+    rtData->energyConsumedToday = planResultAsFloat( &plan, &result, TRACER_CONSUMED_ENERGY_TODAY );
+    rtData->energyConsumedMonth = planResultAsFloat( &plan, &result, TRACER_CONSUMED_ENERGY_MONTH );
+    rtData->energyConsumedYear  = planResultAsFloat( &plan, &result, TRACER_CONSUMED_ENERGY_YEAR );
+    rtData->energyConsumedTotal = planResultAsFloat( &plan, &result, TRACER_CONSUMED_ENERGY_TOTAL );
+    rtData->energyGeneratedToday = planResultAsFloat( &plan, &result, TRACER_GENERATED_ENERGY_TODAY );
+    rtData->energyGeneratedMonth = planResultAsFloat( &plan, &result, TRACER_GENERATED_ENERGY_MONTH );
+    rtData->energyGeneratedYear  = planResultAsFloat( &plan, &result, TRACER_GENERATED_ENERGY_YEAR );
+    rtData->energyGeneratedTotal = planResultAsFloat( &plan, &result, TRACER_GENERATED_ENERGY_TOTAL );
 }
 
 
+// -----------------------------------------------------------------------------
+static
+int     checkConnection (epsolarController_t *controller)
+{
+    //
+    //  FALSE if a Modbus TCP link is down and it isn't time to try it again
+    //  yet - the snapshot fails straight away instead of timing out. Only
+    //  Modbus TCP ever needs it, so nothing else pays for the lock.
+    if (controller->transport != EPSOLAR_TRANSPORT_TCP || controller->ctx == NULL)
+        return TRUE;
+
+    int status = TRUE;
+    tracerBus_t *bus = tracerLockContext( controller->ctx );
+    if (controller->needsReconnect) {
+        if (epsolarMonotonicMillis() < controller->nextReconnectMillis)
+            status = FALSE;
+        else
+            status = reconnectLocked( controller );
+    }
+    tracerUnlockContext( bus );
+
+    return status;
+}
+
+// -----------------------------------------------------------------------------
+static
+void    noteReadStatus (epsolarController_t *controller, const int readStatus)
+{
+    //
+    //  An I/O error over Modbus TCP is a socket that's gone - reset, refused,
+    //  or given up on by the keepalive. Serial ports and the bridge's pty
+    //  don't go away like that.
+    if (readStatus == TRACER_STATUS_IO_ERROR && controller->transport == EPSOLAR_TRANSPORT_TCP && controller->ctx != NULL) {
+        tracerBus_t *bus = tracerLockContext( controller->ctx );
+        controller->needsReconnect = TRUE;
+        controller->nextReconnectMillis = 0;
+        tracerUnlockContext( bus );
+    }
+}
+
+// -----------------------------------------------------------------------------
+static
+uint16_t    rawWord (const tracerReadPlan_t *plan, const tracerReadResult_t *result, const int regId)
+{
+    //
+    //  Zero if the request it was in failed
+    const uint16_t *words = planResultWords( plan, result, regId );
+    return (words != NULL ? words[ 0x00 ] : 0);
+}
+
+// -----------------------------------------------------------------------------
+static
+uint32_t    rawLong (const tracerReadPlan_t *plan, const tracerReadResult_t *result, const int regId)
+{
+    //
+    //  Two registers, low word first
+    const uint16_t *words = planResultWords( plan, result, regId );
+    return (words != NULL ? ((uint32_t) words[ 0x01 ] << 16) | words[ 0x00 ] : 0);
+}
+
+// -----------------------------------------------------------------------------
+static
+void    getDefaultTimeoutPolicy (const epsolarController_t *controller, tracerTimeoutPolicy_t *policy)
+{
+    //
+    //  p99 of the recent round trips, plus enough slack for a USB adapter to
+    //  sit on a few characters. Never more than libmodbus' own half second
+    //  on a serial port.
+    int     bitsPerChar = 1 + controller->dataBits + (controller->parity == 'N' ? 0 : 1) + controller->stopBits;
+    long    charMicros = (controller->baudRate > 0 ? (1000000L * bitsPerChar) / controller->baudRate : 1000L);
+
+    policy->percentile = 99.0;
+    policy->marginMicros = 5000L + (4 * charMicros);
+    policy->minMicros = 10000L;
+    policy->maxMicros = 500000L;
+    policy->byteMicros = (10 * charMicros > 10000L ? 10 * charMicros : 10000L);
+    policy->maxBackoff = 3;
+
+    //
+    //  Through a gateway the network can add more than the bus does, and it
+    //  jitters - more slack, and room to wait out a slow link
+    if (controller->transport != EPSOLAR_TRANSPORT_RTU) {
+        policy->marginMicros += 20000L;
+        policy->minMicros = 50000L;
+        policy->maxMicros = 1500000L;
+    }
+}
+
 // -----------------------------------------------------------------------------
 static
 const char  *getControllerStatus (const uint16_t chargingEquipmentStatusBits)
@@ -360,17 +976,23 @@ const char  *getControllerStatus (const uint16_t chargingEquipmentStatusBits)
 
 // -----------------------------------------------------------------------------
 static
-const char  *getLoadControlMode ()
+const char  *getLoadControlMode (modbus_t *ctx)
 {
-    if (epsolarModbusGetContext() == NULL) {
+    if (ctx == NULL) {
         Logger_LogError( "Modbus Context is Zero - did you forget to connect?\n" );
         return "NOT CONNECTED";
     }
 
-    uint16_t    lcm = eps_getLoadControllingMode();
+    uint16_t    lcm = getLoadControllingMode( ctx );
     
     Logger_LogDebug( "getLoadControlMode - lcmBits [%0X]\n", lcm );
-    
+    return loadControlModeToString( lcm );
+}
+
+// -----------------------------------------------------------------------------
+static
+const char  *loadControlModeToString (const int lcm)
+{
     if (lcm == 0x00)    return "Manual";
     if (lcm == 0x01)    return "Dusk-Dawn";
     if (lcm == 0x02)    return "Dusk-Timer";
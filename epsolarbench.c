@@ -0,0 +1,271 @@
+/*
+ * Benchmarks for the real time data path, run against the simulator.
+ *
+ *  For every baud rate and turnaround delay asked for, a simulated controller
+ *  is started and epsolarGetRealTimeData() is timed twice - register by
+ *  register, the way the library always used to do it, and through the read
+ *  planner - followed by each of the individual getters. For every case it
+ *  reports wall time per call, p50/p99 latency, Modbus transactions per call
+ *  and the bytes each way on the wire, so an I/O change can be compared with
+ *  the one-register-per-call numbers on the same line speed.
+ *
+ *  usage: epsolarbench [-n calls] [-b baud[,baud..]] [-t micros[,micros..]] [-x]
+ *      -n  calls per case, default 20
+ *      -b  baud rates, default 9600,115200
+ *      -t  controller turnaround in microseconds, default 2000
+ *      -x  turn the read cache off for every register class
+ */
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <modbus/modbus.h>
+
+#include "log4c.h"
+#include "libepsolar.h"
+#include "epsolarsim.h"
+
+
+#define MAX_CALLS           10000
+#define MAX_SETTINGS        16
+
+//
+// Getters worth timing on their own. One of the two pointers is set.
+typedef struct benchGetter {
+    const char  *name;
+    float       (*asFloat)( modbus_t *ctx );
+    int         (*asInt)( modbus_t *ctx );
+} benchGetter_t;
+
+static const benchGetter_t getters[] = {
+    { "getPVArrayInputVoltage",     getPVArrayInputVoltage,     NULL },
+    { "getPVArrayInputPower",       getPVArrayInputPower,       NULL },
+    { "getBatteryVoltage",          getBatteryVoltage,          NULL },
+    { "getBatteryCurrent",          getBatteryCurrent,          NULL },
+    { "getBatteryTemperature",      getBatteryTemperature,      NULL },
+    { "getBatteryStateOfCharge",    NULL,                       getBatteryStateOfCharge },
+    { "getLoadPower",               getLoadPower,               NULL },
+    { "getGeneratedEnergyTotal",    getGeneratedEnergyTotal,    NULL },
+    { "getRatedChargingCurrent",    getRatedChargingCurrent,    NULL },
+    { "getBoostingVoltage",         getBoostingVoltage,         NULL },
+    { "getLoadControllingMode",     NULL,                       getLoadControllingMode },
+    { "isNightTime",                NULL,                       isNightTime },
+};
+
+typedef struct benchResult {
+    int             calls;
+    double          meanMicros;
+    double          p50Micros;
+    double          p99Micros;
+    double          transactionsPerCall;
+    double          bytesOutPerCall;        // library to controller
+    double          bytesInPerCall;         // controller to library
+} benchResult_t;
+
+
+static  void        runSetting( const int baudRate, const int turnaroundMicros, const int calls );
+static  void        runCase( epsolarSimulator_t *sim, const benchGetter_t *getter, const int blockReads, const int calls, benchResult_t *result );
+static  void        printResult( const int baudRate, const int turnaroundMicros, const char *name, const benchResult_t *result );
+static  unsigned long   countTransactions( void );
+static  int         parseList( const char *arg, int *values, const int maxValues );
+static  int         compareDoubles( const void *a, const void *b );
+static  double      monotonicMicros( void );
+
+static  double      samples[ MAX_CALLS ];
+static  tracerStats_t   stats;              // too big for the stack
+
+
+
+// -----------------------------------------------------------------------------
+int main (int argc, char *argv[])
+{
+    int     baudRates[ MAX_SETTINGS ] = { 9600, 115200 };
+    int     numBaudRates = 2;
+    int     turnarounds[ MAX_SETTINGS ] = { 2000 };
+    int     numTurnarounds = 1;
+    int     calls = 20;
+    int     opt;
+
+    while ((opt = getopt( argc, argv, "n:b:t:x" )) != -1) {
+        switch (opt) {
+            case 'n':   calls = atoi( optarg );
+                break;
+            case 'b':   numBaudRates = parseList( optarg, baudRates, MAX_SETTINGS );
+                break;
+            case 't':   numTurnarounds = parseList( optarg, turnarounds, MAX_SETTINGS );
+                break;
+            case 'x':
+                for (int i = 0; i < TRACER_CLASS_COUNT; i += 1)
+                    setRegisterCacheTTL( i, 0 );
+                break;
+            default:
+                fprintf( stderr, "usage: %s [-n calls] [-b baud[,baud..]] [-t micros[,micros..]] [-x]\n", argv[ 0 ] );
+                return EXIT_FAILURE;
+        }
+    }
+
+    if (calls < 1 || calls > MAX_CALLS || numBaudRates < 1 || numTurnarounds < 1) {
+        fprintf( stderr, "%s: need 1 to %d calls and at least one baud rate and turnaround\n", argv[ 0 ], MAX_CALLS );
+        return EXIT_FAILURE;
+    }
+
+    printf( "%-7s %-8s %-28s %6s %10s %10s %10s %9s %9s %9s\n",
+            "baud", "turn us", "call", "calls", "mean ms", "p50 ms", "p99 ms", "txns", "tx bytes", "rx bytes" );
+
+    for (int b = 0; b < numBaudRates; b += 1)
+        for (int t = 0; t < numTurnarounds; t += 1)
+            runSetting( baudRates[ b ], turnarounds[ t ], calls );
+
+    return EXIT_SUCCESS;
+}
+
+// -----------------------------------------------------------------------------
+static
+void    runSetting (const int baudRate, const int turnaroundMicros, const int calls)
+{
+    epsolarSimulatorConfig_t    config = {
+        .slaveId = 1,
+        .baudRate = baudRate,
+        .bitsPerChar = 10,
+        .turnaroundMicros = turnaroundMicros
+    };
+    benchResult_t   result;
+
+    epsolarSimulator_t *sim = epsolarSimulatorStart( &config );
+    if (sim == NULL) {
+        fprintf( stderr, "unable to start the simulator at %d baud\n", baudRate );
+        return;
+    }
+
+    epsolarSetDefaultBaudRate( baudRate );
+    epsolarSetDefaultParity( 'N' );
+    epsolarSetDefaultDataBits( 8 );
+    epsolarSetDefaultStopBits( 1 );
+    if (!epsolarModbusConnect( epsolarSimulatorGetPortName( sim ), config.slaveId )) {
+        fprintf( stderr, "unable to connect to the simulator on [%s]\n", epsolarSimulatorGetPortName( sim ) );
+        epsolarSimulatorStop( sim );
+        return;
+    }
+
+    runCase( sim, NULL, FALSE, calls, &result );
+    printResult( baudRate, turnaroundMicros, "RealTimeData by register", &result );
+    runCase( sim, NULL, TRUE, calls, &result );
+    printResult( baudRate, turnaroundMicros, "RealTimeData by block", &result );
+
+    for (size_t i = 0; i < sizeof( getters ) / sizeof( getters[ 0 ] ); i += 1) {
+        runCase( sim, &getters[ i ], TRUE, calls, &result );
+        printResult( baudRate, turnaroundMicros, getters[ i ].name, &result );
+    }
+
+    epsolarModbusDisconnect();
+    epsolarSimulatorStop( sim );
+    epsolarSetBlockReads( TRUE );
+}
+
+// -----------------------------------------------------------------------------
+static
+void    runCase (epsolarSimulator_t *sim, const benchGetter_t *getter, const int blockReads, const int calls, benchResult_t *result)
+{
+    //
+    //  NULL getter times epsolarGetRealTimeData(). The cache starts out empty
+    //  every time so one case can't warm it up for the next.
+    epsolarRealTimeData_t       rtData;
+    epsolarSimulatorStats_t     simStats;
+    modbus_t    *ctx = epsolarModbusGetContext();
+    double      total = 0.0;
+
+    assert( calls <= MAX_CALLS );
+    epsolarSetBlockReads( blockReads );
+    invalidateRegisterCache();
+    tracerResetStats();
+    epsolarSimulatorResetStats( sim );
+
+    for (int i = 0; i < calls; i += 1) {
+        double started = monotonicMicros();
+        if (getter == NULL)
+            epsolarGetRealTimeData( &rtData );
+        else if (getter->asFloat != NULL)
+            (void) getter->asFloat( ctx );
+        else
+            (void) getter->asInt( ctx );
+        samples[ i ] = monotonicMicros() - started;
+        total += samples[ i ];
+    }
+
+    epsolarSimulatorGetStats( sim, &simStats );
+    qsort( samples, calls, sizeof( double ), compareDoubles );
+
+    result->calls = calls;
+    result->meanMicros = total / calls;
+    result->p50Micros = samples[ (calls - 1) / 2 ];
+    result->p99Micros = samples[ ((calls - 1) * 99) / 100 ];
+    result->transactionsPerCall = (double) countTransactions() / calls;
+    result->bytesOutPerCall = (double) simStats.bytesIn / calls;
+    result->bytesInPerCall = (double) simStats.bytesOut / calls;
+}
+
+// -----------------------------------------------------------------------------
+static
+void    printResult (const int baudRate, const int turnaroundMicros, const char *name, const benchResult_t *result)
+{
+    printf( "%-7d %-8d %-28s %6d %10.3f %10.3f %10.3f %9.1f %9.1f %9.1f\n",
+            baudRate, turnaroundMicros, name, result->calls,
+            result->meanMicros / 1000.0, result->p50Micros / 1000.0, result->p99Micros / 1000.0,
+            result->transactionsPerCall, result->bytesOutPerCall, result->bytesInPerCall );
+    fflush( stdout );
+}
+
+// -----------------------------------------------------------------------------
+static
+unsigned long countTransactions (void)
+{
+    unsigned long   total;
+
+    tracerGetStats( &stats );
+    total = stats.untrackedTransactions;
+    for (int i = 0; i < stats.numEntries; i += 1)
+        total += stats.entries[ i ].transactions;
+
+    return total;
+}
+
+// -----------------------------------------------------------------------------
+static
+int     parseList (const char *arg, int *values, const int maxValues)
+{
+    //
+    //  "9600,19200,115200" - returns how many it found
+    char    buffer[ 256 ];
+    char    *save = NULL;
+    int     count = 0;
+
+    strncpy( buffer, arg, sizeof( buffer ) - 1 );
+    buffer[ sizeof( buffer ) - 1 ] = '\0';
+
+    for (char *token = strtok_r( buffer, ",", &save ); token != NULL && count < maxValues; token = strtok_r( NULL, ",", &save ))
+        values[ count++ ] = atoi( token );
+
+    return count;
+}
+
+// -----------------------------------------------------------------------------
+static
+int     compareDoubles (const void *a, const void *b)
+{
+    double  x = *(const double *) a;
+    double  y = *(const double *) b;
+
+    return ((x > y) - (x < y));
+}
+
+// -----------------------------------------------------------------------------
+static
+double  monotonicMicros (void)
+{
+    struct timespec ts;
+
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return ((double) ts.tv_sec * 1000000.0) + (ts.tv_nsec / 1000.0);
+}
@@ -0,0 +1,169 @@
+/*
+ * Change detection.
+ *
+ *  Compares each snapshot with what was last sent downstream and passes on
+ *  only the fields that moved further than their deadband - an absolute
+ *  amount, a fraction of the last sent value, whichever is bigger. Fields
+ *  are compared against the last value *sent*, not the last one seen, so a
+ *  slow drift still goes out once it adds up. Every keyframeEvery snapshots
+ *  everything goes out regardless, so a consumer that joins late or drops
+ *  one catches up.
+ *
+ *  Not thread safe - one detector belongs to one producer, normally the
+ *  poller.
+ */
+#include <assert.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "log4c.h"
+#include "libepsolar.h"
+
+
+struct epsolarChangeDetector {
+    epsolarChangeConfig_t   config;
+    int                     haveSent;           // FALSE until the first keyframe
+    int                     sinceKeyframe;
+    int                     keyframeRequested;
+
+    float                   sent[ EPSOLAR_METRIC_COUNT ];
+    uint16_t                sentStatusBits;
+    uint8_t                 sentFlags;
+};
+
+
+
+// -----------------------------------------------------------------------------
+void    epsolarChangeDefaultConfig (epsolarChangeConfig_t *config)
+{
+    //
+    //  Roughly the resolution that matters on a dashboard. The energy
+    //  counters go out on every 0.01 kWh tick.
+    assert( config != NULL );
+    memset( config, '\0', sizeof( *config ) );
+
+    config->absolute[ EPSOLAR_METRIC_PV_VOLTAGE ] = 0.1f;
+    config->absolute[ EPSOLAR_METRIC_PV_CURRENT ] = 0.05f;
+    config->absolute[ EPSOLAR_METRIC_PV_POWER ] = 1.0f;
+    config->relative[ EPSOLAR_METRIC_PV_POWER ] = 0.01f;
+    config->absolute[ EPSOLAR_METRIC_BATTERY_VOLTAGE ] = 0.02f;
+    config->absolute[ EPSOLAR_METRIC_BATTERY_CURRENT ] = 0.05f;
+    config->absolute[ EPSOLAR_METRIC_BATTERY_SOC ] = 0.5f;
+    config->absolute[ EPSOLAR_METRIC_BATTERY_MAX_VOLTAGE ] = 0.0f;
+    config->absolute[ EPSOLAR_METRIC_BATTERY_MIN_VOLTAGE ] = 0.0f;
+    config->absolute[ EPSOLAR_METRIC_BATTERY_TEMPERATURE ] = 0.5f;
+    config->absolute[ EPSOLAR_METRIC_LOAD_VOLTAGE ] = 0.05f;
+    config->absolute[ EPSOLAR_METRIC_LOAD_CURRENT ] = 0.05f;
+    config->absolute[ EPSOLAR_METRIC_LOAD_POWER ] = 1.0f;
+    config->relative[ EPSOLAR_METRIC_LOAD_POWER ] = 0.01f;
+    config->absolute[ EPSOLAR_METRIC_CONTROLLER_TEMP ] = 0.5f;
+    config->keyframeEvery = 60;
+}
+
+// -----------------------------------------------------------------------------
+epsolarChangeDetector_t *epsolarChangeDetectorNew (const epsolarChangeConfig_t *config)
+{
+    //
+    //  NULL config gets epsolarChangeDefaultConfig()
+    epsolarChangeDetector_t *detector = calloc( 1, sizeof( epsolarChangeDetector_t ) );
+    if (detector == NULL) {
+        Logger_LogError( "epsolarChangeDetectorNew - unable to allocate a detector\n" );
+        return NULL;
+    }
+
+    if (config != NULL)
+        detector->config = *config;
+    else
+        epsolarChangeDefaultConfig( &detector->config );
+
+    detector->haveSent = FALSE;
+    return detector;
+}
+
+// -----------------------------------------------------------------------------
+void    epsolarChangeDetectorFree (epsolarChangeDetector_t *detector)
+{
+    free( detector );
+}
+
+// -----------------------------------------------------------------------------
+void    epsolarChangeForceKeyframe (epsolarChangeDetector_t *detector)
+{
+    //
+    //  The next snapshot goes out whole - for a consumer that just connected
+    assert( detector != NULL );
+    detector->keyframeRequested = TRUE;
+}
+
+// -----------------------------------------------------------------------------
+int     epsolarChangeDetect (epsolarChangeDetector_t *detector, const epsolarRealTimeData_t *rtData, const int64_t timeMillis, epsolarChange_t *change)
+{
+    //
+    //  TRUE if there's something to send, and 'change' holds it. Snapshots
+    //  that didn't read cleanly are never sent - a timeout isn't a change.
+    uint8_t     flags;
+
+    assert( detector != NULL );
+    assert( rtData != NULL );
+    assert( change != NULL );
+
+    if (rtData->readStatus != TRACER_STATUS_OK)
+        return FALSE;
+
+    flags = epsolarSnapshotFlags( rtData );
+    change->timeMillis = timeMillis;
+    change->changedMask = 0;
+    change->numValues = 0;
+    change->isKeyframe = (!detector->haveSent || detector->keyframeRequested ||
+                          (detector->config.keyframeEvery > 0 && detector->sinceKeyframe + 1 >= detector->config.keyframeEvery));
+
+    for (int m = 0; m < EPSOLAR_METRIC_COUNT; m += 1) {
+        float value = epsolarMetricValue( rtData, m );
+
+        if (!change->isKeyframe) {
+            float previous = detector->sent[ m ];
+            float band = fmaxf( detector->config.absolute[ m ], detector->config.relative[ m ] * fabsf( previous ) );
+            float moved = fabsf( value - previous );
+
+            //
+            //  Zero deadband means any change at all. Going to or from NaN
+            //  always counts.
+            int changed;
+            if (isnan( value ) || isnan( previous ))
+                changed = !(isnan( value ) && isnan( previous ));
+            else if (band > 0.0f)
+                changed = (moved >= band);
+            else
+                changed = (value != previous);
+
+            if (!changed)
+                continue;
+        }
+
+        change->changedMask |= (1u << m);
+        change->values[ change->numValues++ ] = value;
+        detector->sent[ m ] = value;
+    }
+
+    if (change->isKeyframe || rtData->controllerStatusBits != detector->sentStatusBits) {
+        change->changedMask |= EPSOLAR_CHANGE_STATUS_BITS;
+        detector->sentStatusBits = rtData->controllerStatusBits;
+    }
+    if (change->isKeyframe || flags != detector->sentFlags) {
+        change->changedMask |= EPSOLAR_CHANGE_FLAGS;
+        detector->sentFlags = flags;
+    }
+    change->controllerStatusBits = detector->sentStatusBits;
+    change->flags = detector->sentFlags;
+
+    if (change->isKeyframe) {
+        detector->haveSent = TRUE;
+        detector->keyframeRequested = FALSE;
+        detector->sinceKeyframe = 0;
+    } else {
+        detector->sinceKeyframe += 1;
+    }
+
+    return (change->changedMask != 0);
+}
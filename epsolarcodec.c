@@ -0,0 +1,481 @@
+/*
+ * Compression for stored samples.
+ *
+ *  Packs a run of epsolarLogRecord_t into a block, column by column, using
+ *  what solar telemetry looks like: samples arrive at a steady rate, energy
+ *  counters only climb, status words hardly ever change and half the day
+ *  every reading is zero.
+ *
+ *      timestamps, sequence    delta-of-delta - a steady rate is one bit
+ *      energy counters         delta-of-delta on the 0.01 kWh register value
+ *      everything else float   XOR with the previous value (Gorilla style)
+ *      status, flags           one bit if unchanged
+ *
+ *  Decoding gives back exactly the records that went in, bit for bit, except
+ *  'reserved' which comes back zero. A counter column that doesn't round trip
+ *  through the register scale is XOR coded like the rest instead.
+ */
+#include <assert.h>
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "log4c.h"
+#include "libepsolar.h"
+
+
+#define BLOCK_MAGIC             0xE5
+#define BLOCK_VERSION           1
+#define BLOCK_HEADER_SIZE       6               // magic, version, record count
+
+#define COLUMN_XOR              0
+#define COLUMN_COUNTER          1
+
+#define COUNTER_SCALE           100.0           // energy registers are 0.01 kWh
+
+//
+// The most any one value can cost, in bits
+#define MAX_DOD_BITS            (5 + 64)        // five ones, no stop bit, the lot
+#define MAX_XOR_BITS            (2 + 5 + 5 + 32)
+#define MAX_SMALL_BITS          ((1 + 16) + (2 * (1 + 8)))
+
+typedef struct bitWriter {
+    uint8_t     *buffer;
+    size_t      size;
+    size_t      bitPos;
+    int         overflow;
+} bitWriter_t;
+
+typedef struct int64Column {
+    uint64_t    previous;
+    uint64_t    previousDelta;
+    int         count;
+} int64Column_t;
+
+typedef struct bitReader {
+    const uint8_t   *buffer;
+    size_t      size;
+    size_t      bitPos;
+    int         underflow;
+} bitReader_t;
+
+//
+// delta-of-delta buckets: a prefix of 'n' ones then a zero picks the width
+static const int dodWidths[] = { 0, 7, 12, 20, 32, 64 };
+#define NUM_DOD_WIDTHS  ((int) (sizeof( dodWidths ) / sizeof( dodWidths[ 0 ] )))
+
+
+static  void        putBits( bitWriter_t *writer, const uint64_t value, const int numBits );
+static  uint64_t    getBits( bitReader_t *reader, const int numBits );
+static  void        putDeltaOfDelta( bitWriter_t *writer, const int64_t dod );
+static  int64_t     getDeltaOfDelta( bitReader_t *reader );
+static  void        putInt64( bitWriter_t *writer, int64Column_t *column, const int64_t value );
+static  void        getInt64Column( bitReader_t *reader, int64_t *values, const int count );
+static  void        putXorColumn( bitWriter_t *writer, const uint32_t *values, const int count );
+static  void        getXorColumn( bitReader_t *reader, uint32_t *values, const int count );
+static  int         isCounterMetric( const int metric );
+static  int         counterRoundTrips( const float value, int64_t *scaled );
+
+
+
+// -----------------------------------------------------------------------------
+size_t  epsolarCodecMaxEncodedSize (const int numRecords)
+{
+    //
+    //  Worst case, every value escaping to its widest form. The 64 bit
+    //  columns - timestamps, sequence and the energy counters - can take a
+    //  full width delta-of-delta per record (the first value is only 64),
+    //  the XOR coded ones a new window per record.
+    size_t perRecord = (3 * MAX_DOD_BITS) + MAX_SMALL_BITS;
+
+    for (int metric = 0; metric < EPSOLAR_METRIC_COUNT; metric += 1)
+        perRecord += (isCounterMetric( metric ) ? MAX_DOD_BITS : MAX_XOR_BITS);
+    return BLOCK_HEADER_SIZE + EPSOLAR_METRIC_COUNT + ((numRecords * perRecord) + 7) / 8;
+}
+
+// -----------------------------------------------------------------------------
+size_t  epsolarCodecEncode (const epsolarLogRecord_t *records, const int numRecords, uint8_t *out, const size_t outSize)
+{
+    //
+    //  Returns the bytes used, or zero if 'out' isn't big enough - a buffer
+    //  of epsolarCodecMaxEncodedSize() always is
+    bitWriter_t     writer = { out, outSize, 0, FALSE };
+    uint32_t        scratch32[ EPSOLAR_CODEC_MAX_RECORDS ];         // a column at a time
+    int64Column_t   column;
+    int64_t         scaled;
+
+    assert( records != NULL || numRecords == 0 );
+    assert( out != NULL );
+    assert( numRecords >= 0 && numRecords <= EPSOLAR_CODEC_MAX_RECORDS );
+
+    putBits( &writer, BLOCK_MAGIC, 8 );
+    putBits( &writer, BLOCK_VERSION, 8 );
+    putBits( &writer, (uint64_t) numRecords, 32 );
+
+    memset( &column, '\0', sizeof( column ) );
+    for (int i = 0; i < numRecords; i += 1)
+        putInt64( &writer, &column, records[ i ].monotonicNanos );
+
+    memset( &column, '\0', sizeof( column ) );
+    for (int i = 0; i < numRecords; i += 1)
+        putInt64( &writer, &column, records[ i ].wallMillis );
+
+    memset( &column, '\0', sizeof( column ) );
+    for (int i = 0; i < numRecords; i += 1)
+        putInt64( &writer, &column, records[ i ].sequence );
+
+    for (int metric = 0; metric < EPSOLAR_METRIC_COUNT; metric += 1) {
+        int mode = COLUMN_XOR;
+
+        if (isCounterMetric( metric )) {
+            mode = COLUMN_COUNTER;
+            for (int i = 0; i < numRecords && mode == COLUMN_COUNTER; i += 1)
+                if (!counterRoundTrips( records[ i ].values[ metric ], &scaled ))
+                    mode = COLUMN_XOR;
+        }
+
+        putBits( &writer, mode, 8 );
+        if (mode == COLUMN_COUNTER) {
+            memset( &column, '\0', sizeof( column ) );
+            for (int i = 0; i < numRecords; i += 1) {
+                counterRoundTrips( records[ i ].values[ metric ], &scaled );
+                putInt64( &writer, &column, scaled );
+            }
+        } else {
+            for (int i = 0; i < numRecords; i += 1)
+                memcpy( &scratch32[ i ], &records[ i ].values[ metric ], sizeof( uint32_t ) );
+            putXorColumn( &writer, scratch32, numRecords );
+        }
+    }
+
+    //
+    //  The small stuff - a bit says "same as last time"
+    for (int i = 0; i < numRecords; i += 1) {
+        const epsolarLogRecord_t *previous = (i > 0 ? &records[ i - 1 ] : NULL);
+
+        if (previous != NULL && records[ i ].controllerStatusBits == previous->controllerStatusBits) {
+            putBits( &writer, 0, 1 );
+        } else {
+            putBits( &writer, 1, 1 );
+            putBits( &writer, records[ i ].controllerStatusBits, 16 );
+        }
+        if (previous != NULL && records[ i ].readStatus == previous->readStatus) {
+            putBits( &writer, 0, 1 );
+        } else {
+            putBits( &writer, 1, 1 );
+            putBits( &writer, records[ i ].readStatus, 8 );
+        }
+        if (previous != NULL && records[ i ].flags == previous->flags) {
+            putBits( &writer, 0, 1 );
+        } else {
+            putBits( &writer, 1, 1 );
+            putBits( &writer, records[ i ].flags, 8 );
+        }
+    }
+
+    if (writer.overflow)
+        return 0;
+    return (writer.bitPos + 7) / 8;
+}
+
+// -----------------------------------------------------------------------------
+int     epsolarCodecDecode (const uint8_t *in, const size_t inSize, epsolarLogRecord_t *records, const int maxRecords)
+{
+    //
+    //  Returns how many records came out, or -1 if the block is damaged or
+    //  holds more than maxRecords
+    bitReader_t     reader = { in, inSize, 0, FALSE };
+    int64_t         scratch64[ EPSOLAR_CODEC_MAX_RECORDS ];
+    uint32_t        scratch32[ EPSOLAR_CODEC_MAX_RECORDS ];
+
+    assert( in != NULL );
+    assert( records != NULL );
+
+    if (getBits( &reader, 8 ) != BLOCK_MAGIC || getBits( &reader, 8 ) != BLOCK_VERSION) {
+        Logger_LogError( "epsolarCodecDecode - not a sample block, or not a version we know\n" );
+        return -1;
+    }
+
+    int numRecords = (int) getBits( &reader, 32 );
+    if (numRecords < 0 || numRecords > maxRecords || numRecords > EPSOLAR_CODEC_MAX_RECORDS) {
+        Logger_LogError( "epsolarCodecDecode - block holds %d records, room for %d\n", numRecords, maxRecords );
+        return -1;
+    }
+    memset( records, '\0', numRecords * sizeof( epsolarLogRecord_t ) );
+
+    getInt64Column( &reader, scratch64, numRecords );
+    for (int i = 0; i < numRecords; i += 1)
+        records[ i ].monotonicNanos = scratch64[ i ];
+
+    getInt64Column( &reader, scratch64, numRecords );
+    for (int i = 0; i < numRecords; i += 1)
+        records[ i ].wallMillis = scratch64[ i ];
+
+    getInt64Column( &reader, scratch64, numRecords );
+    for (int i = 0; i < numRecords; i += 1)
+        records[ i ].sequence = (uint32_t) scratch64[ i ];
+
+    for (int metric = 0; metric < EPSOLAR_METRIC_COUNT; metric += 1) {
+        int mode = (int) getBits( &reader, 8 );
+
+        if (mode == COLUMN_COUNTER) {
+            getInt64Column( &reader, scratch64, numRecords );
+            for (int i = 0; i < numRecords; i += 1)
+                records[ i ].values[ metric ] = (float) (scratch64[ i ] / COUNTER_SCALE);
+        } else if (mode == COLUMN_XOR) {
+            getXorColumn( &reader, scratch32, numRecords );
+            for (int i = 0; i < numRecords; i += 1)
+                memcpy( &records[ i ].values[ metric ], &scratch32[ i ], sizeof( uint32_t ) );
+        } else {
+            reader.underflow = TRUE;
+            break;
+        }
+    }
+
+    //
+    //  The first record always has all three written out, so a "same as
+    //  last time" bit there means the block is damaged
+    for (int i = 0; i < numRecords && !reader.underflow; i += 1) {
+        const epsolarLogRecord_t *previous = (i > 0 ? &records[ i - 1 ] : NULL);
+
+        if (getBits( &reader, 1 ))
+            records[ i ].controllerStatusBits = (uint16_t) getBits( &reader, 16 );
+        else if (previous != NULL)
+            records[ i ].controllerStatusBits = previous->controllerStatusBits;
+        else
+            reader.underflow = TRUE;
+
+        if (getBits( &reader, 1 ))
+            records[ i ].readStatus = (uint8_t) getBits( &reader, 8 );
+        else if (previous != NULL)
+            records[ i ].readStatus = previous->readStatus;
+        else
+            reader.underflow = TRUE;
+
+        if (getBits( &reader, 1 ))
+            records[ i ].flags = (uint8_t) getBits( &reader, 8 );
+        else if (previous != NULL)
+            records[ i ].flags = previous->flags;
+        else
+            reader.underflow = TRUE;
+    }
+
+    if (reader.underflow) {
+        Logger_LogError( "epsolarCodecDecode - block is truncated or damaged\n" );
+        return -1;
+    }
+
+    return numRecords;
+}
+
+// -----------------------------------------------------------------------------
+static
+void    putBits (bitWriter_t *writer, const uint64_t value, const int numBits)
+{
+    //
+    //  Most significant bit first
+    for (int bit = numBits - 1; bit >= 0; bit -= 1) {
+        size_t byte = writer->bitPos / 8;
+        if (byte >= writer->size) {
+            writer->overflow = TRUE;
+            return;
+        }
+
+        int shift = 7 - (int) (writer->bitPos % 8);
+        if (shift == 7)
+            writer->buffer[ byte ] = 0;
+        writer->buffer[ byte ] |= (uint8_t) (((value >> bit) & 0x01) << shift);
+        writer->bitPos += 1;
+    }
+}
+
+// -----------------------------------------------------------------------------
+static
+uint64_t    getBits (bitReader_t *reader, const int numBits)
+{
+    //
+    //  Reading off the end gives zeros and sets 'underflow'
+    uint64_t    value = 0;
+
+    for (int bit = 0; bit < numBits; bit += 1) {
+        size_t byte = reader->bitPos / 8;
+        if (byte >= reader->size) {
+            reader->underflow = TRUE;
+            return 0;
+        }
+
+        int shift = 7 - (int) (reader->bitPos % 8);
+        value = (value << 1) | ((reader->buffer[ byte ] >> shift) & 0x01);
+        reader->bitPos += 1;
+    }
+
+    return value;
+}
+
+// -----------------------------------------------------------------------------
+static
+void    putDeltaOfDelta (bitWriter_t *writer, const int64_t dod)
+{
+    //
+    //  Smallest bucket the value fits, two's complement in that many bits
+    for (int bucket = 0; bucket < NUM_DOD_WIDTHS; bucket += 1) {
+        int width = dodWidths[ bucket ];
+        int64_t limit = (width >= 64 ? INT64_MAX : (width == 0 ? 0 : ((int64_t) 1 << (width - 1)) - 1));
+
+        if (width == 64 || (dod >= -limit - (width > 0 ? 1 : 0) && dod <= limit)) {
+            putBits( writer, ((uint64_t) 1 << bucket) - 1, bucket );       // 'bucket' ones
+            if (bucket < NUM_DOD_WIDTHS - 1)
+                putBits( writer, 0, 1 );
+            if (width > 0)
+                putBits( writer, (uint64_t) dod, width );
+            return;
+        }
+    }
+}
+
+// -----------------------------------------------------------------------------
+static
+int64_t     getDeltaOfDelta (bitReader_t *reader)
+{
+    int bucket = 0;
+    while (bucket < NUM_DOD_WIDTHS - 1 && getBits( reader, 1 ) == 1)
+        bucket += 1;
+
+    int width = dodWidths[ bucket ];
+    if (width == 0)
+        return 0;
+
+    uint64_t raw = getBits( reader, width );
+    if (width < 64 && (raw & ((uint64_t) 1 << (width - 1))))
+        raw |= ~(((uint64_t) 1 << width) - 1);                              // sign extend
+    return (int64_t) raw;
+}
+
+// -----------------------------------------------------------------------------
+static
+void    putInt64 (bitWriter_t *writer, int64Column_t *column, const int64_t value)
+{
+    //
+    //  First value whole, then the change in the change. Arithmetic is done
+    //  unsigned so wild values wrap rather than overflow.
+    uint64_t    current = (uint64_t) value;
+
+    if (column->count == 0) {
+        putBits( writer, current, 64 );
+    } else {
+        uint64_t delta = current - column->previous;
+        putDeltaOfDelta( writer, (int64_t) (delta - column->previousDelta) );
+        column->previousDelta = delta;
+    }
+    column->previous = current;
+    column->count += 1;
+}
+
+// -----------------------------------------------------------------------------
+static
+void    getInt64Column (bitReader_t *reader, int64_t *values, const int count)
+{
+    uint64_t    previous = 0;
+    uint64_t    previousDelta = 0;
+
+    for (int i = 0; i < count; i += 1) {
+        uint64_t value;
+        if (i == 0) {
+            value = getBits( reader, 64 );
+        } else {
+            previousDelta += (uint64_t) getDeltaOfDelta( reader );
+            value = previous + previousDelta;
+        }
+        values[ i ] = (int64_t) value;
+        previous = value;
+    }
+}
+
+// -----------------------------------------------------------------------------
+static
+void    putXorColumn (bitWriter_t *writer, const uint32_t *values, const int count)
+{
+    //
+    //  '0' same as the last one. '10' the changed bits fit inside the last
+    //  window, write just those. '11' a new window: 5 bits of leading zeros,
+    //  5 bits of length - 1, then the bits.
+    uint32_t    previous = 0;
+    int         leading = -1;
+    int         trailing = 0;
+
+    for (int i = 0; i < count; i += 1) {
+        uint32_t xor = values[ i ] ^ previous;
+        previous = values[ i ];
+
+        if (xor == 0) {
+            putBits( writer, 0, 1 );
+            continue;
+        }
+
+        int newLeading = __builtin_clz( xor );
+        int newTrailing = __builtin_ctz( xor );
+        if (newLeading > 31)
+            newLeading = 31;
+
+        if (leading >= 0 && newLeading >= leading && newTrailing >= trailing) {
+            putBits( writer, 0x02, 2 );
+            putBits( writer, xor >> trailing, 32 - leading - trailing );
+        } else {
+            leading = newLeading;
+            trailing = newTrailing;
+            int length = 32 - leading - trailing;
+            putBits( writer, 0x03, 2 );
+            putBits( writer, leading, 5 );
+            putBits( writer, length - 1, 5 );
+            putBits( writer, xor >> trailing, length );
+        }
+    }
+}
+
+// -----------------------------------------------------------------------------
+static
+void    getXorColumn (bitReader_t *reader, uint32_t *values, const int count)
+{
+    uint32_t    previous = 0;
+    int         leading = 0;
+    int         trailing = 0;
+
+    for (int i = 0; i < count; i += 1) {
+        if (getBits( reader, 1 ) == 1) {
+            if (getBits( reader, 1 ) == 1) {
+                leading = (int) getBits( reader, 5 );
+                int length = (int) getBits( reader, 5 ) + 1;
+                trailing = 32 - leading - length;
+                if (trailing < 0) {
+                    reader->underflow = TRUE;
+                    return;
+                }
+            }
+            previous ^= (uint32_t) (getBits( reader, 32 - leading - trailing ) << trailing);
+        }
+        values[ i ] = previous;
+    }
+}
+
+// -----------------------------------------------------------------------------
+static
+int     isCounterMetric (const int metric)
+{
+    return (metric == EPSOLAR_METRIC_ENERGY_GENERATED_TODAY || metric == EPSOLAR_METRIC_ENERGY_GENERATED_TOTAL ||
+            metric == EPSOLAR_METRIC_ENERGY_CONSUMED_TODAY || metric == EPSOLAR_METRIC_ENERGY_CONSUMED_TOTAL);
+}
+
+// -----------------------------------------------------------------------------
+static
+int     counterRoundTrips (const float value, int64_t *scaled)
+{
+    //
+    //  True if the value is a whole number of 0.01 kWh that decodes back to
+    //  the very same float
+    if (!isfinite( value ) || fabs( value ) > 9.0e15 / COUNTER_SCALE)
+        return FALSE;
+
+    *scaled = (int64_t) llround( value * COUNTER_SCALE );
+    float back = (float) (*scaled / COUNTER_SCALE);
+    return (memcmp( &back, &value, sizeof( float ) ) == 0);
+}
@@ -0,0 +1,425 @@
+/*
+ * Finding controllers.
+ *
+ *  Every candidate serial device gets its own probe thread, so a scan costs
+ *  about as long as the slowest single device rather than the sum of them.
+ *  A probe opens its device at each baud rate in turn and asks every slave ID
+ *  for the real time clock with a short response timeout. Anything that
+ *  answers with a clock that makes sense is a controller. Once a baud rate
+ *  turns one up the others aren't tried - a bus only runs at one speed.
+ *
+ *  A scan costs a timeout per empty device and slave ID, so the last thing
+ *  found can be kept in a small state file along with a fingerprint - the
+ *  rated data block at 0x3000, which doesn't change while the same
+ *  controller is on the end of the wire. Next time that entry is checked
+ *  with one read of the rated block and one of the clock, and the scan only
+ *  runs if the answer doesn't match.
+ */
+#include <assert.h>
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <modbus/modbus.h>
+
+#include "log4c.h"
+#include "libepsolar.h"
+
+
+#define MAX_PROBE_DEVICES       256
+#define FINGERPRINT_ADDRESS     0x3000          // rated data, input registers
+#define FINGERPRINT_WORDS       9
+
+typedef struct deviceProbe {
+    const epsolarProbeConfig_t  *config;
+    char                        portName[ 64 ];
+    pthread_t                   thread;
+    int                         started;
+    int                         numFound;
+    int                         maxFound;       // no more than the slave IDs it asks
+    epsolarFoundController_t    *found;
+} deviceProbe_t;
+
+
+static  void    *probeThread( void *arg );
+static  int     probeSlave( modbus_t *ctx, const int slaveId );
+static  void    setProbeTimeout( modbus_t *ctx, const long micros );
+static  modbus_t    *openProbeContext( const epsolarFoundController_t *controller, const long timeoutMicros );
+static  int     readFingerprint( modbus_t *ctx, uint16_t *words );
+static  int     loadDiscoveryState( const char *stateFile, epsolarFoundController_t *found, uint16_t *fingerprint );
+static  int     saveDiscoveryState( const char *stateFile, const epsolarFoundController_t *found, const uint16_t *fingerprint );
+
+
+
+// -----------------------------------------------------------------------------
+int epsolarFindControllers (const epsolarProbeConfig_t *config, epsolarFoundController_t *found, const int maxFound)
+{
+    //
+    //  Returns how many controllers answered, in device order and then slave
+    //  ID order. Devices that don't exist are skipped without opening them.
+    static const int    defaultSlaveIds[] = { 1 };
+    static const int    defaultBaudRates[] = { 115200 };
+    epsolarProbeConfig_t    probeConfig;
+    deviceProbe_t       *probes;
+    epsolarFoundController_t    *slots;
+    int                 numProbes = 0;
+    int                 numFound = 0;
+
+    assert( config != NULL );
+    assert( found != NULL );
+
+    probeConfig = *config;
+    if (probeConfig.slaveIds == NULL || probeConfig.numSlaveIds < 1) {
+        probeConfig.slaveIds = defaultSlaveIds;
+        probeConfig.numSlaveIds = 1;
+    }
+    if (probeConfig.baudRates == NULL || probeConfig.numBaudRates < 1) {
+        probeConfig.baudRates = defaultBaudRates;
+        probeConfig.numBaudRates = 1;
+    }
+    if (probeConfig.parity == '\0') {
+        probeConfig.parity = 'N';
+        probeConfig.dataBits = 8;
+        probeConfig.stopBits = 1;
+    }
+    if (probeConfig.probeTimeoutMicros <= 0)
+        probeConfig.probeTimeoutMicros = EPSOLAR_DEFAULT_PROBE_TIMEOUT;
+
+    //
+    //  The candidates - an explicit list, or base name plus 0..maxDevNum. Only
+    //  as many probes and result slots as this scan can actually use
+    int numCandidates = (probeConfig.portNames != NULL ? probeConfig.numPortNames : probeConfig.maxDevNum + 1);
+    if (numCandidates > MAX_PROBE_DEVICES)
+        numCandidates = MAX_PROBE_DEVICES;
+    if (numCandidates < 1)
+        return 0;
+    int perProbe = (probeConfig.numSlaveIds < EPSOLAR_MAX_FOUND ? probeConfig.numSlaveIds : EPSOLAR_MAX_FOUND);
+
+    probes = calloc( numCandidates, sizeof( deviceProbe_t ) );
+    slots = calloc( (size_t) numCandidates * perProbe, sizeof( epsolarFoundController_t ) );
+    if (probes == NULL || slots == NULL) {
+        Logger_LogError( "epsolarFindControllers - unable to allocate the probes\n" );
+        free( probes );
+        free( slots );
+        return 0;
+    }
+
+    for (int i = 0; i < numCandidates; i += 1) {
+        deviceProbe_t   *probe = &probes[ numProbes ];
+        struct stat     info;
+
+        if (probeConfig.portNames != NULL)
+            snprintf( probe->portName, sizeof( probe->portName ), "%s", probeConfig.portNames[ i ] );
+        else
+            snprintf( probe->portName, sizeof( probe->portName ), "%s%d", probeConfig.deviceNameBase, i );
+
+        if (stat( probe->portName, &info ) != 0)
+            continue;
+
+        probe->config = &probeConfig;
+        probe->maxFound = perProbe;
+        probe->found = &slots[ numProbes * perProbe ];
+        int status = pthread_create( &probe->thread, NULL, probeThread, probe );
+        if (status != 0) {
+            //
+            //  Out of threads - do it ourselves, it's only slower
+            Logger_LogWarning( "epsolarFindControllers - no thread for [%s]: %s\n", probe->portName, strerror( status ) );
+            probeThread( probe );
+        } else {
+            probe->started = TRUE;
+        }
+        numProbes += 1;
+    }
+
+    for (int i = 0; i < numProbes; i += 1) {
+        if (probes[ i ].started)
+            pthread_join( probes[ i ].thread, NULL );
+
+        for (int j = 0; j < probes[ i ].numFound && numFound < maxFound; j += 1)
+            found[ numFound++ ] = probes[ i ].found[ j ];
+    }
+
+    Logger_LogInfo( "epsolarFindControllers - probed %d devices, found %d controllers\n", numProbes, numFound );
+    free( slots );
+    free( probes );
+    return numFound;
+}
+
+// -----------------------------------------------------------------------------
+int epsolarFindControllerCached (const char *stateFile, const epsolarProbeConfig_t *config, epsolarFoundController_t *found)
+{
+    //
+    //  The controller the state file remembers, if it still answers with the
+    //  same fingerprint - otherwise the first one a scan turns up, which is
+    //  then written back. Returns FALSE if neither finds anything.
+    uint16_t    saved[ FINGERPRINT_WORDS ];
+    uint16_t    current[ FINGERPRINT_WORDS ];
+    long        timeoutMicros;
+    modbus_t    *ctx;
+
+    assert( stateFile != NULL );
+    assert( config != NULL );
+    assert( found != NULL );
+
+    timeoutMicros = (config->probeTimeoutMicros > 0 ? config->probeTimeoutMicros : EPSOLAR_DEFAULT_PROBE_TIMEOUT);
+
+    if (loadDiscoveryState( stateFile, found, saved )) {
+        ctx = openProbeContext( found, timeoutMicros );
+        if (ctx != NULL) {
+            int verified = (readFingerprint( ctx, current ) &&
+                            memcmp( saved, current, sizeof( saved ) ) == 0 &&
+                            probeSlave( ctx, found->slaveId ));
+            modbus_close( ctx );
+            modbus_free( ctx );
+
+            if (verified) {
+                Logger_LogInfo( "epsolarFindControllerCached - slave %d on [%s] at %d still answers, skipping the scan\n",
+                        found->slaveId, found->portName, found->baudRate );
+                return TRUE;
+            }
+        }
+        Logger_LogInfo( "epsolarFindControllerCached - [%s] in [%s] didn't verify, scanning\n", found->portName, stateFile );
+    }
+
+    if (epsolarFindControllers( config, found, 1 ) < 1)
+        return FALSE;
+
+    //
+    //  Found one - remember it. Not being able to is only a slower restart.
+    ctx = openProbeContext( found, timeoutMicros );
+    if (ctx != NULL) {
+        if (readFingerprint( ctx, current ))
+            saveDiscoveryState( stateFile, found, current );
+        modbus_close( ctx );
+        modbus_free( ctx );
+    }
+
+    return TRUE;
+}
+
+// -----------------------------------------------------------------------------
+static
+void    *probeThread (void *arg)
+{
+    deviceProbe_t               *probe = (deviceProbe_t *) arg;
+    const epsolarProbeConfig_t  *config = probe->config;
+
+    for (int b = 0; b < config->numBaudRates && probe->numFound == 0; b += 1) {
+        int baudRate = config->baudRates[ b ];
+
+        Logger_LogDebug( "probeThread - trying [%s] at %d\n", probe->portName, baudRate );
+        modbus_t *ctx = modbus_new_rtu( probe->portName, baudRate, config->parity, config->dataBits, config->stopBits );
+        if (ctx == NULL) {
+            Logger_LogError( "probeThread - unable to create a context for [%s]: %s\n", probe->portName, modbus_strerror( errno ) );
+            break;
+        }
+
+        if (modbus_connect( ctx ) == -1) {
+            //
+            //  Not a serial port, or somebody else has it - no point trying other speeds
+            Logger_LogDebug( "probeThread - unable to open [%s]: %s\n", probe->portName, modbus_strerror( errno ) );
+            modbus_free( ctx );
+            break;
+        }
+        setProbeTimeout( ctx, config->probeTimeoutMicros );
+
+        for (int s = 0; s < config->numSlaveIds && probe->numFound < probe->maxFound; s += 1) {
+            if (!probeSlave( ctx, config->slaveIds[ s ] ))
+                continue;
+
+            epsolarFoundController_t *found = &probe->found[ probe->numFound++ ];
+            snprintf( found->portName, sizeof( found->portName ), "%s", probe->portName );
+            found->baudRate = baudRate;
+            found->parity = config->parity;
+            found->dataBits = config->dataBits;
+            found->stopBits = config->stopBits;
+            found->slaveId = config->slaveIds[ s ];
+            Logger_LogInfo( "probeThread - found slave %d on [%s] at %d\n", found->slaveId, probe->portName, baudRate );
+        }
+
+        modbus_close( ctx );
+        modbus_free( ctx );
+    }
+
+    return NULL;
+}
+
+// -----------------------------------------------------------------------------
+static
+int     probeSlave (modbus_t *ctx, const int slaveId)
+{
+    //
+    //  Straight to libmodbus: no retries, no cache and no bus lock - nobody
+    //  else has this context, and a miss should cost one short timeout.
+    const tracerRegister_t  *clock = getRegisterDescriptor( TRACER_REALTIME_CLOCK );
+    uint16_t    words[ 3 ];
+    int         seconds, minutes, hour, day, month, year;
+
+    modbus_set_slave( ctx, slaveId );
+    if (modbus_read_registers( ctx, clock->address, clock->numRegisters, words ) == -1) {
+        //
+        //  The wrong baud rate makes garbage - don't let it spill into the next try
+        modbus_flush( ctx );
+        return FALSE;
+    }
+
+    decodeRealtimeClock( words, &seconds, &minutes, &hour, &day, &month, &year );
+    return ((seconds >= 0 && seconds < 60) && (minutes >= 0 && minutes < 60) && (hour >= 0 && hour < 24) &&
+            (day >= 1 && day <= 31) && (month >= 1 && month <= 12));
+}
+
+// -----------------------------------------------------------------------------
+static
+void    setProbeTimeout (modbus_t *ctx, const long micros)
+{
+#ifdef RPI
+    modbus_set_response_timeout( ctx, micros / 1000000L, micros % 1000000L );
+#else
+    struct timeval  timeout;
+
+    timeout.tv_sec = micros / 1000000L;
+    timeout.tv_usec = micros % 1000000L;
+    modbus_set_response_timeout( ctx, &timeout );
+#endif
+}
+
+// -----------------------------------------------------------------------------
+static
+modbus_t    *openProbeContext (const epsolarFoundController_t *controller, const long timeoutMicros)
+{
+    modbus_t *ctx = modbus_new_rtu( controller->portName, controller->baudRate, controller->parity, controller->dataBits, controller->stopBits );
+    if (ctx == NULL)
+        return NULL;
+
+    if (modbus_connect( ctx ) == -1) {
+        Logger_LogDebug( "openProbeContext - unable to open [%s]: %s\n", controller->portName, modbus_strerror( errno ) );
+        modbus_free( ctx );
+        return NULL;
+    }
+
+    modbus_set_slave( ctx, controller->slaveId );
+    setProbeTimeout( ctx, timeoutMicros );
+    return ctx;
+}
+
+// -----------------------------------------------------------------------------
+static
+int     readFingerprint (modbus_t *ctx, uint16_t *words)
+{
+    if (modbus_read_input_registers( ctx, FINGERPRINT_ADDRESS, FINGERPRINT_WORDS, words ) == -1) {
+        modbus_flush( ctx );
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+// -----------------------------------------------------------------------------
+static
+int     loadDiscoveryState (const char *stateFile, epsolarFoundController_t *found, uint16_t *fingerprint)
+{
+    //
+    //  One "key=value" per line, written by saveDiscoveryState(). Anything
+    //  missing or mangled and the whole file is ignored.
+    char    line[ 256 ];
+    int     haveKeys = 0;
+    int     numWords = 0;
+
+    FILE *fp = fopen( stateFile, "r" );
+    if (fp == NULL)
+        return FALSE;
+
+    memset( found, '\0', sizeof( *found ) );
+    while (fgets( line, sizeof( line ), fp ) != NULL) {
+        char    *value = strchr( line, '=' );
+        if (line[ 0 ] == '#' || value == NULL)
+            continue;
+
+        *value++ = '\0';
+        value[ strcspn( value, "\r\n" ) ] = '\0';
+
+        if (strcmp( line, "port" ) == 0) {
+            snprintf( found->portName, sizeof( found->portName ), "%s", value );
+            haveKeys |= 0x01;
+        } else if (strcmp( line, "baud" ) == 0) {
+            found->baudRate = atoi( value );
+            haveKeys |= 0x02;
+        } else if (strcmp( line, "parity" ) == 0) {
+            found->parity = value[ 0 ];
+            haveKeys |= 0x04;
+        } else if (strcmp( line, "dataBits" ) == 0) {
+            found->dataBits = atoi( value );
+            haveKeys |= 0x08;
+        } else if (strcmp( line, "stopBits" ) == 0) {
+            found->stopBits = atoi( value );
+            haveKeys |= 0x10;
+        } else if (strcmp( line, "slave" ) == 0) {
+            found->slaveId = atoi( value );
+            haveKeys |= 0x20;
+        } else if (strcmp( line, "fingerprint" ) == 0) {
+            char    *next = value;
+            for (numWords = 0; numWords < FINGERPRINT_WORDS; numWords += 1) {
+                char    *end;
+                unsigned long word = strtoul( next, &end, 16 );
+                if (end == next || word > 0xFFFF)
+                    break;
+                fingerprint[ numWords ] = (uint16_t) word;
+                next = end;
+            }
+        }
+    }
+    fclose( fp );
+
+    if (haveKeys != 0x3F || numWords != FINGERPRINT_WORDS || found->portName[ 0 ] == '\0' || found->baudRate <= 0) {
+        Logger_LogWarning( "loadDiscoveryState - ignoring incomplete state file [%s]\n", stateFile );
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+// -----------------------------------------------------------------------------
+static
+int     saveDiscoveryState (const char *stateFile, const epsolarFoundController_t *found, const uint16_t *fingerprint)
+{
+    //
+    //  Written next to the real one and renamed over it, so a crash halfway
+    //  leaves the old file rather than half a new one
+    char    tempFile[ PATH_MAX ];
+
+    snprintf( tempFile, sizeof( tempFile ), "%s.tmp", stateFile );
+    FILE *fp = fopen( tempFile, "w" );
+    if (fp == NULL) {
+        Logger_LogWarning( "saveDiscoveryState - unable to write [%s]: %s\n", tempFile, strerror( errno ) );
+        return FALSE;
+    }
+
+    fprintf( fp, "# libepsolar discovery cache - safe to delete\n" );
+    fprintf( fp, "port=%s\n", found->portName );
+    fprintf( fp, "baud=%d\n", found->baudRate );
+    fprintf( fp, "parity=%c\n", found->parity );
+    fprintf( fp, "dataBits=%d\n", found->dataBits );
+    fprintf( fp, "stopBits=%d\n", found->stopBits );
+    fprintf( fp, "slave=%d\n", found->slaveId );
+    fprintf( fp, "fingerprint=" );
+    for (int i = 0; i < FINGERPRINT_WORDS; i += 1)
+        fprintf( fp, "%s%04X", (i == 0 ? "" : " "), fingerprint[ i ] );
+    fprintf( fp, "\n" );
+
+    //
+    //  Flushed to the disk before the rename, or a power cut can leave the
+    //  new name pointing at an empty file
+    int synced = (fflush( fp ) == 0 && fsync( fileno( fp ) ) == 0);
+    if (fclose( fp ) != 0 || !synced || rename( tempFile, stateFile ) != 0) {
+        Logger_LogWarning( "saveDiscoveryState - unable to replace [%s]: %s\n", stateFile, strerror( errno ) );
+        unlink( tempFile );
+        return FALSE;
+    }
+
+    Logger_LogDebug( "saveDiscoveryState - remembered slave %d on [%s] in [%s]\n", found->slaveId, found->portName, stateFile );
+    return TRUE;
+}
@@ -0,0 +1,296 @@
+/*
+ * In-memory history of real time samples.
+ *
+ *  A fixed capacity ring laid out column by column - one contiguous float
+ *  array per metric, plus the timestamps and read status - so
+ *  "average PV power over the last hour" walks two arrays front to back
+ *  instead of striding over whole epsolarRealTimeData_t records. Everything
+ *  is allocated up front; appending a sample only stores into the columns.
+ *
+ *  One writer (normally the poller) and any number of readers. The writer
+ *  fills a slot and then publishes it by bumping 'head'. A reader works out
+ *  which slots it wants from 'head', does its scan, and then checks that the
+ *  writer hasn't lapped round onto any of them in the meantime - if it has,
+ *  it simply scans again. No locks either side.
+ */
+#include <assert.h>
+#include <float.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "log4c.h"
+#include "libepsolar.h"
+
+
+#define MAX_SCAN_ATTEMPTS       8
+
+struct epsolarHistory {
+    int             capacity;
+    atomic_ulong    head;                       // samples ever appended
+    void            *block;                     // every column lives in here
+
+    int64_t         *timeMillis;
+    float           *columns[ EPSOLAR_METRIC_COUNT ];
+    uint8_t         *readStatus;
+};
+
+typedef struct scanRange {
+    unsigned long   first;                      // sample numbers, not slots
+    unsigned long   end;
+} scanRange_t;
+
+
+static  int     findRange( epsolarHistory_t *history, const int64_t fromMillis, const int64_t toMillis, scanRange_t *range );
+static  int     rangeStillValid( epsolarHistory_t *history, const scanRange_t *range );
+
+
+
+// -----------------------------------------------------------------------------
+epsolarHistory_t    *epsolarHistoryNew (const int capacity)
+{
+    size_t  timeBytes, columnBytes;
+
+    assert( capacity > 0 );
+
+    epsolarHistory_t *history = calloc( 1, sizeof( epsolarHistory_t ) );
+    if (history == NULL) {
+        Logger_LogError( "epsolarHistoryNew - unable to allocate a history\n" );
+        return NULL;
+    }
+
+    //
+    //  One block, each column starting on its own cache line
+    timeBytes = ((capacity * sizeof( int64_t )) + 63) & ~((size_t) 63);
+    columnBytes = ((capacity * sizeof( float )) + 63) & ~((size_t) 63);
+
+    if (posix_memalign( &history->block, 64, timeBytes + (EPSOLAR_METRIC_COUNT * columnBytes) + capacity ) != 0) {
+        Logger_LogError( "epsolarHistoryNew - unable to allocate %d samples\n", capacity );
+        free( history );
+        return NULL;
+    }
+
+    char *next = history->block;
+    history->timeMillis = (int64_t *) next;
+    next += timeBytes;
+    for (int i = 0; i < EPSOLAR_METRIC_COUNT; i += 1) {
+        history->columns[ i ] = (float *) next;
+        next += columnBytes;
+    }
+    history->readStatus = (uint8_t *) next;
+
+    history->capacity = capacity;
+    atomic_init( &history->head, 0 );
+    return history;
+}
+
+// -----------------------------------------------------------------------------
+void    epsolarHistoryFree (epsolarHistory_t *history)
+{
+    if (history == NULL)
+        return;
+
+    free( history->block );
+    free( history );
+}
+
+// -----------------------------------------------------------------------------
+void    epsolarHistoryAppend (epsolarHistory_t *history, const epsolarRealTimeData_t *rtData, const int64_t timeMillis)
+{
+    //
+    //  Only ever call this from one thread at a time
+    assert( history != NULL );
+    assert( rtData != NULL );
+
+    unsigned long head = atomic_load_explicit( &history->head, memory_order_relaxed );
+    int slot = (int) (head % history->capacity);
+
+    history->timeMillis[ slot ] = timeMillis;
+    for (int i = 0; i < EPSOLAR_METRIC_COUNT; i += 1)
+        history->columns[ i ][ slot ] = epsolarMetricValue( rtData, i );
+    history->readStatus[ slot ] = (uint8_t) rtData->readStatus;
+
+    atomic_store_explicit( &history->head, head + 1, memory_order_release );
+}
+
+// -----------------------------------------------------------------------------
+unsigned long   epsolarHistoryCount (epsolarHistory_t *history)
+{
+    //
+    //  Samples appended since it was created - the ring holds the last
+    //  'capacity' of them
+    assert( history != NULL );
+    return atomic_load_explicit( &history->head, memory_order_acquire );
+}
+
+// -----------------------------------------------------------------------------
+int     epsolarHistoryWindow (epsolarHistory_t *history, const int metric, const int64_t fromMillis, const int64_t toMillis, epsolarHistoryStats_t *stats)
+{
+    //
+    //  min/max/mean of one metric over samples stamped fromMillis..toMillis
+    //  inclusive. Samples that didn't read cleanly are left out. Returns how
+    //  many samples went in - zero and the stats are all zero.
+    scanRange_t     range;
+
+    assert( history != NULL );
+    assert( metric >= 0 && metric < EPSOLAR_METRIC_COUNT );
+    assert( stats != NULL );
+
+    for (int attempt = 0; attempt < MAX_SCAN_ATTEMPTS; attempt += 1) {
+        const float     *column = history->columns[ metric ];
+        double          sum = 0.0;
+        float           minimum = FLT_MAX;
+        float           maximum = -FLT_MAX;
+        int             count = 0;
+
+        memset( stats, '\0', sizeof( *stats ) );
+        if (!findRange( history, fromMillis, toMillis, &range ))
+            return 0;
+
+        //
+        //  At most two contiguous runs - up to the end of the arrays, then
+        //  from the start
+        unsigned long sample = range.first;
+        while (sample < range.end) {
+            int slot = (int) (sample % history->capacity);
+            int runEnd = slot + (int) (range.end - sample);
+            if (runEnd > history->capacity)
+                runEnd = history->capacity;
+
+            for (int i = slot; i < runEnd; i += 1) {
+                if (history->readStatus[ i ] != TRACER_STATUS_OK ||
+                        history->timeMillis[ i ] < fromMillis || history->timeMillis[ i ] > toMillis)
+                    continue;
+
+                float value = column[ i ];
+                sum += value;
+                minimum = (value < minimum ? value : minimum);
+                maximum = (value > maximum ? value : maximum);
+                count += 1;
+            }
+            sample += (runEnd - slot);
+        }
+
+        if (!rangeStillValid( history, &range ))
+            continue;                           // lapped while we looked, again
+
+        if (count > 0) {
+            stats->count = count;
+            stats->minimum = minimum;
+            stats->maximum = maximum;
+            stats->mean = sum / count;
+        }
+        return count;
+    }
+
+    Logger_LogWarning( "epsolarHistoryWindow - writer kept lapping the scan, giving up\n" );
+    memset( stats, '\0', sizeof( *stats ) );
+    return 0;
+}
+
+// -----------------------------------------------------------------------------
+int     epsolarHistoryCopy (epsolarHistory_t *history, const int metric, const int64_t fromMillis, const int64_t toMillis,
+                                int64_t *timeMillis, float *values, const int maxSamples)
+{
+    //
+    //  The raw samples, oldest first, bad reads included. Either output may
+    //  be NULL. Returns how many were copied; if there were more than
+    //  maxSamples you get the newest maxSamples.
+    scanRange_t     range;
+
+    assert( history != NULL );
+    assert( metric >= 0 && metric < EPSOLAR_METRIC_COUNT );
+
+    for (int attempt = 0; attempt < MAX_SCAN_ATTEMPTS; attempt += 1) {
+        int     count = 0;
+
+        if (!findRange( history, fromMillis, toMillis, &range ) || maxSamples <= 0)
+            return 0;
+        if (range.end - range.first > (unsigned long) maxSamples)
+            range.first = range.end - maxSamples;
+
+        for (unsigned long sample = range.first; sample < range.end; sample += 1) {
+            int slot = (int) (sample % history->capacity);
+            if (history->timeMillis[ slot ] < fromMillis || history->timeMillis[ slot ] > toMillis)
+                continue;
+
+            if (timeMillis != NULL)
+                timeMillis[ count ] = history->timeMillis[ slot ];
+            if (values != NULL)
+                values[ count ] = history->columns[ metric ][ slot ];
+            count += 1;
+        }
+
+        if (rangeStillValid( history, &range ))
+            return count;
+    }
+
+    Logger_LogWarning( "epsolarHistoryCopy - writer kept lapping the copy, giving up\n" );
+    return 0;
+}
+
+// -----------------------------------------------------------------------------
+const char  *epsolarMetricName (const int metric)
+{
+    static const char *names[ EPSOLAR_METRIC_COUNT ] = {
+        [ EPSOLAR_METRIC_PV_VOLTAGE ]               = "pvVoltage",
+        [ EPSOLAR_METRIC_PV_CURRENT ]               = "pvCurrent",
+        [ EPSOLAR_METRIC_PV_POWER ]                 = "pvPower",
+        [ EPSOLAR_METRIC_BATTERY_VOLTAGE ]          = "batteryVoltage",
+        [ EPSOLAR_METRIC_BATTERY_CURRENT ]          = "batteryCurrent",
+        [ EPSOLAR_METRIC_BATTERY_SOC ]              = "batteryStateOfCharge",
+        [ EPSOLAR_METRIC_BATTERY_MAX_VOLTAGE ]      = "batteryMaxVoltage",
+        [ EPSOLAR_METRIC_BATTERY_MIN_VOLTAGE ]      = "batteryMinVoltage",
+        [ EPSOLAR_METRIC_BATTERY_TEMPERATURE ]      = "batteryTemperature",
+        [ EPSOLAR_METRIC_LOAD_VOLTAGE ]             = "loadVoltage",
+        [ EPSOLAR_METRIC_LOAD_CURRENT ]             = "loadCurrent",
+        [ EPSOLAR_METRIC_LOAD_POWER ]               = "loadPower",
+        [ EPSOLAR_METRIC_CONTROLLER_TEMP ]          = "controllerTemp",
+        [ EPSOLAR_METRIC_ENERGY_GENERATED_TODAY ]   = "energyGeneratedToday",
+        [ EPSOLAR_METRIC_ENERGY_GENERATED_TOTAL ]   = "energyGeneratedTotal",
+        [ EPSOLAR_METRIC_ENERGY_CONSUMED_TODAY ]    = "energyConsumedToday",
+        [ EPSOLAR_METRIC_ENERGY_CONSUMED_TOTAL ]    = "energyConsumedTotal",
+    };
+
+    if (metric < 0 || metric >= EPSOLAR_METRIC_COUNT)
+        return "unknown";
+    return names[ metric ];
+}
+
+// -----------------------------------------------------------------------------
+static
+int     findRange (epsolarHistory_t *history, const int64_t fromMillis, const int64_t toMillis, scanRange_t *range)
+{
+    //
+    //  Walk the timestamp column back from the newest sample until we're
+    //  before fromMillis. Stamps come from the wall clock so they're only
+    //  nearly in order - the scans still check each one against the window.
+    //  The oldest slot of a full ring is left out, it's the next one written.
+    unsigned long   head = atomic_load_explicit( &history->head, memory_order_acquire );
+    unsigned long   oldest = (head >= (unsigned long) history->capacity ? head - history->capacity + 1 : 0);
+    unsigned long   first = head;
+
+    while (first > oldest && history->timeMillis[ (first - 1) % history->capacity ] >= fromMillis)
+        first -= 1;
+
+    unsigned long end = head;
+    while (end > first && history->timeMillis[ (end - 1) % history->capacity ] > toMillis)
+        end -= 1;
+
+    range->first = first;
+    range->end = end;
+    return (end > first);
+}
+
+// -----------------------------------------------------------------------------
+static
+int     rangeStillValid (epsolarHistory_t *history, const scanRange_t *range)
+{
+    //
+    //  Good if the writer hasn't started overwriting the oldest slot we read -
+    //  it writes slot 'head' before publishing it
+    atomic_thread_fence( memory_order_acquire );
+    unsigned long head = atomic_load_explicit( &history->head, memory_order_relaxed );
+    return (head < range->first + history->capacity);
+}
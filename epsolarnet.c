@@ -0,0 +1,428 @@
+/*
+ * Network transports.
+ *
+ *  A portName of "tcp://host[:port]" talks Modbus TCP, MBAP framing and all,
+ *  to a gateway or a controller with an Ethernet port of its own.
+ *  "rtu+tcp://host[:port]" is for the RS485 gateways in transparent mode,
+ *  which pass RTU frames - CRC included - through a TCP socket untouched.
+ *  libmodbus has no backend for that, so a bridge hands it a pty to open as
+ *  if it were the serial adapter, and copies bytes between the pty and the
+ *  socket on a thread of its own. Nothing above libmodbus can tell.
+ *
+ *  Both get TCP keepalives, so a gateway that loses power or a link that
+ *  goes away is noticed in seconds rather than at the next write. The bridge
+ *  reconnects by itself, backing off while the gateway stays away; a Modbus
+ *  TCP context is reconnected by epsolarControllerReconnect().
+ */
+#define _GNU_SOURCE
+#include <assert.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include "log4c.h"
+#include "libepsolar.h"
+
+
+#define BRIDGE_BUFFER           512
+#define BRIDGE_POLL_MILLIS      200             // how long a stop request can wait
+#define MIN_BACKOFF_MILLIS      250
+#define MAX_BACKOFF_MILLIS      30000
+#define CONNECT_TIMEOUT_MILLIS  3000            // per address, a dead host otherwise takes minutes
+
+struct epsolarTcpBridge {
+    char            host[ 256 ];
+    int             tcpPort;
+    int             keepaliveSeconds;
+
+    int             masterFd;
+    int             slaveFd;                    // kept open so the pty never hangs up
+    char            portName[ 64 ];
+    int             sock;                       // -1 while the gateway is away
+
+    pthread_t       thread;
+    atomic_int      stopRequested;
+    atomic_int      connected;
+};
+
+
+static  void        *bridgeThread( void *arg );
+static  int         connectSocket( const char *host, const int tcpPort );
+static  int         connectWithTimeout( const int sock, const struct sockaddr *address, const socklen_t addressLength );
+static  int         pump( const int fromFd, const int toFd, const int toSocket );
+
+
+
+// -----------------------------------------------------------------------------
+int     epsolarParsePortName (const char *portName, char *host, const size_t hostSize, int *tcpPort)
+{
+    //
+    //  Which transport a portName asks for. For the network ones, host and
+    //  tcpPort get filled in; IPv6 addresses go in brackets ("tcp://[::1]:502").
+    //  Anything without a scheme is a serial device.
+    const char  *rest;
+    int         transport;
+
+    assert( portName != NULL );
+
+    if (strncmp( portName, "tcp://", 6 ) == 0) {
+        transport = EPSOLAR_TRANSPORT_TCP;
+        rest = portName + 6;
+    } else if (strncmp( portName, "rtu+tcp://", 10 ) == 0) {
+        transport = EPSOLAR_TRANSPORT_RTU_OVER_TCP;
+        rest = portName + 10;
+    } else {
+        return EPSOLAR_TRANSPORT_RTU;
+    }
+
+    const char  *hostEnd;
+    const char  *colon;
+    if (*rest == '[') {
+        rest += 1;
+        hostEnd = strchr( rest, ']' );
+        if (hostEnd == NULL)
+            return -1;
+        if (hostEnd[ 1 ] != ':' && hostEnd[ 1 ] != '\0' && hostEnd[ 1 ] != '/')
+            return -1;
+        colon = (hostEnd[ 1 ] == ':' ? hostEnd + 1 : NULL);
+    } else {
+        //
+        //  More than one colon is an IPv6 address without its brackets -
+        //  there's no telling where the address stops and the port starts
+        colon = strchr( rest, ':' );
+        if (colon != NULL && strchr( colon + 1, ':' ) != NULL)
+            return -1;
+        hostEnd = (colon != NULL ? colon : rest + strcspn( rest, "/" ));
+    }
+
+    size_t  hostLen = hostEnd - rest;
+    if (hostLen == 0 || hostLen >= hostSize)
+        return -1;
+    memcpy( host, rest, hostLen );
+    host[ hostLen ] = '\0';
+
+    *tcpPort = EPSOLAR_DEFAULT_TCP_PORT;
+    if (colon != NULL) {
+        char    *end;
+        long    port;
+
+        //
+        //  strtol() would let a sign or leading blanks through
+        if (!isdigit( (unsigned char) colon[ 1 ] ))
+            return -1;
+        port = strtol( colon + 1, &end, 10 );
+        if (*end != '\0' && *end != '/')
+            return -1;
+        if (port <= 0 || port > 65535)
+            return -1;
+        *tcpPort = (int) port;
+    }
+
+    return transport;
+}
+
+// -----------------------------------------------------------------------------
+int     epsolarSetKeepalive (const int fd, const int idleSeconds)
+{
+    //
+    //  Probe after idleSeconds of silence, then every idleSeconds / 3, and
+    //  give up after three unanswered probes
+    int     on = 1;
+    int     idle = (idleSeconds > 0 ? idleSeconds : EPSOLAR_DEFAULT_KEEPALIVE);
+    int     interval = (idle >= 3 ? idle / 3 : 1);
+    int     count = 3;
+
+    if (setsockopt( fd, SOL_SOCKET, SO_KEEPALIVE, &on, sizeof( on ) ) != 0) {
+        Logger_LogWarning( "epsolarSetKeepalive - SO_KEEPALIVE failed: %s\n", strerror( errno ) );
+        return FALSE;
+    }
+#ifdef TCP_KEEPIDLE
+    setsockopt( fd, IPPROTO_TCP, TCP_KEEPIDLE, &idle, sizeof( idle ) );
+    setsockopt( fd, IPPROTO_TCP, TCP_KEEPINTVL, &interval, sizeof( interval ) );
+    setsockopt( fd, IPPROTO_TCP, TCP_KEEPCNT, &count, sizeof( count ) );
+#endif
+    //
+    //  Requests are a few bytes each and shouldn't sit waiting for an ACK
+    setsockopt( fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof( on ) );
+    return TRUE;
+}
+
+// -----------------------------------------------------------------------------
+epsolarTcpBridge_t  *epsolarTcpBridgeStart (const char *host, const int tcpPort, const int keepaliveSeconds)
+{
+    //
+    //  The first connection is made here, so a gateway that isn't there
+    //  fails the connect the same way a missing serial adapter does
+    assert( host != NULL );
+
+    epsolarTcpBridge_t *bridge = calloc( 1, sizeof( epsolarTcpBridge_t ) );
+    if (bridge == NULL) {
+        Logger_LogError( "epsolarTcpBridgeStart - unable to allocate a bridge\n" );
+        return NULL;
+    }
+
+    strncpy( bridge->host, host, sizeof( bridge->host ) - 1 );
+    bridge->tcpPort = tcpPort;
+    bridge->keepaliveSeconds = keepaliveSeconds;
+    bridge->masterFd = -1;
+    bridge->slaveFd = -1;
+    atomic_init( &bridge->stopRequested, FALSE );
+
+    bridge->sock = connectSocket( host, tcpPort );
+    if (bridge->sock < 0)
+        goto failed;
+    epsolarSetKeepalive( bridge->sock, keepaliveSeconds );
+    atomic_init( &bridge->connected, TRUE );
+
+    //
+    //  The pty. Both ends raw so nothing gets echoed or translated.
+    struct termios  tio;
+    bridge->masterFd = posix_openpt( O_RDWR | O_NOCTTY );
+    if (bridge->masterFd < 0 || grantpt( bridge->masterFd ) != 0 || unlockpt( bridge->masterFd ) != 0 ||
+        ptsname_r( bridge->masterFd, bridge->portName, sizeof( bridge->portName ) ) != 0) {
+        Logger_LogError( "epsolarTcpBridgeStart - unable to create a pty: %s\n", strerror( errno ) );
+        goto failed;
+    }
+
+    bridge->slaveFd = open( bridge->portName, O_RDWR | O_NOCTTY );
+    if (bridge->slaveFd < 0) {
+        Logger_LogError( "epsolarTcpBridgeStart - unable to open [%s]: %s\n", bridge->portName, strerror( errno ) );
+        goto failed;
+    }
+
+    tcgetattr( bridge->masterFd, &tio );
+    cfmakeraw( &tio );
+    tcsetattr( bridge->masterFd, TCSANOW, &tio );
+    tcgetattr( bridge->slaveFd, &tio );
+    cfmakeraw( &tio );
+    tcsetattr( bridge->slaveFd, TCSANOW, &tio );
+
+    if (pthread_create( &bridge->thread, NULL, bridgeThread, bridge ) != 0) {
+        Logger_LogError( "epsolarTcpBridgeStart - unable to start the bridge thread\n" );
+        goto failed;
+    }
+
+    Logger_LogInfo( "epsolarTcpBridgeStart - [%s] is RTU over TCP to %s:%d\n", bridge->portName, host, tcpPort );
+    return bridge;
+
+failed:
+    if (bridge->sock >= 0)
+        close( bridge->sock );
+    if (bridge->slaveFd >= 0)
+        close( bridge->slaveFd );
+    if (bridge->masterFd >= 0)
+        close( bridge->masterFd );
+    free( bridge );
+    return NULL;
+}
+
+// -----------------------------------------------------------------------------
+void    epsolarTcpBridgeStop (epsolarTcpBridge_t *bridge)
+{
+    if (bridge == NULL)
+        return;
+
+    atomic_store( &bridge->stopRequested, TRUE );
+    pthread_join( bridge->thread, NULL );
+
+    if (bridge->sock >= 0)
+        close( bridge->sock );
+    close( bridge->slaveFd );
+    close( bridge->masterFd );
+    free( bridge );
+}
+
+// -----------------------------------------------------------------------------
+const char  *epsolarTcpBridgeGetPortName (const epsolarTcpBridge_t *bridge)
+{
+    return bridge->portName;
+}
+
+// -----------------------------------------------------------------------------
+int     epsolarTcpBridgeIsConnected (epsolarTcpBridge_t *bridge)
+{
+    return atomic_load( &bridge->connected );
+}
+
+// -----------------------------------------------------------------------------
+static
+void    *bridgeThread (void *arg)
+{
+    epsolarTcpBridge_t  *bridge = (epsolarTcpBridge_t *) arg;
+    int                 backoffMillis = MIN_BACKOFF_MILLIS;
+
+    while (!atomic_load( &bridge->stopRequested )) {
+        if (bridge->sock < 0) {
+            //
+            //  Gateway's away. Anything libmodbus writes meanwhile is thrown
+            //  away rather than sent late - it will have timed out by then.
+            struct pollfd   pfd = { .fd = bridge->masterFd, .events = POLLIN };
+            int             waited = 0;
+
+            while (waited < backoffMillis && !atomic_load( &bridge->stopRequested )) {
+                if (poll( &pfd, 1, BRIDGE_POLL_MILLIS ) > 0)
+                    tcflush( bridge->masterFd, TCIFLUSH );
+                waited += BRIDGE_POLL_MILLIS;
+            }
+            if (atomic_load( &bridge->stopRequested ))
+                break;
+
+            bridge->sock = connectSocket( bridge->host, bridge->tcpPort );
+            if (bridge->sock < 0) {
+                backoffMillis = (backoffMillis * 2 < MAX_BACKOFF_MILLIS ? backoffMillis * 2 : MAX_BACKOFF_MILLIS);
+                continue;
+            }
+
+            epsolarSetKeepalive( bridge->sock, bridge->keepaliveSeconds );
+            atomic_store( &bridge->connected, TRUE );
+            backoffMillis = MIN_BACKOFF_MILLIS;
+            Logger_LogInfo( "bridgeThread - reconnected to %s:%d\n", bridge->host, bridge->tcpPort );
+        }
+
+        struct pollfd   pfds[ 2 ] = {
+            { .fd = bridge->masterFd, .events = POLLIN },
+            { .fd = bridge->sock, .events = POLLIN }
+        };
+
+        int ready = poll( pfds, 2, BRIDGE_POLL_MILLIS );
+        if (ready < 0 && errno != EINTR) {
+            Logger_LogError( "bridgeThread - poll failed: %s\n", strerror( errno ) );
+            break;
+        }
+        if (ready <= 0)
+            continue;
+
+        int ok = TRUE;
+        if (pfds[ 0 ].revents & POLLIN)
+            ok = pump( bridge->masterFd, bridge->sock, TRUE );
+        if (ok && (pfds[ 1 ].revents & (POLLIN | POLLHUP | POLLERR)))
+            ok = pump( bridge->sock, bridge->masterFd, FALSE );
+
+        if (!ok) {
+            Logger_LogWarning( "bridgeThread - lost %s:%d: %s\n", bridge->host, bridge->tcpPort, strerror( errno ) );
+            close( bridge->sock );
+            bridge->sock = -1;
+            atomic_store( &bridge->connected, FALSE );
+        }
+    }
+
+    return NULL;
+}
+
+// -----------------------------------------------------------------------------
+static
+int     connectSocket (const char *host, const int tcpPort)
+{
+    struct addrinfo hints, *addresses;
+    char            service[ 8 ];
+    int             sock = -1;
+
+    memset( &hints, '\0', sizeof( hints ) );
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    snprintf( service, sizeof( service ), "%d", tcpPort );
+
+    int status = getaddrinfo( host, service, &hints, &addresses );
+    if (status != 0) {
+        Logger_LogError( "connectSocket - unable to resolve [%s]: %s\n", host, gai_strerror( status ) );
+        return -1;
+    }
+
+    for (struct addrinfo *address = addresses; address != NULL && sock < 0; address = address->ai_next) {
+        sock = socket( address->ai_family, address->ai_socktype | SOCK_CLOEXEC, address->ai_protocol );
+        if (sock < 0)
+            continue;
+        if (!connectWithTimeout( sock, address->ai_addr, address->ai_addrlen )) {
+            int err = errno;
+            close( sock );
+            errno = err;
+            sock = -1;
+        }
+    }
+    freeaddrinfo( addresses );
+
+    if (sock < 0)
+        Logger_LogError( "connectSocket - unable to connect to %s:%d: %s\n", host, tcpPort, strerror( errno ) );
+    return sock;
+}
+
+// -----------------------------------------------------------------------------
+static
+int     connectWithTimeout (const int sock, const struct sockaddr *address, const socklen_t addressLength)
+{
+    //
+    //  A blocking connect() to a host that's gone quiet sits there for as long
+    //  as the kernel keeps retrying the SYN. Connect non-blocking instead and
+    //  give up after CONNECT_TIMEOUT_MILLIS. The socket is left blocking again,
+    //  the way the rest of the bridge expects it.
+    int flags = fcntl( sock, F_GETFL, 0 );
+    if (flags < 0 || fcntl( sock, F_SETFL, flags | O_NONBLOCK ) < 0)
+        return FALSE;
+
+    if (connect( sock, address, addressLength ) != 0) {
+        if (errno != EINPROGRESS)
+            return FALSE;
+
+        struct pollfd   pfd = { .fd = sock, .events = POLLOUT };
+        int             ready;
+        do {
+            ready = poll( &pfd, 1, CONNECT_TIMEOUT_MILLIS );
+        } while (ready < 0 && errno == EINTR);
+        if (ready == 0)
+            errno = ETIMEDOUT;
+        if (ready <= 0)
+            return FALSE;
+
+        int         err = 0;
+        socklen_t   length = sizeof( err );
+        if (getsockopt( sock, SOL_SOCKET, SO_ERROR, &err, &length ) != 0)
+            return FALSE;
+        if (err != 0) {
+            errno = err;
+            return FALSE;
+        }
+    }
+
+    return (fcntl( sock, F_SETFL, flags ) == 0);
+}
+
+// -----------------------------------------------------------------------------
+static
+int     pump (const int fromFd, const int toFd, const int toSocket)
+{
+    //
+    //  FALSE if the socket end has gone. A gateway that hangs up mustn't
+    //  take the process down with SIGPIPE.
+    uint8_t buffer[ BRIDGE_BUFFER ];
+
+    ssize_t got = read( fromFd, buffer, sizeof( buffer ) );
+    if (got == 0)
+        errno = ECONNRESET;
+    if (got <= 0)
+        return (got < 0 && (errno == EINTR || errno == EAGAIN));
+
+    for (ssize_t sent = 0; sent < got; ) {
+        ssize_t wrote = (toSocket ? send( toFd, &buffer[ sent ], got - sent, MSG_NOSIGNAL )
+                                  : write( toFd, &buffer[ sent ], got - sent ));
+        if (wrote < 0) {
+            if (errno == EINTR)
+                continue;
+            return FALSE;
+        }
+        sent += wrote;
+    }
+
+    return TRUE;
+}
@@ -0,0 +1,183 @@
+/*
+ * Background acquisition for one controller.
+ *
+ *  A thread owns the bus and refreshes an epsolarRealTimeData_t at a fixed
+ *  rate. It publishes each snapshot through a sequence lock, so a reader
+ *  copies the latest complete one without touching the bus or taking a mutex.
+ */
+#include <assert.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <modbus/modbus.h>
+
+#include "log4c.h"
+#include "libepsolar.h"
+#include "epsolarseqlock.h"
+
+
+struct epsolarPoller {
+    epsolarController_t     *controller;
+    int                     intervalMillis;
+    epsolarPollerSinks_t    sinks;              // every snapshot goes to these too
+    int64_t                 lastStampMillis;    // what the sinks were last handed
+
+    pthread_t               thread;
+    pthread_mutex_t         stopMutex;          // only for the stop handshake,
+    pthread_cond_t          stopCond;           //  readers never go near these
+    int                     stopRequested;
+
+    //
+    //  The sequence lock. Odd while the poller is writing 'snapshot', and
+    //  bumped by two for every snapshot published.
+    atomic_uint             sequence;
+    epsolarRealTimeData_t   snapshot;
+};
+
+
+static  void    *pollerThread( void *arg );
+
+
+
+// -----------------------------------------------------------------------------
+epsolarPoller_t *epsolarPollerStart (epsolarController_t *controller, const int intervalMillis)
+{
+    return epsolarPollerStartWithSinks( controller, intervalMillis, NULL );
+}
+
+// -----------------------------------------------------------------------------
+epsolarPoller_t *epsolarPollerStartWithSinks (epsolarController_t *controller, const int intervalMillis, const epsolarPollerSinks_t *sinks)
+{
+    //
+    //  The poller becomes the one writer of every sink that's set (sinks
+    //  itself can be NULL) - don't add to them yourself while it runs
+    assert( controller != NULL );
+    assert( intervalMillis > 0 );
+
+    epsolarPoller_t *poller = calloc( 1, sizeof( epsolarPoller_t ) );
+    if (poller == NULL) {
+        Logger_LogError( "epsolarPollerStart - unable to allocate a poller\n" );
+        return NULL;
+    }
+
+    poller->controller = controller;
+    poller->intervalMillis = intervalMillis;
+    if (sinks != NULL)
+        poller->sinks = *sinks;
+    poller->stopRequested = FALSE;
+    atomic_init( &poller->sequence, 0 );
+
+    //
+    //  Wait on the monotonic clock so setting the system time doesn't upset us
+    pthread_condattr_t  attr;
+    pthread_condattr_init( &attr );
+    pthread_condattr_setclock( &attr, CLOCK_MONOTONIC );
+    pthread_cond_init( &poller->stopCond, &attr );
+    pthread_condattr_destroy( &attr );
+    pthread_mutex_init( &poller->stopMutex, NULL );
+
+    int status = pthread_create( &poller->thread, NULL, pollerThread, poller );
+    if (status != 0) {
+        Logger_LogError( "epsolarPollerStart - unable to start the poller thread: %s\n", strerror( status ) );
+        pthread_cond_destroy( &poller->stopCond );
+        pthread_mutex_destroy( &poller->stopMutex );
+        free( poller );
+        return NULL;
+    }
+
+    Logger_LogInfo( "epsolarPollerStart - polling [%s] every %d ms\n", controller->portName, intervalMillis );
+    return poller;
+}
+
+// -----------------------------------------------------------------------------
+void epsolarPollerStop (epsolarPoller_t *poller)
+{
+    if (poller == NULL)
+        return;
+
+    pthread_mutex_lock( &poller->stopMutex );
+    poller->stopRequested = TRUE;
+    pthread_cond_signal( &poller->stopCond );
+    pthread_mutex_unlock( &poller->stopMutex );
+
+    pthread_join( poller->thread, NULL );
+
+    pthread_cond_destroy( &poller->stopCond );
+    pthread_mutex_destroy( &poller->stopMutex );
+    free( poller );
+}
+
+// -----------------------------------------------------------------------------
+unsigned int epsolarPollerGetSnapshot (epsolarPoller_t *poller, epsolarRealTimeData_t *rtData)
+{
+    //
+    //  Copy the latest complete snapshot. Returns how many snapshots have been
+    //  published so far - zero means there isn't one yet and rtData is zeroed.
+    //  Comparing the return value between calls tells you if it's a new one.
+    assert( poller != NULL );
+    assert( rtData != NULL );
+
+    return seqlockCopy( &poller->sequence, rtData, &poller->snapshot, sizeof( epsolarRealTimeData_t ) );
+}
+
+// -----------------------------------------------------------------------------
+static
+void    *pollerThread (void *arg)
+{
+    epsolarPoller_t         *poller = (epsolarPoller_t *) arg;
+    epsolarRealTimeData_t   fresh;
+    epsolarChange_t         change;
+    struct timespec         deadline;
+    int                     done = FALSE;
+
+    clock_gettime( CLOCK_MONOTONIC, &deadline );
+
+    while (!done) {
+        //
+        //  All the slow serial I/O happens here, into our own buffer
+        epsolarControllerGetRealTimeData( poller->controller, &fresh );
+
+        //
+        //  Publish - readers see this one from now on
+        seqlockPublish( &poller->sequence, &poller->snapshot, &fresh, sizeof( epsolarRealTimeData_t ) );
+
+        //
+        //  The sinks get the wall clock, but never a stamp earlier than the
+        //  last one. If the time is set back we hold at the last stamp until
+        //  the clock catches up - the rollup would drop samples from the past
+        //  and the recorder's seek needs its records in order.
+        int64_t nowMillis = epsolarNowMillis();
+        if (nowMillis < poller->lastStampMillis)
+            nowMillis = poller->lastStampMillis;
+        poller->lastStampMillis = nowMillis;
+
+        if (poller->sinks.history != NULL)
+            epsolarHistoryAppend( poller->sinks.history, &fresh, nowMillis );
+        if (poller->sinks.recorder != NULL)
+            epsolarRecorderAppend( poller->sinks.recorder, &fresh, nowMillis );
+        if (poller->sinks.rollup != NULL)
+            epsolarRollupAdd( poller->sinks.rollup, &fresh, nowMillis );
+        if (poller->sinks.changes != NULL && poller->sinks.onChange != NULL &&
+                epsolarChangeDetect( poller->sinks.changes, &fresh, nowMillis, &change ))
+            poller->sinks.onChange( &change, poller->sinks.userData );
+        if (poller->sinks.statusWatcher != NULL)
+            epsolarStatusWatcherUpdate( poller->sinks.statusWatcher, &fresh, nowMillis );
+
+        //
+        //  Next tick, or straight away if this one overran
+        nextDeadline( &deadline, poller->intervalMillis );
+
+        pthread_mutex_lock( &poller->stopMutex );
+        while (!poller->stopRequested) {
+            if (pthread_cond_timedwait( &poller->stopCond, &poller->stopMutex, &deadline ) == ETIMEDOUT)
+                break;
+        }
+        done = poller->stopRequested;
+        pthread_mutex_unlock( &poller->stopMutex );
+    }
+
+    return NULL;
+}
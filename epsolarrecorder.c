@@ -0,0 +1,454 @@
+/*
+ * Binary sample log.
+ *
+ *  An append-only file of fixed width records - every metric as a float,
+ *  the status bits, a few flags and two timestamps - written through a
+ *  shared memory map. Reading it back is an mmap and a pointer; nothing is
+ *  parsed or copied, so months of 1 Hz samples open in milliseconds.
+ *
+ *  The file starts with a header page. Every record carries its own
+ *  sequence number, stored last, so a record is either all there or reads
+ *  as not there at all. Every 'checkpointEvery' records the header's record
+ *  count is brought up to date and the map is flushed; reopening only has
+ *  to check the records written after the last checkpoint. Whatever follows
+ *  the first record that doesn't check out is wiped on reopen, so records
+ *  from before a crash can't line up with new ones and come back to life.
+ */
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "log4c.h"
+#include "libepsolar.h"
+
+
+#define LOG_MAGIC               "EPSLOG01"
+#define LOG_VERSION             1
+#define LOG_HEADER_SIZE         4096
+#define LOG_GROW_RECORDS        16384           // about 1.5MB at a time
+#define DEFAULT_CHECKPOINT      60
+
+typedef struct logHeader {
+    char            magic[ 8 ];
+    uint32_t        version;
+    uint32_t        headerSize;
+    uint32_t        recordSize;
+    uint32_t        numMetrics;
+    int64_t         createdMillis;
+    uint64_t        checkpointRecords;          // known good up to here
+    int64_t         checkpointMillis;
+} logHeader_t;
+
+struct epsolarRecorder {
+    int             fd;
+    char            *map;
+    size_t          mapSize;
+    uint64_t        numRecords;
+    int             checkpointEvery;
+    int             sinceCheckpoint;
+};
+
+struct epsolarLogReader {
+    int             fd;
+    char            *map;
+    size_t          mapSize;
+    uint64_t        numRecords;
+};
+
+
+static  int     checkHeader( const logHeader_t *header, const char *fileName );
+static  uint64_t    countRecords( const char *map, const size_t mapSize );
+static  void    clearAfter( epsolarRecorder_t *recorder, const uint64_t numRecords );
+static  int     growMap( epsolarRecorder_t *recorder, const uint64_t minRecords );
+static  void    writeCheckpoint( epsolarRecorder_t *recorder );
+static  int64_t monotonicNanos( void );
+
+#define RECORDS(map)        ((epsolarLogRecord_t *) ((map) + LOG_HEADER_SIZE))
+
+
+
+// -----------------------------------------------------------------------------
+epsolarRecorder_t   *epsolarRecorderOpen (const char *fileName, const int checkpointEvery)
+{
+    //
+    //  Creates the file, or carries on appending to one that's already there.
+    //  checkpointEvery <= 0 gets a checkpoint a minute at 1 Hz.
+    struct stat     info;
+
+    assert( fileName != NULL );
+
+    epsolarRecorder_t *recorder = calloc( 1, sizeof( epsolarRecorder_t ) );
+    if (recorder == NULL) {
+        Logger_LogError( "epsolarRecorderOpen - unable to allocate a recorder\n" );
+        return NULL;
+    }
+    recorder->checkpointEvery = (checkpointEvery > 0 ? checkpointEvery : DEFAULT_CHECKPOINT);
+
+    recorder->fd = open( fileName, O_RDWR | O_CREAT, 0644 );
+    if (recorder->fd < 0 || fstat( recorder->fd, &info ) != 0) {
+        Logger_LogError( "epsolarRecorderOpen - unable to open [%s]: %s\n", fileName, strerror( errno ) );
+        if (recorder->fd >= 0)
+            close( recorder->fd );
+        free( recorder );
+        return NULL;
+    }
+
+    if (info.st_size == 0) {
+        //
+        //  New file - write the header, then map it with room to grow
+        logHeader_t     header;
+
+        memset( &header, '\0', sizeof( header ) );
+        memcpy( header.magic, LOG_MAGIC, sizeof( header.magic ) );
+        header.version = LOG_VERSION;
+        header.headerSize = LOG_HEADER_SIZE;
+        header.recordSize = sizeof( epsolarLogRecord_t );
+        header.numMetrics = EPSOLAR_METRIC_COUNT;
+        header.createdMillis = epsolarNowMillis();
+
+        if (pwrite( recorder->fd, &header, sizeof( header ), 0 ) != sizeof( header )) {
+            Logger_LogError( "epsolarRecorderOpen - unable to write the header to [%s]: %s\n", fileName, strerror( errno ) );
+            close( recorder->fd );
+            free( recorder );
+            return NULL;
+        }
+        Logger_LogInfo( "epsolarRecorderOpen - started a new log in [%s]\n", fileName );
+    } else {
+        logHeader_t     header;
+
+        if (pread( recorder->fd, &header, sizeof( header ), 0 ) != sizeof( header ) || !checkHeader( &header, fileName )) {
+            close( recorder->fd );
+            free( recorder );
+            return NULL;
+        }
+    }
+
+    if (!growMap( recorder, 0 )) {
+        close( recorder->fd );
+        free( recorder );
+        return NULL;
+    }
+
+    recorder->numRecords = countRecords( recorder->map, recorder->mapSize );
+    clearAfter( recorder, recorder->numRecords );
+    Logger_LogInfo( "epsolarRecorderOpen - [%s] has %llu records\n", fileName, (unsigned long long) recorder->numRecords );
+    return recorder;
+}
+
+// -----------------------------------------------------------------------------
+int     epsolarRecorderAppend (epsolarRecorder_t *recorder, const epsolarRealTimeData_t *rtData, const int64_t wallMillis)
+{
+    //
+    //  One writer per file. The sequence number goes in last, after
+    //  everything else in the record is visible.
+    assert( recorder != NULL );
+    assert( rtData != NULL );
+
+    if (!growMap( recorder, recorder->numRecords + 1 ))
+        return FALSE;
+
+    epsolarLogRecord_t *record = &RECORDS( recorder->map )[ recorder->numRecords ];
+    record->monotonicNanos = monotonicNanos();
+    record->wallMillis = wallMillis;
+    for (int i = 0; i < EPSOLAR_METRIC_COUNT; i += 1)
+        record->values[ i ] = epsolarMetricValue( rtData, i );
+    record->controllerStatusBits = rtData->controllerStatusBits;
+    record->readStatus = (uint8_t) rtData->readStatus;
+    record->flags = epsolarSnapshotFlags( rtData );
+
+    atomic_store_explicit( (_Atomic uint32_t *) &record->sequence, (uint32_t) (recorder->numRecords + 1), memory_order_release );
+    recorder->numRecords += 1;
+
+    if (++recorder->sinceCheckpoint >= recorder->checkpointEvery)
+        writeCheckpoint( recorder );
+
+    return TRUE;
+}
+
+// -----------------------------------------------------------------------------
+void    epsolarRecorderSync (epsolarRecorder_t *recorder)
+{
+    //
+    //  Checkpoint now and wait for it to reach the disk
+    assert( recorder != NULL );
+
+    writeCheckpoint( recorder );
+    if (msync( recorder->map, recorder->mapSize, MS_SYNC ) != 0)
+        Logger_LogWarning( "epsolarRecorderSync - msync failed: %s\n", strerror( errno ) );
+}
+
+// -----------------------------------------------------------------------------
+uint64_t    epsolarRecorderCount (const epsolarRecorder_t *recorder)
+{
+    assert( recorder != NULL );
+    return recorder->numRecords;
+}
+
+// -----------------------------------------------------------------------------
+void    epsolarRecorderClose (epsolarRecorder_t *recorder)
+{
+    if (recorder == NULL)
+        return;
+
+    epsolarRecorderSync( recorder );
+    munmap( recorder->map, recorder->mapSize );
+    close( recorder->fd );
+    free( recorder );
+}
+
+// -----------------------------------------------------------------------------
+epsolarLogReader_t  *epsolarLogReaderOpen (const char *fileName)
+{
+    //
+    //  Read only. Fine to do while a recorder is still appending - call
+    //  epsolarLogReaderRefresh() to pick up what's been added since.
+    assert( fileName != NULL );
+
+    epsolarLogReader_t *reader = calloc( 1, sizeof( epsolarLogReader_t ) );
+    if (reader == NULL) {
+        Logger_LogError( "epsolarLogReaderOpen - unable to allocate a reader\n" );
+        return NULL;
+    }
+
+    reader->fd = open( fileName, O_RDONLY );
+    if (reader->fd < 0) {
+        Logger_LogError( "epsolarLogReaderOpen - unable to open [%s]: %s\n", fileName, strerror( errno ) );
+        free( reader );
+        return NULL;
+    }
+
+    if (!epsolarLogReaderRefresh( reader ) || !checkHeader( (const logHeader_t *) reader->map, fileName )) {
+        epsolarLogReaderClose( reader );
+        return NULL;
+    }
+
+    return reader;
+}
+
+// -----------------------------------------------------------------------------
+int     epsolarLogReaderRefresh (epsolarLogReader_t *reader)
+{
+    //
+    //  Remap if the file has grown and recount. Pointers from before are
+    //  no good afterwards.
+    struct stat     info;
+
+    assert( reader != NULL );
+
+    if (fstat( reader->fd, &info ) != 0 || (size_t) info.st_size < LOG_HEADER_SIZE) {
+        Logger_LogError( "epsolarLogReaderRefresh - not a sample log, or too short\n" );
+        return FALSE;
+    }
+
+    if ((size_t) info.st_size != reader->mapSize) {
+        if (reader->map != NULL)
+            munmap( reader->map, reader->mapSize );
+
+        reader->map = mmap( NULL, info.st_size, PROT_READ, MAP_SHARED, reader->fd, 0 );
+        if (reader->map == MAP_FAILED) {
+            Logger_LogError( "epsolarLogReaderRefresh - mmap failed: %s\n", strerror( errno ) );
+            reader->map = NULL;
+            reader->mapSize = 0;
+            return FALSE;
+        }
+        reader->mapSize = info.st_size;
+        madvise( reader->map, reader->mapSize, MADV_SEQUENTIAL );
+    }
+
+    reader->numRecords = countRecords( reader->map, reader->mapSize );
+    return TRUE;
+}
+
+// -----------------------------------------------------------------------------
+const epsolarLogRecord_t    *epsolarLogReaderRecords (const epsolarLogReader_t *reader, uint64_t *numRecords)
+{
+    //
+    //  Every record, oldest first, straight out of the map
+    assert( reader != NULL );
+    assert( numRecords != NULL );
+
+    *numRecords = reader->numRecords;
+    return RECORDS( reader->map );
+}
+
+// -----------------------------------------------------------------------------
+uint64_t    epsolarLogReaderSeek (const epsolarLogReader_t *reader, const int64_t wallMillis)
+{
+    //
+    //  Index of the first record stamped at or after wallMillis, by binary
+    //  search - numRecords if there isn't one
+    const epsolarLogRecord_t    *records = RECORDS( reader->map );
+    uint64_t    low = 0;
+    uint64_t    high = reader->numRecords;
+
+    while (low < high) {
+        uint64_t middle = low + ((high - low) / 2);
+        if (records[ middle ].wallMillis < wallMillis)
+            low = middle + 1;
+        else
+            high = middle;
+    }
+
+    return low;
+}
+
+// -----------------------------------------------------------------------------
+void    epsolarLogReaderClose (epsolarLogReader_t *reader)
+{
+    if (reader == NULL)
+        return;
+
+    if (reader->map != NULL)
+        munmap( reader->map, reader->mapSize );
+    close( reader->fd );
+    free( reader );
+}
+
+// -----------------------------------------------------------------------------
+static
+int     checkHeader (const logHeader_t *header, const char *fileName)
+{
+    if (memcmp( header->magic, LOG_MAGIC, sizeof( header->magic ) ) != 0) {
+        Logger_LogError( "checkHeader - [%s] isn't a sample log\n", fileName );
+        return FALSE;
+    }
+
+    if (header->version != LOG_VERSION || header->headerSize != LOG_HEADER_SIZE ||
+            header->recordSize != sizeof( epsolarLogRecord_t ) || header->numMetrics != EPSOLAR_METRIC_COUNT) {
+        Logger_LogError( "checkHeader - [%s] is version %u with %u byte records and %u metrics, we want version %d, %d and %d\n",
+                fileName, header->version, header->recordSize, header->numMetrics,
+                LOG_VERSION, (int) sizeof( epsolarLogRecord_t ), EPSOLAR_METRIC_COUNT );
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+// -----------------------------------------------------------------------------
+static
+uint64_t    countRecords (const char *map, const size_t mapSize)
+{
+    //
+    //  Everything up to the checkpoint is known good; past it, keep going
+    //  for as long as the sequence numbers do
+    const logHeader_t           *header = (const logHeader_t *) map;
+    const epsolarLogRecord_t    *records = (const epsolarLogRecord_t *) (map + LOG_HEADER_SIZE);
+    uint64_t    capacity = (mapSize - LOG_HEADER_SIZE) / sizeof( epsolarLogRecord_t );
+    uint64_t    count = header->checkpointRecords;
+
+    if (count > capacity)
+        count = capacity;
+    if (count > 0 && records[ count - 1 ].sequence != (uint32_t) count)
+        count = 0;                              // checkpoint got to disk and the records didn't
+
+    while (count < capacity) {
+        uint32_t sequence = atomic_load_explicit( (const _Atomic uint32_t *) &records[ count ].sequence, memory_order_acquire );
+        if (sequence != (uint32_t) (count + 1))
+            break;
+        count += 1;
+    }
+
+    return count;
+}
+
+// -----------------------------------------------------------------------------
+static
+void    clearAfter (epsolarRecorder_t *recorder, const uint64_t numRecords)
+{
+    //
+    //  After a crash there can be a torn record and then good ones past it.
+    //  Appending would fill the gap, the old sequence numbers would line up
+    //  again and the next reopen would take them for new data. Zero every
+    //  record past the end that isn't zero already - untouched pages stay
+    //  clean - and get that to disk before anything new is written.
+    static const epsolarLogRecord_t empty;
+    epsolarLogRecord_t  *records = RECORDS( recorder->map );
+    uint64_t    capacity = (recorder->mapSize - LOG_HEADER_SIZE) / sizeof( epsolarLogRecord_t );
+    uint64_t    numCleared = 0;
+
+    for (uint64_t i = numRecords; i < capacity; i += 1) {
+        if (memcmp( &records[ i ], &empty, sizeof( empty ) ) != 0) {
+            memset( &records[ i ], '\0', sizeof( epsolarLogRecord_t ) );
+            numCleared += 1;
+        }
+    }
+
+    if (numCleared == 0)
+        return;
+
+    Logger_LogWarning( "clearAfter - cleared %llu stale records after record %llu\n", (unsigned long long) numCleared, (unsigned long long) numRecords );
+    if (msync( recorder->map, recorder->mapSize, MS_SYNC ) != 0)
+        Logger_LogWarning( "clearAfter - msync failed: %s\n", strerror( errno ) );
+}
+
+// -----------------------------------------------------------------------------
+static
+int     growMap (epsolarRecorder_t *recorder, const uint64_t minRecords)
+{
+    //
+    //  Make sure the file and the map hold at least minRecords, growing a
+    //  chunk at a time. New space reads as zeros, so as no records.
+    struct stat     info;
+
+    size_t needed = LOG_HEADER_SIZE + (minRecords * sizeof( epsolarLogRecord_t ));
+    if (recorder->map != NULL && needed <= recorder->mapSize)
+        return TRUE;
+
+    if (fstat( recorder->fd, &info ) != 0)
+        return FALSE;
+
+    size_t size = info.st_size;
+    if (size < needed || size < LOG_HEADER_SIZE + sizeof( epsolarLogRecord_t )) {
+        size = needed + (LOG_GROW_RECORDS * sizeof( epsolarLogRecord_t ));
+        if (ftruncate( recorder->fd, size ) != 0) {
+            Logger_LogError( "growMap - unable to grow the log to %zu bytes: %s\n", size, strerror( errno ) );
+            return FALSE;
+        }
+    }
+
+    if (recorder->map != NULL)
+        munmap( recorder->map, recorder->mapSize );
+
+    recorder->map = mmap( NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, recorder->fd, 0 );
+    if (recorder->map == MAP_FAILED) {
+        Logger_LogError( "growMap - mmap failed: %s\n", strerror( errno ) );
+        recorder->map = NULL;
+        recorder->mapSize = 0;
+        return FALSE;
+    }
+
+    recorder->mapSize = size;
+    return TRUE;
+}
+
+// -----------------------------------------------------------------------------
+static
+void    writeCheckpoint (epsolarRecorder_t *recorder)
+{
+    logHeader_t *header = (logHeader_t *) recorder->map;
+
+    header->checkpointRecords = recorder->numRecords;
+    header->checkpointMillis = epsolarNowMillis();
+    recorder->sinceCheckpoint = 0;
+
+    if (msync( recorder->map, recorder->mapSize, MS_ASYNC ) != 0)
+        Logger_LogWarning( "writeCheckpoint - msync failed: %s\n", strerror( errno ) );
+}
+
+// -----------------------------------------------------------------------------
+static
+int64_t monotonicNanos (void)
+{
+    struct timespec ts;
+
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return ((int64_t) ts.tv_sec * 1000000000LL) + ts.tv_nsec;
+}
@@ -0,0 +1,267 @@
+/*
+ * Rollups - samples pre-aggregated at 1 second, 1 minute, 1 hour and 1 day.
+ *
+ *  Every level is a ring of buckets, allocated up front. A new sample
+ *  lands in the current bucket of each level - min, max, sum, last and a
+ *  count per metric - so it costs the same whether the rollup holds an
+ *  hour or ten years. When a sample falls into a later bucket than the
+ *  slot holds, the slot is cleared and reused; buckets skipped over while
+ *  nothing was arriving are left stale and read back as empty, because each
+ *  slot remembers which bucket it was last used for.
+ *
+ *  Days are UTC days. One writer and any number of readers - the writer
+ *  publishes through a sequence lock the same way the poller does, and a
+ *  reader that sees a write land under it just reads again.
+ */
+#include <assert.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "log4c.h"
+#include "libepsolar.h"
+#include "epsolarseqlock.h"
+
+
+static const int64_t    levelMillis[ EPSOLAR_ROLLUP_LEVELS ] = {
+    [ EPSOLAR_ROLLUP_SECOND ]   = 1000LL,
+    [ EPSOLAR_ROLLUP_MINUTE ]   = 60LL * 1000LL,
+    [ EPSOLAR_ROLLUP_HOUR ]     = 60LL * 60LL * 1000LL,
+    [ EPSOLAR_ROLLUP_DAY ]      = 24LL * 60LL * 60LL * 1000LL
+};
+
+//
+// Bucket numbers go negative before 1970, so -1 is a real one
+#define NEVER_USED      INT64_MIN
+
+static const int        defaultBuckets[ EPSOLAR_ROLLUP_LEVELS ] = {
+    [ EPSOLAR_ROLLUP_SECOND ]   = 3600,                 // an hour
+    [ EPSOLAR_ROLLUP_MINUTE ]   = 7 * 24 * 60,          // a week
+    [ EPSOLAR_ROLLUP_HOUR ]     = 92 * 24,              // a quarter
+    [ EPSOLAR_ROLLUP_DAY ]      = 2 * 366               // two years
+};
+
+//
+// One level, column by column like the history
+typedef struct rollupLevel {
+    int             numBuckets;
+    int64_t         *bucketNumber;              // which bucket the slot holds, NEVER_USED if none
+    uint32_t        *count;                     // clean samples in it
+    float           *minimum[ EPSOLAR_METRIC_COUNT ];
+    float           *maximum[ EPSOLAR_METRIC_COUNT ];
+    float           *last[ EPSOLAR_METRIC_COUNT ];
+    double          *sum[ EPSOLAR_METRIC_COUNT ];
+} rollupLevel_t;
+
+struct epsolarRollup {
+    atomic_uint     sequence;                   // odd while a sample is going in
+    void            *block;
+    rollupLevel_t   levels[ EPSOLAR_ROLLUP_LEVELS ];
+};
+
+
+static  void    addToLevel( rollupLevel_t *level, const int64_t bucket, const float *values );
+static  int64_t floorDiv( const int64_t value, const int64_t divisor );
+
+
+
+// -----------------------------------------------------------------------------
+epsolarRollup_t *epsolarRollupNew (const int *bucketsPerLevel)
+{
+    //
+    //  bucketsPerLevel[ EPSOLAR_ROLLUP_LEVELS ], or NULL for an hour of
+    //  seconds, a week of minutes, a quarter of hours and two years of days
+    size_t  total = 0;
+
+    epsolarRollup_t *rollup = calloc( 1, sizeof( epsolarRollup_t ) );
+    if (rollup == NULL) {
+        Logger_LogError( "epsolarRollupNew - unable to allocate a rollup\n" );
+        return NULL;
+    }
+
+    for (int l = 0; l < EPSOLAR_ROLLUP_LEVELS; l += 1) {
+        int buckets = (bucketsPerLevel != NULL ? bucketsPerLevel[ l ] : defaultBuckets[ l ]);
+        assert( buckets > 0 );
+        rollup->levels[ l ].numBuckets = buckets;
+        total += buckets * (sizeof( int64_t ) + sizeof( uint32_t ) +
+                            EPSOLAR_METRIC_COUNT * ((3 * sizeof( float )) + sizeof( double )));
+    }
+
+    rollup->block = malloc( total );
+    if (rollup->block == NULL) {
+        Logger_LogError( "epsolarRollupNew - unable to allocate %zu bytes of buckets\n", total );
+        free( rollup );
+        return NULL;
+    }
+
+    //
+    //  Carve the block up, widest types first so everything stays aligned
+    char *next = rollup->block;
+    for (int l = 0; l < EPSOLAR_ROLLUP_LEVELS; l += 1) {
+        rollupLevel_t *level = &rollup->levels[ l ];
+        level->bucketNumber = (int64_t *) next;
+        next += level->numBuckets * sizeof( int64_t );
+        for (int m = 0; m < EPSOLAR_METRIC_COUNT; m += 1) {
+            level->sum[ m ] = (double *) next;
+            next += level->numBuckets * sizeof( double );
+        }
+    }
+    for (int l = 0; l < EPSOLAR_ROLLUP_LEVELS; l += 1) {
+        rollupLevel_t *level = &rollup->levels[ l ];
+        level->count = (uint32_t *) next;
+        next += level->numBuckets * sizeof( uint32_t );
+        for (int m = 0; m < EPSOLAR_METRIC_COUNT; m += 1) {
+            level->minimum[ m ] = (float *) next;
+            next += level->numBuckets * sizeof( float );
+            level->maximum[ m ] = (float *) next;
+            next += level->numBuckets * sizeof( float );
+            level->last[ m ] = (float *) next;
+            next += level->numBuckets * sizeof( float );
+        }
+
+        for (int b = 0; b < level->numBuckets; b += 1) {
+            level->bucketNumber[ b ] = NEVER_USED;
+            level->count[ b ] = 0;
+        }
+    }
+
+    atomic_init( &rollup->sequence, 0 );
+    return rollup;
+}
+
+// -----------------------------------------------------------------------------
+void    epsolarRollupFree (epsolarRollup_t *rollup)
+{
+    if (rollup == NULL)
+        return;
+
+    free( rollup->block );
+    free( rollup );
+}
+
+// -----------------------------------------------------------------------------
+void    epsolarRollupAdd (epsolarRollup_t *rollup, const epsolarRealTimeData_t *rtData, const int64_t timeMillis)
+{
+    //
+    //  One writer. Snapshots that didn't read cleanly are left out, the
+    //  same as the history's window stats.
+    float   values[ EPSOLAR_METRIC_COUNT ];
+
+    assert( rollup != NULL );
+    assert( rtData != NULL );
+
+    if (rtData->readStatus != TRACER_STATUS_OK)
+        return;
+
+    for (int m = 0; m < EPSOLAR_METRIC_COUNT; m += 1)
+        values[ m ] = epsolarMetricValue( rtData, m );
+
+    seqlockWriteBegin( &rollup->sequence );
+    for (int l = 0; l < EPSOLAR_ROLLUP_LEVELS; l += 1)
+        addToLevel( &rollup->levels[ l ], floorDiv( timeMillis, levelMillis[ l ] ), values );
+    seqlockWriteEnd( &rollup->sequence );
+}
+
+// -----------------------------------------------------------------------------
+int     epsolarRollupQuery (epsolarRollup_t *rollup, const int level, const int metric, const int64_t fromMillis, const int64_t toMillis,
+                                epsolarRollupPoint_t *points, const int maxPoints)
+{
+    //
+    //  The buckets of one level that overlap fromMillis..toMillis and have
+    //  something in them, oldest first. Returns how many went into points.
+    unsigned int    before;
+    int             numPoints;
+
+    assert( rollup != NULL );
+    assert( level >= 0 && level < EPSOLAR_ROLLUP_LEVELS );
+    assert( metric >= 0 && metric < EPSOLAR_METRIC_COUNT );
+    assert( points != NULL );
+
+    const rollupLevel_t *rl = &rollup->levels[ level ];
+    int64_t first = floorDiv( fromMillis, levelMillis[ level ] );
+    int64_t last = floorDiv( toMillis, levelMillis[ level ] );
+
+    //
+    //  Older than the ring reaches back can't be in it
+    if (last - first >= rl->numBuckets)
+        first = last - rl->numBuckets + 1;
+
+    do {
+        before = seqlockReadBegin( &rollup->sequence );
+
+        numPoints = 0;
+        for (int64_t bucket = first; bucket <= last && numPoints < maxPoints; bucket += 1) {
+            int slot = (int) (((bucket % rl->numBuckets) + rl->numBuckets) % rl->numBuckets);
+            if (rl->bucketNumber[ slot ] != bucket || rl->count[ slot ] == 0)
+                continue;
+
+            epsolarRollupPoint_t *point = &points[ numPoints++ ];
+            point->startMillis = bucket * levelMillis[ level ];
+            point->count = (int) rl->count[ slot ];
+            point->minimum = rl->minimum[ metric ][ slot ];
+            point->maximum = rl->maximum[ metric ][ slot ];
+            point->mean = rl->sum[ metric ][ slot ] / rl->count[ slot ];
+            point->last = rl->last[ metric ][ slot ];
+        }
+
+    } while (seqlockReadRetry( &rollup->sequence, before ));
+
+    return numPoints;
+}
+
+// -----------------------------------------------------------------------------
+int64_t epsolarRollupBucketMillis (const int level)
+{
+    assert( level >= 0 && level < EPSOLAR_ROLLUP_LEVELS );
+    return levelMillis[ level ];
+}
+
+// -----------------------------------------------------------------------------
+static
+void    addToLevel (rollupLevel_t *level, const int64_t bucket, const float *values)
+{
+    int slot = (int) (((bucket % level->numBuckets) + level->numBuckets) % level->numBuckets);
+
+    if (level->bucketNumber[ slot ] != bucket) {
+        //
+        //  A sample stamped before the slot's bucket is from a clock that went
+        //  backwards - drop it rather than wipe newer data
+        if (bucket < level->bucketNumber[ slot ])
+            return;
+
+        level->bucketNumber[ slot ] = bucket;
+        level->count[ slot ] = 0;
+    }
+
+    if (level->count[ slot ] == 0) {
+        for (int m = 0; m < EPSOLAR_METRIC_COUNT; m += 1) {
+            level->minimum[ m ][ slot ] = values[ m ];
+            level->maximum[ m ][ slot ] = values[ m ];
+            level->sum[ m ][ slot ] = values[ m ];
+            level->last[ m ][ slot ] = values[ m ];
+        }
+    } else {
+        for (int m = 0; m < EPSOLAR_METRIC_COUNT; m += 1) {
+            if (values[ m ] < level->minimum[ m ][ slot ])
+                level->minimum[ m ][ slot ] = values[ m ];
+            if (values[ m ] > level->maximum[ m ][ slot ])
+                level->maximum[ m ][ slot ] = values[ m ];
+            level->sum[ m ][ slot ] += values[ m ];
+            level->last[ m ][ slot ] = values[ m ];
+        }
+    }
+    level->count[ slot ] += 1;
+}
+
+// -----------------------------------------------------------------------------
+static
+int64_t floorDiv (const int64_t value, const int64_t divisor)
+{
+    //
+    //  Rounds towards minus infinity, so times before 1970 still bucket right
+    int64_t quotient = value / divisor;
+    if ((value % divisor) != 0 && (value < 0))
+        quotient -= 1;
+    return quotient;
+}
@@ -0,0 +1,362 @@
+/*
+ * Poll many controllers at once.
+ *
+ *  A scheduler owns a set of RS485 buses, each with one or more controllers
+ *  daisy chained on it. Every bus gets its own I/O thread, which walks the
+ *  slave IDs on that bus round robin, so the buses all run in parallel while
+ *  the controllers sharing a bus take fair turns. Snapshots are published per
+ *  controller through a sequence lock, the same way the poller does it.
+ *
+ *  A controller that stops answering sits out rounds - one, then two, four
+ *  and so on up to BACKOFF_MAX_ROUNDS - so its timeouts don't eat into the
+ *  time the others on the bus get. When its turn does come it's asked for a
+ *  single register before anything else. The first answer puts it back in
+ *  every round.
+ */
+#include <assert.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <modbus/modbus.h>
+
+#include "log4c.h"
+#include "libepsolar.h"
+#include "epsolarseqlock.h"
+
+#define BACKOFF_MAX_ROUNDS      64
+
+typedef struct slaveSlot {
+    int                     slaveId;
+    atomic_uint             sequence;           // odd while being written
+    epsolarRealTimeData_t   snapshot;
+    int                     failures;           // timed out rounds in a row - these two
+    int                     skipRounds;         //  only ever touched by the bus thread
+    atomic_int              backedOff;
+} slaveSlot_t;
+
+typedef struct schedulerBus {
+    epsolarController_t     *controller;
+    int                     numSlaves;
+    slaveSlot_t             slaves[ EPSOLAR_MAX_SLAVES_PER_BUS ];
+    pthread_t               thread;
+    int                     running;
+    struct epsolarScheduler *scheduler;
+} schedulerBus_t;
+
+struct epsolarScheduler {
+    int                     numBuses;
+    schedulerBus_t          buses[ EPSOLAR_MAX_BUSES ];
+    int                     intervalMillis;
+
+    pthread_mutex_t         stopMutex;
+    pthread_cond_t          stopCond;
+    int                     stopRequested;
+
+    atomic_ulong            snapshots;          // across every bus
+    struct timespec         startedAt;
+};
+
+
+static  void    *busThread( void *arg );
+static  int     slaveAnswers( epsolarController_t *controller );
+static  void    noteSlaveStatus( slaveSlot_t *slot, const int readStatus );
+static  double  secondsSince( const struct timespec *then );
+
+
+
+// -----------------------------------------------------------------------------
+epsolarScheduler_t *epsolarSchedulerNew (void)
+{
+    epsolarScheduler_t *scheduler = calloc( 1, sizeof( epsolarScheduler_t ) );
+    if (scheduler == NULL) {
+        Logger_LogError( "epsolarSchedulerNew - unable to allocate a scheduler\n" );
+        return NULL;
+    }
+
+    pthread_condattr_t  attr;
+    pthread_condattr_init( &attr );
+    pthread_condattr_setclock( &attr, CLOCK_MONOTONIC );
+    pthread_cond_init( &scheduler->stopCond, &attr );
+    pthread_condattr_destroy( &attr );
+    pthread_mutex_init( &scheduler->stopMutex, NULL );
+    atomic_init( &scheduler->snapshots, 0 );
+
+    return scheduler;
+}
+
+// -----------------------------------------------------------------------------
+int epsolarSchedulerAddBus (epsolarScheduler_t *scheduler, const char *portName, const int baudRate, const char parity,
+                            const int dataBits, const int stopBits, const int *slaveIds, const int numSlaves)
+{
+    //
+    //  Returns the bus number, or -1. Buses can only be added before starting.
+    assert( scheduler != NULL );
+    assert( slaveIds != NULL );
+
+    if (scheduler->numBuses >= EPSOLAR_MAX_BUSES) {
+        Logger_LogError( "epsolarSchedulerAddBus - already have %d buses\n", EPSOLAR_MAX_BUSES );
+        return -1;
+    }
+    if (numSlaves < 1 || numSlaves > EPSOLAR_MAX_SLAVES_PER_BUS) {
+        Logger_LogError( "epsolarSchedulerAddBus - need 1 to %d slaves on [%s], got %d\n", EPSOLAR_MAX_SLAVES_PER_BUS, portName, numSlaves );
+        return -1;
+    }
+
+    schedulerBus_t *bus = &scheduler->buses[ scheduler->numBuses ];
+    bus->controller = epsolarControllerNew( portName, baudRate, parity, dataBits, stopBits, slaveIds[ 0 ] );
+    if (bus->controller == NULL)
+        return -1;
+
+    //
+    //  Daisy chained controllers are where a silent one hurts the most
+    epsolarControllerSetAdaptiveTimeouts( bus->controller, TRUE );
+
+    bus->numSlaves = numSlaves;
+    for (int i = 0; i < numSlaves; i += 1) {
+        bus->slaves[ i ].slaveId = slaveIds[ i ];
+        atomic_init( &bus->slaves[ i ].sequence, 0 );
+        atomic_init( &bus->slaves[ i ].backedOff, FALSE );
+    }
+    bus->scheduler = scheduler;
+
+    return scheduler->numBuses++;
+}
+
+// -----------------------------------------------------------------------------
+int epsolarSchedulerStart (epsolarScheduler_t *scheduler, const int intervalMillis)
+{
+    //
+    //  intervalMillis is how often each bus starts a new round of its slaves,
+    //  zero to go round as fast as the bus allows. Returns the number of buses
+    //  that came up - one that can't be opened is logged and left idle.
+    int running = 0;
+
+    assert( scheduler != NULL );
+    assert( intervalMillis >= 0 );
+
+    scheduler->intervalMillis = intervalMillis;
+    scheduler->stopRequested = FALSE;
+    atomic_store( &scheduler->snapshots, 0 );
+    clock_gettime( CLOCK_MONOTONIC, &scheduler->startedAt );
+
+    for (int i = 0; i < scheduler->numBuses; i += 1) {
+        schedulerBus_t *bus = &scheduler->buses[ i ];
+
+        if (!epsolarControllerConnect( bus->controller )) {
+            Logger_LogError( "epsolarSchedulerStart - unable to open bus [%s]\n", bus->controller->portName );
+            continue;
+        }
+
+        int status = pthread_create( &bus->thread, NULL, busThread, bus );
+        if (status != 0) {
+            Logger_LogError( "epsolarSchedulerStart - no thread for bus [%s]: %s\n", bus->controller->portName, strerror( status ) );
+            epsolarControllerDisconnect( bus->controller );
+            continue;
+        }
+
+        bus->running = TRUE;
+        running += 1;
+    }
+
+    Logger_LogInfo( "epsolarSchedulerStart - %d of %d buses running\n", running, scheduler->numBuses );
+    return running;
+}
+
+// -----------------------------------------------------------------------------
+void epsolarSchedulerStop (epsolarScheduler_t *scheduler)
+{
+    assert( scheduler != NULL );
+
+    pthread_mutex_lock( &scheduler->stopMutex );
+    scheduler->stopRequested = TRUE;
+    pthread_cond_broadcast( &scheduler->stopCond );
+    pthread_mutex_unlock( &scheduler->stopMutex );
+
+    for (int i = 0; i < scheduler->numBuses; i += 1) {
+        schedulerBus_t *bus = &scheduler->buses[ i ];
+        if (bus->running) {
+            pthread_join( bus->thread, NULL );
+            epsolarControllerDisconnect( bus->controller );
+            bus->running = FALSE;
+        }
+    }
+}
+
+// -----------------------------------------------------------------------------
+void epsolarSchedulerFree (epsolarScheduler_t *scheduler)
+{
+    if (scheduler == NULL)
+        return;
+
+    epsolarSchedulerStop( scheduler );
+    for (int i = 0; i < scheduler->numBuses; i += 1)
+        epsolarControllerFree( scheduler->buses[ i ].controller );
+
+    pthread_cond_destroy( &scheduler->stopCond );
+    pthread_mutex_destroy( &scheduler->stopMutex );
+    free( scheduler );
+}
+
+// -----------------------------------------------------------------------------
+unsigned int epsolarSchedulerGetSnapshot (epsolarScheduler_t *scheduler, const int busNumber, const int slaveId, epsolarRealTimeData_t *rtData)
+{
+    //
+    //  Same deal as epsolarPollerGetSnapshot(): never blocks, returns how many
+    //  snapshots that controller has had published, zero if none (or no such
+    //  bus and slave) in which case rtData is zeroed.
+    assert( scheduler != NULL );
+    assert( rtData != NULL );
+
+    memset( rtData, '\0', sizeof( epsolarRealTimeData_t ) );
+    if (busNumber < 0 || busNumber >= scheduler->numBuses)
+        return 0;
+
+    schedulerBus_t *bus = &scheduler->buses[ busNumber ];
+    for (int i = 0; i < bus->numSlaves; i += 1) {
+        slaveSlot_t     *slot = &bus->slaves[ i ];
+
+        if (slot->slaveId == slaveId)
+            return seqlockCopy( &slot->sequence, rtData, &slot->snapshot, sizeof( epsolarRealTimeData_t ) );
+    }
+
+    return 0;
+}
+
+// -----------------------------------------------------------------------------
+void epsolarSchedulerGetStats (epsolarScheduler_t *scheduler, epsolarSchedulerStats_t *stats)
+{
+    assert( scheduler != NULL );
+    assert( stats != NULL );
+
+    memset( stats, '\0', sizeof( epsolarSchedulerStats_t ) );
+    for (int i = 0; i < scheduler->numBuses; i += 1) {
+        schedulerBus_t *bus = &scheduler->buses[ i ];
+
+        if (bus->running) {
+            stats->busesRunning += 1;
+            stats->controllers += bus->numSlaves;
+            for (int j = 0; j < bus->numSlaves; j += 1) {
+                if (atomic_load( &bus->slaves[ j ].backedOff ))
+                    stats->controllersBackedOff += 1;
+            }
+        }
+    }
+
+    stats->snapshots = atomic_load( &scheduler->snapshots );
+    stats->elapsedSeconds = secondsSince( &scheduler->startedAt );
+    if (stats->elapsedSeconds > 0.0)
+        stats->snapshotsPerSecond = stats->snapshots / stats->elapsedSeconds;
+}
+
+// -----------------------------------------------------------------------------
+static
+void    *busThread (void *arg)
+{
+    schedulerBus_t          *bus = (schedulerBus_t *) arg;
+    epsolarScheduler_t      *scheduler = bus->scheduler;
+    epsolarController_t     *controller = bus->controller;
+    epsolarRealTimeData_t   fresh;
+    struct timespec         deadline;
+    int                     done = FALSE;
+
+    clock_gettime( CLOCK_MONOTONIC, &deadline );
+
+    while (!done) {
+        //
+        //  One round: every slave on the bus once, in order, bar any sitting
+        //  out. This thread is the only one using the context, so switching
+        //  slave IDs is safe.
+        for (int i = 0; i < bus->numSlaves && !done; i += 1) {
+            slaveSlot_t     *slot = &bus->slaves[ i ];
+
+            if (slot->skipRounds > 0) {
+                slot->skipRounds -= 1;
+                continue;
+            }
+
+            controller->slaveNumber = slot->slaveId;
+            modbus_set_slave( controller->ctx, controller->slaveNumber );
+
+            //
+            //  A full snapshot from a slave that isn't there costs every
+            //  request's timeout, so one that's been timing out is asked
+            //  for one register first
+            if (slot->failures > 0 && !slaveAnswers( controller )) {
+                memset( &fresh, '\0', sizeof( epsolarRealTimeData_t ) );
+                fresh.readStatus = TRACER_STATUS_TIMEOUT;
+            } else {
+                epsolarControllerGetRealTimeData( controller, &fresh );
+            }
+            seqlockPublish( &slot->sequence, &slot->snapshot, &fresh, sizeof( epsolarRealTimeData_t ) );
+            atomic_fetch_add( &scheduler->snapshots, 1 );
+            noteSlaveStatus( slot, fresh.readStatus );
+
+            pthread_mutex_lock( &scheduler->stopMutex );
+            done = scheduler->stopRequested;
+            pthread_mutex_unlock( &scheduler->stopMutex );
+        }
+
+        if (done || scheduler->intervalMillis == 0)
+            continue;
+
+        //
+        //  Pace the rounds. An overrun starts the next round straight away.
+        nextDeadline( &deadline, scheduler->intervalMillis );
+
+        pthread_mutex_lock( &scheduler->stopMutex );
+        while (!scheduler->stopRequested) {
+            if (pthread_cond_timedwait( &scheduler->stopCond, &scheduler->stopMutex, &deadline ) == ETIMEDOUT)
+                break;
+        }
+        done = scheduler->stopRequested;
+        pthread_mutex_unlock( &scheduler->stopMutex );
+    }
+
+    return NULL;
+}
+
+// -----------------------------------------------------------------------------
+static
+int     slaveAnswers (epsolarController_t *controller)
+{
+    tracerClearStatus();
+    readRegisterAsInt( controller->ctx, TRACER_BATTERY_VOLTAGE );
+    return (tracerGetLastStatus() != TRACER_STATUS_TIMEOUT);
+}
+
+// -----------------------------------------------------------------------------
+static
+void    noteSlaveStatus (slaveSlot_t *slot, const int readStatus)
+{
+    //
+    //  Only a timeout means nobody's there. A bad CRC or an exception is a
+    //  controller that answered, and an I/O error is the port - skipping
+    //  one slave wouldn't help with either.
+    if (readStatus != TRACER_STATUS_TIMEOUT) {
+        if (slot->failures > 0)
+            Logger_LogInfo( "noteSlaveStatus - slave %d is answering again\n", slot->slaveId );
+        slot->failures = 0;
+        atomic_store( &slot->backedOff, FALSE );
+        return;
+    }
+
+    slot->failures += 1;
+    slot->skipRounds = (slot->failures > 6 ? BACKOFF_MAX_ROUNDS : 1 << (slot->failures - 1));
+    atomic_store( &slot->backedOff, TRUE );
+
+    Logger_LogWarning( "noteSlaveStatus - slave %d timed out %d rounds running, skipping the next %d\n",
+            slot->slaveId, slot->failures, slot->skipRounds );
+}
+
+// -----------------------------------------------------------------------------
+static
+double  secondsSince (const struct timespec *then)
+{
+    struct timespec now;
+
+    clock_gettime( CLOCK_MONOTONIC, &now );
+    return (now.tv_sec - then->tv_sec) + ((now.tv_nsec - then->tv_nsec) / 1.0e9);
+}
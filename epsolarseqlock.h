@@ -0,0 +1,109 @@
+/*
+ */
+
+/*
+ * File:   epsolarseqlock.h
+ *
+ * Internal to the library, not installed. The sequence lock the poller, the
+ *  scheduler and the rollup publish through, and the fixed rate pacing the
+ *  poller and the scheduler share.
+ *
+ *  One writer bumps the sequence to odd, changes the data, and bumps it to
+ *  even again. A reader copies the data and keeps the copy only if the
+ *  sequence was even and the same before and after - readers never block the
+ *  writer or each other, and never see half a write.
+ */
+
+#ifndef EPSOLARSEQLOCK_H
+#define EPSOLARSEQLOCK_H
+
+#include <stdatomic.h>
+#include <string.h>
+#include <time.h>
+
+
+// -----------------------------------------------------------------------------
+static inline void  seqlockWriteBegin (atomic_uint *sequence)
+{
+    //
+    //  Only ever one writer, so a plain increment will do
+    unsigned int seq = atomic_load_explicit( sequence, memory_order_relaxed );
+
+    atomic_store_explicit( sequence, seq + 1, memory_order_relaxed );
+    atomic_thread_fence( memory_order_release );
+}
+
+// -----------------------------------------------------------------------------
+static inline void  seqlockWriteEnd (atomic_uint *sequence)
+{
+    unsigned int seq = atomic_load_explicit( sequence, memory_order_relaxed );
+
+    atomic_store_explicit( sequence, seq + 1, memory_order_release );
+}
+
+// -----------------------------------------------------------------------------
+static inline unsigned int  seqlockReadBegin (atomic_uint *sequence)
+{
+    //
+    //  Waits out a write in progress
+    unsigned int seq;
+
+    while ((seq = atomic_load_explicit( sequence, memory_order_acquire )) & 0x01)
+        ;
+    return seq;
+}
+
+// -----------------------------------------------------------------------------
+static inline int   seqlockReadRetry (atomic_uint *sequence, const unsigned int before)
+{
+    //
+    //  TRUE if a write got in while we were reading - go round again
+    atomic_thread_fence( memory_order_acquire );
+    return (atomic_load_explicit( sequence, memory_order_relaxed ) != before);
+}
+
+// -----------------------------------------------------------------------------
+static inline void  seqlockPublish (atomic_uint *sequence, void *shared, const void *fresh, const size_t size)
+{
+    seqlockWriteBegin( sequence );
+    memcpy( shared, fresh, size );
+    seqlockWriteEnd( sequence );
+}
+
+// -----------------------------------------------------------------------------
+static inline unsigned int  seqlockCopy (atomic_uint *sequence, void *copy, const void *shared, const size_t size)
+{
+    //
+    //  Returns how many writes have been published so far
+    unsigned int before;
+
+    do {
+        before = seqlockReadBegin( sequence );
+        memcpy( copy, shared, size );
+    } while (seqlockReadRetry( sequence, before ));
+
+    return (before / 2);
+}
+
+// -----------------------------------------------------------------------------
+static inline void  nextDeadline (struct timespec *deadline, const int intervalMillis)
+{
+    //
+    //  CLOCK_MONOTONIC, one interval on. If the last one overran, start again
+    //  from now rather than firing off a burst to catch up.
+    struct timespec now;
+
+    deadline->tv_sec += (intervalMillis / 1000);
+    deadline->tv_nsec += (long) (intervalMillis % 1000) * 1000000L;
+    if (deadline->tv_nsec >= 1000000000L) {
+        deadline->tv_sec += 1;
+        deadline->tv_nsec -= 1000000000L;
+    }
+
+    clock_gettime( CLOCK_MONOTONIC, &now );
+    if (now.tv_sec > deadline->tv_sec || (now.tv_sec == deadline->tv_sec && now.tv_nsec > deadline->tv_nsec))
+        *deadline = now;
+}
+
+
+#endif /* EPSOLARSEQLOCK_H */
@@ -0,0 +1,649 @@
+/*
+ * A Tracer charge controller simulator on a pseudo terminal.
+ *
+ *  The simulator holds the master side of a pty and answers Modbus RTU frames
+ *  written to the slave side, which is what libmodbus opens in place of the
+ *  real /dev/ttyXXX. It knows the same address ranges the real controller
+ *  answers for (see the V2.5 protocol document), replies with an illegal data
+ *  address exception outside them, and holds each reply back for as long as
+ *  the request and response would take on the wire at the configured baud
+ *  rate, plus a turnaround delay. Good enough to benchmark against.
+ *
+ *  Function codes handled: 0x01 0x02 0x03 0x04 0x05 0x06 0x0F 0x10
+ */
+#define _GNU_SOURCE
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "log4c.h"
+#include "epsolarsim.h"
+
+
+#define MAX_FRAME           256
+#define SILENCE_MILLIS      20          // a partial frame this old is garbage
+
+#define EXCEPTION_ILLEGAL_FUNCTION          0x01
+#define EXCEPTION_ILLEGAL_DATA_ADDRESS      0x02
+#define EXCEPTION_ILLEGAL_DATA_VALUE        0x03
+
+typedef struct simRange {
+    int     functionCode;               // the table it lives in: 0x01, 0x02, 0x03 or 0x04
+    int     first;
+    int     last;
+} simRange_t;
+
+//
+// What a real controller answers for. Same list as readableRanges in
+//  tracerseries.c - a request straddling two of these gets an exception.
+static const simRange_t simRanges[] = {
+    { 0x01, 0x0000, 0x0003 },
+    { 0x01, 0x0005, 0x0006 },
+    { 0x01, 0x0013, 0x0014 },
+    { 0x02, 0x2000, 0x2000 },
+    { 0x02, 0x200C, 0x200C },
+    { 0x04, 0x3000, 0x3008 },
+    { 0x04, 0x300E, 0x300E },
+    { 0x04, 0x3100, 0x3112 },
+    { 0x04, 0x311A, 0x311D },
+    { 0x04, 0x3200, 0x3202 },
+    { 0x04, 0x3300, 0x3313 },
+    { 0x04, 0x331A, 0x331C },
+    { 0x03, 0x9000, 0x900E },
+    { 0x03, 0x9013, 0x901B },
+    { 0x03, 0x901E, 0x9021 },
+    { 0x03, 0x903D, 0x903F },
+    { 0x03, 0x9042, 0x904D },
+    { 0x03, 0x9063, 0x9063 },
+    { 0x03, 0x9065, 0x9067 },
+    { 0x03, 0x9069, 0x906E },
+    { 0x03, 0x9070, 0x9070 },
+};
+
+//
+// Power up values - a 12V system on a sunny afternoon
+typedef struct simDefault {
+    int         functionCode;
+    int         address;
+    uint16_t    value;
+} simDefault_t;
+
+static const simDefault_t simDefaults[] = {
+    { 0x01, 0x0000, 1 },                                    // charging on
+    { 0x02, 0x200C, 0 },                                    // daytime
+    { 0x04, 0x3000, 15000 }, { 0x04, 0x3001, 4000 },        // rated PV 150V 40A
+    { 0x04, 0x3002, 0x9620 }, { 0x04, 0x3003, 0x0001 },     //  1040W
+    { 0x04, 0x3004, 1200 }, { 0x04, 0x3005, 4000 },         // rated battery 12V 40A
+    { 0x04, 0x3006, 0x9620 }, { 0x04, 0x3007, 0x0001 },
+    { 0x04, 0x3008, 0x0002 }, { 0x04, 0x300E, 4000 },       // MPPT, rated load 40A
+    { 0x04, 0x3100, 1850 }, { 0x04, 0x3101, 250 },          // PV 18.5V 2.5A
+    { 0x04, 0x3102, 4625 }, { 0x04, 0x3103, 0 },
+    { 0x04, 0x3104, 1330 }, { 0x04, 0x3105, 330 },          // charging 13.3V 3.3A
+    { 0x04, 0x3106, 4389 }, { 0x04, 0x3107, 0 },
+    { 0x04, 0x310C, 1330 }, { 0x04, 0x310D, 120 },          // load 13.3V 1.2A
+    { 0x04, 0x310E, 1596 }, { 0x04, 0x310F, 0 },
+    { 0x04, 0x3110, 2500 }, { 0x04, 0x3111, 3100 },         // 25C battery, 31C device
+    { 0x04, 0x311A, 85 }, { 0x04, 0x311D, 1200 },
+    { 0x04, 0x3200, 0x0000 }, { 0x04, 0x3201, 0x0005 }, { 0x04, 0x3202, 0x0001 },
+    { 0x04, 0x3300, 2150 }, { 0x04, 0x3301, 30 },
+    { 0x04, 0x3302, 1420 }, { 0x04, 0x3303, 1250 },
+    { 0x04, 0x3304, 45 }, { 0x04, 0x3306, 1310 }, { 0x04, 0x3308, 15020 }, { 0x04, 0x330A, 40210 },
+    { 0x04, 0x330C, 120 }, { 0x04, 0x330E, 2780 }, { 0x04, 0x3310, 31005 }, { 0x04, 0x3312, 0x3A98 }, { 0x04, 0x3313, 0x0001 },
+    { 0x04, 0x331A, 1330 }, { 0x04, 0x331B, 210 }, { 0x04, 0x331C, 0 },
+    { 0x03, 0x9000, 1 }, { 0x03, 0x9001, 200 }, { 0x03, 0x9002, 300 },
+    { 0x03, 0x9003, 1600 }, { 0x03, 0x9004, 1500 }, { 0x03, 0x9005, 1500 }, { 0x03, 0x9006, 1460 },
+    { 0x03, 0x9007, 1440 }, { 0x03, 0x9008, 1380 }, { 0x03, 0x9009, 1320 }, { 0x03, 0x900A, 1260 },
+    { 0x03, 0x900B, 1220 }, { 0x03, 0x900C, 1200 }, { 0x03, 0x900D, 1110 }, { 0x03, 0x900E, 1060 },
+    { 0x03, 0x9017, 6500 }, { 0x03, 0x9018, 0xF060 }, { 0x03, 0x9019, 8500 }, { 0x03, 0x901A, 7500 },
+    { 0x03, 0x901E, 500 }, { 0x03, 0x901F, 10 }, { 0x03, 0x9020, 600 }, { 0x03, 0x9021, 10 },
+    { 0x03, 0x903D, 0 }, { 0x03, 0x903E, 0x0100 }, { 0x03, 0x903F, 0x0100 },
+    { 0x03, 0x9063, 60 }, { 0x03, 0x9065, 0x0A00 }, { 0x03, 0x9067, 1 },
+    { 0x03, 0x906B, 120 }, { 0x03, 0x906C, 120 }, { 0x03, 0x906D, 80 }, { 0x03, 0x906E, 100 },
+    { 0x03, 0x9070, 0 },
+};
+
+struct epsolarSimulator {
+    epsolarSimulatorConfig_t    config;
+    int                         masterFd;
+    int                         slaveFd;            // kept open so the pty never hangs up
+    char                        portName[ 64 ];
+
+    pthread_t                   thread;
+    atomic_int                  stopRequested;
+
+    pthread_mutex_t             lock;               // registers and stats
+    uint16_t                    coils[ 0x20 ];
+    uint16_t                    discreteInputs[ 0x20 ];
+    uint16_t                    inputRegisters[ 0x400 ];    // 0x3000..
+    uint16_t                    holdingRegisters[ 0x100 ];  // 0x9000..
+    long                        clockOffset;                // seconds from our clock to the controller's
+    epsolarSimulatorStats_t     stats;
+};
+
+
+static  void        *simulatorThread( void *arg );
+static  int         frameLength( const uint8_t *frame, const int len );
+static  void        handleFrame( epsolarSimulator_t *sim, const uint8_t *request, const int len, const struct timespec *arrived );
+static  int         buildResponse( epsolarSimulator_t *sim, const uint8_t *request, uint8_t *response );
+static  int         exceptionResponse( const uint8_t *request, const int code, uint8_t *response );
+static  uint16_t    *registerSlot( epsolarSimulator_t *sim, const int functionCode, const int address );
+static  const simRange_t    *findRange( const int functionCode, const int first, const int last );
+static  uint16_t    readWord( epsolarSimulator_t *sim, const int functionCode, const int address );
+static  void        writeWord( epsolarSimulator_t *sim, const int functionCode, const int address, const uint16_t value );
+static  void        sendPaced( epsolarSimulator_t *sim, const uint8_t *response, const int len, struct timespec *when );
+static  uint16_t    crc16( const uint8_t *buffer, const int len );
+static  long        charNanos( const epsolarSimulatorConfig_t *config );
+static  void        addNanos( struct timespec *ts, const long long nanos );
+
+
+
+// -----------------------------------------------------------------------------
+epsolarSimulator_t *epsolarSimulatorStart (const epsolarSimulatorConfig_t *config)
+{
+    static const epsolarSimulatorConfig_t defaultConfig = {
+        .slaveId = 1,
+        .baudRate = 115200,
+        .bitsPerChar = 10,
+        .turnaroundMicros = 2000
+    };
+
+    epsolarSimulator_t *sim = calloc( 1, sizeof( epsolarSimulator_t ) );
+    if (sim == NULL) {
+        Logger_LogError( "epsolarSimulatorStart - unable to allocate a simulator\n" );
+        return NULL;
+    }
+
+    sim->config = (config != NULL ? *config : defaultConfig);
+    sim->masterFd = -1;
+    sim->slaveFd = -1;
+    if (sim->config.bitsPerChar <= 0)
+        sim->config.bitsPerChar = 10;
+    pthread_mutex_init( &sim->lock, NULL );
+    atomic_init( &sim->stopRequested, FALSE );
+
+    for (size_t i = 0; i < sizeof( simDefaults ) / sizeof( simDefaults[ 0 ] ); i += 1)
+        *registerSlot( sim, simDefaults[ i ].functionCode, simDefaults[ i ].address ) = simDefaults[ i ].value;
+
+    //
+    //  The pty. Both ends raw so nothing gets echoed or translated.
+    struct termios  tio;
+    sim->masterFd = posix_openpt( O_RDWR | O_NOCTTY );
+    if (sim->masterFd < 0 || grantpt( sim->masterFd ) != 0 || unlockpt( sim->masterFd ) != 0 ||
+        ptsname_r( sim->masterFd, sim->portName, sizeof( sim->portName ) ) != 0) {
+        Logger_LogError( "epsolarSimulatorStart - unable to create a pty: %s\n", strerror( errno ) );
+        goto failed;
+    }
+
+    sim->slaveFd = open( sim->portName, O_RDWR | O_NOCTTY );
+    if (sim->slaveFd < 0) {
+        Logger_LogError( "epsolarSimulatorStart - unable to open [%s]: %s\n", sim->portName, strerror( errno ) );
+        goto failed;
+    }
+
+    tcgetattr( sim->masterFd, &tio );
+    cfmakeraw( &tio );
+    tcsetattr( sim->masterFd, TCSANOW, &tio );
+    tcgetattr( sim->slaveFd, &tio );
+    cfmakeraw( &tio );
+    tcsetattr( sim->slaveFd, TCSANOW, &tio );
+
+    if (pthread_create( &sim->thread, NULL, simulatorThread, sim ) != 0) {
+        Logger_LogError( "epsolarSimulatorStart - unable to start the simulator thread\n" );
+        goto failed;
+    }
+
+    Logger_LogInfo( "epsolarSimulatorStart - slave %d on [%s], %d baud, %d us turnaround\n",
+            sim->config.slaveId, sim->portName, sim->config.baudRate, sim->config.turnaroundMicros );
+    return sim;
+
+failed:
+    if (sim->slaveFd >= 0)
+        close( sim->slaveFd );
+    if (sim->masterFd >= 0)
+        close( sim->masterFd );
+    pthread_mutex_destroy( &sim->lock );
+    free( sim );
+    return NULL;
+}
+
+// -----------------------------------------------------------------------------
+void epsolarSimulatorStop (epsolarSimulator_t *sim)
+{
+    if (sim == NULL)
+        return;
+
+    atomic_store( &sim->stopRequested, TRUE );
+    pthread_join( sim->thread, NULL );
+
+    close( sim->slaveFd );
+    close( sim->masterFd );
+    pthread_mutex_destroy( &sim->lock );
+    free( sim );
+}
+
+// -----------------------------------------------------------------------------
+const char *epsolarSimulatorGetPortName (const epsolarSimulator_t *sim)
+{
+    return sim->portName;
+}
+
+// -----------------------------------------------------------------------------
+void epsolarSimulatorGetStats (epsolarSimulator_t *sim, epsolarSimulatorStats_t *stats)
+{
+    pthread_mutex_lock( &sim->lock );
+    *stats = sim->stats;
+    pthread_mutex_unlock( &sim->lock );
+}
+
+// -----------------------------------------------------------------------------
+void epsolarSimulatorResetStats (epsolarSimulator_t *sim)
+{
+    pthread_mutex_lock( &sim->lock );
+    memset( &sim->stats, '\0', sizeof( epsolarSimulatorStats_t ) );
+    pthread_mutex_unlock( &sim->lock );
+}
+
+// -----------------------------------------------------------------------------
+void epsolarSimulatorSetRegister (epsolarSimulator_t *sim, const int functionCode, const int address, const uint16_t value)
+{
+    pthread_mutex_lock( &sim->lock );
+    writeWord( sim, functionCode, address, value );
+    pthread_mutex_unlock( &sim->lock );
+}
+
+// -----------------------------------------------------------------------------
+uint16_t epsolarSimulatorGetRegister (epsolarSimulator_t *sim, const int functionCode, const int address)
+{
+    pthread_mutex_lock( &sim->lock );
+    uint16_t value = readWord( sim, functionCode, address );
+    pthread_mutex_unlock( &sim->lock );
+    return value;
+}
+
+// -----------------------------------------------------------------------------
+static
+void *simulatorThread (void *arg)
+{
+    epsolarSimulator_t  *sim = (epsolarSimulator_t *) arg;
+    uint8_t             frame[ MAX_FRAME ];
+    int                 len = 0;
+
+    while (!atomic_load( &sim->stopRequested )) {
+        struct pollfd   pfd = { .fd = sim->masterFd, .events = POLLIN };
+
+        int ready = poll( &pfd, 1, SILENCE_MILLIS );
+        if (ready < 0 && errno != EINTR) {
+            Logger_LogError( "simulatorThread - poll failed: %s\n", strerror( errno ) );
+            break;
+        }
+
+        if (ready <= 0) {
+            //
+            //  Line went quiet. Whatever's left over is a frame we couldn't
+            //  size - answer it if it's ours and intact, otherwise drop it.
+            if (len >= 4 && crc16( frame, len - 2 ) == (frame[ len - 2 ] | (frame[ len - 1 ] << 8))) {
+                struct timespec now;
+                clock_gettime( CLOCK_MONOTONIC, &now );
+                handleFrame( sim, frame, len, &now );
+            } else if (len > 0) {
+                pthread_mutex_lock( &sim->lock );
+                sim->stats.ignored += 1;
+                pthread_mutex_unlock( &sim->lock );
+            }
+            len = 0;
+            continue;
+        }
+
+        int got = read( sim->masterFd, &frame[ len ], sizeof( frame ) - len );
+        if (got <= 0)
+            continue;
+
+        pthread_mutex_lock( &sim->lock );
+        sim->stats.bytesIn += got;
+        pthread_mutex_unlock( &sim->lock );
+        len += got;
+
+        int need;
+        while ((need = frameLength( frame, len )) > 0 && len >= need) {
+            struct timespec now;
+            clock_gettime( CLOCK_MONOTONIC, &now );
+            handleFrame( sim, frame, need, &now );
+
+            memmove( frame, &frame[ need ], len - need );
+            len -= need;
+        }
+
+        if (need > MAX_FRAME || len == MAX_FRAME)
+            len = 0;                        // nonsense, start over
+    }
+
+    return NULL;
+}
+
+// -----------------------------------------------------------------------------
+static
+int frameLength (const uint8_t *frame, const int len)
+{
+    //
+    //  Bytes in the request starting at frame[0], 0 if we can't tell yet,
+    //  -1 for a function code we don't know the shape of.
+    if (len < 2)
+        return 0;
+
+    switch (frame[ 1 ]) {
+        case 0x01: case 0x02: case 0x03: case 0x04: case 0x05: case 0x06:
+            return 8;
+        case 0x0F: case 0x10:
+            return (len < 7 ? 0 : 9 + frame[ 6 ]);
+        default:
+            return -1;
+    }
+}
+
+// -----------------------------------------------------------------------------
+static
+void handleFrame (epsolarSimulator_t *sim, const uint8_t *request, const int len, const struct timespec *arrived)
+{
+    uint8_t         response[ MAX_FRAME ];
+    struct timespec when = *arrived;
+
+    if (crc16( request, len - 2 ) != (request[ len - 2 ] | (request[ len - 1 ] << 8))) {
+        pthread_mutex_lock( &sim->lock );
+        sim->stats.crcErrors += 1;
+        pthread_mutex_unlock( &sim->lock );
+        return;
+    }
+
+    if (request[ 0 ] != sim->config.slaveId) {
+        pthread_mutex_lock( &sim->lock );
+        sim->stats.ignored += 1;
+        pthread_mutex_unlock( &sim->lock );
+        return;
+    }
+
+    pthread_mutex_lock( &sim->lock );
+    sim->stats.requests += 1;
+    int rlen = (frameLength( request, len ) < 0 ?
+                    exceptionResponse( request, EXCEPTION_ILLEGAL_FUNCTION, response ) :
+                    buildResponse( sim, request, response ));
+    if (response[ 1 ] & 0x80)
+        sim->stats.exceptions += 1;
+    pthread_mutex_unlock( &sim->lock );
+
+    uint16_t crc = crc16( response, rlen );
+    response[ rlen++ ] = (crc & 0xFF);
+    response[ rlen++ ] = (crc >> 8);
+
+    //
+    //  The pty handed us the request instantly. On a real line it would
+    //  still be arriving, then the controller thinks about it.
+    addNanos( &when, (long long) len * charNanos( &sim->config ) + (long long) sim->config.turnaroundMicros * 1000LL );
+    sendPaced( sim, response, rlen, &when );
+}
+
+// -----------------------------------------------------------------------------
+static
+int buildResponse (epsolarSimulator_t *sim, const uint8_t *request, uint8_t *response)
+{
+    //
+    //  Caller holds sim->lock. Returns the length without the CRC.
+    int functionCode = request[ 1 ];
+    int address = (request[ 2 ] << 8) | request[ 3 ];
+    int count = (request[ 4 ] << 8) | request[ 5 ];
+    int len = 0;
+
+    response[ len++ ] = request[ 0 ];
+    response[ len++ ] = functionCode;
+
+    switch (functionCode) {
+        case 0x01:
+        case 0x02:
+            if (count < 1 || count > 2000)
+                return exceptionResponse( request, EXCEPTION_ILLEGAL_DATA_VALUE, response );
+            if (findRange( functionCode, address, address + count - 1 ) == NULL)
+                return exceptionResponse( request, EXCEPTION_ILLEGAL_DATA_ADDRESS, response );
+
+            response[ len++ ] = (count + 7) / 8;
+            memset( &response[ len ], '\0', (count + 7) / 8 );
+            for (int i = 0; i < count; i += 1) {
+                if (readWord( sim, functionCode, address + i ))
+                    response[ len + (i / 8) ] |= (1 << (i % 8));
+            }
+            return len + (count + 7) / 8;
+
+        case 0x03:
+        case 0x04:
+            if (count < 1 || count > 125)
+                return exceptionResponse( request, EXCEPTION_ILLEGAL_DATA_VALUE, response );
+            if (findRange( functionCode, address, address + count - 1 ) == NULL)
+                return exceptionResponse( request, EXCEPTION_ILLEGAL_DATA_ADDRESS, response );
+
+            response[ len++ ] = count * 2;
+            for (int i = 0; i < count; i += 1) {
+                uint16_t value = readWord( sim, functionCode, address + i );
+                response[ len++ ] = (value >> 8);
+                response[ len++ ] = (value & 0xFF);
+            }
+            return len;
+
+        case 0x05:
+            //
+            //  count is really the value here: 0xFF00 on, 0x0000 off
+            if (count != 0xFF00 && count != 0x0000)
+                return exceptionResponse( request, EXCEPTION_ILLEGAL_DATA_VALUE, response );
+            if (findRange( 0x01, address, address ) == NULL)
+                return exceptionResponse( request, EXCEPTION_ILLEGAL_DATA_ADDRESS, response );
+            writeWord( sim, 0x01, address, (count == 0xFF00) );
+            memcpy( response, request, 6 );
+            return 6;
+
+        case 0x06:
+            if (findRange( 0x03, address, address ) == NULL)
+                return exceptionResponse( request, EXCEPTION_ILLEGAL_DATA_ADDRESS, response );
+            writeWord( sim, 0x03, address, count );
+            memcpy( response, request, 6 );
+            return 6;
+
+        case 0x0F:
+            if (count < 1 || request[ 6 ] != (count + 7) / 8)
+                return exceptionResponse( request, EXCEPTION_ILLEGAL_DATA_VALUE, response );
+            if (findRange( 0x01, address, address + count - 1 ) == NULL)
+                return exceptionResponse( request, EXCEPTION_ILLEGAL_DATA_ADDRESS, response );
+            for (int i = 0; i < count; i += 1)
+                writeWord( sim, 0x01, address + i, (request[ 7 + (i / 8) ] >> (i % 8)) & 0x01 );
+            memcpy( response, request, 6 );
+            return 6;
+
+        case 0x10:
+            if (count < 1 || count > 123 || request[ 6 ] != count * 2)
+                return exceptionResponse( request, EXCEPTION_ILLEGAL_DATA_VALUE, response );
+            if (findRange( 0x03, address, address + count - 1 ) == NULL)
+                return exceptionResponse( request, EXCEPTION_ILLEGAL_DATA_ADDRESS, response );
+            for (int i = 0; i < count; i += 1)
+                writeWord( sim, 0x03, address + i, (request[ 7 + (i * 2) ] << 8) | request[ 8 + (i * 2) ] );
+            memcpy( response, request, 6 );
+            return 6;
+
+        default:
+            return exceptionResponse( request, EXCEPTION_ILLEGAL_FUNCTION, response );
+    }
+}
+
+// -----------------------------------------------------------------------------
+static
+int exceptionResponse (const uint8_t *request, const int code, uint8_t *response)
+{
+    response[ 0 ] = request[ 0 ];
+    response[ 1 ] = request[ 1 ] | 0x80;
+    response[ 2 ] = code;
+    return 3;
+}
+
+// -----------------------------------------------------------------------------
+static
+const simRange_t *findRange (const int functionCode, const int first, const int last)
+{
+    for (size_t i = 0; i < sizeof( simRanges ) / sizeof( simRanges[ 0 ] ); i += 1) {
+        if (simRanges[ i ].functionCode == functionCode && simRanges[ i ].first <= first && last <= simRanges[ i ].last)
+            return &simRanges[ i ];
+    }
+
+    return NULL;
+}
+
+// -----------------------------------------------------------------------------
+static
+uint16_t *registerSlot (epsolarSimulator_t *sim, const int functionCode, const int address)
+{
+    //
+    //  Storage for every address in simRanges; anything else asserts
+    switch (functionCode) {
+        case 0x01:  assert( address < 0x20 );
+            return &sim->coils[ address ];
+        case 0x02:  assert( address >= 0x2000 && address < 0x2020 );
+            return &sim->discreteInputs[ address - 0x2000 ];
+        case 0x03:  assert( address >= 0x9000 && address < 0x9100 );
+            return &sim->holdingRegisters[ address - 0x9000 ];
+        default:    assert( address >= 0x3000 && address < 0x3400 );
+            return &sim->inputRegisters[ address - 0x3000 ];
+    }
+}
+
+// -----------------------------------------------------------------------------
+static
+uint16_t readWord (epsolarSimulator_t *sim, const int functionCode, const int address)
+{
+    //
+    //  The clock keeps ticking, everything else just sits there
+    if (functionCode == 0x03 && address >= 0x9013 && address <= 0x9015) {
+        time_t      now = time( NULL ) + sim->clockOffset;
+        struct tm   tm;
+
+        localtime_r( &now, &tm );
+        if (address == 0x9013)  return (tm.tm_min << 8) | tm.tm_sec;
+        if (address == 0x9014)  return (tm.tm_mday << 8) | tm.tm_hour;
+        return ((tm.tm_year % 100) << 8) | (tm.tm_mon + 1);
+    }
+
+    return *registerSlot( sim, functionCode, address );
+}
+
+// -----------------------------------------------------------------------------
+static
+void writeWord (epsolarSimulator_t *sim, const int functionCode, const int address, const uint16_t value)
+{
+    *registerSlot( sim, functionCode, address ) = value;
+
+    if (functionCode == 0x03 && address == 0x9015) {
+        //
+        //  Last word of a clock write - work out how far off our clock it is
+        struct tm   tm;
+        memset( &tm, '\0', sizeof tm );
+        tm.tm_sec = sim->holdingRegisters[ 0x13 ] & 0xFF;
+        tm.tm_min = sim->holdingRegisters[ 0x13 ] >> 8;
+        tm.tm_hour = sim->holdingRegisters[ 0x14 ] & 0xFF;
+        tm.tm_mday = sim->holdingRegisters[ 0x14 ] >> 8;
+        tm.tm_mon = (value & 0xFF) - 1;
+        tm.tm_year = (value >> 8) + 100;
+        tm.tm_isdst = -1;
+        sim->clockOffset = (long) (mktime( &tm ) - time( NULL ));
+    } else if (functionCode == 0x01 && address == 0x0002) {
+        //
+        //  Manual load control shows up in the discharging status
+        sim->inputRegisters[ 0x202 ] = (sim->inputRegisters[ 0x202 ] & ~0x0001) | (value ? 0x0001 : 0x0000);
+    } else if (functionCode == 0x01 && address == 0x0014 && value) {
+        //
+        //  Clear generating electricity statistics
+        memset( &sim->inputRegisters[ 0x304 ], '\0', (0x3314 - 0x3304) * sizeof( uint16_t ) );
+    }
+}
+
+// -----------------------------------------------------------------------------
+static
+void sendPaced (epsolarSimulator_t *sim, const uint8_t *response, const int len, struct timespec *when)
+{
+    //
+    //  Dribble the reply out a byte at a time at the configured baud rate,
+    //  starting at 'when', so the client's byte timeout sees a real line.
+    long perChar = charNanos( &sim->config );
+    int sent = 0;
+
+    while (sent < len) {
+        int chunk = 1;
+
+        addNanos( when, perChar );
+        if (perChar > 0) {
+            clock_nanosleep( CLOCK_MONOTONIC, TIMER_ABSTIME, when, NULL );
+
+            //
+            //  Sleeps are coarse - send whatever else has come due since
+            struct timespec now;
+            clock_gettime( CLOCK_MONOTONIC, &now );
+            while (sent + chunk < len) {
+                struct timespec next = *when;
+                addNanos( &next, perChar );
+                if (next.tv_sec > now.tv_sec || (next.tv_sec == now.tv_sec && next.tv_nsec > now.tv_nsec))
+                    break;
+                *when = next;
+                chunk += 1;
+            }
+        } else {
+            clock_nanosleep( CLOCK_MONOTONIC, TIMER_ABSTIME, when, NULL );
+            chunk = len;
+        }
+
+        int wrote = write( sim->masterFd, &response[ sent ], chunk );
+        if (wrote <= 0) {
+            Logger_LogError( "sendPaced - write failed: %s\n", strerror( errno ) );
+            return;
+        }
+        sent += wrote;
+    }
+
+    pthread_mutex_lock( &sim->lock );
+    sim->stats.bytesOut += len;
+    pthread_mutex_unlock( &sim->lock );
+}
+
+// -----------------------------------------------------------------------------
+static
+uint16_t crc16 (const uint8_t *buffer, const int len)
+{
+    uint16_t crc = 0xFFFF;
+
+    for (int i = 0; i < len; i += 1) {
+        crc ^= buffer[ i ];
+        for (int bit = 0; bit < 8; bit += 1)
+            crc = (crc & 0x0001) ? ((crc >> 1) ^ 0xA001) : (crc >> 1);
+    }
+
+    return crc;
+}
+
+// -----------------------------------------------------------------------------
+static
+long charNanos (const epsolarSimulatorConfig_t *config)
+{
+    if (config->baudRate <= 0)
+        return 0;
+    return (long) ((1000000000LL * config->bitsPerChar) / config->baudRate);
+}
+
+// -----------------------------------------------------------------------------
+static
+void addNanos (struct timespec *ts, const long long nanos)
+{
+    long long total = ts->tv_nsec + nanos;
+
+    ts->tv_sec += (total / 1000000000LL);
+    ts->tv_nsec = (total % 1000000000LL);
+}
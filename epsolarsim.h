@@ -0,0 +1,60 @@
+/*
+ */
+
+/*
+ * File:   epsolarsim.h
+ *
+ * A pretend Tracer charge controller on a pseudo terminal. It answers Modbus
+ *  RTU on the slave side of a pty using the same register map tracerseries.c
+ *  reads, and paces its replies like a real serial line would, so the library
+ *  can be exercised and benchmarked without hardware.
+ */
+
+#ifndef EPSOLARSIM_H
+#define EPSOLARSIM_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+
+typedef struct epsolarSimulatorConfig {
+    int     slaveId;                        // requests for anybody else are ignored
+    int     baudRate;                       // wire time per byte, 0 for no pacing
+    int     bitsPerChar;                    // 10 for 8N1 (start + 8 data + stop)
+    int     turnaroundMicros;               // controller "think time" before replying
+} epsolarSimulatorConfig_t;
+
+typedef struct epsolarSimulatorStats {
+    unsigned long   requests;               // well formed frames for our slave ID
+    unsigned long   exceptions;             // answered with an exception
+    unsigned long   crcErrors;              // dropped, no reply
+    unsigned long   ignored;                // other slave IDs, broadcasts, garbage
+    unsigned long   bytesIn;
+    unsigned long   bytesOut;
+} epsolarSimulatorStats_t;
+
+typedef struct epsolarSimulator epsolarSimulator_t;
+
+//
+// NULL config gets slave 1, 115200 baud 8N1 and a 2ms turnaround
+extern  epsolarSimulator_t  *epsolarSimulatorStart( const epsolarSimulatorConfig_t *config );
+extern  void        epsolarSimulatorStop( epsolarSimulator_t *simulator );
+extern  const char  *epsolarSimulatorGetPortName( const epsolarSimulator_t *simulator );
+extern  void        epsolarSimulatorGetStats( epsolarSimulator_t *simulator, epsolarSimulatorStats_t *stats );
+extern  void        epsolarSimulatorResetStats( epsolarSimulator_t *simulator );
+
+//
+// Poke values in behind the library's back. functionCode picks the table:
+//  0x01 coils, 0x02 discrete inputs, 0x03 holding and 0x04 input registers.
+extern  void        epsolarSimulatorSetRegister( epsolarSimulator_t *simulator, const int functionCode, const int address, const uint16_t value );
+extern  uint16_t    epsolarSimulatorGetRegister( epsolarSimulator_t *simulator, const int functionCode, const int address );
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* EPSOLARSIM_H */
@@ -0,0 +1,254 @@
+/*
+ * Status word transitions.
+ *
+ *  Subscribers name a status word (0x3200, 0x3201 or 0x3202) and a mask -
+ *  one fault bit, or a field like the charging stage in D3-D2 - and get
+ *  called when that field changes. Each snapshot costs one XOR per word
+ *  against the last one; only a word that actually changed gets its
+ *  subscriptions looked at, and only the ones whose mask overlaps the
+ *  change are called.
+ *
+ *  The first clean snapshot is compared against all-clear (zero), so a
+ *  fault that's already there when watching starts is reported rather than
+ *  taken for normal.
+ *
+ *  Subscribing and unsubscribing are safe from any thread. Callbacks run on
+ *  the thread calling epsolarStatusWatcherUpdate() - the poller's, normally -
+ *  without the watcher's lock held, so they can unsubscribe themselves.
+ *  Once epsolarStatusUnsubscribe() returns on any other thread the callback
+ *  is done with - it waits out every update that was already dispatching -
+ *  so the caller can free userData straight away.
+ */
+#include <assert.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "log4c.h"
+#include "libepsolar.h"
+
+
+typedef struct subscription {
+    int             id;                         // zero is a free slot
+    int             word;
+    uint16_t        mask;
+    epsolarStatusCallback_t callback;
+    void            *userData;
+} subscription_t;
+
+struct epsolarStatusWatcher {
+    pthread_mutex_t lock;
+    pthread_cond_t  dispatchDone;               // signalled as dispatching drops to zero
+    int             dispatching;                // updates calling back right now
+    int             nextId;
+    uint16_t        lastBits[ TRACER_NUM_STATUS_WORDS ];
+    int             numSubscriptions;
+    subscription_t  subscriptions[ EPSOLAR_MAX_STATUS_SUBSCRIPTIONS ];
+};
+
+
+static  int         isSubscribed( epsolarStatusWatcher_t *watcher, const int id );
+static  uint16_t    fieldValue( const uint16_t bits, const uint16_t mask );
+
+//
+// The watcher this thread is calling back from, if any - an unsubscribe from
+//  inside a callback mustn't wait for its own update to finish
+static __thread epsolarStatusWatcher_t  *dispatchingWatcher = NULL;
+
+
+
+// -----------------------------------------------------------------------------
+epsolarStatusWatcher_t  *epsolarStatusWatcherNew (void)
+{
+    epsolarStatusWatcher_t *watcher = calloc( 1, sizeof( epsolarStatusWatcher_t ) );
+    if (watcher == NULL) {
+        Logger_LogError( "epsolarStatusWatcherNew - unable to allocate a watcher\n" );
+        return NULL;
+    }
+
+    pthread_mutex_init( &watcher->lock, NULL );
+    pthread_cond_init( &watcher->dispatchDone, NULL );
+    watcher->nextId = 1;
+    return watcher;
+}
+
+// -----------------------------------------------------------------------------
+void    epsolarStatusWatcherFree (epsolarStatusWatcher_t *watcher)
+{
+    if (watcher == NULL)
+        return;
+
+    pthread_cond_destroy( &watcher->dispatchDone );
+    pthread_mutex_destroy( &watcher->lock );
+    free( watcher );
+}
+
+// -----------------------------------------------------------------------------
+int     epsolarStatusSubscribe (epsolarStatusWatcher_t *watcher, const int word, const uint16_t mask, epsolarStatusCallback_t callback, void *userData)
+{
+    //
+    //  Returns an id for epsolarStatusUnsubscribe(), or zero if the table's full
+    int     id = 0;
+
+    assert( watcher != NULL );
+    assert( word >= 0 && word < TRACER_NUM_STATUS_WORDS );
+    assert( mask != 0 );
+    assert( callback != NULL );
+
+    pthread_mutex_lock( &watcher->lock );
+    for (int i = 0; i < EPSOLAR_MAX_STATUS_SUBSCRIPTIONS; i += 1) {
+        subscription_t *sub = &watcher->subscriptions[ i ];
+        if (sub->id != 0)
+            continue;
+
+        id = watcher->nextId++;
+        sub->id = id;
+        sub->word = word;
+        sub->mask = mask;
+        sub->callback = callback;
+        sub->userData = userData;
+        if (i >= watcher->numSubscriptions)
+            watcher->numSubscriptions = i + 1;
+        break;
+    }
+    pthread_mutex_unlock( &watcher->lock );
+
+    if (id == 0)
+        Logger_LogError( "epsolarStatusSubscribe - all %d subscriptions are taken\n", EPSOLAR_MAX_STATUS_SUBSCRIPTIONS );
+    return id;
+}
+
+// -----------------------------------------------------------------------------
+void    epsolarStatusUnsubscribe (epsolarStatusWatcher_t *watcher, const int id)
+{
+    assert( watcher != NULL );
+
+    pthread_mutex_lock( &watcher->lock );
+    for (int i = 0; i < watcher->numSubscriptions; i += 1) {
+        if (watcher->subscriptions[ i ].id == id) {
+            memset( &watcher->subscriptions[ i ], '\0', sizeof( subscription_t ) );
+            break;
+        }
+    }
+
+    //
+    //  An update that copied the subscription before we cleared it may still
+    //  be about to call it. Wait for those to finish, unless we're being
+    //  called from one of its callbacks.
+    if (dispatchingWatcher != watcher) {
+        while (watcher->dispatching > 0)
+            pthread_cond_wait( &watcher->dispatchDone, &watcher->lock );
+    }
+    pthread_mutex_unlock( &watcher->lock );
+}
+
+// -----------------------------------------------------------------------------
+void    epsolarStatusWatcherUpdate (epsolarStatusWatcher_t *watcher, const epsolarRealTimeData_t *rtData, const int64_t timeMillis)
+{
+    //
+    //  Snapshots that didn't read cleanly are skipped - zeros from a timeout
+    //  would look like every fault clearing at once
+    subscription_t  due[ EPSOLAR_MAX_STATUS_SUBSCRIPTIONS ];
+    epsolarStatusEvent_t    event;
+    uint16_t        bits[ TRACER_NUM_STATUS_WORDS ];
+    uint16_t        changed[ TRACER_NUM_STATUS_WORDS ];
+    int             numDue = 0;
+
+    assert( watcher != NULL );
+    assert( rtData != NULL );
+
+    if (rtData->readStatus != TRACER_STATUS_OK)
+        return;
+
+    bits[ TRACER_WORD_BATTERY_STATUS ] = rtData->batteryStatusBits;
+    bits[ TRACER_WORD_CHARGING_STATUS ] = rtData->controllerStatusBits;
+    bits[ TRACER_WORD_DISCHARGING_STATUS ] = rtData->dischargingStatusBits;
+
+    pthread_mutex_lock( &watcher->lock );
+    int anyChanged = FALSE;
+    for (int w = 0; w < TRACER_NUM_STATUS_WORDS; w += 1) {
+        changed[ w ] = bits[ w ] ^ watcher->lastBits[ w ];
+        anyChanged |= (changed[ w ] != 0);
+    }
+
+    if (anyChanged) {
+        for (int i = 0; i < watcher->numSubscriptions; i += 1) {
+            const subscription_t *sub = &watcher->subscriptions[ i ];
+            if (sub->id != 0 && (changed[ sub->word ] & sub->mask) != 0)
+                due[ numDue++ ] = *sub;
+        }
+    }
+
+    memcpy( event.oldBits, watcher->lastBits, sizeof( event.oldBits ) );
+    memcpy( watcher->lastBits, bits, sizeof( watcher->lastBits ) );
+    if (numDue > 0)
+        watcher->dispatching += 1;
+    pthread_mutex_unlock( &watcher->lock );
+
+    if (numDue == 0)
+        return;
+
+    epsolarStatusWatcher_t *outerWatcher = dispatchingWatcher;
+    dispatchingWatcher = watcher;
+
+    memcpy( event.newBits, bits, sizeof( event.newBits ) );
+    event.timeMillis = timeMillis;
+    for (int i = 0; i < numDue; i += 1) {
+        //
+        //  A callback earlier in this pass may have unsubscribed a later one
+        if (!isSubscribed( watcher, due[ i ].id ))
+            continue;
+
+        event.word = due[ i ].word;
+        event.mask = due[ i ].mask;
+        event.oldValue = fieldValue( event.oldBits[ event.word ], event.mask );
+        event.newValue = fieldValue( event.newBits[ event.word ], event.mask );
+        due[ i ].callback( &event, due[ i ].userData );
+    }
+
+    dispatchingWatcher = outerWatcher;
+
+    pthread_mutex_lock( &watcher->lock );
+    watcher->dispatching -= 1;
+    if (watcher->dispatching == 0)
+        pthread_cond_broadcast( &watcher->dispatchDone );
+    pthread_mutex_unlock( &watcher->lock );
+}
+
+// -----------------------------------------------------------------------------
+uint16_t    epsolarStatusWatcherGet (epsolarStatusWatcher_t *watcher, const int word)
+{
+    //
+    //  The word as of the last clean snapshot
+    uint16_t    bits;
+
+    assert( watcher != NULL );
+    assert( word >= 0 && word < TRACER_NUM_STATUS_WORDS );
+
+    pthread_mutex_lock( &watcher->lock );
+    bits = watcher->lastBits[ word ];
+    pthread_mutex_unlock( &watcher->lock );
+    return bits;
+}
+
+// -----------------------------------------------------------------------------
+static
+int     isSubscribed (epsolarStatusWatcher_t *watcher, const int id)
+{
+    int     found = FALSE;
+
+    pthread_mutex_lock( &watcher->lock );
+    for (int i = 0; i < watcher->numSubscriptions && !found; i += 1)
+        found = (watcher->subscriptions[ i ].id == id);
+    pthread_mutex_unlock( &watcher->lock );
+    return found;
+}
+
+// -----------------------------------------------------------------------------
+static
+uint16_t    fieldValue (const uint16_t bits, const uint16_t mask)
+{
+    //
+    //  The field shifted down - 0..3 for the charging stage, 0/1 for a flag
+    return (uint16_t) ((bits & mask) >> __builtin_ctz( mask ));
+}
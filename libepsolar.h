@@ -58,14 +58,130 @@ typedef struct  epsolarRealTimeData {
     
     int     isNightTime;                    
     char    controllerClock[ 20 ];           // dd/mm/yy hh:mm:ss    18 chars w/ NULL
+
+    int     readStatus;                     // tracerStatus_t - anything but OK and some fields hold bad read values
+    uint16_t    batteryStatusBits;          // 0x3200 - controllerStatusBits above is 0x3201
+    uint16_t    dischargingStatusBits;      // 0x3202
+    tracerDecodedStatus_t   status;         // all three words above, decoded
 } epsolarRealTimeData_t;
 
 
+//
+// The same snapshot as the registers hold it - centi-units (V, A, W, kWh and
+//  degrees C times 100), status words untouched, no strings - in 88 bytes
+//  rather than the ~300 of epsolarRealTimeData_t. For capturing at a high
+//  rate or storing; the epsolarRaw*() accessors below convert a field when
+//  it's wanted. A request that failed leaves its fields zero and shows up in
+//  readStatus. tracerDecodeStatus() and decodeRealtimeClockStr() take the
+//  status words and the clock as they are.
+typedef struct epsolarRawSnapshot {
+    int64_t     timeMillis;                 // epsolarNowMillis() when the reads finished
+
+    uint32_t    pvPower;                    // 0x3102
+    uint32_t    loadPower;                  // 0x310E
+    int32_t     batteryCurrent;             // 0x331B   negative while discharging
+    uint32_t    energyConsumedToday;        // 0x3304
+    uint32_t    energyConsumedMonth;
+    uint32_t    energyConsumedYear;
+    uint32_t    energyConsumedTotal;
+    uint32_t    energyGeneratedToday;       // 0x330C
+    uint32_t    energyGeneratedMonth;
+    uint32_t    energyGeneratedYear;
+    uint32_t    energyGeneratedTotal;
+
+    uint16_t    pvVoltage;                  // 0x3100
+    uint16_t    pvCurrent;                  // 0x3101
+    uint16_t    loadVoltage;                // 0x310C
+    uint16_t    loadCurrent;                // 0x310D
+    int16_t     batteryTemperature;         // 0x3110
+    int16_t     controllerTemp;             // 0x3111
+    uint16_t    batteryStateOfCharge;       // 0x311A   percent, not scaled
+    uint16_t    batteryVoltage;             // 0x331A
+    uint16_t    batteryMaxVoltage;          // 0x3302
+    uint16_t    batteryMinVoltage;          // 0x3303
+
+    uint16_t    batteryStatusBits;          // 0x3200
+    uint16_t    controllerStatusBits;       // 0x3201
+    uint16_t    dischargingStatusBits;      // 0x3202
+    uint16_t    clock[ 3 ];                 // 0x9013..0x9015
+    uint16_t    loadControlMode;            // 0x903D
+
+    uint8_t     isNightTime;                // 0x200C
+    int8_t      readStatus;                 // tracerStatus_t
+} epsolarRawSnapshot_t;
+
+static inline double epsolarRawScaled( const int64_t centiUnits )      { return (double) centiUnits / 100.0; }
+static inline double epsolarRawPVVoltage( const epsolarRawSnapshot_t *raw )        { return epsolarRawScaled( raw->pvVoltage ); }
+static inline double epsolarRawPVCurrent( const epsolarRawSnapshot_t *raw )        { return epsolarRawScaled( raw->pvCurrent ); }
+static inline double epsolarRawPVPower( const epsolarRawSnapshot_t *raw )          { return epsolarRawScaled( raw->pvPower ); }
+static inline double epsolarRawBatteryVoltage( const epsolarRawSnapshot_t *raw )   { return epsolarRawScaled( raw->batteryVoltage ); }
+static inline double epsolarRawBatteryCurrent( const epsolarRawSnapshot_t *raw )   { return epsolarRawScaled( raw->batteryCurrent ); }
+static inline double epsolarRawLoadVoltage( const epsolarRawSnapshot_t *raw )      { return epsolarRawScaled( raw->loadVoltage ); }
+static inline double epsolarRawLoadCurrent( const epsolarRawSnapshot_t *raw )      { return epsolarRawScaled( raw->loadCurrent ); }
+static inline double epsolarRawLoadPower( const epsolarRawSnapshot_t *raw )        { return epsolarRawScaled( raw->loadPower ); }
+static inline double epsolarRawCelsius( const int16_t centiDegrees )               { return epsolarRawScaled( centiDegrees ); }
+static inline double epsolarRawFahrenheit( const int16_t centiDegrees )            { return (epsolarRawScaled( centiDegrees ) * 9.0 / 5.0) + 32.0; }
+static inline int    epsolarRawLoadIsOn( const epsolarRawSnapshot_t *raw )         { return (raw->dischargingStatusBits & TRACER_DCHG_RUNNING) != 0; }
+static inline int    epsolarRawHasFault( const epsolarRawSnapshot_t *raw )
+{
+    //
+    //  Any fault bit in any of the three words, without decoding them - the
+    //  same answer as anyFault from tracerDecodeStatus()
+    return ((raw->batteryStatusBits & TRACER_BATT_FAULTS) != 0 ||
+            (raw->batteryStatusBits & TRACER_BATT_VOLTAGE_STATUS) >= TRACER_BATT_FAULT ||
+            ((raw->batteryStatusBits & TRACER_BATT_TEMPERATURE_STATUS) >> 4) > TRACER_TEMP_LOW ||
+            (raw->controllerStatusBits & TRACER_CHG_FAULTS) != 0 ||
+            (raw->dischargingStatusBits & TRACER_DCHG_FAULTS) != 0);
+}
+
+
 typedef struct epsolarBatteryData {
     
 } epsolarBatteryData_t;
 
 
+//
+// How a controller is reached, picked by its portName: a serial device,
+//  "tcp://host[:port]" for Modbus TCP, or "rtu+tcp://host[:port]" for an RS485
+//  gateway that passes RTU frames through a socket as they are.
+typedef enum {
+    EPSOLAR_TRANSPORT_RTU = 0,
+    EPSOLAR_TRANSPORT_TCP,
+    EPSOLAR_TRANSPORT_RTU_OVER_TCP
+} epsolarTransport_t;
+
+#define EPSOLAR_DEFAULT_TCP_PORT        502
+#define EPSOLAR_DEFAULT_KEEPALIVE       10              // seconds idle before the first probe
+
+typedef struct epsolarTcpBridge epsolarTcpBridge_t;
+
+//
+// One of these per charge controller. It owns the port settings and the
+//  libmodbus context, and the context gets its own bus lock and read cache
+//  (tracerAttachContext) so controllers on separate adapters don't take turns.
+//  epsolarModbusConnect(), the epsolarSetDefault*() calls and the eps_* macros
+//  all work on a built in default controller.
+typedef struct epsolarController {
+    char        portName[ 128 ];
+    int         baudRate;                   // the RS485 side, for a gateway
+    char        parity;
+    int         dataBits;
+    int         stopBits;
+    int         slaveNumber;                // the unit ID over Modbus TCP
+    int         useBlockReads;
+    int         adaptiveTimeouts;           // timeouts follow the measured round trips
+    modbus_t    *ctx;                       // NULL until connected
+
+    int         transport;                  // epsolarTransport_t, from portName at connect time
+    int         keepaliveSeconds;           // network transports, 0 for EPSOLAR_DEFAULT_KEEPALIVE
+    int         needsReconnect;             // a Modbus TCP read hit an I/O error - these three
+    int         reconnectBackoffMillis;     //  only under the context's bus lock
+    int64_t     nextReconnectMillis;        // epsolarMonotonicMillis()
+    epsolarTcpBridge_t  *bridge;            // rtu+tcp:// only
+    int         pipelineDepth;              // Modbus TCP requests in flight at once, 0 or 1 is off
+} epsolarController_t;
+
+
 extern  char        *epsolarGetVersion( void );
 extern  int         epsolarModbusConnect( const char *portName, const int slaveNumber );
 extern  int         epsolarModbusDisconnect( void );
@@ -81,8 +197,324 @@ extern  void        epsolarSetDefaultDataBits( const int newBits );
 extern  const int   epsolarGetStopBits( void );
 extern  void        epsolarSetDefaultStopBits( const int newBits );
 extern  void        epsolarGetRealTimeData( epsolarRealTimeData_t *rtData );
+extern  void        epsolarGetRawSnapshot( epsolarRawSnapshot_t *raw );
+extern  void        epsolarSetBlockReads( const int enable );
+extern  int         epsolarGetBlockReads( void );
+extern  void        epsolarSetAdaptiveTimeouts( const int enable );
+extern  int         epsolarGetAdaptiveTimeouts( void );
 extern  char        *findController( const char *deviceNameBase, int maxDevNum, const int leaveOpen );
 
+extern  epsolarController_t *epsolarControllerNew( const char *portName, const int baudRate, const char parity, const int dataBits, const int stopBits, const int slaveNumber );
+extern  void        epsolarControllerFree( epsolarController_t *controller );
+extern  int         epsolarControllerConnect( epsolarController_t *controller );
+extern  int         epsolarControllerDisconnect( epsolarController_t *controller );
+extern  modbus_t    *epsolarControllerGetContext( const epsolarController_t *controller );
+extern  void        epsolarControllerGetRealTimeData( epsolarController_t *controller, epsolarRealTimeData_t *rtData );
+extern  void        epsolarControllerGetRawSnapshot( epsolarController_t *controller, epsolarRawSnapshot_t *raw );
+extern  void        epsolarControllerSetAdaptiveTimeouts( epsolarController_t *controller, const int enable );
+extern  void        epsolarControllerSetPipelining( epsolarController_t *controller, const int maxInFlight );
+extern  epsolarController_t *epsolarGetDefaultController( void );
+extern  int         epsolarControllerReconnect( epsolarController_t *controller );
+extern  float       epsolarMetricValue( const epsolarRealTimeData_t *rtData, const int metric );
+extern  uint8_t     epsolarSnapshotFlags( const epsolarRealTimeData_t *rtData );
+extern  int64_t     epsolarNowMillis( void );           // wall clock, can step
+extern  int64_t     epsolarMonotonicMillis( void );     // CLOCK_MONOTONIC, for intervals
+
+//
+// Network transports. epsolarControllerConnect() does all this given a
+//  tcp:// or rtu+tcp:// portName; these are the pieces. A bridge gives
+//  libmodbus a pty to open as its serial port and carries the bytes to and
+//  from the gateway, reconnecting on its own when the gateway goes away.
+extern  int         epsolarParsePortName( const char *portName, char *host, const size_t hostSize, int *tcpPort );
+extern  int         epsolarSetKeepalive( const int fd, const int idleSeconds );
+extern  epsolarTcpBridge_t  *epsolarTcpBridgeStart( const char *host, const int tcpPort, const int keepaliveSeconds );
+extern  void        epsolarTcpBridgeStop( epsolarTcpBridge_t *bridge );
+extern  const char  *epsolarTcpBridgeGetPortName( const epsolarTcpBridge_t *bridge );
+extern  int         epsolarTcpBridgeIsConnected( epsolarTcpBridge_t *bridge );
+
+//
+// Controller discovery. Every candidate device is probed on its own thread, at
+//  each baud rate in turn, for each slave ID, with a short response timeout.
+//  Give either an explicit list of portNames or a deviceNameBase plus
+//  maxDevNum ("/dev/ttyACM" and 3 tries ttyACM0..ttyACM3). Zeroed fields get
+//  the defaults: slave 1, 115200 8N1 and EPSOLAR_DEFAULT_PROBE_TIMEOUT.
+#define EPSOLAR_MAX_FOUND               32
+#define EPSOLAR_DEFAULT_PROBE_TIMEOUT   100000L         // microseconds
+
+typedef struct epsolarProbeConfig {
+    const char  *deviceNameBase;
+    int         maxDevNum;
+    const char  **portNames;                // overrides deviceNameBase when set
+    int         numPortNames;
+    const int   *slaveIds;
+    int         numSlaveIds;
+    const int   *baudRates;                 // tried in order, first one that answers wins
+    int         numBaudRates;
+    char        parity;
+    int         dataBits;
+    int         stopBits;
+    long        probeTimeoutMicros;
+} epsolarProbeConfig_t;
+
+typedef struct epsolarFoundController {
+    char        portName[ 64 ];
+    int         baudRate;
+    char        parity;
+    int         dataBits;
+    int         stopBits;
+    int         slaveId;
+} epsolarFoundController_t;
+
+extern  int         epsolarFindControllers( const epsolarProbeConfig_t *config, epsolarFoundController_t *found, const int maxFound );
+
+//
+// The same, remembered across restarts. The state file holds the last
+//  controller found and its rated data as a fingerprint; if that controller
+//  still answers with the same fingerprint the scan is skipped altogether.
+//  findController() uses one when epsolarSetDiscoveryStateFile() names it.
+extern  int         epsolarFindControllerCached( const char *stateFile, const epsolarProbeConfig_t *config, epsolarFoundController_t *found );
+extern  void        epsolarSetDiscoveryStateFile( const char *stateFile );
+
+//
+// History. A preallocated ring of samples kept one array per metric, so a
+//  window query is a straight scan down one column. Put one in a poller's
+//  sinks and every snapshot lands in it with no allocation; one writer, any
+//  number of lock free readers.
+typedef enum {
+    EPSOLAR_METRIC_PV_VOLTAGE = 0,
+    EPSOLAR_METRIC_PV_CURRENT,
+    EPSOLAR_METRIC_PV_POWER,
+    EPSOLAR_METRIC_BATTERY_VOLTAGE,
+    EPSOLAR_METRIC_BATTERY_CURRENT,
+    EPSOLAR_METRIC_BATTERY_SOC,
+    EPSOLAR_METRIC_BATTERY_MAX_VOLTAGE,
+    EPSOLAR_METRIC_BATTERY_MIN_VOLTAGE,
+    EPSOLAR_METRIC_BATTERY_TEMPERATURE,
+    EPSOLAR_METRIC_LOAD_VOLTAGE,
+    EPSOLAR_METRIC_LOAD_CURRENT,
+    EPSOLAR_METRIC_LOAD_POWER,
+    EPSOLAR_METRIC_CONTROLLER_TEMP,
+    EPSOLAR_METRIC_ENERGY_GENERATED_TODAY,
+    EPSOLAR_METRIC_ENERGY_GENERATED_TOTAL,
+    EPSOLAR_METRIC_ENERGY_CONSUMED_TODAY,
+    EPSOLAR_METRIC_ENERGY_CONSUMED_TOTAL,
+    EPSOLAR_METRIC_COUNT
+} epsolarMetric_t;
+
+typedef struct epsolarHistory epsolarHistory_t;
+
+typedef struct epsolarHistoryStats {
+    int         count;                      // samples that went in
+    double      minimum;
+    double      maximum;
+    double      mean;
+} epsolarHistoryStats_t;
+
+extern  epsolarHistory_t    *epsolarHistoryNew( const int capacity );
+extern  void        epsolarHistoryFree( epsolarHistory_t *history );
+extern  void        epsolarHistoryAppend( epsolarHistory_t *history, const epsolarRealTimeData_t *rtData, const int64_t timeMillis );
+extern  unsigned long   epsolarHistoryCount( epsolarHistory_t *history );
+extern  int         epsolarHistoryWindow( epsolarHistory_t *history, const int metric, const int64_t fromMillis, const int64_t toMillis, epsolarHistoryStats_t *stats );
+extern  int         epsolarHistoryCopy( epsolarHistory_t *history, const int metric, const int64_t fromMillis, const int64_t toMillis,
+                                int64_t *timeMillis, float *values, const int maxSamples );
+extern  const char  *epsolarMetricName( const int metric );
+
+//
+// Binary sample log. epsolarRecorder_t appends one fixed width record per
+//  snapshot to a memory mapped file, with a checkpoint in the header every so
+//  many records. epsolarLogReader_t maps the same file read only and hands
+//  out the records in place - no parsing, no copying.
+#define EPSOLAR_LOG_LOAD_ON             0x01
+#define EPSOLAR_LOG_NIGHT               0x02
+#define EPSOLAR_LOG_CHARGER_RUNNING     0x04
+#define EPSOLAR_LOG_CHARGER_NORMAL      0x08
+
+typedef struct epsolarLogRecord {
+    int64_t     monotonicNanos;             // CLOCK_MONOTONIC - for spacing, resets with the machine
+    int64_t     wallMillis;                 // what epsolarLogReaderSeek() goes by
+    uint32_t    sequence;                   // record number + 1, zero past the end
+    uint16_t    controllerStatusBits;
+    uint8_t     readStatus;                 // tracerStatus_t
+    uint8_t     flags;                      // EPSOLAR_LOG_*
+    float       values[ EPSOLAR_METRIC_COUNT ];     // indexed by epsolarMetric_t
+    uint32_t    reserved;
+} epsolarLogRecord_t;
+
+typedef struct epsolarRecorder epsolarRecorder_t;
+typedef struct epsolarLogReader epsolarLogReader_t;
+
+extern  epsolarRecorder_t   *epsolarRecorderOpen( const char *fileName, const int checkpointEvery );
+extern  int         epsolarRecorderAppend( epsolarRecorder_t *recorder, const epsolarRealTimeData_t *rtData, const int64_t wallMillis );
+extern  void        epsolarRecorderSync( epsolarRecorder_t *recorder );
+extern  uint64_t    epsolarRecorderCount( const epsolarRecorder_t *recorder );
+extern  void        epsolarRecorderClose( epsolarRecorder_t *recorder );
+
+extern  epsolarLogReader_t  *epsolarLogReaderOpen( const char *fileName );
+extern  int         epsolarLogReaderRefresh( epsolarLogReader_t *reader );
+extern  const epsolarLogRecord_t    *epsolarLogReaderRecords( const epsolarLogReader_t *reader, uint64_t *numRecords );
+extern  uint64_t    epsolarLogReaderSeek( const epsolarLogReader_t *reader, const int64_t wallMillis );
+extern  void        epsolarLogReaderClose( epsolarLogReader_t *reader );
+
+//
+// Compressed blocks of log records for long term storage. Timestamps, the
+//  sequence and the energy counters are delta-of-delta coded, the other
+//  readings XOR coded against the previous sample. Lossless apart from
+//  'reserved'. Up to EPSOLAR_CODEC_MAX_RECORDS records a block.
+#define EPSOLAR_CODEC_MAX_RECORDS       1024
+
+extern  size_t      epsolarCodecMaxEncodedSize( const int numRecords );
+extern  size_t      epsolarCodecEncode( const epsolarLogRecord_t *records, const int numRecords, uint8_t *out, const size_t outSize );
+extern  int         epsolarCodecDecode( const uint8_t *in, const size_t inSize, epsolarLogRecord_t *records, const int maxRecords );
+
+//
+// Rollups. Every snapshot fed in updates a min/max/mean/last bucket per metric
+//  at each resolution, in constant time, so a month long chart reads a few
+//  hundred buckets instead of millions of samples. Buckets are preallocated
+//  rings; days are UTC days.
+typedef enum {
+    EPSOLAR_ROLLUP_SECOND = 0,
+    EPSOLAR_ROLLUP_MINUTE,
+    EPSOLAR_ROLLUP_HOUR,
+    EPSOLAR_ROLLUP_DAY,
+    EPSOLAR_ROLLUP_LEVELS
+} epsolarRollupLevel_t;
+
+typedef struct epsolarRollup epsolarRollup_t;
+
+typedef struct epsolarRollupPoint {
+    int64_t     startMillis;                // start of the bucket
+    int         count;                      // samples in it
+    float       minimum;
+    float       maximum;
+    float       mean;
+    float       last;
+} epsolarRollupPoint_t;
+
+extern  epsolarRollup_t *epsolarRollupNew( const int *bucketsPerLevel );
+extern  void        epsolarRollupFree( epsolarRollup_t *rollup );
+extern  void        epsolarRollupAdd( epsolarRollup_t *rollup, const epsolarRealTimeData_t *rtData, const int64_t timeMillis );
+extern  int         epsolarRollupQuery( epsolarRollup_t *rollup, const int level, const int metric, const int64_t fromMillis, const int64_t toMillis,
+                                epsolarRollupPoint_t *points, const int maxPoints );
+extern  int64_t     epsolarRollupBucketMillis( const int level );
+
+//
+// Change detection. Only the fields that moved further than their deadband
+//  since they were last sent come out - bit 'metric' of changedMask set and
+//  the values packed in bit order - plus a full keyframe every keyframeEvery
+//  snapshots. A field's deadband is the larger of absolute[] and relative[]
+//  times the last value sent; zero for both means any change at all.
+#define EPSOLAR_CHANGE_STATUS_BITS      (1u << EPSOLAR_METRIC_COUNT)
+#define EPSOLAR_CHANGE_FLAGS            (1u << (EPSOLAR_METRIC_COUNT + 1))
+
+typedef struct epsolarChangeConfig {
+    float       absolute[ EPSOLAR_METRIC_COUNT ];
+    float       relative[ EPSOLAR_METRIC_COUNT ];
+    int         keyframeEvery;              // snapshots, zero only the first
+} epsolarChangeConfig_t;
+
+typedef struct epsolarChange {
+    int64_t     timeMillis;
+    int         isKeyframe;
+    uint32_t    changedMask;                // 1 << metric, EPSOLAR_CHANGE_*
+    int         numValues;
+    float       values[ EPSOLAR_METRIC_COUNT ];     // just the changed metrics, lowest bit first
+    uint16_t    controllerStatusBits;       // always current, flagged when changed
+    uint8_t     flags;                      // EPSOLAR_LOG_*, the same
+} epsolarChange_t;
+
+typedef struct epsolarChangeDetector epsolarChangeDetector_t;
+
+extern  void        epsolarChangeDefaultConfig( epsolarChangeConfig_t *config );
+extern  epsolarChangeDetector_t *epsolarChangeDetectorNew( const epsolarChangeConfig_t *config );
+extern  void        epsolarChangeDetectorFree( epsolarChangeDetector_t *detector );
+extern  void        epsolarChangeForceKeyframe( epsolarChangeDetector_t *detector );
+extern  int         epsolarChangeDetect( epsolarChangeDetector_t *detector, const epsolarRealTimeData_t *rtData, const int64_t timeMillis, epsolarChange_t *change );
+
+//
+// Status word transitions. Subscribe to a bit or a field of 0x3200, 0x3201
+//  or 0x3202 (the TRACER_BATT_*, TRACER_CHG_* and TRACER_DCHG_* masks) and
+//  the callback runs when that field changes - each word is compared once
+//  per snapshot, not once per subscriber. Words are named by
+//  tracerStatusWord_t (TRACER_WORD_*). epsolarStatusUnsubscribe() waits for
+//  any update that's calling back to finish, so once it returns the callback
+//  won't run again and userData can go - except from inside a callback, which
+//  can't wait on itself and so doesn't.
+#define EPSOLAR_MAX_STATUS_SUBSCRIPTIONS    64
+
+typedef struct epsolarStatusEvent {
+    int64_t     timeMillis;
+    int         word;                       // tracerStatusWord_t
+    uint16_t    mask;                       // as subscribed
+    uint16_t    oldValue;                   // the field, shifted down
+    uint16_t    newValue;
+    uint16_t    oldBits[ TRACER_NUM_STATUS_WORDS ]; // all three words, before and after
+    uint16_t    newBits[ TRACER_NUM_STATUS_WORDS ];
+} epsolarStatusEvent_t;
+
+typedef void    (*epsolarStatusCallback_t)( const epsolarStatusEvent_t *event, void *userData );
+typedef struct epsolarStatusWatcher epsolarStatusWatcher_t;
+
+extern  epsolarStatusWatcher_t  *epsolarStatusWatcherNew( void );
+extern  void        epsolarStatusWatcherFree( epsolarStatusWatcher_t *watcher );
+extern  int         epsolarStatusSubscribe( epsolarStatusWatcher_t *watcher, const int word, const uint16_t mask, epsolarStatusCallback_t callback, void *userData );
+extern  void        epsolarStatusUnsubscribe( epsolarStatusWatcher_t *watcher, const int id );
+extern  void        epsolarStatusWatcherUpdate( epsolarStatusWatcher_t *watcher, const epsolarRealTimeData_t *rtData, const int64_t timeMillis );
+extern  uint16_t    epsolarStatusWatcherGet( epsolarStatusWatcher_t *watcher, const int word );
+
+//
+// Optional background acquisition. A thread refreshes a controller's real time
+//  data every intervalMillis, and epsolarPollerGetSnapshot() hands back a copy
+//  of the latest complete snapshot without waiting on the bus or a lock.
+//  Anything set in epsolarPollerSinks_t gets every snapshot as well, stamped
+//  with the wall clock held so it never goes backwards - after the time is
+//  set back the stamps stay put until the clock catches up. The poller is
+//  then the sinks' one writer.
+typedef struct epsolarPoller epsolarPoller_t;
+
+typedef struct epsolarPollerSinks {
+    epsolarHistory_t    *history;
+    epsolarRecorder_t   *recorder;
+    epsolarRollup_t     *rollup;
+    epsolarChangeDetector_t *changes;       // onChange() gets what it lets through
+    void                (*onChange)( const epsolarChange_t *change, void *userData );
+    void                *userData;
+    epsolarStatusWatcher_t  *statusWatcher;
+} epsolarPollerSinks_t;
+
+extern  epsolarPoller_t *epsolarPollerStart( epsolarController_t *controller, const int intervalMillis );
+extern  epsolarPoller_t *epsolarPollerStartWithSinks( epsolarController_t *controller, const int intervalMillis, const epsolarPollerSinks_t *sinks );
+extern  void        epsolarPollerStop( epsolarPoller_t *poller );
+extern  unsigned int    epsolarPollerGetSnapshot( epsolarPoller_t *poller, epsolarRealTimeData_t *rtData );
+
+//
+// Many controllers at once: N RS485 buses, each with up to M controllers daisy
+//  chained on it. One I/O thread per bus, slaves on a bus polled round robin
+//  with adaptive timeouts. A slave that times out is skipped for 1, 2, 4...
+//  up to 64 rounds, and its snapshot keeps saying so until it answers again.
+//  Snapshots are read the same lock free way as the poller's.
+#define EPSOLAR_MAX_BUSES               16
+#define EPSOLAR_MAX_SLAVES_PER_BUS      32
+
+typedef struct epsolarScheduler epsolarScheduler_t;
+
+typedef struct epsolarSchedulerStats {
+    int             busesRunning;
+    int             controllers;                // on the running buses
+    int             controllersBackedOff;       // timing out, polled every few rounds
+    unsigned long   snapshots;                  // since epsolarSchedulerStart()
+    double          elapsedSeconds;
+    double          snapshotsPerSecond;         // aggregate across every bus
+} epsolarSchedulerStats_t;
+
+extern  epsolarScheduler_t  *epsolarSchedulerNew( void );
+extern  int         epsolarSchedulerAddBus( epsolarScheduler_t *scheduler, const char *portName, const int baudRate, const char parity,
+                                            const int dataBits, const int stopBits, const int *slaveIds, const int numSlaves );
+extern  int         epsolarSchedulerStart( epsolarScheduler_t *scheduler, const int intervalMillis );
+extern  void        epsolarSchedulerStop( epsolarScheduler_t *scheduler );
+extern  void        epsolarSchedulerFree( epsolarScheduler_t *scheduler );
+extern  unsigned int    epsolarSchedulerGetSnapshot( epsolarScheduler_t *scheduler, const int busNumber, const int slaveId, epsolarRealTimeData_t *rtData );
+extern  void        epsolarSchedulerGetStats( epsolarScheduler_t *scheduler, epsolarSchedulerStats_t *stats );
+
 
 //
 // Defines to make Modbus Context-Free calls easier
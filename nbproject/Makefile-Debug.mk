@@ -36,9 +36,35 @@ OBJECTDIR=${CND_BUILDDIR}/${CND_CONF}/${CND_PLATFORM}
 # Object Files
 OBJECTFILES= \
 	${OBJECTDIR}/epsolar.o \
+	${OBJECTDIR}/epsolarpoller.o \
+	${OBJECTDIR}/epsolarscheduler.o \
+	${OBJECTDIR}/epsolarsim.o \
+	${OBJECTDIR}/epsolardiscovery.o \
+	${OBJECTDIR}/epsolarhistory.o \
+	${OBJECTDIR}/epsolarrecorder.o \
+	${OBJECTDIR}/epsolarcodec.o \
+	${OBJECTDIR}/epsolarrollup.o \
+	${OBJECTDIR}/epsolarchange.o \
+	${OBJECTDIR}/epsolarstatus.o \
+	${OBJECTDIR}/epsolarnet.o \
 	${OBJECTDIR}/tracerseries.o
 
 
+# Test Directory
+TESTDIR=${CND_BUILDDIR}/${CND_CONF}/${CND_PLATFORM}/tests
+
+# Test Files
+TESTFILES= \
+	${TESTDIR}/TestFiles/f1 \
+	${TESTDIR}/TestFiles/f2 \
+	${TESTDIR}/TestFiles/f3
+
+# Test Object Files
+TESTOBJECTFILES= \
+	${TESTDIR}/tests/simtests.o \
+	${TESTDIR}/tests/epsolartests.o \
+	${TESTDIR}/tests/nettests.o
+
 # C Compiler Flags
 CFLAGS=-DRPI
 
@@ -75,9 +101,110 @@ ${OBJECTDIR}/tracerseries.o: tracerseries.c
 	${RM} "$@.d"
 	$(COMPILE.c) -g -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/tracerseries.o tracerseries.c
 
+${OBJECTDIR}/epsolarpoller.o: epsolarpoller.c
+	${MKDIR} -p ${OBJECTDIR}
+	${RM} "$@.d"
+	$(COMPILE.c) -g -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/epsolarpoller.o epsolarpoller.c
+
+${OBJECTDIR}/epsolarscheduler.o: epsolarscheduler.c
+	${MKDIR} -p ${OBJECTDIR}
+	${RM} "$@.d"
+	$(COMPILE.c) -g -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/epsolarscheduler.o epsolarscheduler.c
+
+${OBJECTDIR}/epsolarsim.o: epsolarsim.c
+	${MKDIR} -p ${OBJECTDIR}
+	${RM} "$@.d"
+	$(COMPILE.c) -g -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/epsolarsim.o epsolarsim.c
+
+${OBJECTDIR}/epsolardiscovery.o: epsolardiscovery.c
+	${MKDIR} -p ${OBJECTDIR}
+	${RM} "$@.d"
+	$(COMPILE.c) -g -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/epsolardiscovery.o epsolardiscovery.c
+
+${OBJECTDIR}/epsolarhistory.o: epsolarhistory.c
+	${MKDIR} -p ${OBJECTDIR}
+	${RM} "$@.d"
+	$(COMPILE.c) -g -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/epsolarhistory.o epsolarhistory.c
+
+${OBJECTDIR}/epsolarrecorder.o: epsolarrecorder.c
+	${MKDIR} -p ${OBJECTDIR}
+	${RM} "$@.d"
+	$(COMPILE.c) -g -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/epsolarrecorder.o epsolarrecorder.c
+
+${OBJECTDIR}/epsolarcodec.o: epsolarcodec.c
+	${MKDIR} -p ${OBJECTDIR}
+	${RM} "$@.d"
+	$(COMPILE.c) -g -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/epsolarcodec.o epsolarcodec.c
+
+${OBJECTDIR}/epsolarrollup.o: epsolarrollup.c
+	${MKDIR} -p ${OBJECTDIR}
+	${RM} "$@.d"
+	$(COMPILE.c) -g -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/epsolarrollup.o epsolarrollup.c
+
+${OBJECTDIR}/epsolarchange.o: epsolarchange.c
+	${MKDIR} -p ${OBJECTDIR}
+	${RM} "$@.d"
+	$(COMPILE.c) -g -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/epsolarchange.o epsolarchange.c
+
+${OBJECTDIR}/epsolarstatus.o: epsolarstatus.c
+	${MKDIR} -p ${OBJECTDIR}
+	${RM} "$@.d"
+	$(COMPILE.c) -g -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/epsolarstatus.o epsolarstatus.c
+
+${OBJECTDIR}/epsolarnet.o: epsolarnet.c
+	${MKDIR} -p ${OBJECTDIR}
+	${RM} "$@.d"
+	$(COMPILE.c) -g -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/epsolarnet.o epsolarnet.c
+
 # Subprojects
 .build-subprojects:
 
+# Build Test Targets
+.build-tests-conf: .build-tests-subprojects .build-conf ${TESTFILES}
+.build-tests-subprojects:
+
+${TESTDIR}/TestFiles/f1: ${TESTDIR}/tests/simtests.o ${OBJECTFILES}
+	${MKDIR} -p ${TESTDIR}/TestFiles
+	${LINK.c} -o ${TESTDIR}/TestFiles/f1 $^ ${LDLIBSOPTIONS}   -lmodbus -llog4c -lpthread -lm 
+
+${TESTDIR}/TestFiles/f2: ${TESTDIR}/tests/epsolartests.o ${OBJECTFILES}
+	${MKDIR} -p ${TESTDIR}/TestFiles
+	${LINK.c} -o ${TESTDIR}/TestFiles/f2 $^ ${LDLIBSOPTIONS}   -lmodbus -llog4c -lpthread -lm 
+
+${TESTDIR}/TestFiles/f3: ${TESTDIR}/tests/nettests.o ${OBJECTFILES}
+	${MKDIR} -p ${TESTDIR}/TestFiles
+	${LINK.c} -o ${TESTDIR}/TestFiles/f3 $^ ${LDLIBSOPTIONS}   -lmodbus -llog4c -lpthread -lm 
+
+
+${TESTDIR}/tests/simtests.o: tests/simtests.c 
+	${MKDIR} -p ${TESTDIR}/tests
+	${RM} "$@.d"
+	$(COMPILE.c) -g -I. -MMD -MP -MF "$@.d" -o ${TESTDIR}/tests/simtests.o tests/simtests.c
+
+
+${TESTDIR}/tests/epsolartests.o: tests/epsolartests.c 
+	${MKDIR} -p ${TESTDIR}/tests
+	${RM} "$@.d"
+	$(COMPILE.c) -g -I. -MMD -MP -MF "$@.d" -o ${TESTDIR}/tests/epsolartests.o tests/epsolartests.c
+
+
+${TESTDIR}/tests/nettests.o: tests/nettests.c 
+	${MKDIR} -p ${TESTDIR}/tests
+	${RM} "$@.d"
+	$(COMPILE.c) -g -I. -MMD -MP -MF "$@.d" -o ${TESTDIR}/tests/nettests.o tests/nettests.c
+
+
+# Run Test Targets
+.test-conf:
+	@if [ "${TEST}" = "" ]; \
+	then  \
+	    ${TESTDIR}/TestFiles/f1 && \
+	    ${TESTDIR}/TestFiles/f2 && \
+	    ${TESTDIR}/TestFiles/f3; \
+	else  \
+	    ./${TEST}; \
+	fi
+
 # Clean Targets
 .clean-conf: ${CLEAN_SUBPROJECTS}
 	${RM} -r ${CND_BUILDDIR}/${CND_CONF}
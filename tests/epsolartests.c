@@ -0,0 +1,1066 @@
+/*
+ * Tests for the parts of the library that don't need a controller. Everything
+ *  is fed made up snapshots and timestamps, so these run in a few
+ *  milliseconds.
+ *
+ *  Output is in the NetBeans simple test format. Exits non-zero if anything
+ *  failed.
+ */
+#include <fcntl.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "libepsolar.h"
+#include "epsolarseqlock.h"
+
+
+#define SUITE       "epsolartests"
+
+#define CHECK(condition)    check( (condition), #condition, __LINE__ )
+
+#define LOG_HEADER_SIZE     4096            // epsolarrecorder.c's header page
+
+//
+// What a status callback saw
+#define MAX_EVENTS  16
+
+typedef struct eventLog {
+    int                     numEvents;
+    epsolarStatusEvent_t    events[ MAX_EVENTS ];
+} eventLog_t;
+
+//
+// A callback that takes its time, and one that unsubscribes from inside
+typedef struct slowSubscriber {
+    atomic_int      entered;
+    atomic_int      finished;
+} slowSubscriber_t;
+
+typedef struct unsubscriber {
+    epsolarStatusWatcher_t  *watcher;
+    int             ids[ 2 ];                   // itself and another
+    int             calls;
+} unsubscriber_t;
+
+//
+// What the seqlock writer publishes - every word set to the publish count
+#define SEQLOCK_WORDS       4096
+#define SEQLOCK_WRITES      20000
+
+typedef struct seqlockShared {
+    atomic_uint     sequence;
+    uint32_t        words[ SEQLOCK_WORDS ];
+    atomic_int      done;
+} seqlockShared_t;
+
+//
+// The history writer stamps sample n with time n and a PV voltage of n
+#define HISTORY_CAPACITY    1024
+#define HISTORY_SAMPLES     2000000
+
+typedef struct historyArgs {
+    epsolarHistory_t    *history;
+    atomic_int          done;
+} historyArgs_t;
+
+typedef struct updateArgs {
+    epsolarStatusWatcher_t  *watcher;
+    epsolarRealTimeData_t   rtData;
+} updateArgs_t;
+
+
+static  void        makeSnapshot( epsolarRealTimeData_t *rtData, const float pvVoltage );
+static  int         statusMismatches( const uint16_t batteryBits, const uint16_t chargingBits, const uint16_t dischargingBits );
+static  void        logEvent( const epsolarStatusEvent_t *event, void *userData );
+static  void        slowEvent( const epsolarStatusEvent_t *event, void *userData );
+static  void        unsubscribeEvent( const epsolarStatusEvent_t *event, void *userData );
+static  void        *updateThread( void *arg );
+static  void        *seqlockWriter( void *arg );
+static  void        *historyWriter( void *arg );
+static  void        sleepMillis( const int millis );
+static  void        check( const int passed, const char *condition, const int line );
+static  void        runTest( const char *name, void (*test)( void ) );
+
+static  void        testDecodeSignedRegisters( void );
+static  void        testCodecRoundTrip( void );
+static  void        testCodecWorstCase( void );
+static  void        testRollupWrap( void );
+static  void        testChangeDeadbands( void );
+static  void        testChangeKeyframes( void );
+static  void        testStatusTransitions( void );
+static  void        testStatusUnsubscribeWaits( void );
+static  void        testStatusUnsubscribeInCallback( void );
+static  void        testParsePortName( void );
+static  void        testRecorderCrashRecovery( void );
+static  void        testSeqlockNoTornReads( void );
+static  void        testHistoryWindows( void );
+static  void        testHistoryLapCheck( void );
+static  void        testDecodeStatus( void );
+
+static  const char  *currentTest;
+static  int         currentFailed;
+static  int         testsFailed;
+
+static  epsolarLogRecord_t  records[ EPSOLAR_CODEC_MAX_RECORDS ];
+static  epsolarLogRecord_t  decoded[ EPSOLAR_CODEC_MAX_RECORDS ];
+
+
+
+// -----------------------------------------------------------------------------
+int main (void)
+{
+    printf( "%%SUITE_STARTING%% %s\n", SUITE );
+    printf( "%%SUITE_STARTED%%\n" );
+
+    runTest( "testDecodeSignedRegisters", testDecodeSignedRegisters );
+    runTest( "testCodecRoundTrip", testCodecRoundTrip );
+    runTest( "testCodecWorstCase", testCodecWorstCase );
+    runTest( "testRollupWrap", testRollupWrap );
+    runTest( "testChangeDeadbands", testChangeDeadbands );
+    runTest( "testChangeKeyframes", testChangeKeyframes );
+    runTest( "testStatusTransitions", testStatusTransitions );
+    runTest( "testStatusUnsubscribeWaits", testStatusUnsubscribeWaits );
+    runTest( "testStatusUnsubscribeInCallback", testStatusUnsubscribeInCallback );
+    runTest( "testParsePortName", testParsePortName );
+    runTest( "testRecorderCrashRecovery", testRecorderCrashRecovery );
+    runTest( "testSeqlockNoTornReads", testSeqlockNoTornReads );
+    runTest( "testHistoryWindows", testHistoryWindows );
+    runTest( "testHistoryLapCheck", testHistoryLapCheck );
+    runTest( "testDecodeStatus", testDecodeStatus );
+
+    printf( "%%SUITE_FINISHED%% time=0\n" );
+    return (testsFailed == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+}
+
+// -----------------------------------------------------------------------------
+static
+void testDecodeSignedRegisters ()
+{
+    //
+    //  Words as they come off the wire, low word first. The battery current
+    //  and the temperatures are signed, the power and energy counters aren't,
+    //  and the top bit of either kind must land the right way.
+    static const uint16_t   discharging[ 2 ] = { 0xFF38, 0xFFFF };         // -200
+    static const uint16_t   mostNegative[ 2 ] = { 0x0000, 0x8000 };
+    static const uint16_t   frosty[ 1 ] = { 0xFF9C };                      // -100
+    static const uint16_t   hot[ 1 ] = { 0x0FA0 };                         // 4000
+
+    CHECK( getRegisterDescriptor( TRACER_BATTERY_CURRENT )->isSigned );
+    CHECK( decodeRegisterAsInt( TRACER_BATTERY_CURRENT, discharging ) == -200 );
+    CHECK( decodeRegisterAsFloat( TRACER_BATTERY_CURRENT, discharging ) == -2.00f );
+    CHECK( decodeRegisterAsInt( TRACER_BATTERY_CURRENT, mostNegative ) == INT32_MIN );
+
+    CHECK( decodeRegisterAsInt( TRACER_PV_ARRAY_INPUT_POWER, discharging ) == (int) 0xFFFFFF38u );
+    CHECK( decodeRegisterAsFloat( TRACER_GENERATED_ENERGY_TOTAL, mostNegative ) > 0.0f );
+
+    CHECK( decodeRegisterAsFloat( TRACER_BATTERY_TEMPERATURE, frosty ) == -1.00f );
+    CHECK( fabsf( decodeTemperatureRegister( TRACER_BATTERY_TEMPERATURE, frosty ) - 30.2f ) < 0.001f );
+    CHECK( fabsf( decodeTemperatureRegister( TRACER_DEVICE_TEMPERATURE, hot ) - 104.0f ) < 0.001f );
+}
+
+// -----------------------------------------------------------------------------
+static
+void testCodecRoundTrip ()
+{
+    //
+    //  A day's worth of ordinary samples, a second apart with some jitter,
+    //  comes back bit for bit and a good deal smaller than it went in
+    size_t  maxSize = epsolarCodecMaxEncodedSize( EPSOLAR_CODEC_MAX_RECORDS );
+    uint8_t *block = malloc( maxSize );
+
+    CHECK( block != NULL );
+    if (block == NULL)
+        return;
+
+    memset( records, '\0', sizeof( records ) );
+    for (int i = 0; i < EPSOLAR_CODEC_MAX_RECORDS; i += 1) {
+        epsolarLogRecord_t *r = &records[ i ];
+        r->monotonicNanos = 5000000000LL + (i * 1000000000LL) + ((i % 7) * 1000LL);
+        r->wallMillis = 1700000000000LL + (i * 1000LL) + (i % 3);
+        r->sequence = i + 1;
+        r->controllerStatusBits = (i < 500 ? 0x0005 : 0x0009);
+        r->readStatus = (i % 100 == 99 ? TRACER_STATUS_TIMEOUT : TRACER_STATUS_OK);
+        r->flags = EPSOLAR_LOG_CHARGER_RUNNING | EPSOLAR_LOG_CHARGER_NORMAL;
+        for (int m = 0; m < EPSOLAR_METRIC_COUNT; m += 1)
+            r->values[ m ] = 12.0f + (m * 0.5f) + ((i / 10) % 5) * 0.01f;
+        r->values[ EPSOLAR_METRIC_ENERGY_GENERATED_TOTAL ] = 1234.56f + (i / 60) * 0.01f;
+    }
+
+    size_t size = epsolarCodecEncode( records, EPSOLAR_CODEC_MAX_RECORDS, block, maxSize );
+    CHECK( size > 0 && size <= maxSize );
+    CHECK( size < EPSOLAR_CODEC_MAX_RECORDS * sizeof( epsolarLogRecord_t ) / 4 );
+
+    CHECK( epsolarCodecDecode( block, size, decoded, EPSOLAR_CODEC_MAX_RECORDS ) == EPSOLAR_CODEC_MAX_RECORDS );
+    CHECK( memcmp( records, decoded, sizeof( records ) ) == 0 );
+
+    //
+    //  Too small a buffer is refused rather than overrun, and so is a block
+    //  with more records than the caller has room for
+    CHECK( epsolarCodecEncode( records, EPSOLAR_CODEC_MAX_RECORDS, block, size - 1 ) == 0 );
+    CHECK( epsolarCodecDecode( block, size, decoded, EPSOLAR_CODEC_MAX_RECORDS - 1 ) < 0 );
+
+    free( block );
+}
+
+// -----------------------------------------------------------------------------
+static
+void testCodecWorstCase ()
+{
+    //
+    //  Everything as far from its neighbour as it can be - timestamps and the
+    //  sequence flipping end to end, the readings' bit patterns inverted
+    //  every record, counters swinging by trillions. The block has to fit in
+    //  epsolarCodecMaxEncodedSize() and still decode exactly.
+    memset( records, '\0', sizeof( records ) );
+    for (int i = 0; i < EPSOLAR_CODEC_MAX_RECORDS; i += 1) {
+        epsolarLogRecord_t *r = &records[ i ];
+        int odd = (i & 0x01);
+
+        r->monotonicNanos = (odd ? INT64_MIN : INT64_MAX);
+        r->wallMillis = (odd ? INT64_MAX : INT64_MIN);
+        r->sequence = (odd ? 0 : 0xFFFFFFFFu);
+        r->controllerStatusBits = (uint16_t) (odd ? 0x0000 : 0xFFFF);
+        r->readStatus = (uint8_t) (odd ? 0x00 : 0xFF);
+        r->flags = (uint8_t) (odd ? 0x00 : 0xFF);
+
+        for (int m = 0; m < EPSOLAR_METRIC_COUNT; m += 1) {
+            uint32_t bits = (odd ? 0x00000001u : 0x80000000u) ^ ((uint32_t) i << 8);
+            memcpy( &r->values[ m ], &bits, sizeof( bits ) );
+        }
+
+        float big = (odd ? -8.0e13f : 8.0e13f);
+        r->values[ EPSOLAR_METRIC_ENERGY_GENERATED_TODAY ] = big;
+        r->values[ EPSOLAR_METRIC_ENERGY_GENERATED_TOTAL ] = -big;
+        r->values[ EPSOLAR_METRIC_ENERGY_CONSUMED_TODAY ] = big;
+        r->values[ EPSOLAR_METRIC_ENERGY_CONSUMED_TOTAL ] = -big;
+    }
+
+    for (int n = 1; n <= EPSOLAR_CODEC_MAX_RECORDS; n *= 4) {
+        size_t  maxSize = epsolarCodecMaxEncodedSize( n );
+        uint8_t *block = malloc( maxSize );
+
+        CHECK( block != NULL );
+        if (block == NULL)
+            return;
+
+        size_t size = epsolarCodecEncode( records, n, block, maxSize );
+        CHECK( size > 0 && size <= maxSize );
+        CHECK( epsolarCodecDecode( block, size, decoded, n ) == n );
+        CHECK( memcmp( records, decoded, n * sizeof( epsolarLogRecord_t ) ) == 0 );
+        free( block );
+    }
+}
+
+// -----------------------------------------------------------------------------
+static
+void testRollupWrap ()
+{
+    //
+    //  Four one second buckets. Ten seconds of samples leave only the last
+    //  four seconds in the ring, while the minute holding all ten sees every
+    //  one of them. Times straddle zero, so floor division matters too.
+    static const int    buckets[ EPSOLAR_ROLLUP_LEVELS ] = { 4, 2, 2, 2 };
+    epsolarRollupPoint_t    points[ 16 ];
+    epsolarRealTimeData_t   rtData;
+
+    epsolarRollup_t *rollup = epsolarRollupNew( buckets );
+    CHECK( rollup != NULL );
+    if (rollup == NULL)
+        return;
+
+    for (int s = -2; s < 8; s += 1) {
+        makeSnapshot( &rtData, (float) s );
+        epsolarRollupAdd( rollup, &rtData, (s * 1000LL) + 500 );
+    }
+
+    int n = epsolarRollupQuery( rollup, EPSOLAR_ROLLUP_SECOND, EPSOLAR_METRIC_PV_VOLTAGE, -2000, 7999, points, 16 );
+    CHECK( n == 4 );
+    for (int i = 0; i < n; i += 1) {
+        CHECK( points[ i ].startMillis == (4 + i) * 1000LL );
+        CHECK( points[ i ].count == 1 );
+        CHECK( points[ i ].last == (float) (4 + i) );
+    }
+
+    CHECK( epsolarRollupQuery( rollup, EPSOLAR_ROLLUP_SECOND, EPSOLAR_METRIC_PV_VOLTAGE, -2000, 3999, points, 16 ) == 0 );
+
+    //
+    //  -2 and -1 went into the minute before zero, 0..7 into minute zero
+    n = epsolarRollupQuery( rollup, EPSOLAR_ROLLUP_MINUTE, EPSOLAR_METRIC_PV_VOLTAGE, -60000, 59999, points, 16 );
+    CHECK( n == 2 );
+    if (n == 2) {
+        CHECK( points[ 0 ].startMillis == -60000 && points[ 0 ].count == 2 );
+        CHECK( points[ 0 ].minimum == -2.0f && points[ 0 ].maximum == -1.0f && points[ 0 ].last == -1.0f );
+        CHECK( points[ 1 ].startMillis == 0 && points[ 1 ].count == 8 );
+        CHECK( points[ 1 ].minimum == 0.0f && points[ 1 ].maximum == 7.0f );
+        CHECK( fabsf( points[ 1 ].mean - 3.5f ) < 0.0001f );
+    }
+
+    //
+    //  A late sample for a slot that's moved on is dropped, not merged into
+    //  the newer bucket, and a bad read never gets in at all
+    makeSnapshot( &rtData, 100.0f );
+    epsolarRollupAdd( rollup, &rtData, 3500 );
+    rtData.readStatus = TRACER_STATUS_TIMEOUT;
+    epsolarRollupAdd( rollup, &rtData, 7500 );
+    n = epsolarRollupQuery( rollup, EPSOLAR_ROLLUP_SECOND, EPSOLAR_METRIC_PV_VOLTAGE, 7000, 7999, points, 16 );
+    CHECK( n == 1 && points[ 0 ].count == 1 && points[ 0 ].last == 7.0f );
+
+    //
+    //  Jumping a whole ring ahead clears what was there
+    makeSnapshot( &rtData, 50.0f );
+    epsolarRollupAdd( rollup, &rtData, 60500 );
+    CHECK( epsolarRollupQuery( rollup, EPSOLAR_ROLLUP_SECOND, EPSOLAR_METRIC_PV_VOLTAGE, 0, 60999, points, 16 ) == 1 );
+    CHECK( points[ 0 ].startMillis == 60000 && points[ 0 ].last == 50.0f );
+
+    epsolarRollupFree( rollup );
+}
+
+// -----------------------------------------------------------------------------
+static
+void testChangeDeadbands ()
+{
+    //
+    //  PV voltage on a 0.1 V absolute band, PV power on 1 W or 1% of the last
+    //  value sent, battery current on any change at all. Small drifts add up
+    //  against the last value *sent* until they cross the band.
+    epsolarChangeConfig_t   config;
+    epsolarRealTimeData_t   rtData;
+    epsolarChange_t         change;
+
+    memset( &config, '\0', sizeof( config ) );
+    for (int m = 0; m < EPSOLAR_METRIC_COUNT; m += 1)
+        config.absolute[ m ] = 1.0e6f;
+    config.absolute[ EPSOLAR_METRIC_PV_VOLTAGE ] = 0.1f;
+    config.absolute[ EPSOLAR_METRIC_PV_POWER ] = 1.0f;
+    config.relative[ EPSOLAR_METRIC_PV_POWER ] = 0.01f;
+    config.absolute[ EPSOLAR_METRIC_BATTERY_CURRENT ] = 0.0f;
+    config.keyframeEvery = 0;
+
+    epsolarChangeDetector_t *detector = epsolarChangeDetectorNew( &config );
+    CHECK( detector != NULL );
+    if (detector == NULL)
+        return;
+
+    makeSnapshot( &rtData, 20.0f );
+    rtData.pvPower = 500.0f;
+    CHECK( epsolarChangeDetect( detector, &rtData, 0, &change ) == TRUE );
+    CHECK( change.isKeyframe && change.numValues == EPSOLAR_METRIC_COUNT );
+
+    //
+    //  Nothing moved far enough
+    rtData.pvVoltage = 20.06f;
+    rtData.pvPower = 504.0f;
+    CHECK( epsolarChangeDetect( detector, &rtData, 1000, &change ) == FALSE );
+
+    //
+    //  Another 0.06 V makes 0.12 V since the last one sent
+    rtData.pvVoltage = 20.12f;
+    CHECK( epsolarChangeDetect( detector, &rtData, 2000, &change ) == TRUE );
+    CHECK( !change.isKeyframe );
+    CHECK( change.changedMask == (1u << EPSOLAR_METRIC_PV_VOLTAGE) );
+    CHECK( change.numValues == 1 && change.values[ 0 ] == 20.12f );
+
+    //
+    //  At 500 W the relative band (5 W) beats the absolute one
+    rtData.pvPower = 505.5f;
+    CHECK( epsolarChangeDetect( detector, &rtData, 3000, &change ) == TRUE );
+    CHECK( change.changedMask == (1u << EPSOLAR_METRIC_PV_POWER) );
+
+    //
+    //  Zero deadband - the smallest change counts
+    rtData.batteryCurrent += 0.001f;
+    CHECK( epsolarChangeDetect( detector, &rtData, 4000, &change ) == TRUE );
+    CHECK( change.changedMask == (1u << EPSOLAR_METRIC_BATTERY_CURRENT) );
+
+    //
+    //  Status bits always go out when they change, values packed lowest bit
+    //  first, and a bad read is never a change
+    rtData.controllerStatusBits ^= TRACER_CHG_FAULT;
+    rtData.pvVoltage = 30.0f;
+    rtData.batteryCurrent += 1.0f;
+    CHECK( epsolarChangeDetect( detector, &rtData, 5000, &change ) == TRUE );
+    CHECK( change.changedMask == ((1u << EPSOLAR_METRIC_PV_VOLTAGE) | (1u << EPSOLAR_METRIC_BATTERY_CURRENT) | EPSOLAR_CHANGE_STATUS_BITS) );
+    CHECK( change.numValues == 2 && change.values[ 0 ] == 30.0f && change.values[ 1 ] == (float) rtData.batteryCurrent );
+    CHECK( change.controllerStatusBits == rtData.controllerStatusBits );
+
+    rtData.readStatus = TRACER_STATUS_TIMEOUT;
+    rtData.pvVoltage = 40.0f;
+    CHECK( epsolarChangeDetect( detector, &rtData, 6000, &change ) == FALSE );
+
+    epsolarChangeDetectorFree( detector );
+}
+
+// -----------------------------------------------------------------------------
+static
+void testChangeKeyframes ()
+{
+    //
+    //  The first snapshot and every keyframeEvery'th after it go out whole,
+    //  changed or not. So does the one after epsolarChangeForceKeyframe(),
+    //  which starts the count again.
+    epsolarChangeConfig_t   config;
+    epsolarRealTimeData_t   rtData;
+    epsolarChange_t         change;
+    int                     keyframes[ 12 ];
+
+    epsolarChangeDefaultConfig( &config );
+    config.keyframeEvery = 4;
+
+    epsolarChangeDetector_t *detector = epsolarChangeDetectorNew( &config );
+    CHECK( detector != NULL );
+    if (detector == NULL)
+        return;
+
+    makeSnapshot( &rtData, 20.0f );
+    for (int i = 0; i < 12; i += 1) {
+        if (i == 6)
+            epsolarChangeForceKeyframe( detector );
+        int sent = epsolarChangeDetect( detector, &rtData, i * 1000LL, &change );
+        keyframes[ i ] = (sent && change.isKeyframe);
+        CHECK( sent == keyframes[ i ] );
+    }
+
+    static const int expected[ 12 ] = { 1, 0, 0, 0, 1, 0, 1, 0, 0, 0, 1, 0 };
+    for (int i = 0; i < 12; i += 1)
+        CHECK( keyframes[ i ] == expected[ i ] );
+
+    //
+    //  A keyframe carries everything, status and flags included
+    epsolarChangeForceKeyframe( detector );
+    CHECK( epsolarChangeDetect( detector, &rtData, 12000, &change ) == TRUE );
+    CHECK( change.numValues == EPSOLAR_METRIC_COUNT );
+    CHECK( (change.changedMask & EPSOLAR_CHANGE_STATUS_BITS) && (change.changedMask & EPSOLAR_CHANGE_FLAGS) );
+
+    epsolarChangeDetectorFree( detector );
+}
+
+// -----------------------------------------------------------------------------
+static
+void testStatusTransitions ()
+{
+    //
+    //  Subscribers to a single bit and to a multi-bit field, on different
+    //  words. Only the ones whose field actually moved are called, with the
+    //  field shifted down.
+    epsolarRealTimeData_t   rtData;
+    eventLog_t              stage, fault, load;
+
+    memset( &stage, '\0', sizeof( stage ) );
+    memset( &fault, '\0', sizeof( fault ) );
+    memset( &load, '\0', sizeof( load ) );
+
+    epsolarStatusWatcher_t *watcher = epsolarStatusWatcherNew();
+    CHECK( watcher != NULL );
+    if (watcher == NULL)
+        return;
+
+    int stageId = epsolarStatusSubscribe( watcher, TRACER_WORD_CHARGING_STATUS, TRACER_CHG_CHARGING_STAGE, logEvent, &stage );
+    int faultId = epsolarStatusSubscribe( watcher, TRACER_WORD_CHARGING_STATUS, TRACER_CHG_PV_INPUT_SHORTED, logEvent, &fault );
+    int loadId = epsolarStatusSubscribe( watcher, TRACER_WORD_DISCHARGING_STATUS, TRACER_DCHG_RUNNING, logEvent, &load );
+    CHECK( stageId != 0 && faultId != 0 && loadId != 0 );
+    CHECK( stageId != faultId && faultId != loadId );
+
+    //
+    //  The first snapshot is compared with all clear - a fault that's
+    //  already there gets reported
+    makeSnapshot( &rtData, 20.0f );
+    rtData.controllerStatusBits = TRACER_CHG_RUNNING | (2 << 2) | TRACER_CHG_PV_INPUT_SHORTED;
+    epsolarStatusWatcherUpdate( watcher, &rtData, 1000 );
+    CHECK( stage.numEvents == 1 && stage.events[ 0 ].oldValue == 0 && stage.events[ 0 ].newValue == 2 );
+    CHECK( fault.numEvents == 1 && fault.events[ 0 ].newValue == 1 );
+    CHECK( load.numEvents == 0 );
+    CHECK( stage.events[ 0 ].word == TRACER_WORD_CHARGING_STATUS && stage.events[ 0 ].mask == TRACER_CHG_CHARGING_STAGE );
+    CHECK( stage.events[ 0 ].timeMillis == 1000 );
+
+    //
+    //  The same again - nobody hears anything
+    epsolarStatusWatcherUpdate( watcher, &rtData, 2000 );
+    CHECK( stage.numEvents == 1 && fault.numEvents == 1 && load.numEvents == 0 );
+
+    //
+    //  Boost to float, and a bit nobody subscribed to
+    rtData.controllerStatusBits = TRACER_CHG_RUNNING | (1 << 2) | TRACER_CHG_PV_INPUT_SHORTED | TRACER_CHG_DISEQUILIBRIUM;
+    epsolarStatusWatcherUpdate( watcher, &rtData, 3000 );
+    CHECK( stage.numEvents == 2 && stage.events[ 1 ].oldValue == 2 && stage.events[ 1 ].newValue == 1 );
+    CHECK( fault.numEvents == 1 );
+    CHECK( stage.events[ 1 ].oldBits[ TRACER_WORD_CHARGING_STATUS ] == (TRACER_CHG_RUNNING | (2 << 2) | TRACER_CHG_PV_INPUT_SHORTED) );
+    CHECK( stage.events[ 1 ].newBits[ TRACER_WORD_CHARGING_STATUS ] == rtData.controllerStatusBits );
+
+    //
+    //  A bad read is skipped, not taken for everything clearing
+    rtData.readStatus = TRACER_STATUS_TIMEOUT;
+    rtData.controllerStatusBits = 0;
+    epsolarStatusWatcherUpdate( watcher, &rtData, 4000 );
+    CHECK( stage.numEvents == 2 && fault.numEvents == 1 );
+    CHECK( epsolarStatusWatcherGet( watcher, TRACER_WORD_CHARGING_STATUS ) != 0 );
+
+    //
+    //  Load switching on, with the stage subscription gone
+    epsolarStatusUnsubscribe( watcher, stageId );
+    makeSnapshot( &rtData, 20.0f );
+    rtData.controllerStatusBits = TRACER_CHG_RUNNING | TRACER_CHG_PV_INPUT_SHORTED;
+    rtData.dischargingStatusBits = TRACER_DCHG_RUNNING;
+    epsolarStatusWatcherUpdate( watcher, &rtData, 5000 );
+    CHECK( stage.numEvents == 2 );
+    CHECK( load.numEvents == 1 && load.events[ 0 ].oldValue == 0 && load.events[ 0 ].newValue == 1 );
+    CHECK( epsolarStatusWatcherGet( watcher, TRACER_WORD_DISCHARGING_STATUS ) == TRACER_DCHG_RUNNING );
+
+    epsolarStatusWatcherFree( watcher );
+}
+
+// -----------------------------------------------------------------------------
+static
+void testStatusUnsubscribeWaits ()
+{
+    //
+    //  An update on another thread is partway through a slow callback when
+    //  we unsubscribe it. Unsubscribe mustn't come back until the callback
+    //  has returned - after that the caller is free to throw userData away.
+    slowSubscriber_t    slow;
+    updateArgs_t        args;
+    pthread_t           thread;
+
+    atomic_init( &slow.entered, FALSE );
+    atomic_init( &slow.finished, FALSE );
+
+    args.watcher = epsolarStatusWatcherNew();
+    CHECK( args.watcher != NULL );
+    if (args.watcher == NULL)
+        return;
+
+    int id = epsolarStatusSubscribe( args.watcher, TRACER_WORD_CHARGING_STATUS, TRACER_CHG_FAULT, slowEvent, &slow );
+    makeSnapshot( &args.rtData, 20.0f );
+    args.rtData.controllerStatusBits = TRACER_CHG_FAULT;
+
+    CHECK( pthread_create( &thread, NULL, updateThread, &args ) == 0 );
+    for (int waited = 0; !atomic_load( &slow.entered ) && waited < 2000; waited += 1)
+        sleepMillis( 1 );
+    CHECK( atomic_load( &slow.entered ) );
+
+    epsolarStatusUnsubscribe( args.watcher, id );
+    CHECK( atomic_load( &slow.finished ) );
+
+    pthread_join( thread, NULL );
+    epsolarStatusWatcherFree( args.watcher );
+}
+
+// -----------------------------------------------------------------------------
+static
+void testStatusUnsubscribeInCallback ()
+{
+    //
+    //  A callback unsubscribing itself and a later subscription on the same
+    //  change doesn't wait on its own update, and the later one isn't called
+    epsolarRealTimeData_t   rtData;
+    unsubscriber_t          unsubscriber;
+    eventLog_t              later;
+
+    memset( &unsubscriber, '\0', sizeof( unsubscriber ) );
+    memset( &later, '\0', sizeof( later ) );
+
+    unsubscriber.watcher = epsolarStatusWatcherNew();
+    CHECK( unsubscriber.watcher != NULL );
+    if (unsubscriber.watcher == NULL)
+        return;
+
+    unsubscriber.ids[ 0 ] = epsolarStatusSubscribe( unsubscriber.watcher, TRACER_WORD_CHARGING_STATUS, TRACER_CHG_FAULT, unsubscribeEvent, &unsubscriber );
+    unsubscriber.ids[ 1 ] = epsolarStatusSubscribe( unsubscriber.watcher, TRACER_WORD_CHARGING_STATUS, TRACER_CHG_FAULT, logEvent, &later );
+
+    makeSnapshot( &rtData, 20.0f );
+    rtData.controllerStatusBits = TRACER_CHG_FAULT;
+    epsolarStatusWatcherUpdate( unsubscriber.watcher, &rtData, 1000 );
+    CHECK( unsubscriber.calls == 1 );
+    CHECK( later.numEvents == 0 );
+
+    rtData.controllerStatusBits = 0;
+    epsolarStatusWatcherUpdate( unsubscriber.watcher, &rtData, 2000 );
+    CHECK( unsubscriber.calls == 1 && later.numEvents == 0 );
+
+    epsolarStatusWatcherFree( unsubscriber.watcher );
+}
+
+// -----------------------------------------------------------------------------
+static
+void testParsePortName ()
+{
+    char    host[ 64 ];
+    int     port;
+
+    CHECK( epsolarParsePortName( "/dev/ttyXRUSB0", host, sizeof( host ), &port ) == EPSOLAR_TRANSPORT_RTU );
+
+    CHECK( epsolarParsePortName( "tcp://gateway.local", host, sizeof( host ), &port ) == EPSOLAR_TRANSPORT_TCP );
+    CHECK( strcmp( host, "gateway.local" ) == 0 && port == EPSOLAR_DEFAULT_TCP_PORT );
+
+    CHECK( epsolarParsePortName( "rtu+tcp://10.0.0.7:4196", host, sizeof( host ), &port ) == EPSOLAR_TRANSPORT_RTU_OVER_TCP );
+    CHECK( strcmp( host, "10.0.0.7" ) == 0 && port == 4196 );
+
+    CHECK( epsolarParsePortName( "tcp://[::1]:1502", host, sizeof( host ), &port ) == EPSOLAR_TRANSPORT_TCP );
+    CHECK( strcmp( host, "::1" ) == 0 && port == 1502 );
+
+    CHECK( epsolarParsePortName( "tcp://[fe80::1%eth0]", host, sizeof( host ), &port ) == EPSOLAR_TRANSPORT_TCP );
+    CHECK( strcmp( host, "fe80::1%eth0" ) == 0 && port == EPSOLAR_DEFAULT_TCP_PORT );
+
+    CHECK( epsolarParsePortName( "tcp://host:502/", host, sizeof( host ), &port ) == EPSOLAR_TRANSPORT_TCP );
+    CHECK( port == 502 );
+
+    //
+    //  Bad ports, hosts and brackets
+    CHECK( epsolarParsePortName( "tcp://host:", host, sizeof( host ), &port ) == -1 );
+    CHECK( epsolarParsePortName( "tcp://host:0", host, sizeof( host ), &port ) == -1 );
+    CHECK( epsolarParsePortName( "tcp://host:65536", host, sizeof( host ), &port ) == -1 );
+    CHECK( epsolarParsePortName( "tcp://host:-502", host, sizeof( host ), &port ) == -1 );
+    CHECK( epsolarParsePortName( "tcp://host:+502", host, sizeof( host ), &port ) == -1 );
+    CHECK( epsolarParsePortName( "tcp://host: 502", host, sizeof( host ), &port ) == -1 );
+    CHECK( epsolarParsePortName( "tcp://host:502x", host, sizeof( host ), &port ) == -1 );
+    CHECK( epsolarParsePortName( "tcp://host:99999999999999999999", host, sizeof( host ), &port ) == -1 );
+    CHECK( epsolarParsePortName( "tcp://:502", host, sizeof( host ), &port ) == -1 );
+    CHECK( epsolarParsePortName( "tcp://", host, sizeof( host ), &port ) == -1 );
+    CHECK( epsolarParsePortName( "tcp://[::1", host, sizeof( host ), &port ) == -1 );
+    CHECK( epsolarParsePortName( "tcp://[]:502", host, sizeof( host ), &port ) == -1 );
+    CHECK( epsolarParsePortName( "tcp://[::1]502", host, sizeof( host ), &port ) == -1 );
+    CHECK( epsolarParsePortName( "tcp://[::1]:", host, sizeof( host ), &port ) == -1 );
+    CHECK( epsolarParsePortName( "tcp://::1", host, sizeof( host ), &port ) == -1 );
+    CHECK( epsolarParsePortName( "tcp://a-host-name-that-will-not-fit", host, 8, &port ) == -1 );
+}
+
+// -----------------------------------------------------------------------------
+static
+void testRecorderCrashRecovery ()
+{
+    //
+    //  A child writes 20 records with a checkpoint at 10, tears record 13 and
+    //  dies without closing. The parent reopens, appends over the gap and
+    //  reopens again - records 14 to 20 from before the crash must stay gone.
+    char    fileName[] = "/tmp/epsolartestsXXXXXX";
+    epsolarRealTimeData_t   rtData;
+
+    int fd = mkstemp( fileName );
+    CHECK( fd >= 0 );
+    if (fd < 0)
+        return;
+    close( fd );
+
+    pid_t child = fork();
+    if (child == 0) {
+        epsolarRecorder_t *recorder = epsolarRecorderOpen( fileName, 1000 );
+        uint32_t    torn = 0;
+
+        if (recorder == NULL)
+            _exit( 1 );
+        for (int i = 0; i < 20; i += 1) {
+            makeSnapshot( &rtData, 100.0f + i );
+            epsolarRecorderAppend( recorder, &rtData, 1000 * i );
+            if (i == 9)
+                epsolarRecorderSync( recorder );
+        }
+
+        fd = open( fileName, O_WRONLY );
+        off_t offset = LOG_HEADER_SIZE + (12 * sizeof( epsolarLogRecord_t )) + offsetof( epsolarLogRecord_t, sequence );
+        if (fd < 0 || pwrite( fd, &torn, sizeof( torn ), offset ) != sizeof( torn ))
+            _exit( 1 );
+        _exit( 0 );
+    }
+
+    int     status = -1;
+    CHECK( child > 0 && waitpid( child, &status, 0 ) == child );
+    CHECK( WIFEXITED( status ) && WEXITSTATUS( status ) == 0 );
+
+    epsolarRecorder_t *recorder = epsolarRecorderOpen( fileName, 1000 );
+    CHECK( recorder != NULL );
+    if (recorder == NULL) {
+        unlink( fileName );
+        return;
+    }
+    CHECK( epsolarRecorderCount( recorder ) == 12 );
+
+    for (int i = 0; i < 3; i += 1) {
+        makeSnapshot( &rtData, 200.0f + i );
+        CHECK( epsolarRecorderAppend( recorder, &rtData, 50000 + (1000 * i) ) );
+    }
+    epsolarRecorderClose( recorder );
+
+    recorder = epsolarRecorderOpen( fileName, 1000 );
+    CHECK( recorder != NULL && epsolarRecorderCount( recorder ) == 15 );
+    epsolarRecorderClose( recorder );
+
+    uint64_t    numRecords = 0;
+    epsolarLogReader_t *reader = epsolarLogReaderOpen( fileName );
+    CHECK( reader != NULL );
+    if (reader != NULL) {
+        const epsolarLogRecord_t *logRecords = epsolarLogReaderRecords( reader, &numRecords );
+        CHECK( numRecords == 15 );
+        CHECK( numRecords == 15 && logRecords[ 11 ].values[ EPSOLAR_METRIC_PV_VOLTAGE ] == 111.0f );
+        CHECK( numRecords == 15 && logRecords[ 14 ].values[ EPSOLAR_METRIC_PV_VOLTAGE ] == 202.0f );
+        epsolarLogReaderClose( reader );
+    }
+
+    unlink( fileName );
+}
+
+// -----------------------------------------------------------------------------
+static
+void testSeqlockNoTornReads ()
+{
+    //
+    //  One thread publishes as fast as it can while we copy as fast as we
+    //  can. Every copy has to be one whole write - all its words the same -
+    //  and the one the returned count says it is, and the count never goes
+    //  backwards.
+    static seqlockShared_t  shared;
+    uint32_t        copy[ SEQLOCK_WORDS ];
+    unsigned int    lastCount = 0;
+    unsigned long   numCopies = 0, numTorn = 0, numWrongCount = 0, numBackwards = 0;
+    pthread_t       thread;
+
+    memset( &shared, '\0', sizeof( shared ) );
+    atomic_init( &shared.sequence, 0 );
+    atomic_init( &shared.done, FALSE );
+
+    CHECK( seqlockCopy( &shared.sequence, copy, shared.words, sizeof( copy ) ) == 0 );
+
+    CHECK( pthread_create( &thread, NULL, seqlockWriter, &shared ) == 0 );
+    while (!atomic_load( &shared.done )) {
+        unsigned int count = seqlockCopy( &shared.sequence, copy, shared.words, sizeof( copy ) );
+
+        for (int i = 1; i < SEQLOCK_WORDS; i += 1) {
+            if (copy[ i ] != copy[ 0 ]) {
+                numTorn += 1;
+                break;
+            }
+        }
+        if (copy[ 0 ] != count)
+            numWrongCount += 1;
+        if (count < lastCount)
+            numBackwards += 1;
+        lastCount = count;
+        numCopies += 1;
+    }
+    pthread_join( thread, NULL );
+
+    CHECK( numCopies > 0 );
+    CHECK( numTorn == 0 );
+    CHECK( numWrongCount == 0 );
+    CHECK( numBackwards == 0 );
+    CHECK( seqlockCopy( &shared.sequence, copy, shared.words, sizeof( copy ) ) == SEQLOCK_WRITES );
+    CHECK( copy[ 0 ] == SEQLOCK_WRITES && copy[ SEQLOCK_WORDS - 1 ] == SEQLOCK_WRITES );
+}
+
+// -----------------------------------------------------------------------------
+static
+void testHistoryWindows ()
+{
+    //
+    //  20 samples through a ring of 8. Only the newest 7 are kept - the
+    //  oldest slot is the next to be written - and a bad read counts for the
+    //  copy but not for the stats.
+    epsolarRealTimeData_t   rtData;
+    epsolarHistoryStats_t   stats;
+    int64_t     timeMillis[ 8 ];
+    float       values[ 8 ];
+
+    epsolarHistory_t *history = epsolarHistoryNew( 8 );
+    CHECK( history != NULL );
+    if (history == NULL)
+        return;
+
+    CHECK( epsolarHistoryWindow( history, EPSOLAR_METRIC_PV_VOLTAGE, 0, INT64_MAX, &stats ) == 0 );
+
+    for (int i = 0; i < 20; i += 1) {
+        makeSnapshot( &rtData, (float) i );
+        if (i == 17)
+            rtData.readStatus = TRACER_STATUS_TIMEOUT;
+        epsolarHistoryAppend( history, &rtData, 1000 * i );
+    }
+    CHECK( epsolarHistoryCount( history ) == 20 );
+
+    CHECK( epsolarHistoryWindow( history, EPSOLAR_METRIC_PV_VOLTAGE, 0, INT64_MAX, &stats ) == 6 );
+    CHECK( stats.count == 6 && stats.minimum == 13.0 && stats.maximum == 19.0 );
+    CHECK( fabs( stats.mean - (95.0 / 6.0) ) < 1e-6 );
+
+    CHECK( epsolarHistoryWindow( history, EPSOLAR_METRIC_PV_VOLTAGE, 14500, 16000, &stats ) == 2 );
+    CHECK( stats.minimum == 15.0 && stats.maximum == 16.0 );
+    CHECK( epsolarHistoryWindow( history, EPSOLAR_METRIC_PV_VOLTAGE, 30000, 40000, &stats ) == 0 );
+
+    CHECK( epsolarHistoryCopy( history, EPSOLAR_METRIC_PV_VOLTAGE, 15000, 18000, timeMillis, values, 8 ) == 4 );
+    CHECK( timeMillis[ 0 ] == 15000 && values[ 0 ] == 15.0f && timeMillis[ 3 ] == 18000 && values[ 3 ] == 18.0f );
+    CHECK( epsolarHistoryCopy( history, EPSOLAR_METRIC_PV_VOLTAGE, 15000, 18000, timeMillis, values, 2 ) == 2 );
+    CHECK( values[ 0 ] == 17.0f && values[ 1 ] == 18.0f );
+
+    epsolarHistoryFree( history );
+}
+
+// -----------------------------------------------------------------------------
+static
+void testHistoryLapCheck ()
+{
+    //
+    //  The writer laps a small ring over and over while we copy and window
+    //  it. A copy has to be one unbroken run of samples, each value with its
+    //  own timestamp, and a window's stats have to add up for such a run -
+    //  a scan the writer ran over must be thrown away and done again.
+    static int64_t  timeMillis[ HISTORY_CAPACITY ];
+    static float    values[ HISTORY_CAPACITY ];
+    epsolarHistoryStats_t   stats;
+    unsigned long   numCopies = 0, numBroken = 0, numBadStats = 0;
+    historyArgs_t   args;
+    pthread_t       thread;
+
+    args.history = epsolarHistoryNew( HISTORY_CAPACITY );
+    CHECK( args.history != NULL );
+    if (args.history == NULL)
+        return;
+    atomic_init( &args.done, FALSE );
+
+    CHECK( pthread_create( &thread, NULL, historyWriter, &args ) == 0 );
+    while (!atomic_load( &args.done )) {
+        int count = epsolarHistoryCopy( args.history, EPSOLAR_METRIC_PV_VOLTAGE, 0, INT64_MAX, timeMillis, values, HISTORY_CAPACITY );
+
+        for (int i = 0; i < count; i += 1) {
+            if (values[ i ] != (float) timeMillis[ i ] || timeMillis[ i ] != timeMillis[ 0 ] + i) {
+                numBroken += 1;
+                break;
+            }
+        }
+
+        if (epsolarHistoryWindow( args.history, EPSOLAR_METRIC_PV_VOLTAGE, 0, INT64_MAX, &stats ) > 0) {
+            if (stats.count != (int) (stats.maximum - stats.minimum) + 1 ||
+                    fabs( stats.mean - ((stats.minimum + stats.maximum) / 2.0) ) > 1e-6)
+                numBadStats += 1;
+        }
+        numCopies += 1;
+    }
+    pthread_join( thread, NULL );
+
+    CHECK( numCopies > 0 );
+    CHECK( numBroken == 0 );
+    CHECK( numBadStats == 0 );
+    CHECK( epsolarHistoryCopy( args.history, EPSOLAR_METRIC_PV_VOLTAGE, 0, INT64_MAX, timeMillis, values, HISTORY_CAPACITY ) == HISTORY_CAPACITY - 1 );
+    CHECK( timeMillis[ HISTORY_CAPACITY - 2 ] == HISTORY_SAMPLES );
+
+    epsolarHistoryFree( args.history );
+}
+
+// -----------------------------------------------------------------------------
+static
+void testDecodeStatus ()
+{
+    //
+    //  Every value of each status word through the table, checked field by
+    //  field against the bit helpers it replaced, then a few by hand
+    tracerDecodedStatus_t   decoded;
+    unsigned long           mismatches = 0;
+
+    for (uint32_t v = 0; v <= 0xFFFF; v += 1) {
+        mismatches += statusMismatches( (uint16_t) v, 0, 0 );
+        mismatches += statusMismatches( 0, (uint16_t) v, 0 );
+        mismatches += statusMismatches( 0, 0, (uint16_t) v );
+        mismatches += statusMismatches( (uint16_t) v, (uint16_t) v, (uint16_t) v );
+    }
+    CHECK( mismatches == 0 );
+
+    //
+    //  Floating, D1 set the way a healthy controller reports it, load on
+    //  and moderate
+    tracerDecodeStatus( 0x0000, 0x0007, 0x1001, &decoded );
+    CHECK( decoded.chargingStage == TRACER_STAGE_FLOAT && decoded.chargingRunning && decoded.chargingFaultBit );
+    CHECK( decoded.dischargingRunning && decoded.loadLevel == TRACER_LOAD_MODERATE );
+    CHECK( !decoded.anyFault );
+    CHECK( strcmp( tracerStatusFieldLabel( TRACER_FIELD_CHARGING_STAGE, decoded.chargingStage ), "Floating" ) == 0 );
+
+    //
+    //  Undocumented battery codes count as faults, and the lookups refuse
+    //  what isn't there
+    tracerDecodeStatus( 0x0030, 0x0000, 0x0000, &decoded );
+    CHECK( decoded.batteryTemperature == 3 && decoded.anyFault );
+    CHECK( strcmp( tracerStatusFieldLabel( TRACER_FIELD_BATTERY_TEMPERATURE, decoded.batteryTemperature ), "???" ) == 0 );
+    CHECK( tracerStatusFieldValue( &decoded, TRACER_NUM_STATUS_FIELDS ) == -1 );
+    CHECK( strcmp( tracerStatusFieldName( -1 ), "???" ) == 0 );
+    CHECK( strcmp( tracerStatusFieldName( TRACER_FIELD_LOAD_SHORTED ), "Load Shorted" ) == 0 );
+}
+
+// -----------------------------------------------------------------------------
+static
+void makeSnapshot (epsolarRealTimeData_t *rtData, const float pvVoltage)
+{
+    //
+    //  A clean read with everything else at some plausible fixed value
+    memset( rtData, '\0', sizeof( *rtData ) );
+    rtData->pvVoltage = pvVoltage;
+    rtData->pvCurrent = 2.5f;
+    rtData->pvPower = 50.0f;
+    rtData->batteryVoltage = 13.2f;
+    rtData->batteryCurrent = 3.0f;
+    rtData->batteryStateOfCharge = 80;
+    rtData->loadVoltage = 13.1f;
+    rtData->readStatus = TRACER_STATUS_OK;
+}
+
+// -----------------------------------------------------------------------------
+static
+int statusMismatches (const uint16_t batteryBits, const uint16_t chargingBits, const uint16_t dischargingBits)
+{
+    //
+    //  How many fields of the table decode disagree with the old helpers
+    tracerDecodedStatus_t   decoded;
+    int     mismatches = 0;
+
+    tracerDecodeStatus( batteryBits, chargingBits, dischargingBits, &decoded );
+
+    mismatches += (strcmp( tracerStatusFieldLabel( TRACER_FIELD_BATTERY_VOLTAGE, decoded.batteryVoltage ), getBatteryStatusVoltage( batteryBits ) ) != 0);
+    mismatches += (strcmp( tracerStatusFieldLabel( TRACER_FIELD_BATTERY_TEMPERATURE, decoded.batteryTemperature ), getBatteryStatusTemperature( batteryBits ) ) != 0);
+    mismatches += (strcmp( tracerStatusFieldLabel( TRACER_FIELD_BATTERY_INNER_RESISTANCE, decoded.batteryInnerResistanceAbnormal ), getBatteryStatusInnerResistance( batteryBits ) ) != 0);
+    mismatches += (strcmp( tracerStatusFieldLabel( TRACER_FIELD_BATTERY_WRONG_RATED_VOLTAGE, decoded.batteryWrongRatedVoltage ), getBatteryStatusIdentification( batteryBits ) ) != 0);
+
+    mismatches += (decoded.chargingRunning != isChargingStatusRunning( chargingBits ));
+    mismatches += (decoded.chargingFaultBit != isChargingStatusNormal( chargingBits ));        // D1, kept raw
+    mismatches += (strcmp( tracerStatusFieldLabel( TRACER_FIELD_CHARGING_STAGE, decoded.chargingStage ), getChargingStatus( chargingBits ) ) != 0);
+    mismatches += (decoded.pvInputShorted != isPVInputShorted( chargingBits ));
+    mismatches += (decoded.disequilibrium != isDisequilibriumInThreeCircuits( chargingBits ));
+    mismatches += (decoded.loadMOSFETShorted != isLoadMOSFETShorted( chargingBits ));
+    mismatches += (decoded.loadShorted != isLoadShorted( chargingBits ));
+    mismatches += (decoded.loadOverCurrent != isLoadOverCurrent( chargingBits ));
+    mismatches += (decoded.inputOverCurrent != isInputOverCurrent( chargingBits ));
+    mismatches += (decoded.antiReverseMOSFETShorted != isAntiReverseMOSFETShort( chargingBits ));
+    mismatches += (decoded.chargingMOSFETOpen != isChargingMOSFETOpen( chargingBits ));
+    mismatches += (decoded.chargingMOSFETShorted != isChargingMOSFETShorted( chargingBits ));
+    mismatches += (strcmp( tracerStatusFieldLabel( TRACER_FIELD_PV_INPUT_STATUS, decoded.pvInputStatus ), getChargingEquipmentStatusInputVoltageStatus( chargingBits ) ) != 0);
+
+    mismatches += (decoded.dischargingRunning != isDischargeStatusRunning( dischargingBits ));
+    mismatches += (decoded.dischargingFaultBit == isDischargeStatusNormal( dischargingBits ));
+    mismatches += (decoded.outputOverVoltage != isDischargeStatusOutputOverVoltage( dischargingBits ));
+    mismatches += (decoded.boostOverVoltage != isDischargeStatusBoostOverVoltage( dischargingBits ));
+    mismatches += (decoded.shortedHighVoltageSide != isDischargeStatusShortedInHighVoltage( dischargingBits ));
+    mismatches += (decoded.inputOverVoltage != isDischargeStatusInputOverVoltage( dischargingBits ));
+    mismatches += (decoded.outputVoltageAbnormal != isDischargeStatusOutputVoltageAbnormal( dischargingBits ));
+    mismatches += (decoded.unableToStopDischarging != isDischargeStatusUnableToStopDischarge( dischargingBits ));
+    mismatches += (decoded.unableToDischarge != isDischargeStatusUnableToDischarge( dischargingBits ));
+    mismatches += (decoded.dischargingShorted != isDischargeStatusShorted( dischargingBits ));
+    mismatches += (strcmp( tracerStatusFieldLabel( TRACER_FIELD_LOAD_LEVEL, decoded.loadLevel ), getDischargingStatusOutputPower( dischargingBits ) ) != 0);
+    mismatches += (strcmp( tracerStatusFieldLabel( TRACER_FIELD_DISCHARGE_INPUT_STATUS, decoded.dischargeInputStatus ), getDischargingStatusInputVoltageStatus( dischargingBits ) ) != 0);
+
+    int anyFault = ((batteryBits & TRACER_BATT_FAULTS) || (chargingBits & TRACER_CHG_FAULTS) || (dischargingBits & TRACER_DCHG_FAULTS) ||
+                    (batteryBits & TRACER_BATT_VOLTAGE_STATUS) >= TRACER_BATT_FAULT || ((batteryBits & TRACER_BATT_TEMPERATURE_STATUS) >> 4) > TRACER_TEMP_LOW);
+    mismatches += (decoded.anyFault != anyFault);
+
+    for (int f = 0; f < TRACER_NUM_STATUS_FIELDS; f += 1)
+        mismatches += (tracerStatusFieldValue( &decoded, f ) != ((const uint8_t *) &decoded)[ f ]);
+
+    return mismatches;
+}
+
+// -----------------------------------------------------------------------------
+static
+void logEvent (const epsolarStatusEvent_t *event, void *userData)
+{
+    eventLog_t *log = userData;
+
+    if (log->numEvents < MAX_EVENTS)
+        log->events[ log->numEvents++ ] = *event;
+}
+
+// -----------------------------------------------------------------------------
+static
+void slowEvent (const epsolarStatusEvent_t *event, void *userData)
+{
+    slowSubscriber_t *slow = userData;
+
+    (void) event;
+    atomic_store( &slow->entered, TRUE );
+    sleepMillis( 100 );
+    atomic_store( &slow->finished, TRUE );
+}
+
+// -----------------------------------------------------------------------------
+static
+void unsubscribeEvent (const epsolarStatusEvent_t *event, void *userData)
+{
+    unsubscriber_t *unsubscriber = userData;
+
+    (void) event;
+    unsubscriber->calls += 1;
+    epsolarStatusUnsubscribe( unsubscriber->watcher, unsubscriber->ids[ 0 ] );
+    epsolarStatusUnsubscribe( unsubscriber->watcher, unsubscriber->ids[ 1 ] );
+}
+
+// -----------------------------------------------------------------------------
+static
+void *updateThread (void *arg)
+{
+    updateArgs_t *args = arg;
+
+    epsolarStatusWatcherUpdate( args->watcher, &args->rtData, 1000 );
+    return NULL;
+}
+
+// -----------------------------------------------------------------------------
+static
+void *seqlockWriter (void *arg)
+{
+    seqlockShared_t *shared = arg;
+    uint32_t        fresh[ SEQLOCK_WORDS ];
+
+    for (uint32_t n = 1; n <= SEQLOCK_WRITES; n += 1) {
+        for (int i = 0; i < SEQLOCK_WORDS; i += 1)
+            fresh[ i ] = n;
+        seqlockPublish( &shared->sequence, shared->words, fresh, sizeof( fresh ) );
+    }
+    atomic_store( &shared->done, TRUE );
+    return NULL;
+}
+
+// -----------------------------------------------------------------------------
+static
+void *historyWriter (void *arg)
+{
+    historyArgs_t           *args = arg;
+    epsolarRealTimeData_t   rtData;
+
+    for (int n = 1; n <= HISTORY_SAMPLES; n += 1) {
+        makeSnapshot( &rtData, (float) n );
+        epsolarHistoryAppend( args->history, &rtData, n );
+    }
+    atomic_store( &args->done, TRUE );
+    return NULL;
+}
+
+// -----------------------------------------------------------------------------
+static
+void sleepMillis (const int millis)
+{
+    struct timespec pause = { .tv_sec = millis / 1000, .tv_nsec = (millis % 1000) * 1000000L };
+    nanosleep( &pause, NULL );
+}
+
+// -----------------------------------------------------------------------------
+static
+void check (const int passed, const char *condition, const int line)
+{
+    if (passed)
+        return;
+
+    printf( "%%TEST_FAILED%% time=0 testname=%s (%s) message=line %d: %s\n", currentTest, SUITE, line, condition );
+    currentFailed = TRUE;
+}
+
+// -----------------------------------------------------------------------------
+static
+void runTest (const char *name, void (*test)( void ))
+{
+    currentTest = name;
+    currentFailed = FALSE;
+
+    printf( "%%TEST_STARTED%% %s (%s)\n", name, SUITE );
+    test();
+    printf( "%%TEST_FINISHED%% time=0 %s (%s)\n", name, SUITE );
+
+    if (currentFailed)
+        testsFailed += 1;
+}
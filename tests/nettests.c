@@ -0,0 +1,929 @@
+/*
+ * Tests run over loopback TCP.
+ *
+ *  A small Modbus TCP server runs on a thread of its own and answers reads
+ *  with made up values - each register holds its own address plus its offset
+ *  in the request, so a reply handed to the wrong request shows. It can be
+ *  told to hold replies back and send them in reverse, to delay the first
+ *  reply to an address, or to garble it, which is what a busy gateway does
+ *  to pipelined requests now and then. Or it can pass the bytes straight
+ *  through to the simulator, the way a transparent RS485 gateway does.
+ *
+ *  Stopping the server and starting it again on the same port is a gateway
+ *  losing power and coming back.
+ *
+ *  Output is in the NetBeans simple test format. Exits non-zero if anything
+ *  failed.
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include <modbus/modbus.h>
+
+#include "libepsolar.h"
+#include "epsolarsim.h"
+
+
+#define SUITE       "nettests"
+
+#define CHECK(condition)    check( (condition), #condition, __LINE__ )
+
+#define MAX_SCRIPTED        8
+#define MAX_PENDING         64
+#define SERVER_POLL_MILLIS  10
+
+typedef enum garble {
+    GARBLE_NONE = 0,
+    GARBLE_FUNCTION,                        // answers a different function code
+    GARBLE_FRAMING                          // MBAP length nobody could send
+} garble_t;
+
+typedef struct scriptedReply {
+    int         address;                    // the first request for it only
+    int         delayMillis;
+    int         garble;
+    int         used;
+} scriptedReply_t;
+
+typedef struct pendingReply {
+    int64_t     dueMillis;
+    int         length;
+    uint8_t     adu[ MODBUS_TCP_MAX_ADU_LENGTH ];
+} pendingReply_t;
+
+typedef struct mbapServer {
+    int             port;
+    int             listenFd;
+    int             clientFd;
+    int             relayFd;                // bytes pass through to this instead, or -1
+    pthread_t       thread;
+    atomic_int      stopRequested;
+
+    pthread_mutex_t lock;                   // everything from here down
+    scriptedReply_t script[ MAX_SCRIPTED ];
+    int             numScripted;
+    int             holdReplies;            // held until this many, then sent last first
+    pendingReply_t  held[ MAX_PENDING ];
+    int             numHeld;
+    pendingReply_t  pending[ MAX_PENDING ];
+    int             numPending;
+    int             requests;
+    int             connections;
+} mbapServer_t;
+
+typedef struct netClient {
+    modbus_t            *ctx;
+    tracerReadPlan_t    plan;
+} netClient_t;
+
+
+static  int         serverStart( mbapServer_t *server, const int port, const int relayFd );
+static  void        serverStop( mbapServer_t *server );
+static  void        serverScript( mbapServer_t *server, const int address, const int delayMillis, const int garble );
+static  void        serverHold( mbapServer_t *server, const int numReplies );
+static  int         serverRequests( mbapServer_t *server );
+static  int         serverConnections( mbapServer_t *server );
+static  void        *serverThread( void *arg );
+static  void        serverRelay( mbapServer_t *server );
+static  void        serverRequest( mbapServer_t *server, const uint8_t *adu, const int length );
+static  int         buildReply( const uint8_t *adu, uint8_t *reply );
+static  int         clientStart( netClient_t *client, const mbapServer_t *server, const int pipelineDepth, const int responseMillis );
+static  void        clientStop( netClient_t *client );
+static  int         requestWordsMatch( const netClient_t *client, const tracerReadResult_t *result, const int r );
+static  void        setResponseMillis( modbus_t *ctx, const int millis );
+static  void        setRetries( const int maxAttempts, const long delayMicros );
+static  int64_t     nowMillis( void );
+static  void        sleepMillis( const int millis );
+static  void        check( const int passed, const char *condition, const int line );
+static  void        runTest( const char *name, void (*test)( void ) );
+
+static  void        testPipelineReordered( void );
+static  void        testPipelineLateReply( void );
+static  void        testPipelineGarbled( void );
+static  void        testPipelineFlushBeforeRetry( void );
+static  void        testTcpReconnect( void );
+static  void        testBridgeReconnect( void );
+
+static  const char  *currentTest;
+static  int         currentFailed;
+static  int         testsFailed;
+
+
+
+// -----------------------------------------------------------------------------
+int main (void)
+{
+    printf( "%%SUITE_STARTING%% %s\n", SUITE );
+    printf( "%%SUITE_STARTED%%\n" );
+
+    //
+    //  Every plan goes to the server - nothing comes out of the cache
+    for (int c = 0; c < TRACER_CLASS_COUNT; c += 1)
+        setRegisterCacheTTL( c, 0 );
+
+    runTest( "testPipelineReordered", testPipelineReordered );
+    runTest( "testPipelineLateReply", testPipelineLateReply );
+    runTest( "testPipelineGarbled", testPipelineGarbled );
+    runTest( "testPipelineFlushBeforeRetry", testPipelineFlushBeforeRetry );
+    runTest( "testTcpReconnect", testTcpReconnect );
+    runTest( "testBridgeReconnect", testBridgeReconnect );
+
+    printf( "%%SUITE_FINISHED%% time=0\n" );
+    return (testsFailed == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+}
+
+// -----------------------------------------------------------------------------
+static
+void testPipelineReordered ()
+{
+    //
+    //  All four requests go out before any reply comes back, and the replies
+    //  come back last first. Each one still lands where its own request said.
+    mbapServer_t        server;
+    netClient_t         client;
+    tracerReadResult_t  result;
+
+    setRetries( 1, 0 );
+    if (!serverStart( &server, 0, -1 ))
+        return;
+    if (!clientStart( &client, &server, 8, 200 )) {
+        serverStop( &server );
+        return;
+    }
+    CHECK( tracerGetPipelining( client.ctx ) == 8 );
+
+    serverHold( &server, client.plan.numRequests );
+    CHECK( executeReadPlan( client.ctx, &client.plan, &result ) );
+    for (int r = 0; r < client.plan.numRequests; r += 1) {
+        CHECK( result.requestOK[ r ] && result.requestStatus[ r ] == TRACER_STATUS_OK );
+        CHECK( requestWordsMatch( &client, &result, r ) );
+    }
+    CHECK( serverRequests( &server ) == client.plan.numRequests );
+
+    clientStop( &client );
+    serverStop( &server );
+}
+
+// -----------------------------------------------------------------------------
+static
+void testPipelineLateReply ()
+{
+    //
+    //  Two in flight at a time. The first request's reply turns up after it
+    //  has timed out, while the last one is still out - it mustn't be taken
+    //  for that one's. The late request then goes again on its own.
+    //
+    //      0ms     0x3100 and 0x3200 out, 0x3200 answered, 0x3300 out
+    //    160ms     0x3300 answered, 0x331A out
+    //    200ms     0x3100 times out
+    //    260ms     0x3100's late reply, dropped
+    //    320ms     0x331A answered, 0x3100 tried again
+    mbapServer_t        server;
+    netClient_t         client;
+    tracerReadResult_t  result;
+
+    setRetries( 2, 0 );
+    if (!serverStart( &server, 0, -1 ))
+        return;
+    if (!clientStart( &client, &server, 2, 200 )) {
+        serverStop( &server );
+        return;
+    }
+
+    serverScript( &server, 0x3100, 260, GARBLE_NONE );
+    serverScript( &server, 0x3300, 160, GARBLE_NONE );
+    serverScript( &server, 0x331A, 160, GARBLE_NONE );
+    CHECK( executeReadPlan( client.ctx, &client.plan, &result ) );
+    for (int r = 0; r < client.plan.numRequests; r += 1) {
+        CHECK( result.requestOK[ r ] && result.requestStatus[ r ] == TRACER_STATUS_OK );
+        CHECK( requestWordsMatch( &client, &result, r ) );
+    }
+    CHECK( serverRequests( &server ) == client.plan.numRequests + 1 );
+
+    clientStop( &client );
+    serverStop( &server );
+}
+
+// -----------------------------------------------------------------------------
+static
+void testPipelineGarbled ()
+{
+    //
+    //  A reply with the wrong function code fails its request as a garbled
+    //  one, or is tried again if the retry policy allows. A reply with a
+    //  length nobody could send loses the framing for whatever came with it
+    //  - those time out and go again one at a time - but not for the replies
+    //  after it, and the next plan is back to normal.
+    mbapServer_t        server;
+    netClient_t         client;
+    tracerReadResult_t  result;
+    int                 requests = 0;
+
+    if (!serverStart( &server, 0, -1 ))
+        return;
+    if (!clientStart( &client, &server, 8, 100 )) {
+        serverStop( &server );
+        return;
+    }
+
+    setRetries( 1, 0 );
+    serverScript( &server, 0x3200, 0, GARBLE_FUNCTION );
+    CHECK( !executeReadPlan( client.ctx, &client.plan, &result ) );
+    for (int r = 0; r < client.plan.numRequests; r += 1) {
+        if (client.plan.requests[ r ].address == 0x3200) {
+            CHECK( !result.requestOK[ r ] && result.requestStatus[ r ] == TRACER_STATUS_CRC_ERROR );
+        } else {
+            CHECK( result.requestOK[ r ] && result.requestStatus[ r ] == TRACER_STATUS_OK );
+            CHECK( requestWordsMatch( &client, &result, r ) );
+        }
+    }
+    requests += client.plan.numRequests;
+    CHECK( serverRequests( &server ) == requests );
+
+    setRetries( 2, 0 );
+    serverScript( &server, 0x3200, 0, GARBLE_FUNCTION );
+    CHECK( executeReadPlan( client.ctx, &client.plan, &result ) );
+    for (int r = 0; r < client.plan.numRequests; r += 1) {
+        CHECK( result.requestOK[ r ] && result.requestStatus[ r ] == TRACER_STATUS_OK );
+        CHECK( requestWordsMatch( &client, &result, r ) );
+    }
+    requests += client.plan.numRequests + 1;
+    CHECK( serverRequests( &server ) == requests );
+
+    //
+    //  The first two replies in one write, the broken one first. The other
+    //  two follow a little later and have to be read as they are.
+    serverHold( &server, 2 );
+    serverScript( &server, 0x3200, 0, GARBLE_FRAMING );
+    serverScript( &server, 0x3300, 50, GARBLE_NONE );
+    serverScript( &server, 0x331A, 50, GARBLE_NONE );
+    CHECK( executeReadPlan( client.ctx, &client.plan, &result ) );
+    for (int r = 0; r < client.plan.numRequests; r += 1) {
+        CHECK( result.requestOK[ r ] && result.requestStatus[ r ] == TRACER_STATUS_OK );
+        CHECK( requestWordsMatch( &client, &result, r ) );
+    }
+    requests += client.plan.numRequests + 2;
+    CHECK( serverRequests( &server ) == requests );
+
+    CHECK( executeReadPlan( client.ctx, &client.plan, &result ) );
+    for (int r = 0; r < client.plan.numRequests; r += 1)
+        CHECK( result.requestOK[ r ] && requestWordsMatch( &client, &result, r ) );
+    requests += client.plan.numRequests;
+    CHECK( serverRequests( &server ) == requests );
+
+    clientStop( &client );
+    serverStop( &server );
+}
+
+// -----------------------------------------------------------------------------
+static
+void testPipelineFlushBeforeRetry ()
+{
+    //
+    //  The pause before a retry is long enough for the late reply to arrive
+    //  after the pipeline has finished with the socket. It has to be flushed
+    //  before the request goes again, or libmodbus reads it as the answer -
+    //  with the old transaction ID - and the retry fails too.
+    //
+    //      0ms     everything out, all but 0x3100 answered
+    //    100ms     0x3100 times out, 150ms pause
+    //    180ms     its late reply arrives
+    //    250ms     flushed, 0x3100 tried again
+    mbapServer_t        server;
+    netClient_t         client;
+    tracerReadResult_t  result;
+
+    setRetries( 2, 150000L );
+    if (!serverStart( &server, 0, -1 ))
+        return;
+    if (!clientStart( &client, &server, 8, 100 )) {
+        serverStop( &server );
+        return;
+    }
+
+    serverScript( &server, 0x3100, 180, GARBLE_NONE );
+    CHECK( executeReadPlan( client.ctx, &client.plan, &result ) );
+    for (int r = 0; r < client.plan.numRequests; r += 1) {
+        CHECK( result.requestOK[ r ] && result.requestStatus[ r ] == TRACER_STATUS_OK );
+        CHECK( requestWordsMatch( &client, &result, r ) );
+    }
+    CHECK( serverRequests( &server ) == client.plan.numRequests + 1 );
+
+    setRetries( 1, 0 );
+    clientStop( &client );
+    serverStop( &server );
+}
+
+// -----------------------------------------------------------------------------
+static
+void testTcpReconnect ()
+{
+    //
+    //  A poller on a Modbus TCP controller, and the server goes away in the
+    //  middle of it. The hang up shows as an I/O error straight away, and
+    //  while the server stays away the snapshots fail without waiting on
+    //  anything. Reconnecting backs off - 250ms, 500ms, 1s, 2s - so a server
+    //  back after two seconds is found by the try at about 3.75s, not by
+    //  the next poll.
+    epsolarRealTimeData_t   rtData;
+    mbapServer_t            server;
+    char                    portName[ 64 ];
+    unsigned int            count = 0, later = 0;
+    int                     on = 0;
+    socklen_t               length = sizeof( on );
+
+    setRetries( 1, 0 );
+    if (!serverStart( &server, 0, -1 ))
+        return;
+    int port = server.port;
+
+    snprintf( portName, sizeof( portName ), "tcp://127.0.0.1:%d", port );
+    epsolarController_t *controller = epsolarControllerNew( portName, 115200, 'N', 8, 1, 1 );
+    CHECK( controller != NULL );
+    if (controller == NULL) {
+        serverStop( &server );
+        return;
+    }
+    controller->keepaliveSeconds = 6;
+    CHECK( epsolarControllerConnect( controller ) );
+
+    //
+    //  Dead connections the server can't tell us about are the keepalive's job
+    int fd = modbus_get_socket( epsolarControllerGetContext( controller ) );
+    CHECK( getsockopt( fd, SOL_SOCKET, SO_KEEPALIVE, &on, &length ) == 0 && on == 1 );
+#ifdef TCP_KEEPIDLE
+    CHECK( getsockopt( fd, IPPROTO_TCP, TCP_KEEPIDLE, &on, &length ) == 0 && on == 6 );
+#endif
+
+    epsolarPoller_t *poller = epsolarPollerStart( controller, 50 );
+    CHECK( poller != NULL );
+    if (poller == NULL) {
+        epsolarControllerFree( controller );
+        serverStop( &server );
+        return;
+    }
+
+    for (int waited = 0; (epsolarPollerGetSnapshot( poller, &rtData ) == 0 || rtData.readStatus != TRACER_STATUS_OK) && waited < 2000; waited += 5)
+        sleepMillis( 5 );
+    CHECK( rtData.readStatus == TRACER_STATUS_OK );
+    CHECK( rtData.batteryStatusBits == 0x3200 );
+
+    serverStop( &server );
+    int64_t stoppedAt = nowMillis();
+    for (int waited = 0; epsolarPollerGetSnapshot( poller, &rtData ) && rtData.readStatus == TRACER_STATUS_OK && waited < 2000; waited += 5)
+        sleepMillis( 5 );
+    CHECK( rtData.readStatus == TRACER_STATUS_IO_ERROR );
+
+    count = epsolarPollerGetSnapshot( poller, &rtData );
+    sleepMillis( (int) (stoppedAt + 2000 - nowMillis()) );
+    later = epsolarPollerGetSnapshot( poller, &rtData );
+    CHECK( rtData.readStatus == TRACER_STATUS_IO_ERROR );
+    CHECK( later - count >= 10 );
+
+    if (!serverStart( &server, port, -1 )) {
+        epsolarPollerStop( poller );
+        epsolarControllerFree( controller );
+        return;
+    }
+    int64_t restartedAt = nowMillis();
+    for (int waited = 0; epsolarPollerGetSnapshot( poller, &rtData ) && rtData.readStatus != TRACER_STATUS_OK && waited < 6000; waited += 5)
+        sleepMillis( 5 );
+    int64_t recoveredAfter = nowMillis() - restartedAt;
+
+    CHECK( rtData.readStatus == TRACER_STATUS_OK );
+    CHECK( rtData.batteryStatusBits == 0x3200 );
+    CHECK( recoveredAfter >= 500 && recoveredAfter <= 4000 );
+    CHECK( serverConnections( &server ) == 1 );
+
+    epsolarPollerStop( poller );
+    epsolarControllerDisconnect( controller );
+    epsolarControllerFree( controller );
+    serverStop( &server );
+}
+
+// -----------------------------------------------------------------------------
+static
+void testBridgeReconnect ()
+{
+    //
+    //  RTU over TCP to a transparent gateway in front of the simulator. The
+    //  bridge notices the gateway hang up, reads fail while it's away, and
+    //  it reconnects by itself - backing off, so a gateway back after 1.2s
+    //  is found by the try at about 2s. Nothing is sent meanwhile, so the
+    //  bridge's waits run their full length.
+    epsolarRealTimeData_t   rtData;
+    mbapServer_t            server;
+    struct termios          tio;
+    char                    portName[ 64 ];
+
+    setRetries( 1, 0 );
+    epsolarSimulator_t *sim = epsolarSimulatorStart( NULL );
+    CHECK( sim != NULL );
+    if (sim == NULL)
+        return;
+
+    int simFd = open( epsolarSimulatorGetPortName( sim ), O_RDWR | O_NOCTTY | O_CLOEXEC );
+    CHECK( simFd >= 0 );
+    if (simFd < 0 || !serverStart( &server, 0, simFd )) {
+        if (simFd >= 0)
+            close( simFd );
+        epsolarSimulatorStop( sim );
+        return;
+    }
+    tcgetattr( simFd, &tio );
+    cfmakeraw( &tio );
+    tcsetattr( simFd, TCSANOW, &tio );
+    int port = server.port;
+
+    snprintf( portName, sizeof( portName ), "rtu+tcp://127.0.0.1:%d", port );
+    epsolarController_t *controller = epsolarControllerNew( portName, 115200, 'N', 8, 1, 1 );
+    CHECK( controller != NULL && epsolarControllerConnect( controller ) );
+    if (controller == NULL || controller->ctx == NULL) {
+        epsolarControllerFree( controller );
+        serverStop( &server );
+        close( simFd );
+        epsolarSimulatorStop( sim );
+        return;
+    }
+    modbus_t *ctx = epsolarControllerGetContext( controller );
+    setResponseMillis( ctx, 100 );
+
+    epsolarControllerGetRealTimeData( controller, &rtData );
+    CHECK( rtData.readStatus == TRACER_STATUS_OK );
+    CHECK( epsolarTcpBridgeIsConnected( controller->bridge ) );
+
+    serverStop( &server );
+    int64_t stoppedAt = nowMillis();
+    for (int waited = 0; epsolarTcpBridgeIsConnected( controller->bridge ) && waited < 2000; waited += 5)
+        sleepMillis( 5 );
+    CHECK( !epsolarTcpBridgeIsConnected( controller->bridge ) );
+    CHECK( nowMillis() - stoppedAt < 500 );
+
+    tracerClearStatus();
+    readRegisterAsInt( ctx, TRACER_BATTERY_VOLTAGE );
+    CHECK( tracerGetLastStatus() == TRACER_STATUS_TIMEOUT );
+
+    sleepMillis( (int) (stoppedAt + 1200 - nowMillis()) );
+    if (!serverStart( &server, port, simFd )) {
+        epsolarControllerFree( controller );
+        close( simFd );
+        epsolarSimulatorStop( sim );
+        return;
+    }
+    int64_t restartedAt = nowMillis();
+    for (int waited = 0; !epsolarTcpBridgeIsConnected( controller->bridge ) && waited < 5000; waited += 5)
+        sleepMillis( 5 );
+    int64_t reconnectedAfter = nowMillis() - restartedAt;
+
+    CHECK( epsolarTcpBridgeIsConnected( controller->bridge ) );
+    CHECK( reconnectedAfter >= 400 && reconnectedAfter <= 3000 );
+    CHECK( serverConnections( &server ) == 1 );
+
+    epsolarControllerGetRealTimeData( controller, &rtData );
+    CHECK( rtData.readStatus == TRACER_STATUS_OK );
+
+    epsolarControllerDisconnect( controller );
+    epsolarControllerFree( controller );
+    serverStop( &server );
+    close( simFd );
+    epsolarSimulatorStop( sim );
+}
+
+// -----------------------------------------------------------------------------
+static
+int serverStart (mbapServer_t *server, const int port, const int relayFd)
+{
+    //
+    //  Listens on loopback. Port 0 picks a free one; give the same port again
+    //  to bring a stopped server back where the clients expect it. relayFd
+    //  is left open when the server stops.
+    struct sockaddr_in  address;
+    socklen_t           length = sizeof( address );
+    int                 on = 1;
+
+    memset( server, '\0', sizeof( *server ) );
+    server->clientFd = -1;
+    server->relayFd = relayFd;
+    atomic_init( &server->stopRequested, FALSE );
+    pthread_mutex_init( &server->lock, NULL );
+
+    memset( &address, '\0', sizeof( address ) );
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl( INADDR_LOOPBACK );
+    address.sin_port = htons( port );
+
+    server->listenFd = socket( AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0 );
+    CHECK( server->listenFd >= 0 );
+    if (server->listenFd < 0)
+        return FALSE;
+    setsockopt( server->listenFd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof( on ) );
+
+    int ok = (bind( server->listenFd, (struct sockaddr *) &address, sizeof( address ) ) == 0 &&
+              listen( server->listenFd, 4 ) == 0 &&
+              getsockname( server->listenFd, (struct sockaddr *) &address, &length ) == 0 &&
+              pthread_create( &server->thread, NULL, serverThread, server ) == 0);
+    CHECK( ok );
+    if (!ok) {
+        close( server->listenFd );
+        return FALSE;
+    }
+
+    server->port = ntohs( address.sin_port );
+    if (relayFd >= 0)
+        tcflush( relayFd, TCIOFLUSH );
+    return TRUE;
+}
+
+// -----------------------------------------------------------------------------
+static
+void serverStop (mbapServer_t *server)
+{
+    //
+    //  Hangs up on the client and stops listening, as a gateway losing power
+    //  would look from the other end
+    atomic_store( &server->stopRequested, TRUE );
+    pthread_join( server->thread, NULL );
+
+    if (server->clientFd >= 0)
+        close( server->clientFd );
+    close( server->listenFd );
+    pthread_mutex_destroy( &server->lock );
+}
+
+// -----------------------------------------------------------------------------
+static
+void serverScript (mbapServer_t *server, const int address, const int delayMillis, const int garble)
+{
+    pthread_mutex_lock( &server->lock );
+    if (server->numScripted < MAX_SCRIPTED) {
+        scriptedReply_t *entry = &server->script[ server->numScripted++ ];
+        entry->address = address;
+        entry->delayMillis = delayMillis;
+        entry->garble = garble;
+        entry->used = FALSE;
+    }
+    pthread_mutex_unlock( &server->lock );
+}
+
+// -----------------------------------------------------------------------------
+static
+void serverHold (mbapServer_t *server, const int numReplies)
+{
+    pthread_mutex_lock( &server->lock );
+    server->holdReplies = numReplies;
+    server->numHeld = 0;
+    pthread_mutex_unlock( &server->lock );
+}
+
+// -----------------------------------------------------------------------------
+static
+int serverRequests (mbapServer_t *server)
+{
+    pthread_mutex_lock( &server->lock );
+    int requests = server->requests;
+    pthread_mutex_unlock( &server->lock );
+
+    return requests;
+}
+
+// -----------------------------------------------------------------------------
+static
+int serverConnections (mbapServer_t *server)
+{
+    pthread_mutex_lock( &server->lock );
+    int connections = server->connections;
+    pthread_mutex_unlock( &server->lock );
+
+    return connections;
+}
+
+// -----------------------------------------------------------------------------
+static
+void *serverThread (void *arg)
+{
+    //
+    //  One client at a time; a new connection replaces the old one. Replies
+    //  that fall due together go out in a single write.
+    mbapServer_t    *server = (mbapServer_t *) arg;
+    uint8_t         buffer[ 2 * MODBUS_TCP_MAX_ADU_LENGTH ];
+    int             buffered = 0;
+
+    while (!atomic_load( &server->stopRequested )) {
+        struct pollfd   pfds[ 3 ] = {
+            { .fd = server->listenFd, .events = POLLIN },
+            { .fd = server->clientFd, .events = POLLIN },
+            { .fd = server->relayFd, .events = POLLIN }
+        };
+
+        if (poll( pfds, 3, SERVER_POLL_MILLIS ) < 0 && errno != EINTR)
+            break;
+
+        if (server->relayFd >= 0 && (pfds[ 2 ].revents & POLLIN))
+            serverRelay( server );
+
+        if (pfds[ 0 ].revents & POLLIN) {
+            int fd = accept4( server->listenFd, NULL, NULL, SOCK_CLOEXEC );
+            if (fd >= 0) {
+                if (server->clientFd >= 0)
+                    close( server->clientFd );
+                server->clientFd = fd;
+                buffered = 0;
+                pthread_mutex_lock( &server->lock );
+                server->connections += 1;
+                server->numPending = 0;
+                pthread_mutex_unlock( &server->lock );
+                continue;
+            }
+        }
+
+        if (server->clientFd >= 0 && (pfds[ 1 ].revents & (POLLIN | POLLHUP | POLLERR))) {
+            ssize_t got = recv( server->clientFd, &buffer[ buffered ], sizeof( buffer ) - buffered, 0 );
+            if (got <= 0) {
+                close( server->clientFd );
+                server->clientFd = -1;
+                continue;
+            }
+            if (server->relayFd >= 0) {
+                write( server->relayFd, buffer, got );
+                continue;
+            }
+            buffered += got;
+
+            while (buffered >= 7 && buffered >= 6 + ((buffer[ 4 ] << 8) | buffer[ 5 ])) {
+                int length = 6 + ((buffer[ 4 ] << 8) | buffer[ 5 ]);
+                serverRequest( server, buffer, length );
+                memmove( buffer, &buffer[ length ], buffered - length );
+                buffered -= length;
+            }
+        }
+
+        //
+        //  Whatever has come due
+        uint8_t out[ MAX_PENDING * MODBUS_TCP_MAX_ADU_LENGTH ];
+        size_t  outLength = 0;
+        int64_t now = nowMillis();
+
+        pthread_mutex_lock( &server->lock );
+        for (int i = 0; i < server->numPending; ) {
+            if (server->pending[ i ].dueMillis > now) {
+                i += 1;
+                continue;
+            }
+            memcpy( &out[ outLength ], server->pending[ i ].adu, server->pending[ i ].length );
+            outLength += server->pending[ i ].length;
+            server->pending[ i ] = server->pending[ --server->numPending ];
+        }
+        pthread_mutex_unlock( &server->lock );
+
+        if (outLength > 0 && server->clientFd >= 0)
+            send( server->clientFd, out, outLength, MSG_NOSIGNAL );
+    }
+
+    return NULL;
+}
+
+// -----------------------------------------------------------------------------
+static
+void serverRelay (mbapServer_t *server)
+{
+    //
+    //  The simulator's reply, on to the client - or nowhere, if nobody's
+    //  connected
+    uint8_t buffer[ MODBUS_TCP_MAX_ADU_LENGTH ];
+
+    ssize_t got = read( server->relayFd, buffer, sizeof( buffer ) );
+    if (got > 0 && server->clientFd >= 0)
+        send( server->clientFd, buffer, got, MSG_NOSIGNAL );
+}
+
+// -----------------------------------------------------------------------------
+static
+void serverRequest (mbapServer_t *server, const uint8_t *adu, const int length)
+{
+    //
+    //  One whole request in, its reply queued to go out when the script says.
+    //  Pending replies are kept in the order they were queued.
+    pendingReply_t  reply;
+    int             address = (length >= 12 ? (adu[ 8 ] << 8) | adu[ 9 ] : -1);
+
+    memset( &reply, '\0', sizeof( reply ) );
+    reply.length = buildReply( adu, reply.adu );
+    reply.dueMillis = nowMillis();
+
+    pthread_mutex_lock( &server->lock );
+    server->requests += 1;
+
+    for (int i = 0; i < server->numScripted; i += 1) {
+        scriptedReply_t *entry = &server->script[ i ];
+        if (entry->used || entry->address != address)
+            continue;
+
+        entry->used = TRUE;
+        reply.dueMillis += entry->delayMillis;
+        if (entry->garble == GARBLE_FUNCTION)
+            reply.adu[ 7 ] ^= 0x01;
+        else if (entry->garble == GARBLE_FRAMING)
+            reply.adu[ 4 ] = reply.adu[ 5 ] = 0xFF;
+        break;
+    }
+
+    if (server->holdReplies > 0) {
+        server->held[ server->numHeld++ ] = reply;
+        if (server->numHeld == server->holdReplies) {
+            for (int i = server->numHeld - 1; i >= 0 && server->numPending < MAX_PENDING; i -= 1)
+                server->pending[ server->numPending++ ] = server->held[ i ];
+            server->holdReplies = 0;
+            server->numHeld = 0;
+        }
+    } else if (server->numPending < MAX_PENDING) {
+        server->pending[ server->numPending++ ] = reply;
+    }
+    pthread_mutex_unlock( &server->lock );
+}
+
+// -----------------------------------------------------------------------------
+static
+int buildReply (const uint8_t *adu, uint8_t *reply)
+{
+    //
+    //  Registers hold their own address; coils and discrete inputs are all
+    //  off. Anything else gets an illegal function exception.
+    int functionCode = adu[ 7 ];
+    int address = (adu[ 8 ] << 8) | adu[ 9 ];
+    int count = (adu[ 10 ] << 8) | adu[ 11 ];
+    int pduLength;
+
+    memcpy( reply, adu, 7 );
+    reply[ 7 ] = functionCode;
+
+    if ((functionCode == 0x03 || functionCode == 0x04) && count >= 1 && count <= MODBUS_MAX_READ_REGISTERS) {
+        reply[ 8 ] = count * 2;
+        for (int i = 0; i < count; i += 1) {
+            reply[ 9 + (2 * i) ] = ((address + i) >> 8) & 0xFF;
+            reply[ 10 + (2 * i) ] = (address + i) & 0xFF;
+        }
+        pduLength = 2 + (count * 2);
+    } else if ((functionCode == 0x01 || functionCode == 0x02) && count >= 1 && count <= MODBUS_MAX_READ_BITS) {
+        reply[ 8 ] = (count + 7) / 8;
+        memset( &reply[ 9 ], '\0', reply[ 8 ] );
+        pduLength = 2 + reply[ 8 ];
+    } else {
+        reply[ 7 ] = functionCode | 0x80;
+        reply[ 8 ] = 0x01;
+        pduLength = 2;
+    }
+
+    reply[ 4 ] = ((pduLength + 1) >> 8) & 0xFF;
+    reply[ 5 ] = (pduLength + 1) & 0xFF;
+    return 7 + pduLength;
+}
+
+// -----------------------------------------------------------------------------
+static
+int clientStart (netClient_t *client, const mbapServer_t *server, const int pipelineDepth, const int responseMillis)
+{
+    //
+    //  A plain libmodbus context, attached and pipelined, and a plan of four
+    //  input register reads of different sizes
+    static const int    addresses[] = { 0x3100, 0x3200, 0x3300, 0x331A };
+    static const int    sizes[] = { 8, 3, 20, 3 };
+    char                service[ 8 ];
+
+    memset( client, '\0', sizeof( *client ) );
+    snprintf( service, sizeof( service ), "%d", server->port );
+
+    client->ctx = modbus_new_tcp_pi( "127.0.0.1", service );
+    CHECK( client->ctx != NULL );
+    if (client->ctx == NULL)
+        return FALSE;
+
+    modbus_set_slave( client->ctx, 1 );
+    CHECK( modbus_connect( client->ctx ) == 0 );
+    CHECK( tracerAttachContext( client->ctx ) );
+    CHECK( tracerSetPipelining( client->ctx, pipelineDepth ) );
+    setResponseMillis( client->ctx, responseMillis );
+
+    for (int i = 0; i < TRACER_REGISTER_COUNT; i += 1)
+        client->plan.fieldRequest[ i ] = -1;
+    for (int r = 0; r < 4; r += 1) {
+        client->plan.requests[ r ].functionCode = 0x04;
+        client->plan.requests[ r ].address = addresses[ r ];
+        client->plan.requests[ r ].numRegisters = sizes[ r ];
+        client->plan.requests[ r ].offset = client->plan.numWords;
+        client->plan.numWords += sizes[ r ];
+    }
+    client->plan.numRequests = 4;
+
+    return TRUE;
+}
+
+// -----------------------------------------------------------------------------
+static
+void clientStop (netClient_t *client)
+{
+    tracerDetachContext( client->ctx );
+    modbus_close( client->ctx );
+    modbus_free( client->ctx );
+    memset( client, '\0', sizeof( *client ) );
+}
+
+// -----------------------------------------------------------------------------
+static
+int requestWordsMatch (const netClient_t *client, const tracerReadResult_t *result, const int r)
+{
+    const tracerReadRequest_t *req = &client->plan.requests[ r ];
+
+    for (int i = 0; i < req->numRegisters; i += 1) {
+        if (result->words[ req->offset + i ] != (uint16_t) (req->address + i))
+            return FALSE;
+    }
+    return TRUE;
+}
+
+// -----------------------------------------------------------------------------
+static
+void setResponseMillis (modbus_t *ctx, const int millis)
+{
+#ifdef RPI
+    modbus_set_response_timeout( ctx, millis / 1000, (millis % 1000) * 1000 );
+#else
+    struct timeval  timeout = { .tv_sec = millis / 1000, .tv_usec = (millis % 1000) * 1000 };
+    modbus_set_response_timeout( ctx, &timeout );
+#endif
+}
+
+// -----------------------------------------------------------------------------
+static
+void setRetries (const int maxAttempts, const long delayMicros)
+{
+    //
+    //  Timeouts and garbled replies are worth another go, nothing else is
+    tracerRetryPolicy_t policy;
+
+    memset( &policy, '\0', sizeof( policy ) );
+    policy.maxAttempts = maxAttempts;
+    policy.retry[ TRACER_STATUS_TIMEOUT ] = TRUE;
+    policy.retry[ TRACER_STATUS_CRC_ERROR ] = TRUE;
+    policy.delayMicros = delayMicros;
+    tracerSetRetryPolicy( &policy );
+}
+
+// -----------------------------------------------------------------------------
+static
+int64_t nowMillis ()
+{
+    struct timespec now;
+
+    clock_gettime( CLOCK_MONOTONIC, &now );
+    return ((int64_t) now.tv_sec * 1000) + (now.tv_nsec / 1000000L);
+}
+
+// -----------------------------------------------------------------------------
+static
+void sleepMillis (const int millis)
+{
+    if (millis <= 0)
+        return;
+
+    struct timespec pause = { .tv_sec = millis / 1000, .tv_nsec = (millis % 1000) * 1000000L };
+    nanosleep( &pause, NULL );
+}
+
+// -----------------------------------------------------------------------------
+static
+void check (const int passed, const char *condition, const int line)
+{
+    if (passed)
+        return;
+
+    printf( "%%TEST_FAILED%% time=0 testname=%s (%s) message=line %d: %s\n", currentTest, SUITE, line, condition );
+    currentFailed = TRUE;
+}
+
+// -----------------------------------------------------------------------------
+static
+void runTest (const char *name, void (*test)( void ))
+{
+    currentTest = name;
+    currentFailed = FALSE;
+
+    printf( "%%TEST_STARTED%% %s (%s)\n", name, SUITE );
+    test();
+    printf( "%%TEST_FINISHED%% time=0 %s (%s)\n", name, SUITE );
+
+    if (currentFailed)
+        testsFailed += 1;
+}
@@ -0,0 +1,869 @@
+/*
+ * Tests run against the simulator.
+ *
+ *  Each test starts a simulated controller on a pty, talks to it through a
+ *  controller handle the way an application would, and checks what went over
+ *  the wire with the simulator's own counters.
+ *
+ *  Output is in the NetBeans simple test format. Exits non-zero if anything
+ *  failed.
+ */
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <modbus/modbus.h>
+
+#include "libepsolar.h"
+#include "epsolarsim.h"
+
+
+#define SUITE       "simtests"
+
+#define CHECK(condition)    check( (condition), #condition, __LINE__ )
+
+typedef struct simFixture {
+    epsolarSimulator_t  *sim;
+    epsolarController_t *controller;
+    modbus_t            *ctx;
+} simFixture_t;
+
+
+static  int         fixtureStart( simFixture_t *fixture, const epsolarSimulatorConfig_t *config );
+static  void        fixtureStop( simFixture_t *fixture );
+static  unsigned long   simRequests( epsolarSimulator_t *sim );
+static  unsigned long   simIgnored( epsolarSimulator_t *sim );
+static  void        sleepMillis( const int millis );
+static  void        check( const int passed, const char *condition, const int line );
+static  void        runTest( const char *name, void (*test)( void ) );
+
+static  void        testSimulatorAnswers( void );
+static  void        testSimulatorPacing( void );
+static  void        testNegativeReadings( void );
+static  void        testPlanAgainstSimulator( void );
+static  void        testCacheHitAndExpiry( void );
+static  void        testRetryBudget( void );
+static  void        testBatterySettings( void );
+static  void        testPollerSnapshots( void );
+static  void        testSlaveCachesAndTimeouts( void );
+static  void        testSchedulerBacksOffDeadSlave( void );
+static  void        testAdaptiveTimeouts( void );
+static  void        testRawSnapshot( void );
+static  void        testDiscoveryStateFile( void );
+
+static  const char  *currentTest;
+static  int         currentFailed;
+static  int         testsFailed;
+
+
+
+// -----------------------------------------------------------------------------
+int main (void)
+{
+    printf( "%%SUITE_STARTING%% %s\n", SUITE );
+    printf( "%%SUITE_STARTED%%\n" );
+
+    runTest( "testSimulatorAnswers", testSimulatorAnswers );
+    runTest( "testSimulatorPacing", testSimulatorPacing );
+    runTest( "testNegativeReadings", testNegativeReadings );
+    runTest( "testPlanAgainstSimulator", testPlanAgainstSimulator );
+    runTest( "testCacheHitAndExpiry", testCacheHitAndExpiry );
+    runTest( "testRetryBudget", testRetryBudget );
+    runTest( "testBatterySettings", testBatterySettings );
+    runTest( "testPollerSnapshots", testPollerSnapshots );
+    runTest( "testSlaveCachesAndTimeouts", testSlaveCachesAndTimeouts );
+    runTest( "testSchedulerBacksOffDeadSlave", testSchedulerBacksOffDeadSlave );
+    runTest( "testAdaptiveTimeouts", testAdaptiveTimeouts );
+    runTest( "testRawSnapshot", testRawSnapshot );
+    runTest( "testDiscoveryStateFile", testDiscoveryStateFile );
+
+    printf( "%%SUITE_FINISHED%% time=0\n" );
+    return (testsFailed == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+}
+
+// -----------------------------------------------------------------------------
+static
+void testSimulatorAnswers ()
+{
+    //
+    //  Plain libmodbus calls, no library in between. Registers poked in are
+    //  read back, writes land in the table, anything outside the map is an
+    //  exception and another slave's requests are ignored.
+    uint16_t        words[ 4 ];
+    uint8_t         bits[ 2 ];
+    simFixture_t    fixture;
+
+    if (!fixtureStart( &fixture, NULL ))
+        return;
+
+    epsolarSimulatorSetRegister( fixture.sim, 0x04, 0x3100, 1234 );
+    epsolarSimulatorSetRegister( fixture.sim, 0x04, 0x3101, 567 );
+    epsolarSimulatorResetStats( fixture.sim );
+
+    CHECK( modbus_read_input_registers( fixture.ctx, 0x3100, 2, words ) == 2 );
+    CHECK( words[ 0 ] == 1234 && words[ 1 ] == 567 );
+    CHECK( modbus_read_registers( fixture.ctx, 0x9001, 1, words ) == 1 && words[ 0 ] == 200 );
+    CHECK( modbus_read_bits( fixture.ctx, 0x0000, 1, bits ) == 1 && bits[ 0 ] == 1 );
+
+    CHECK( modbus_write_register( fixture.ctx, 0x9003, 1580 ) == 1 );
+    CHECK( epsolarSimulatorGetRegister( fixture.sim, 0x03, 0x9003 ) == 1580 );
+    CHECK( simRequests( fixture.sim ) == 4 );
+
+    //
+    //  0x3009 sits in the hole between the rated data and 0x300E, so a read
+    //  across it is refused like the real controller does
+    CHECK( modbus_read_input_registers( fixture.ctx, 0x3000, 10, words ) == -1 );
+    CHECK( errno == EMBXILADD );
+    CHECK( modbus_write_register( fixture.ctx, 0x9010, 1 ) == -1 );
+
+    epsolarSimulatorStats_t stats;
+    epsolarSimulatorGetStats( fixture.sim, &stats );
+    CHECK( stats.requests == 6 && stats.exceptions == 2 && stats.ignored == 0 );
+    CHECK( stats.bytesIn > 0 && stats.bytesOut > 0 );
+
+    modbus_set_slave( fixture.ctx, 7 );
+    CHECK( modbus_read_input_registers( fixture.ctx, 0x3100, 1, words ) == -1 );
+    CHECK( simIgnored( fixture.sim ) == 1 && simRequests( fixture.sim ) == 6 );
+
+    fixtureStop( &fixture );
+}
+
+// -----------------------------------------------------------------------------
+static
+void testSimulatorPacing ()
+{
+    //
+    //  At 9600 baud with a 20ms turnaround, reading ten registers is an 8
+    //  byte request and a 25 byte reply - 33 characters of 10 bits, or about
+    //  34ms on the wire. The reply can't turn up any sooner than 54ms.
+    epsolarSimulatorConfig_t    config = { .slaveId = 1, .baudRate = 9600, .bitsPerChar = 10, .turnaroundMicros = 20000 };
+    struct timespec             started, finished;
+    uint16_t                    words[ 10 ];
+    simFixture_t                fixture;
+
+    if (!fixtureStart( &fixture, &config ))
+        return;
+
+    clock_gettime( CLOCK_MONOTONIC, &started );
+    CHECK( modbus_read_input_registers( fixture.ctx, 0x3100, 10, words ) == 10 );
+    clock_gettime( CLOCK_MONOTONIC, &finished );
+
+    long elapsedMillis = ((finished.tv_sec - started.tv_sec) * 1000L) + ((finished.tv_nsec - started.tv_nsec) / 1000000L);
+    CHECK( elapsedMillis >= 54 );
+    CHECK( elapsedMillis < 500 );
+
+    fixtureStop( &fixture );
+}
+
+// -----------------------------------------------------------------------------
+static
+void testNegativeReadings ()
+{
+    //
+    //  A battery discharging at 2.50A on a frosty morning, through a single
+    //  getter and through a whole snapshot
+    epsolarRealTimeData_t   rtData;
+    simFixture_t            fixture;
+
+    if (!fixtureStart( &fixture, NULL ))
+        return;
+
+    epsolarSimulatorSetRegister( fixture.sim, 0x04, 0x331B, 0xFF06 );       // -250, low word first
+    epsolarSimulatorSetRegister( fixture.sim, 0x04, 0x331C, 0xFFFF );
+    epsolarSimulatorSetRegister( fixture.sim, 0x04, 0x3110, 0xFDDA );       // -5.50C
+
+    CHECK( getBatteryCurrent( fixture.ctx ) == -2.50f );
+    CHECK( fabsf( getBatteryTemperature( fixture.ctx ) - 22.1f ) < 0.001f );
+
+    epsolarControllerGetRealTimeData( fixture.controller, &rtData );
+    CHECK( rtData.readStatus == TRACER_STATUS_OK );
+    CHECK( fabs( rtData.batteryCurrent + 2.50 ) < 0.0001 );
+    CHECK( fabs( rtData.batteryTemperature - 22.1 ) < 0.001 );
+
+    fixtureStop( &fixture );
+}
+
+// -----------------------------------------------------------------------------
+static
+void testPlanAgainstSimulator ()
+{
+    //
+    //  Registers scattered over three ranges, two of them close enough to be
+    //  read as one. Every value has to come back as the simulator holds it,
+    //  and the controller has to see exactly the requests the plan lists.
+    static const int    regIds[] = {
+        TRACER_PV_ARRAY_INPUT_VOLTAGE, TRACER_PV_ARRAY_INPUT_CURRENT, TRACER_PV_ARRAY_INPUT_POWER,
+        TRACER_BATTERY_STATE_OF_CHARGE, TRACER_GENERATED_ENERGY_TOTAL, TRACER_BATTERY_VOLTAGE
+    };
+    static const int    numIds = sizeof( regIds ) / sizeof( regIds[ 0 ] );
+    tracerReadPlan_t    plan;
+    tracerReadResult_t  result;
+    simFixture_t        fixture;
+
+    CHECK( planRegisterReads( regIds, numIds, TRACER_DEFAULT_GAP_FILL, &plan ) == TRUE );
+    CHECK( plan.numRequests > 0 && plan.numRequests < numIds );
+    for (int i = 0; i < numIds; i += 1)
+        CHECK( plan.fieldRequest[ regIds[ i ] ] >= 0 );
+
+    if (!fixtureStart( &fixture, NULL ))
+        return;
+
+    epsolarSimulatorSetRegister( fixture.sim, 0x04, 0x3100, 1234 );         // 12.34 V
+    epsolarSimulatorSetRegister( fixture.sim, 0x04, 0x3101, 567 );          // 5.67 A
+    epsolarSimulatorSetRegister( fixture.sim, 0x04, 0x3312, 0x5678 );       // low word first
+    epsolarSimulatorSetRegister( fixture.sim, 0x04, 0x3313, 0x0001 );
+    epsolarSimulatorSetRegister( fixture.sim, 0x04, 0x331A, 1325 );
+    epsolarSimulatorResetStats( fixture.sim );
+
+    CHECK( executeReadPlan( fixture.ctx, &plan, &result ) == TRUE );
+    CHECK( simRequests( fixture.sim ) == (unsigned long) plan.numRequests );
+    for (int r = 0; r < plan.numRequests; r += 1)
+        CHECK( result.requestOK[ r ] );
+
+    CHECK( fabsf( planResultAsFloat( &plan, &result, TRACER_PV_ARRAY_INPUT_VOLTAGE ) - 12.34f ) < 0.001f );
+    CHECK( fabsf( planResultAsFloat( &plan, &result, TRACER_PV_ARRAY_INPUT_CURRENT ) - 5.67f ) < 0.001f );
+    CHECK( fabsf( planResultAsFloat( &plan, &result, TRACER_GENERATED_ENERGY_TOTAL ) - (0x15678 / 100.0f) ) < 0.01f );
+    CHECK( fabsf( planResultAsFloat( &plan, &result, TRACER_BATTERY_VOLTAGE ) - 13.25f ) < 0.001f );
+    CHECK( planResultAsInt( &plan, &result, TRACER_BATTERY_STATE_OF_CHARGE ) ==
+           (int) epsolarSimulatorGetRegister( fixture.sim, 0x04, 0x311A ) );
+
+    fixtureStop( &fixture );
+}
+
+// -----------------------------------------------------------------------------
+static
+void testCacheHitAndExpiry ()
+{
+    //
+    //  A settings register read twice inside its freshness window costs one
+    //  request, and a value changed behind the library's back only shows up
+    //  once the window has passed
+    const tracerRegister_t *reg = getRegisterDescriptor( TRACER_BOOSTING_VOLTAGE );
+    long                savedTTL = getRegisterCacheTTL( TRACER_CLASS_SETTINGS );
+    tracerStats_t       *stats = calloc( 2, sizeof( tracerStats_t ) );
+    simFixture_t        fixture;
+
+    if (stats == NULL || !fixtureStart( &fixture, NULL )) {
+        free( stats );
+        return;
+    }
+
+    setRegisterCacheTTL( TRACER_CLASS_SETTINGS, 200 );
+    invalidateRegisterCache();
+    epsolarSimulatorSetRegister( fixture.sim, reg->functionCode, reg->address, 1440 );
+    epsolarSimulatorResetStats( fixture.sim );
+    tracerGetStats( &stats[ 0 ] );
+
+    CHECK( fabsf( readRegisterAsFloat( fixture.ctx, TRACER_BOOSTING_VOLTAGE ) - 14.40f ) < 0.001f );
+    CHECK( simRequests( fixture.sim ) == 1 );
+
+    epsolarSimulatorSetRegister( fixture.sim, reg->functionCode, reg->address, 1460 );
+    CHECK( fabsf( readRegisterAsFloat( fixture.ctx, TRACER_BOOSTING_VOLTAGE ) - 14.40f ) < 0.001f );
+    CHECK( simRequests( fixture.sim ) == 1 );
+    tracerGetStats( &stats[ 1 ] );
+    CHECK( stats[ 1 ].cacheHits == stats[ 0 ].cacheHits + 1 );
+
+    sleepMillis( 250 );
+    CHECK( fabsf( readRegisterAsFloat( fixture.ctx, TRACER_BOOSTING_VOLTAGE ) - 14.60f ) < 0.001f );
+    CHECK( simRequests( fixture.sim ) == 2 );
+
+    //
+    //  A class with caching off always goes to the controller
+    CHECK( getRegisterCacheTTL( TRACER_CLASS_REALTIME ) == 0 );
+    readRegisterAsFloat( fixture.ctx, TRACER_PV_ARRAY_INPUT_VOLTAGE );
+    readRegisterAsFloat( fixture.ctx, TRACER_PV_ARRAY_INPUT_VOLTAGE );
+    CHECK( simRequests( fixture.sim ) == 4 );
+
+    setRegisterCacheTTL( TRACER_CLASS_SETTINGS, savedTTL );
+    fixtureStop( &fixture );
+    free( stats );
+}
+
+// -----------------------------------------------------------------------------
+static
+void testRetryBudget ()
+{
+    //
+    //  Talk to a slave ID nobody answers to. Every read times out, and each
+    //  one - a single register or every request of a plan - gets exactly
+    //  maxAttempts goes and no more.
+    static const int    regIds[] = { TRACER_PV_ARRAY_INPUT_VOLTAGE, TRACER_BATTERY_VOLTAGE };
+    tracerRetryPolicy_t saved, policy;
+    tracerReadPlan_t    plan;
+    tracerReadResult_t  result;
+    simFixture_t        fixture;
+
+    if (!fixtureStart( &fixture, NULL ))
+        return;
+
+    tracerGetRetryPolicy( &saved );
+    policy = saved;
+    policy.maxAttempts = 3;
+    policy.retry[ TRACER_STATUS_TIMEOUT ] = TRUE;
+    tracerSetRetryPolicy( &policy );
+    modbus_set_slave( fixture.ctx, 7 );
+
+    epsolarSimulatorResetStats( fixture.sim );
+    tracerClearStatus();
+    CHECK( readRegisterAsFloat( fixture.ctx, TRACER_PV_ARRAY_INPUT_VOLTAGE ) ==
+           getRegisterDescriptor( TRACER_PV_ARRAY_INPUT_VOLTAGE )->badReadValue );
+    CHECK( tracerGetLastStatus() == TRACER_STATUS_TIMEOUT );
+    CHECK( tracerGetFirstFailure() == TRACER_STATUS_TIMEOUT );
+    CHECK( simIgnored( fixture.sim ) == 3 );
+    CHECK( simRequests( fixture.sim ) == 0 );
+
+    CHECK( planRegisterReads( regIds, 2, TRACER_DEFAULT_GAP_FILL, &plan ) == TRUE );
+    epsolarSimulatorResetStats( fixture.sim );
+    CHECK( executeReadPlan( fixture.ctx, &plan, &result ) == FALSE );
+    CHECK( simIgnored( fixture.sim ) == (unsigned long) (3 * plan.numRequests) );
+    for (int r = 0; r < plan.numRequests; r += 1)
+        CHECK( !result.requestOK[ r ] && result.requestStatus[ r ] == TRACER_STATUS_TIMEOUT );
+
+    //
+    //  With retrying off a failure costs one attempt, and a class the policy
+    //  doesn't cover is never retried whatever maxAttempts says
+    policy.maxAttempts = 1;
+    tracerSetRetryPolicy( &policy );
+    epsolarSimulatorResetStats( fixture.sim );
+    readRegisterAsFloat( fixture.ctx, TRACER_PV_ARRAY_INPUT_VOLTAGE );
+    CHECK( simIgnored( fixture.sim ) == 1 );
+
+    policy.maxAttempts = 3;
+    policy.retry[ TRACER_STATUS_TIMEOUT ] = FALSE;
+    tracerSetRetryPolicy( &policy );
+    epsolarSimulatorResetStats( fixture.sim );
+    readRegisterAsFloat( fixture.ctx, TRACER_PV_ARRAY_INPUT_VOLTAGE );
+    CHECK( simIgnored( fixture.sim ) == 1 );
+
+    //
+    //  And back on the right slave, the first attempt just works
+    tracerSetRetryPolicy( &saved );
+    modbus_set_slave( fixture.ctx, 1 );
+    epsolarSimulatorResetStats( fixture.sim );
+    tracerClearStatus();
+    readRegisterAsFloat( fixture.ctx, TRACER_PV_ARRAY_INPUT_VOLTAGE );
+    CHECK( tracerGetLastStatus() == TRACER_STATUS_OK );
+    CHECK( simRequests( fixture.sim ) == 1 );
+
+    fixtureStop( &fixture );
+}
+
+// -----------------------------------------------------------------------------
+static
+void testBatterySettings ()
+{
+    //
+    //  The whole block goes out in one write and comes back in one read. A
+    //  profile with its voltages out of order never reaches the wire, and a
+    //  negative value survives the trip in both directions.
+    tracerBatterySettings_t settings, readBack;
+    simFixture_t            fixture;
+
+    if (!fixtureStart( &fixture, NULL ))
+        return;
+
+    CHECK( getBatterySettings( fixture.ctx, &settings ) == TRUE );
+    CHECK( settings.batteryType == 1 && settings.batteryCapacity == 200 );
+    CHECK( fabsf( settings.boostingVoltage - 14.40f ) < 0.001f );
+    CHECK( fabsf( settings.dischargingLimitVoltage - 10.60f ) < 0.001f );
+
+    //
+    //  Float above boost
+    readBack = settings;
+    readBack.floatingVoltage = 14.50f;
+    epsolarSimulatorResetStats( fixture.sim );
+    CHECK( validateBatterySettings( &readBack ) == FALSE );
+    CHECK( setBatterySettings( fixture.ctx, &readBack ) == FALSE );
+    CHECK( simRequests( fixture.sim ) == 0 );
+    CHECK( epsolarSimulatorGetRegister( fixture.sim, 0x03, 0x9008 ) == 1380 );
+
+    settings.batteryCapacity = 100;
+    settings.temperatureCompensationCoefficient = -5.00f;
+    settings.boostingVoltage = 14.60f;
+    settings.floatingVoltage = 13.70f;
+    epsolarSimulatorResetStats( fixture.sim );
+    CHECK( setBatterySettings( fixture.ctx, &settings ) == TRUE );
+    CHECK( simRequests( fixture.sim ) == 2 );
+    CHECK( epsolarSimulatorGetRegister( fixture.sim, 0x03, 0x9001 ) == 100 );
+    CHECK( epsolarSimulatorGetRegister( fixture.sim, 0x03, 0x9002 ) == 0xFE0C );    // -500
+    CHECK( epsolarSimulatorGetRegister( fixture.sim, 0x03, 0x9007 ) == 1460 );
+    CHECK( epsolarSimulatorGetRegister( fixture.sim, 0x03, 0x9008 ) == 1370 );
+
+    CHECK( getBatterySettings( fixture.ctx, &readBack ) == TRUE );
+    CHECK( readBack.temperatureCompensationCoefficient == -5.00f );
+    CHECK( fabsf( readBack.floatingVoltage - 13.70f ) < 0.001f );
+
+    //
+    //  The simulator powers up with -40.00C in 0x9018 as the controller
+    //  writes it, 0xF060. It has to read back as exactly that, and writing
+    //  it again has to put the same word back. The setter takes Fahrenheit;
+    //  31.982F is -0.01C, the smallest step below zero.
+    CHECK( readRegisterAsFloat( fixture.ctx, TRACER_BATTERY_TEMPERATURE_WARNING_LOWER_LIMIT ) == -40.00f );
+    epsolarSimulatorSetRegister( fixture.sim, 0x03, 0x9018, 0 );
+    setBatteryTemperatureWarningLowerLimit( fixture.ctx, -40.00f );
+    CHECK( epsolarSimulatorGetRegister( fixture.sim, 0x03, 0x9018 ) == 0xF060 );
+    setBatteryTemperatureWarningLowerLimit( fixture.ctx, 31.982f );
+    CHECK( epsolarSimulatorGetRegister( fixture.sim, 0x03, 0x9018 ) == 0xFFFF );
+    CHECK( readRegisterAsFloat( fixture.ctx, TRACER_BATTERY_TEMPERATURE_WARNING_LOWER_LIMIT ) == -0.01f );
+
+    fixtureStop( &fixture );
+}
+
+// -----------------------------------------------------------------------------
+static
+void testPollerSnapshots ()
+{
+    //
+    //  The poller's snapshots come off the simulator, the count goes up by one
+    //  for each, and a value changed on the controller turns up within a
+    //  couple of intervals. Before the first one there's nothing to copy.
+    epsolarRealTimeData_t   rtData;
+    unsigned int            count = 0, later = 0;
+    simFixture_t            fixture;
+
+    if (!fixtureStart( &fixture, NULL ))
+        return;
+
+    epsolarSimulatorSetRegister( fixture.sim, 0x04, 0x3100, 1234 );
+
+    epsolarPoller_t *poller = epsolarPollerStart( fixture.controller, 20 );
+    CHECK( poller != NULL );
+    if (poller == NULL) {
+        fixtureStop( &fixture );
+        return;
+    }
+
+    for (int waited = 0; (count = epsolarPollerGetSnapshot( poller, &rtData )) == 0 && waited < 2000; waited += 5)
+        sleepMillis( 5 );
+    CHECK( count >= 1 );
+    CHECK( rtData.readStatus == TRACER_STATUS_OK );
+    CHECK( fabs( rtData.pvVoltage - 12.34f ) < 0.001f );
+
+    epsolarSimulatorSetRegister( fixture.sim, 0x04, 0x3100, 2345 );
+    for (int waited = 0; (later = epsolarPollerGetSnapshot( poller, &rtData )) < count + 2 && waited < 2000; waited += 5)
+        sleepMillis( 5 );
+    CHECK( later >= count + 2 );
+    CHECK( fabs( rtData.pvVoltage - 23.45f ) < 0.001f );
+
+    //
+    //  About one snapshot per interval - not a burst, and not stalled
+    count = epsolarPollerGetSnapshot( poller, &rtData );
+    sleepMillis( 200 );
+    later = epsolarPollerGetSnapshot( poller, &rtData );
+    CHECK( later - count >= 5 && later - count <= 12 );
+
+    epsolarPollerStop( poller );
+    fixtureStop( &fixture );
+}
+
+// -----------------------------------------------------------------------------
+static
+void testSlaveCachesAndTimeouts ()
+{
+    //
+    //  Two slave IDs taking turns on one context, as the scheduler does it.
+    //  Slave 1's cached words survive a detour to slave 7, and the timeout
+    //  slave 7 runs up by not answering isn't the one slave 1 gets.
+    tracerRetryPolicy_t saved, policy;
+    simFixture_t        fixture;
+
+    if (!fixtureStart( &fixture, NULL ))
+        return;
+
+    tracerGetRetryPolicy( &saved );
+    policy = saved;
+    policy.maxAttempts = 1;
+    tracerSetRetryPolicy( &policy );
+    epsolarControllerSetAdaptiveTimeouts( fixture.controller, TRUE );
+    invalidateRegisterCache();
+    epsolarSimulatorResetStats( fixture.sim );
+
+    CHECK( fabsf( readRegisterAsFloat( fixture.ctx, TRACER_BOOSTING_VOLTAGE ) - 14.40f ) < 0.001f );
+    for (int i = 0; i < 16; i += 1)
+        readRegisterAsFloat( fixture.ctx, TRACER_PV_ARRAY_INPUT_VOLTAGE );
+    CHECK( simRequests( fixture.sim ) == 17 );
+    long plain = tracerGetResponseTimeout( fixture.ctx );
+    CHECK( plain < 100000L );
+
+    modbus_set_slave( fixture.ctx, 7 );
+    for (int i = 0; i < 3; i += 1)
+        readRegisterAsFloat( fixture.ctx, TRACER_PV_ARRAY_INPUT_VOLTAGE );
+    CHECK( simIgnored( fixture.sim ) == 3 );
+    CHECK( tracerGetResponseTimeout( fixture.ctx ) > plain );
+
+    modbus_set_slave( fixture.ctx, 1 );
+    CHECK( tracerGetResponseTimeout( fixture.ctx ) == plain );
+    CHECK( fabsf( readRegisterAsFloat( fixture.ctx, TRACER_BOOSTING_VOLTAGE ) - 14.40f ) < 0.001f );
+    CHECK( simRequests( fixture.sim ) == 17 );
+
+    tracerSetRetryPolicy( &saved );
+    fixtureStop( &fixture );
+}
+
+// -----------------------------------------------------------------------------
+static
+void testSchedulerBacksOffDeadSlave ()
+{
+    //
+    //  Slave 7 on the same bus never answers. It gets tried now and then and
+    //  its snapshot says it timed out, while slave 1 carries on being polled
+    //  round after round.
+    static const int        slaveIds[] = { 1, 7 };
+    epsolarRealTimeData_t   rtData;
+    epsolarSchedulerStats_t stats;
+
+    epsolarSimulator_t *sim = epsolarSimulatorStart( NULL );
+    CHECK( sim != NULL );
+    if (sim == NULL)
+        return;
+
+    epsolarScheduler_t *scheduler = epsolarSchedulerNew();
+    CHECK( scheduler != NULL );
+    if (scheduler == NULL) {
+        epsolarSimulatorStop( sim );
+        return;
+    }
+
+    CHECK( epsolarSchedulerAddBus( scheduler, epsolarSimulatorGetPortName( sim ), 115200, 'N', 8, 1, slaveIds, 2 ) == 0 );
+    CHECK( epsolarSchedulerStart( scheduler, 0 ) == 1 );
+    sleepMillis( 3000 );
+
+    unsigned int healthy = epsolarSchedulerGetSnapshot( scheduler, 0, 1, &rtData );
+    CHECK( rtData.readStatus == TRACER_STATUS_OK );
+    unsigned int dead = epsolarSchedulerGetSnapshot( scheduler, 0, 7, &rtData );
+    CHECK( rtData.readStatus == TRACER_STATUS_TIMEOUT );
+    epsolarSchedulerGetStats( scheduler, &stats );
+    epsolarSchedulerStop( scheduler );
+
+    CHECK( dead >= 2 && dead <= 10 );
+    CHECK( healthy >= 3 * dead );
+    CHECK( stats.controllers == 2 && stats.controllersBackedOff == 1 );
+
+    epsolarSchedulerFree( scheduler );
+    epsolarSimulatorStop( sim );
+}
+
+// -----------------------------------------------------------------------------
+static
+void testAdaptiveTimeouts ()
+{
+    //
+    //  A controller that takes 20ms to think. The timeout starts at the
+    //  policy's half second, comes down to the round trip plus a margin once
+    //  there are enough of them, doubles on each timeout in a row up to 8x,
+    //  and goes back to libmodbus' own when turned off.
+    epsolarSimulatorConfig_t    config = { .slaveId = 1, .baudRate = 115200, .bitsPerChar = 10, .turnaroundMicros = 20000 };
+    tracerRetryPolicy_t saved, policy;
+    simFixture_t        fixture;
+
+    if (!fixtureStart( &fixture, &config ))
+        return;
+
+    tracerGetRetryPolicy( &saved );
+    policy = saved;
+    policy.maxAttempts = 1;
+    tracerSetRetryPolicy( &policy );
+
+    long original = tracerGetResponseTimeout( fixture.ctx );
+    epsolarControllerSetAdaptiveTimeouts( fixture.controller, TRUE );
+    CHECK( tracerGetResponseTimeout( fixture.ctx ) == 500000L );
+
+    for (int i = 0; i < 16; i += 1)
+        readRegisterAsFloat( fixture.ctx, TRACER_PV_ARRAY_INPUT_VOLTAGE );
+    long learned = tracerGetResponseTimeout( fixture.ctx );
+    CHECK( learned >= 20000L && learned <= 60000L );
+
+    //
+    //  Nobody home at slave 7
+    modbus_set_slave( fixture.ctx, 7 );
+    readRegisterAsFloat( fixture.ctx, TRACER_PV_ARRAY_INPUT_VOLTAGE );
+    CHECK( tracerGetLastStatus() == TRACER_STATUS_TIMEOUT );
+    CHECK( tracerGetResponseTimeout( fixture.ctx ) == 2 * learned );
+    readRegisterAsFloat( fixture.ctx, TRACER_PV_ARRAY_INPUT_VOLTAGE );
+    readRegisterAsFloat( fixture.ctx, TRACER_PV_ARRAY_INPUT_VOLTAGE );
+    CHECK( tracerGetResponseTimeout( fixture.ctx ) == 8 * learned );
+    readRegisterAsFloat( fixture.ctx, TRACER_PV_ARRAY_INPUT_VOLTAGE );
+    CHECK( tracerGetResponseTimeout( fixture.ctx ) == 8 * learned );
+
+    //
+    //  An answer puts it straight back
+    modbus_set_slave( fixture.ctx, 1 );
+    readRegisterAsFloat( fixture.ctx, TRACER_PV_ARRAY_INPUT_VOLTAGE );
+    CHECK( tracerGetLastStatus() == TRACER_STATUS_OK );
+    CHECK( tracerGetResponseTimeout( fixture.ctx ) == learned );
+
+    epsolarControllerSetAdaptiveTimeouts( fixture.controller, FALSE );
+    CHECK( tracerGetResponseTimeout( fixture.ctx ) == original );
+
+    tracerSetRetryPolicy( &saved );
+    fixtureStop( &fixture );
+}
+
+// -----------------------------------------------------------------------------
+static
+void testRawSnapshot ()
+{
+    //
+    //  The raw snapshot holds the registers word for word, signed where they
+    //  are, and its accessors agree with the decoded snapshot. A controller
+    //  that doesn't answer leaves everything zero and says why.
+    epsolarRawSnapshot_t    raw;
+    epsolarRealTimeData_t   rtData;
+    simFixture_t            fixture;
+
+    if (!fixtureStart( &fixture, NULL ))
+        return;
+
+    epsolarSimulatorSetRegister( fixture.sim, 0x04, 0x331B, 0xFF06 );       // -2.50A
+    epsolarSimulatorSetRegister( fixture.sim, 0x04, 0x331C, 0xFFFF );
+    epsolarSimulatorSetRegister( fixture.sim, 0x04, 0x3110, 0xFDDA );       // -5.50C
+    epsolarSimulatorSetRegister( fixture.sim, 0x04, 0x3111, 0xFF38 );       // -2.00C
+
+    epsolarControllerGetRawSnapshot( fixture.controller, &raw );
+
+    CHECK( raw.readStatus == TRACER_STATUS_OK );
+    CHECK( raw.timeMillis > 0 );
+    CHECK( raw.pvVoltage == 1850 && raw.pvCurrent == 250 && raw.pvPower == 4625 );
+    CHECK( raw.loadVoltage == 1330 && raw.loadCurrent == 120 && raw.loadPower == 1596 );
+    CHECK( raw.batteryVoltage == 1330 && raw.batteryStateOfCharge == 85 );
+    CHECK( raw.batteryMaxVoltage == 1420 && raw.batteryMinVoltage == 1250 );
+    CHECK( raw.batteryCurrent == -250 );
+    CHECK( raw.batteryTemperature == -550 && raw.controllerTemp == -200 );
+    CHECK( raw.energyConsumedToday == 45 && raw.energyConsumedMonth == 1310 );
+    CHECK( raw.energyConsumedYear == 15020 && raw.energyConsumedTotal == 40210 );
+    CHECK( raw.energyGeneratedToday == 120 && raw.energyGeneratedMonth == 2780 );
+    CHECK( raw.energyGeneratedYear == 31005 && raw.energyGeneratedTotal == 0x00013A98 );
+    CHECK( raw.batteryStatusBits == 0x0000 && raw.controllerStatusBits == 0x0005 && raw.dischargingStatusBits == 0x0001 );
+    CHECK( raw.loadControlMode == 0 && raw.isNightTime == 0 );
+    CHECK( raw.clock[ 2 ] != 0 );
+
+    CHECK( epsolarRawBatteryCurrent( &raw ) == -2.50 );
+    CHECK( epsolarRawCelsius( raw.batteryTemperature ) == -5.50 );
+    CHECK( epsolarRawLoadIsOn( &raw ) && !epsolarRawHasFault( &raw ) );
+
+    //
+    //  The same registers, decoded
+    epsolarControllerGetRealTimeData( fixture.controller, &rtData );
+    CHECK( fabs( epsolarRawPVVoltage( &raw ) - rtData.pvVoltage ) < 0.001 );
+    CHECK( fabs( epsolarRawPVPower( &raw ) - rtData.pvPower ) < 0.001 );
+    CHECK( fabs( epsolarRawBatteryCurrent( &raw ) - rtData.batteryCurrent ) < 0.001 );
+    CHECK( fabs( epsolarRawFahrenheit( raw.batteryTemperature ) - rtData.batteryTemperature ) < 0.001 );
+    CHECK( fabs( epsolarRawFahrenheit( raw.controllerTemp ) - rtData.controllerTemp ) < 0.001 );
+    CHECK( fabs( epsolarRawScaled( raw.energyGeneratedTotal ) - rtData.energyGeneratedTotal ) < 0.001 );
+    CHECK( epsolarRawHasFault( &raw ) == rtData.status.anyFault );
+
+    //
+    //  Nobody at slave 7. Adaptive timeouts, warmed up above, keep it quick.
+    epsolarControllerSetAdaptiveTimeouts( fixture.controller, TRUE );
+    for (int i = 0; i < 8; i += 1)
+        readRegisterAsFloat( fixture.ctx, TRACER_PV_ARRAY_INPUT_VOLTAGE );
+    modbus_set_slave( fixture.ctx, 7 );
+    epsolarControllerGetRawSnapshot( fixture.controller, &raw );
+    CHECK( raw.readStatus == TRACER_STATUS_TIMEOUT );
+    CHECK( raw.pvVoltage == 0 && raw.batteryCurrent == 0 && raw.energyGeneratedTotal == 0 );
+
+    fixtureStop( &fixture );
+}
+
+// -----------------------------------------------------------------------------
+static
+void testDiscoveryStateFile ()
+{
+    //
+    //  The first call scans and remembers what it found. After that the
+    //  state file is checked with two reads and the scan - which asks the
+    //  empty slave 7 first - only runs when the fingerprint changes or the
+    //  file is no good.
+    static const int        slaveIds[] = { 7, 1 };
+    epsolarProbeConfig_t    config;
+    epsolarFoundController_t    found;
+    epsolarSimulatorStats_t stats;
+    char                    stateFile[] = "/tmp/simtests-discovery-XXXXXX";
+    char                    contents[ 512 ];
+    const char              *portName;
+    FILE                    *fp;
+
+    epsolarSimulator_t *sim = epsolarSimulatorStart( NULL );
+    CHECK( sim != NULL );
+    if (sim == NULL)
+        return;
+
+    int fd = mkstemp( stateFile );
+    CHECK( fd != -1 );
+    if (fd == -1) {
+        epsolarSimulatorStop( sim );
+        return;
+    }
+    close( fd );
+    unlink( stateFile );
+
+    portName = epsolarSimulatorGetPortName( sim );
+    memset( &config, '\0', sizeof( config ) );
+    config.portNames = &portName;
+    config.numPortNames = 1;
+    config.slaveIds = slaveIds;
+    config.numSlaveIds = 2;
+    config.probeTimeoutMicros = 50000L;
+
+    //
+    //  Nothing remembered yet - a full scan, then the fingerprint
+    CHECK( epsolarFindControllerCached( stateFile, &config, &found ) );
+    CHECK( strcmp( found.portName, portName ) == 0 && found.slaveId == 1 && found.baudRate == 115200 );
+    epsolarSimulatorGetStats( sim, &stats );
+    CHECK( stats.ignored == 1 && stats.requests == 2 );
+    CHECK( access( stateFile, R_OK ) == 0 );
+
+    //
+    //  Remembered - the rated block and the clock, and slave 7 isn't asked
+    epsolarSimulatorResetStats( sim );
+    memset( &found, '\0', sizeof( found ) );
+    CHECK( epsolarFindControllerCached( stateFile, &config, &found ) );
+    CHECK( strcmp( found.portName, portName ) == 0 && found.slaveId == 1 );
+    epsolarSimulatorGetStats( sim, &stats );
+    CHECK( stats.ignored == 0 && stats.requests == 2 );
+
+    //
+    //  A different controller on the end of the wire - scan again and
+    //  remember the new fingerprint
+    epsolarSimulatorSetRegister( sim, 0x04, 0x3000, 10000 );
+    epsolarSimulatorResetStats( sim );
+    CHECK( epsolarFindControllerCached( stateFile, &config, &found ) );
+    epsolarSimulatorGetStats( sim, &stats );
+    CHECK( stats.ignored == 1 && stats.requests == 3 );
+
+    epsolarSimulatorResetStats( sim );
+    CHECK( epsolarFindControllerCached( stateFile, &config, &found ) );
+    epsolarSimulatorGetStats( sim, &stats );
+    CHECK( stats.ignored == 0 && stats.requests == 2 );
+
+    //
+    //  A file cut short is ignored rather than half believed
+    fp = fopen( stateFile, "r" );
+    size_t length = (fp != NULL ? fread( contents, 1, sizeof( contents ) - 1, fp ) : 0);
+    if (fp != NULL)
+        fclose( fp );
+    contents[ length ] = '\0';
+    CHECK( strstr( contents, "slave=1\n" ) != NULL );
+
+    fp = fopen( stateFile, "w" );
+    if (fp != NULL) {
+        fwrite( contents, 1, strstr( contents, "slave=" ) - contents, fp );
+        fclose( fp );
+    }
+    epsolarSimulatorResetStats( sim );
+    CHECK( epsolarFindControllerCached( stateFile, &config, &found ) );
+    CHECK( found.slaveId == 1 );
+    epsolarSimulatorGetStats( sim, &stats );
+    CHECK( stats.ignored == 1 && stats.requests == 2 );
+
+    //
+    //  And one naming a device that has gone away
+    fp = fopen( stateFile, "w" );
+    if (fp != NULL) {
+        fprintf( fp, "port=/dev/simtests-gone\nbaud=115200\nparity=N\ndataBits=8\nstopBits=1\nslave=1\n" );
+        fprintf( fp, "fingerprint=2710 0FA0 0000 0000 0000 0000 0000 0000 0000\n" );
+        fclose( fp );
+    }
+    epsolarSimulatorResetStats( sim );
+    CHECK( epsolarFindControllerCached( stateFile, &config, &found ) );
+    CHECK( strcmp( found.portName, portName ) == 0 && found.slaveId == 1 );
+    epsolarSimulatorGetStats( sim, &stats );
+    CHECK( stats.ignored == 1 && stats.requests == 2 );
+
+    unlink( stateFile );
+    epsolarSimulatorStop( sim );
+}
+
+// -----------------------------------------------------------------------------
+static
+int fixtureStart (simFixture_t *fixture, const epsolarSimulatorConfig_t *config)
+{
+    memset( fixture, '\0', sizeof( *fixture ) );
+
+    fixture->sim = epsolarSimulatorStart( config );
+    CHECK( fixture->sim != NULL );
+    if (fixture->sim == NULL)
+        return FALSE;
+
+    fixture->controller = epsolarControllerNew( epsolarSimulatorGetPortName( fixture->sim ), 115200, 'N', 8, 1, 1 );
+    CHECK( fixture->controller != NULL );
+    if (fixture->controller != NULL && epsolarControllerConnect( fixture->controller ))
+        fixture->ctx = epsolarControllerGetContext( fixture->controller );
+
+    CHECK( fixture->ctx != NULL );
+    if (fixture->ctx == NULL) {
+        fixtureStop( fixture );
+        return FALSE;
+    }
+    return TRUE;
+}
+
+// -----------------------------------------------------------------------------
+static
+void fixtureStop (simFixture_t *fixture)
+{
+    if (fixture->controller != NULL) {
+        epsolarControllerDisconnect( fixture->controller );
+        epsolarControllerFree( fixture->controller );
+    }
+    if (fixture->sim != NULL)
+        epsolarSimulatorStop( fixture->sim );
+    memset( fixture, '\0', sizeof( *fixture ) );
+}
+
+// -----------------------------------------------------------------------------
+static
+unsigned long simRequests (epsolarSimulator_t *sim)
+{
+    epsolarSimulatorStats_t stats;
+
+    epsolarSimulatorGetStats( sim, &stats );
+    return stats.requests;
+}
+
+// -----------------------------------------------------------------------------
+static
+unsigned long simIgnored (epsolarSimulator_t *sim)
+{
+    epsolarSimulatorStats_t stats;
+
+    epsolarSimulatorGetStats( sim, &stats );
+    return stats.ignored;
+}
+
+// -----------------------------------------------------------------------------
+static
+void sleepMillis (const int millis)
+{
+    struct timespec pause = { .tv_sec = millis / 1000, .tv_nsec = (millis % 1000) * 1000000L };
+    nanosleep( &pause, NULL );
+}
+
+// -----------------------------------------------------------------------------
+static
+void check (const int passed, const char *condition, const int line)
+{
+    if (passed)
+        return;
+
+    printf( "%%TEST_FAILED%% time=0 testname=%s (%s) message=line %d: %s\n", currentTest, SUITE, line, condition );
+    currentFailed = TRUE;
+}
+
+// -----------------------------------------------------------------------------
+static
+void runTest (const char *name, void (*test)( void ))
+{
+    currentTest = name;
+    currentFailed = FALSE;
+
+    printf( "%%TEST_STARTED%% %s (%s)\n", name, SUITE );
+    test();
+    printf( "%%TEST_FINISHED%% time=0 %s (%s)\n", name, SUITE );
+
+    if (currentFailed)
+        testsFailed += 1;
+}
@@ -12,27 +12,59 @@
  * 
  */
 #include <assert.h>
+#include <stddef.h>
 #include <pthread.h>
 #include <log4c.h>
 #include <errno.h>
+#include <math.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <poll.h>
+#include <sys/socket.h>
 #include <modbus/modbus.h>
 
 #include "tracerseries.h"
 
 //
 // Functions that drop down to the MODBUS level
-static int get_coil_value (modbus_t *ctx, const int coilNum, const char *description );
 static void set_coil_value (modbus_t *ctx, const int coilNum, const int value, const char *description );
-static int int_read_input_register (modbus_t *ctx, const int registerAddress, const int numBytes, const char *description, const int badReadValue );
-static float float_read_input_register (modbus_t *ctx, const int registerAddress, const int numBytes, const char *description, const float badReadValue );
-static int int_read_register (modbus_t *ctx, const int registerAddress, const int numBytes, const char *description, const int badReadValue );
-static float float_read_register (modbus_t *ctx, const int registerAddress, const int numBytes, const char *description, const float badReadValue );
 static int int_read_coil (modbus_t *ctx, const int coilNum, const char *description );
 static void int_set_coil (modbus_t *ctx, const int coilNum, const int value, const char *description );
 static void float_write_registers (modbus_t *ctx, const int registerAddress, const float floatValue );
 static void int_write_registers (modbus_t *ctx, const int registerAddress, const int intValue );
+static uint16_t float_to_register_word (const float floatValue );
+static long long decode_register_words (const tracerRegister_t *reg, const uint16_t *words );
+static int read_register_words (modbus_t *ctx, const tracerRegister_t *reg, uint16_t *words );
+typedef struct busState busState_t;
+typedef struct cachedWord cachedWord_t;
+static int modbus_read_any (busState_t *bus, modbus_t *ctx, const int functionCode, const int address, const int count, uint16_t *words, const int attemptsUsed );
+static int is_readable_range (const int functionCode, const int first, const int last );
+static int cached_read (busState_t *bus, modbus_t *ctx, const int functionCode, const int address, const int count, uint16_t *words );
+static int cache_lookup (busState_t *bus, modbus_t *ctx, const int functionCode, const int address, const int count, uint16_t *words );
+static void cache_store (busState_t *bus, modbus_t *ctx, const int functionCode, const int address, const int count, const uint16_t *words, const long long now );
+static cachedWord_t *cache_for (busState_t *bus, modbus_t *ctx );
+static int cache_slot (const int functionCode, const int address );
+static int pipelined_read_plan (busState_t *bus, modbus_t *ctx, const tracerReadPlan_t *plan, tracerReadResult_t *result );
+static int decode_pipelined_reply (const tracerReadRequest_t *req, const int slave, const uint8_t *adu, const int len, uint16_t *words );
+static void cache_invalidate (busState_t *bus, modbus_t *ctx, const int functionCode, const int address, const int count );
+static busState_t *lock_bus (modbus_t *ctx );
+static void unlock_bus (busState_t *bus );
+static long long monotonic_millis (void );
+static long long monotonic_micros (void );
+static int modbus_write_words (busState_t *bus, modbus_t *ctx, const int address, const int count, const uint16_t *words );
+static int modbus_write_coil (busState_t *bus, modbus_t *ctx, const int coilNum, const int value );
+static void record_transaction (busState_t *bus, const int functionCode, const int address, const int count, const long long micros, const int status, const int err );
+static void record_histogram (unsigned long *histogram, const long long micros );
+static void merge_stats (tracerStats_t *into, const tracerStats_t *from );
+static int end_attempt (busState_t *bus, modbus_t *ctx, const int functionCode, const int address, const int count, const long long started, const int status, const int attempt );
+static void observe_round_trip (busState_t *bus, modbus_t *ctx, const long long micros, const int status, const int err );
+static void apply_timeouts (busState_t *bus, modbus_t *ctx );
+static void set_modbus_timeouts (modbus_t *ctx, const long responseMicros, const long byteMicros );
+static void get_modbus_timeouts (modbus_t *ctx, long *responseMicros, long *byteMicros );
+static busState_t *find_attached_bus (modbus_t *ctx );
+static busState_t *acquire_bus (modbus_t *ctx, const int attachedOnly );
 
 //
 // I want my temperatures to default to Farhenheit
@@ -42,8 +74,233 @@ static float F2C(const float tempF );
 
 
 //
-// If we're in a multithreaded world, let's have a Mutex
-static pthread_mutex_t aMutex = PTHREAD_MUTEX_INITIALIZER;
+// The register map. Addresses, widths and scales are from the V2.5 spec.
+//  Input registers are unsigned except the temperatures and the battery
+//  current, which goes negative while the battery discharges. Signed registers
+//  are two's complement, as float_write_registers() writes them.
+static const tracerRegister_t registerMap[ TRACER_REGISTER_COUNT ] = {
+    //                                                      addr    fc    nb  scale  signed  bad     units   description
+    [ TRACER_CHARGING_DEVICE_STATUS ]                   = { 0x0000, 0x01, 1,   1.0, FALSE,    0.0,  "",     "Charging Device Status (Coil 0)" },
+    [ TRACER_OUTPUT_CONTROL_MODE ]                      = { 0x0001, 0x01, 1,   1.0, FALSE,    0.0,  "",     "Output Control Mode (Coil 1)" },
+    [ TRACER_MANUAL_LOAD_CONTROL_MODE ]                 = { 0x0002, 0x01, 1,   1.0, FALSE,    0.0,  "",     "Manual Load Control Mode (Coil 2)" },
+    [ TRACER_DEFAULT_LOAD_CONTROL_MODE ]                = { 0x0003, 0x01, 1,   1.0, FALSE,    0.0,  "",     "Default Load Control Mode (Coil 3)" },
+    [ TRACER_ENABLE_LOAD_TEST_MODE ]                    = { 0x0005, 0x01, 1,   1.0, FALSE,    0.0,  "",     "Enable Load Test Mode (Coil 5)" },
+
+    [ TRACER_DEVICE_OVER_TEMPERATURE ]                  = { 0x2000, 0x02, 1,   1.0, FALSE,    0.0,  "",     "Device Over Temperature" },
+    [ TRACER_NIGHT_TIME ]                               = { 0x200C, 0x02, 1,   1.0, FALSE,    0.0,  "",     "Day or Night" },
+
+    [ TRACER_RATED_CHARGING_CURRENT ]                   = { 0x3005, 0x04, 1, 100.0, FALSE,   -1.0,  "A",    "Rated Current to Battery" },
+    [ TRACER_RATED_LOAD_CURRENT ]                       = { 0x300E, 0x04, 1, 100.0, FALSE,   -1.0,  "A",    "Rated Current to Load" },
+    [ TRACER_PV_ARRAY_INPUT_VOLTAGE ]                   = { 0x3100, 0x04, 1, 100.0, FALSE,   -1.0,  "V",    "PV Array Input Voltage" },
+    [ TRACER_PV_ARRAY_INPUT_CURRENT ]                   = { 0x3101, 0x04, 1, 100.0, FALSE,   -1.0,  "A",    "PV Array Input Current" },
+    [ TRACER_PV_ARRAY_INPUT_POWER ]                     = { 0x3102, 0x04, 2, 100.0, FALSE,   -1.0,  "W",    "PV Array Input Power" },
+    [ TRACER_LOAD_VOLTAGE ]                             = { 0x310C, 0x04, 1, 100.0, FALSE,   -1.0,  "V",    "Load Voltage" },
+    [ TRACER_LOAD_CURRENT ]                             = { 0x310D, 0x04, 1, 100.0, FALSE,   -1.0,  "A",    "Load Current" },
+    [ TRACER_LOAD_POWER ]                               = { 0x310E, 0x04, 2, 100.0, FALSE,   -1.0,  "W",    "Load Power" },
+    [ TRACER_BATTERY_TEMPERATURE ]                      = { 0x3110, 0x04, 1, 100.0, TRUE,  -100.0,  "C",    "Battery Temp" },
+    [ TRACER_DEVICE_TEMPERATURE ]                       = { 0x3111, 0x04, 1, 100.0, TRUE,  -100.0,  "C",    "Device Temp" },
+    [ TRACER_BATTERY_STATE_OF_CHARGE ]                  = { 0x311A, 0x04, 1,   1.0, FALSE, -100.0,  "%",    "Battery SoC" },
+    [ TRACER_BATTERY_REAL_RATED_VOLTAGE ]               = { 0x311D, 0x04, 1, 100.0, FALSE,   -1.0,  "V",    "Battery Real Rated Voltage" },
+    [ TRACER_BATTERY_STATUS ]                           = { 0x3200, 0x04, 1,   1.0, FALSE, 0xFFFF,  "",     "Battery Status" },
+    [ TRACER_CHARGING_EQUIPMENT_STATUS ]                = { 0x3201, 0x04, 1,   1.0, FALSE, 0xFFFF,  "",     "Charging Equipment Status" },
+    [ TRACER_DISCHARGING_EQUIPMENT_STATUS ]             = { 0x3202, 0x04, 1,   1.0, FALSE, 0xFFFF,  "",     "Discharging Equipment Status" },
+    [ TRACER_MAXIMUM_PV_VOLTAGE_TODAY ]                 = { 0x3300, 0x04, 1, 100.0, FALSE,   -1.0,  "V",    "Maximum PV Voltage Today" },
+    [ TRACER_MINIMUM_PV_VOLTAGE_TODAY ]                 = { 0x3301, 0x04, 1, 100.0, FALSE,   -1.0,  "V",    "Minimum PV Voltage Today" },
+    [ TRACER_MAXIMUM_BATTERY_VOLTAGE_TODAY ]            = { 0x3302, 0x04, 1, 100.0, FALSE,   -1.0,  "V",    "Maximum Battery Voltage Today" },
+    [ TRACER_MINIMUM_BATTERY_VOLTAGE_TODAY ]            = { 0x3303, 0x04, 1, 100.0, FALSE,   -1.0,  "V",    "Minimum Battery Voltage Today" },
+    [ TRACER_CONSUMED_ENERGY_TODAY ]                    = { 0x3304, 0x04, 2, 100.0, FALSE,   -1.0,  "kWh",  "Consumed Energy Today" },
+    [ TRACER_CONSUMED_ENERGY_MONTH ]                    = { 0x3306, 0x04, 2, 100.0, FALSE,   -1.0,  "kWh",  "Consumed Energy This Month" },
+    [ TRACER_CONSUMED_ENERGY_YEAR ]                     = { 0x3308, 0x04, 2, 100.0, FALSE,   -1.0,  "kWh",  "Consumed Energy This Year" },
+    [ TRACER_CONSUMED_ENERGY_TOTAL ]                    = { 0x330A, 0x04, 2, 100.0, FALSE,   -1.0,  "kWh",  "Total Consumed Energy" },
+    [ TRACER_GENERATED_ENERGY_TODAY ]                   = { 0x330C, 0x04, 2, 100.0, FALSE,   -1.0,  "kWh",  "Generated Energy Today" },
+    [ TRACER_GENERATED_ENERGY_MONTH ]                   = { 0x330E, 0x04, 2, 100.0, FALSE,   -1.0,  "kWh",  "Generated Energy This Month" },
+    [ TRACER_GENERATED_ENERGY_YEAR ]                    = { 0x3310, 0x04, 2, 100.0, FALSE,   -1.0,  "kWh",  "Generated Energy This Year" },
+    [ TRACER_GENERATED_ENERGY_TOTAL ]                   = { 0x3312, 0x04, 2, 100.0, FALSE,   -1.0,  "kWh",  "Total Generated Energy" },
+    [ TRACER_BATTERY_VOLTAGE ]                          = { 0x331A, 0x04, 1, 100.0, FALSE,   -1.0,  "V",    "Battery Voltage" },
+    [ TRACER_BATTERY_CURRENT ]                          = { 0x331B, 0x04, 2, 100.0, TRUE,    -1.0,  "A",    "Battery Current" },
+
+    [ TRACER_BATTERY_TYPE ]                             = { 0x9000, 0x03, 1,   1.0, FALSE,   -1.0,  "",     "Battery Type" },
+    [ TRACER_BATTERY_CAPACITY ]                         = { 0x9001, 0x03, 1,   1.0, FALSE,   -1.0,  "Ah",   "Battery Capacity" },
+    [ TRACER_TEMPERATURE_COMPENSATION_COEFFICIENT ]     = { 0x9002, 0x03, 1, 100.0, TRUE,    -1.0,  "mV/C/2V", "Temperature Compensation Coefficient" },
+    [ TRACER_HIGH_VOLTAGE_DISCONNECT ]                  = { 0x9003, 0x03, 1, 100.0, TRUE,    -1.0,  "V",    "High Voltage Disconnect" },
+    [ TRACER_CHARGING_LIMIT_VOLTAGE ]                   = { 0x9004, 0x03, 1, 100.0, TRUE,    -1.0,  "V",    "Charging Limit Voltage" },
+    [ TRACER_OVER_VOLTAGE_RECONNECT ]                   = { 0x9005, 0x03, 1, 100.0, TRUE,    -1.0,  "V",    "Over Voltage Reconnect" },
+    [ TRACER_EQUALIZATION_VOLTAGE ]                     = { 0x9006, 0x03, 1, 100.0, TRUE,    -1.0,  "V",    "Equalization Voltage" },
+    [ TRACER_BOOSTING_VOLTAGE ]                         = { 0x9007, 0x03, 1, 100.0, TRUE,    -1.0,  "V",    "Boosting Voltage" },
+    [ TRACER_FLOATING_VOLTAGE ]                         = { 0x9008, 0x03, 1, 100.0, TRUE,    -1.0,  "V",    "Floating Voltage" },
+    [ TRACER_BOOST_RECONNECT_VOLTAGE ]                  = { 0x9009, 0x03, 1, 100.0, TRUE,    -1.0,  "V",    "Boost Reconnect Voltage" },
+    [ TRACER_LOW_VOLTAGE_RECONNECT_VOLTAGE ]            = { 0x900A, 0x03, 1, 100.0, TRUE,    -1.0,  "V",    "Low Voltage Reconnect Voltage" },
+    [ TRACER_UNDER_VOLTAGE_WARNING_RECOVER_VOLTAGE ]    = { 0x900B, 0x03, 1, 100.0, TRUE,    -1.0,  "V",    "Under Voltage Warning Recover Voltage" },
+    [ TRACER_UNDER_VOLTAGE_WARNING_VOLTAGE ]            = { 0x900C, 0x03, 1, 100.0, TRUE,    -1.0,  "V",    "Under Voltage Warning Voltage" },
+    [ TRACER_LOW_VOLTAGE_DISCONNECT_VOLTAGE ]           = { 0x900D, 0x03, 1, 100.0, TRUE,    -1.0,  "V",    "Low Voltage Disconnect Voltage" },
+    [ TRACER_DISCHARGING_LIMIT_VOLTAGE ]                = { 0x900E, 0x03, 1, 100.0, TRUE,    -1.0,  "V",    "Discharging Limit Voltage" },
+    [ TRACER_REALTIME_CLOCK ]                           = { 0x9013, 0x03, 3,   1.0, FALSE,    0.0,  "",     "Real Time Clock" },
+    [ TRACER_BATTERY_TEMPERATURE_WARNING_UPPER_LIMIT ]  = { 0x9017, 0x03, 1, 100.0, TRUE,    -1.0,  "C",    "Battery Temp Upper Limit" },
+    [ TRACER_BATTERY_TEMPERATURE_WARNING_LOWER_LIMIT ]  = { 0x9018, 0x03, 1, 100.0, TRUE,    -1.0,  "C",    "Battery Temp Lower Limit" },
+    [ TRACER_CONTROLLER_TEMPERATURE_UPPER_LIMIT ]       = { 0x9019, 0x03, 1, 100.0, TRUE,    -1.0,  "C",    "Controller Temp Upper Limit" },
+    [ TRACER_CONTROLLER_TEMPERATURE_UPPER_LIMIT_RECOVER ] = { 0x901A, 0x03, 1, 100.0, TRUE,  -1.0,  "C",    "Controller Temp Upper Limit Recovery" },
+    [ TRACER_DAY_TIME_THRESHOLD_VOLTAGE ]               = { 0x901E, 0x03, 1, 100.0, TRUE,    -1.0,  "V",    "Daytime Threshold Voltage" },
+    [ TRACER_LIGHT_SIGNAL_STARTUP_DELAY_TIME ]          = { 0x901F, 0x03, 1,   1.0, FALSE,   -1.0,  "min",  "Light Signal Startup Delay" },
+    [ TRACER_NIGHT_TIME_THRESHOLD_VOLTAGE ]             = { 0x9020, 0x03, 1, 100.0, TRUE,    -1.0,  "V",    "Nighttime Threshold Voltage" },
+    [ TRACER_LIGHT_SIGNAL_CLOSE_DELAY_TIME ]            = { 0x9021, 0x03, 1,   1.0, FALSE,   -1.0,  "min",  "Light Signal Close Delay" },
+    [ TRACER_LOAD_CONTROLLING_MODE ]                    = { 0x903D, 0x03, 1,   1.0, FALSE,   -1.0,  "",     "Load Controlling Mode" },
+    [ TRACER_WORKING_TIME_LENGTH_1 ]                    = { 0x903E, 0x03, 1,   1.0, FALSE, 0xFFFF,  "",     "Working Time 1 Length" },
+    [ TRACER_WORKING_TIME_LENGTH_2 ]                    = { 0x903F, 0x03, 1,   1.0, FALSE, 0xFFFF,  "",     "Working Time 2 Length" },
+    [ TRACER_TURN_ON_TIMING_1_SECOND ]                  = { 0x9042, 0x03, 1,   1.0, FALSE,   -1.0,  "s",    "Turn On T1 - Second" },
+    [ TRACER_TURN_ON_TIMING_1_MINUTE ]                  = { 0x9043, 0x03, 1,   1.0, FALSE,   -1.0,  "min",  "Turn On T1 - Minute" },
+    [ TRACER_TURN_ON_TIMING_1_HOUR ]                    = { 0x9044, 0x03, 1,   1.0, FALSE,   -1.0,  "h",    "Turn On T1 - Hour" },
+    [ TRACER_TURN_OFF_TIMING_1_SECOND ]                 = { 0x9045, 0x03, 1,   1.0, FALSE,   -1.0,  "s",    "Turn Off T1 - Second" },
+    [ TRACER_TURN_OFF_TIMING_1_MINUTE ]                 = { 0x9046, 0x03, 1,   1.0, FALSE,   -1.0,  "min",  "Turn Off T1 - Minute" },
+    [ TRACER_TURN_OFF_TIMING_1_HOUR ]                   = { 0x9047, 0x03, 1,   1.0, FALSE,   -1.0,  "h",    "Turn Off T1 - Hour" },
+    [ TRACER_TURN_ON_TIMING_2_SECOND ]                  = { 0x9048, 0x03, 1,   1.0, FALSE,   -1.0,  "s",    "Turn On T2 - Second" },
+    [ TRACER_TURN_ON_TIMING_2_MINUTE ]                  = { 0x9049, 0x03, 1,   1.0, FALSE,   -1.0,  "min",  "Turn On T2 - Minute" },
+    [ TRACER_TURN_ON_TIMING_2_HOUR ]                    = { 0x904A, 0x03, 1,   1.0, FALSE,   -1.0,  "h",    "Turn On T2 - Hour" },
+    [ TRACER_TURN_OFF_TIMING_2_SECOND ]                 = { 0x904B, 0x03, 1,   1.0, FALSE,   -1.0,  "s",    "Turn Off T2 - Second" },
+    [ TRACER_TURN_OFF_TIMING_2_MINUTE ]                 = { 0x904C, 0x03, 1,   1.0, FALSE,   -1.0,  "min",  "Turn Off T2 - Minute" },
+    [ TRACER_TURN_OFF_TIMING_2_HOUR ]                   = { 0x904D, 0x03, 1,   1.0, FALSE,   -1.0,  "h",    "Turn Off T2 - Hour" },
+    [ TRACER_BACKLIGHT_TIME ]                           = { 0x9063, 0x03, 1,   1.0, FALSE,   -1.0,  "s",    "Backlight time" },
+    [ TRACER_LENGTH_OF_NIGHT ]                          = { 0x9065, 0x03, 1,   1.0, FALSE, 0xFFFF,  "",     "Length of Night" },
+    [ TRACER_BATTERY_RATED_VOLTAGE_CODE ]               = { 0x9067, 0x03, 1,   1.0, FALSE,   -1.0,  "",     "Battery Rated Voltage Code" },
+    [ TRACER_EQUALIZE_DURATION ]                        = { 0x906B, 0x03, 1,   1.0, FALSE,   -1.0,  "min",  "Equalize Duration" },
+    [ TRACER_BOOST_DURATION ]                           = { 0x906C, 0x03, 1,   1.0, FALSE,   -1.0,  "min",  "Boost Duration" },
+    [ TRACER_DISCHARGING_PERCENTAGE ]                   = { 0x906D, 0x03, 1,   1.0, TRUE,  -100.0,  "%",    "Discharging Percentage" },
+    [ TRACER_CHARGING_PERCENTAGE ]                      = { 0x906E, 0x03, 1,   1.0, TRUE,  -100.0,  "%",    "Charging Percentage" },
+    [ TRACER_BATTERY_MANAGEMENT_MODE ]                  = { 0x9070, 0x03, 1,   1.0, FALSE,   -1.0,  "",     "Charging Mode" },
+};
+
+//
+// Address ranges the controller will answer for. A request that spans the
+//  gap between two of these gets an "illegal data address" exception, so the
+//  read planner never merges across one.
+typedef struct readableRange {
+    int     functionCode;
+    int     first;
+    int     last;
+} readableRange_t;
+
+static const readableRange_t readableRanges[] = {
+    { 0x01, 0x0000, 0x0003 },
+    { 0x01, 0x0005, 0x0006 },
+    { 0x01, 0x0013, 0x0014 },
+    { 0x02, 0x2000, 0x2000 },
+    { 0x02, 0x200C, 0x200C },
+    { 0x04, 0x3000, 0x3008 },
+    { 0x04, 0x300E, 0x300E },
+    { 0x04, 0x3100, 0x3112 },
+    { 0x04, 0x311A, 0x311D },
+    { 0x04, 0x3200, 0x3202 },
+    { 0x04, 0x3300, 0x3313 },
+    { 0x04, 0x331A, 0x331C },
+    { 0x03, 0x9000, 0x900E },
+    { 0x03, 0x9013, 0x901B },
+    { 0x03, 0x901E, 0x9021 },
+    { 0x03, 0x903D, 0x903F },
+    { 0x03, 0x9042, 0x904D },
+    { 0x03, 0x9063, 0x9063 },
+    { 0x03, 0x9065, 0x9067 },
+    { 0x03, 0x9069, 0x906E },
+    { 0x03, 0x9070, 0x9070 },
+};
+
+//
+// The read cache. One slot per word in readableRanges, laid out in table order.
+#define CACHE_SLOTS     256
+
+struct cachedWord {
+    int         valid;
+    uint16_t    value;
+    long long   fetchedAt;      // milliseconds, CLOCK_MONOTONIC
+};
+
+//
+// A bus keeps a cache per context and slave ID, so the controllers daisy
+//  chained on one port (or sharing the default bus) don't throw each other's
+//  words away every time they take turns. Past CACHES_PER_BUS of them the
+//  least recently used one is recycled.
+#define CACHES_PER_BUS  4
+
+typedef struct slaveCache {
+    modbus_t        *owner;
+    int             slave;
+    unsigned long   lastUsed;
+    cachedWord_t    words[ CACHE_SLOTS ];
+} slaveCache_t;
+
+//
+// Everything that has to be serialized per bus - the lock, the read caches and
+//  the transaction counters.
+//  A context registered with tracerAttachContext() gets its own. Anything else
+//  shares defaultBus, which is how it has always worked: one process wide
+//  mutex.
+//
+// Round trip tracking for adaptive timeouts - a window of the most recent
+//  successful transactions and the response timeout currently set from it.
+#define RTT_WINDOW          64
+#define RTT_MIN_SAMPLES     8           // before that we stay at the policy maximum
+#define RTT_UPDATE_EVERY    8
+
+typedef struct adaptiveTimeouts {
+    int                     enabled;
+    tracerTimeoutPolicy_t   policy;
+    long                    samples[ RTT_WINDOW ];      // microseconds
+    int                     numSamples;
+    int                     next;
+    int                     sinceUpdate;
+    int                     consecutiveTimeouts;
+    int                     backoffSlave;               // whose timeouts those are
+    long                    responseMicros;             // in force on the context now
+    long                    savedResponseMicros;        // what libmodbus had before we started
+    long                    savedByteMicros;
+} adaptiveTimeouts_t;
+
+struct busState {
+    modbus_t        *ctx;
+    pthread_mutex_t lock;
+    slaveCache_t    caches[ CACHES_PER_BUS ];
+    unsigned long   cacheUses;          // the clock for lastUsed
+    adaptiveTimeouts_t  timeouts;
+    int             pipelineDepth;      // Modbus TCP requests in flight at once, 0 or 1 is off
+    uint16_t        nextTransactionId;
+    tracerStats_t   stats;              // this bus's share, tracerGetStats() adds them up
+};
+
+static busState_t       defaultBus = { .lock = PTHREAD_MUTEX_INITIALIZER };
+static busState_t       *attachedBuses[ TRACER_MAX_CONTEXTS ];
+static pthread_rwlock_t registryLock = PTHREAD_RWLOCK_INITIALIZER;
+
+//
+// Rated data never changes and settings only change when we write them, but
+//  somebody can still poke at the settings from the front panel - so a minute
+//  rather than forever. Real time values aren't cached unless asked for.
+//  These apply to every bus and aren't locked, so set them up front.
+static long cacheTTL[ TRACER_CLASS_COUNT ] = {
+    [ TRACER_CLASS_RATED ]      = TRACER_CACHE_FOREVER,
+    [ TRACER_CLASS_REALTIME ]   = 0,
+    [ TRACER_CLASS_STATISTICS ] = 10000,
+    [ TRACER_CLASS_SETTINGS ]   = 60000,
+};
+
+//
+// One quick retry for line noise. Exceptions and port errors won't go away by
+//  asking again.
+static tracerRetryPolicy_t  retryPolicy = {
+    .maxAttempts = 2,
+    .retry = {
+        [ TRACER_STATUS_TIMEOUT ]   = TRUE,
+        [ TRACER_STATUS_CRC_ERROR ] = TRUE,
+    },
+    .delayMicros = 0,
+};
+
+//
+// How the calling thread's reads and writes went, for tracerGetLastStatus()
+static __thread int     lastStatus = TRACER_STATUS_OK;
+static __thread int     firstFailure = TRACER_STATUS_OK;
+
+//
+// What detached buses had counted, so their transactions don't drop out of the
+//  totals. Under registryLock.
+static tracerStats_t    retiredStats;
 
 
 
@@ -70,97 +327,68 @@ float F2C (const float tempF)
 // -----------------------------------------------------------------------------
 int deviceIsTooHot (modbus_t *ctx)
 {
-    int registerAddress = 0x2000;
-    uint8_t value = 0;
-    
-    assert( ctx != NULL );
-    pthread_mutex_lock( &aMutex );
-
-    //
-    //  Modbus fuction code 0x02    
-    if (modbus_read_input_bits( ctx, registerAddress, 1, &value) == -1) {
-        Logger_LogError("read_input_bits on register %X failed: %s\n", registerAddress, modbus_strerror(errno) );
-    }
-    pthread_mutex_unlock( &aMutex );
-
-    //
-    // Mask off the top 7 just in case
-    return (value & 0b00000001);
+    return readRegisterAsInt( ctx, TRACER_DEVICE_OVER_TEMPERATURE );
 }
 
 // -----------------------------------------------------------------------------
 int isNightTime (modbus_t *ctx)
 {
-    int registerAddress = 0x200C;
-    uint8_t value = 0;
-
-    assert( ctx != NULL );
-    pthread_mutex_lock( &aMutex );
-    //
-    //  Modbus fuction code 0x02
-    if (modbus_read_input_bits( ctx, registerAddress, 1, &value) == -1) {
-        Logger_LogError("read_input_bits on register %X failed: %s\n", registerAddress, modbus_strerror( errno ));
-    }
-    pthread_mutex_unlock( &aMutex );
-
-    //
-    // Mask off the top 7 just in case
-    return ((value & 0b00000001) == 1);
+    return (readRegisterAsInt( ctx, TRACER_NIGHT_TIME ) == 1);
 }
 
 // -----------------------------------------------------------------------------
 float getPVArrayInputVoltage (modbus_t *ctx)
 {
     
-    return float_read_input_register( ctx, 0x3100, 1, "PV Array Input Voltage", -1.0 );
+    return readRegisterAsFloat( ctx, TRACER_PV_ARRAY_INPUT_VOLTAGE );
 }
 
 // -----------------------------------------------------------------------------
 float getPVArrayInputCurrent (modbus_t *ctx)
 {    
-    return float_read_input_register( ctx, 0x3101, 1, "PV Array Input Current", -1.0 );
+    return readRegisterAsFloat( ctx, TRACER_PV_ARRAY_INPUT_CURRENT );
 }
 
 // -----------------------------------------------------------------------------
 float getPVArrayInputPower (modbus_t *ctx)
 {    
-    return float_read_input_register( ctx, 0x3102, 2, "PV Array Input Power", -1.0 );
+    return readRegisterAsFloat( ctx, TRACER_PV_ARRAY_INPUT_POWER );
 }
 
 // -----------------------------------------------------------------------------
 float getLoadVoltage (modbus_t *ctx)
 {    
-    return float_read_input_register( ctx, 0x310C, 1, "Load Voltage", -1.0 );
+    return readRegisterAsFloat( ctx, TRACER_LOAD_VOLTAGE );
 }
 
 // -----------------------------------------------------------------------------
 float getLoadCurrent (modbus_t *ctx)
 {    
-    return float_read_input_register( ctx, 0x310D, 1, "Load Current", -1.0 );
+    return readRegisterAsFloat( ctx, TRACER_LOAD_CURRENT );
 }
 
 // -----------------------------------------------------------------------------
 float getLoadPower (modbus_t *ctx)
 {    
-    return float_read_input_register( ctx, 0x310E, 2, "Load Power", -1.0 );
+    return readRegisterAsFloat( ctx, TRACER_LOAD_POWER );
 }
 
 // -----------------------------------------------------------------------------
 float getBatteryTemperature (modbus_t *ctx)
 {    
-    return C2F(float_read_input_register( ctx, 0x3110, 1, "Battery Temp", -100.0) );
+    return C2F(readRegisterAsFloat( ctx, TRACER_BATTERY_TEMPERATURE ) );
 }
 
 // -----------------------------------------------------------------------------
 float getDeviceTemperature (modbus_t *ctx)
 {    
-    return C2F(float_read_input_register( ctx, 0x3111, 1, "Device Temp", -100.0) );
+    return C2F(readRegisterAsFloat( ctx, TRACER_DEVICE_TEMPERATURE ) );
 }
 
 // -----------------------------------------------------------------------------
 int getBatteryStateOfCharge (modbus_t *ctx)
 {    
-    return (int) (float_read_input_register( ctx, 0x311A, 1, "Battery SoC", -1.0) * 100.0 );
+    return readRegisterAsInt( ctx, TRACER_BATTERY_STATE_OF_CHARGE );
 }
 
 // -----------------------------------------------------------------------------
@@ -170,7 +398,7 @@ float getBatteryRealRatedVoltage (modbus_t *ctx)
     // Current system rated voltage. 12.00, 24.00, 36.00, 48.00 
     //
     // Changing back to a float and removing / 100.
-    float value = float_read_input_register( ctx, 0x311D, 1, "Battery Real Rated Voltage", -1.0 );
+    float value = readRegisterAsFloat( ctx, TRACER_BATTERY_REAL_RATED_VOLTAGE );
     return value;
 }
 
@@ -182,7 +410,7 @@ char *getBatteryRatedVoltageCode (modbus_t *ctx)
         2-24V ,3-36V, 4-48V, 5-60V, 6-110V,
         7-120V,8-220V,9-240V */
     int value = -9;
-    value = int_read_register( ctx, 0x9067, 1, "Battery Rated Voltage Code", -1 );
+    value = readRegisterAsInt( ctx, TRACER_BATTERY_RATED_VOLTAGE_CODE );
 
     switch (value) {
         case 0: return "Auto";
@@ -223,7 +451,7 @@ uint16_t getBatteryStatusBits (modbus_t *ctx)
                03H Over discharge, 04H Fault
      * */
     
-    return int_read_input_register( ctx, 0x3200, 1, "Battery Status", 0xFFFF );
+    return readRegisterAsInt( ctx, TRACER_BATTERY_STATUS );
 }
 
 // -----------------------------------------------------------------------------
@@ -300,7 +528,7 @@ uint16_t getChargingEquipmentStatusBits (modbus_t *ctx)
      * D0: 1 ing, 0 Standby
      */
     
-    return int_read_input_register( ctx, 0x3201, 1, "Charging Equipment Status", 0xFFFF );
+    return readRegisterAsInt( ctx, TRACER_CHARGING_EQUIPMENT_STATUS );
 }
 
 
@@ -445,7 +673,7 @@ uint16_t getDischargingEquipmentStatusBits  (modbus_t *ctx)
     //  it's getting "Normal"
     //
         
-    return int_read_input_register( ctx, 0x3202, 1, "Discharging Equipment Status", 0xFFFF );
+    return readRegisterAsInt( ctx, TRACER_DISCHARGING_EQUIPMENT_STATUS );
 }
 
 
@@ -546,117 +774,238 @@ int isDischargeStatusRunning(const uint16_t statusBits)
     return ( (statusBits & 0b0000000000000001) ? TRUE : FALSE );
 } // Bit 0
 
+// -----------------------------------------------------------------------------
+//
+// The status field table. Where each field lives, which byte of
+//  tracerDecodedStatus_t it goes in, whether it counts towards anyFault, and
+//  its labels - the same words the get*Status*() helpers use.
+typedef struct statusFieldDescriptor {
+    const char          *name;
+    int                 word;
+    uint16_t            mask;
+    uint8_t             shift;
+    uint8_t             isFault;
+    size_t              offset;
+    const char * const  *labels;                // NULL for plain yes/no
+    int                 numLabels;
+} statusFieldDescriptor_t;
+
+static const char * const batteryVoltageLabels[] = { "Normal", "Over Voltage", "Under Voltage", "Over Discharge", "Fault" };
+static const char * const temperatureLabels[] = { "Normal", "High", "Low" };
+static const char * const innerResistanceLabels[] = { "Normal", "Abnormal" };
+static const char * const identificationLabels[] = { "Correct", "Incorrect" };
+static const char * const chargingStageLabels[] = { "Not Charging", "Floating", "Boosting", "Equalizing" };
+static const char * const pvInputLabels[] = { "Normal", "No Input Power Connected", "Higher Input Voltage", "Input Volt Error" };
+static const char * const loadLevelLabels[] = { "Light", "Moderate", "Rated", "Overload" };
+static const char * const dischargeInputLabels[] = { "Normal", "Low", "High", "No Access - Input Volt Error" };
+
+#define FIELD(ID, NAME, WORD, MASK, SHIFT, FAULT, MEMBER, LABELS) \
+    [ ID ] = { NAME, WORD, MASK, SHIFT, FAULT, offsetof( tracerDecodedStatus_t, MEMBER ), LABELS, (LABELS) == NULL ? 0 : (int) (sizeof( LABELS ) / sizeof( char * )) }
+#define YESNO   ((const char * const *) NULL)
+
+static const statusFieldDescriptor_t statusFields[ TRACER_NUM_STATUS_FIELDS ] = {
+    FIELD( TRACER_FIELD_BATTERY_VOLTAGE,            "Battery Voltage",          TRACER_WORD_BATTERY_STATUS,     TRACER_BATT_VOLTAGE_STATUS,         0,  FALSE,  batteryVoltage,             batteryVoltageLabels ),
+    FIELD( TRACER_FIELD_BATTERY_TEMPERATURE,        "Battery Temperature",      TRACER_WORD_BATTERY_STATUS,     TRACER_BATT_TEMPERATURE_STATUS,     4,  FALSE,  batteryTemperature,         temperatureLabels ),
+    FIELD( TRACER_FIELD_BATTERY_INNER_RESISTANCE,   "Battery Inner Resistance", TRACER_WORD_BATTERY_STATUS,     TRACER_BATT_INNER_RESISTANCE,       8,  TRUE,   batteryInnerResistanceAbnormal, innerResistanceLabels ),
+    FIELD( TRACER_FIELD_BATTERY_WRONG_RATED_VOLTAGE, "Rated Voltage Identification", TRACER_WORD_BATTERY_STATUS, TRACER_BATT_WRONG_RATED_VOLTAGE,   15, TRUE,   batteryWrongRatedVoltage,   identificationLabels ),
+
+    FIELD( TRACER_FIELD_CHARGING_RUNNING,           "Charging Running",         TRACER_WORD_CHARGING_STATUS,    TRACER_CHG_RUNNING,                 0,  FALSE,  chargingRunning,            YESNO ),
+    FIELD( TRACER_FIELD_CHARGING_FAULT_BIT,         "Charging D1",              TRACER_WORD_CHARGING_STATUS,    TRACER_CHG_FAULT,                   1,  FALSE,  chargingFaultBit,           YESNO ),
+    FIELD( TRACER_FIELD_CHARGING_STAGE,             "Charging Stage",           TRACER_WORD_CHARGING_STATUS,    TRACER_CHG_CHARGING_STAGE,          2,  FALSE,  chargingStage,              chargingStageLabels ),
+    FIELD( TRACER_FIELD_PV_INPUT_SHORTED,           "PV Input Shorted",         TRACER_WORD_CHARGING_STATUS,    TRACER_CHG_PV_INPUT_SHORTED,        4,  TRUE,   pvInputShorted,             YESNO ),
+    FIELD( TRACER_FIELD_DISEQUILIBRIUM,             "Disequilibrium In Three Circuits", TRACER_WORD_CHARGING_STATUS, TRACER_CHG_DISEQUILIBRIUM,     6,  TRUE,   disequilibrium,             YESNO ),
+    FIELD( TRACER_FIELD_LOAD_MOSFET_SHORTED,        "Load MOSFET Shorted",      TRACER_WORD_CHARGING_STATUS,    TRACER_CHG_LOAD_MOSFET_SHORTED,     7,  TRUE,   loadMOSFETShorted,          YESNO ),
+    FIELD( TRACER_FIELD_LOAD_SHORTED,               "Load Shorted",             TRACER_WORD_CHARGING_STATUS,    TRACER_CHG_LOAD_SHORTED,            8,  TRUE,   loadShorted,                YESNO ),
+    FIELD( TRACER_FIELD_LOAD_OVER_CURRENT,          "Load Over Current",        TRACER_WORD_CHARGING_STATUS,    TRACER_CHG_LOAD_OVER_CURRENT,       9,  TRUE,   loadOverCurrent,            YESNO ),
+    FIELD( TRACER_FIELD_INPUT_OVER_CURRENT,         "Input Over Current",       TRACER_WORD_CHARGING_STATUS,    TRACER_CHG_INPUT_OVER_CURRENT,      10, TRUE,   inputOverCurrent,           YESNO ),
+    FIELD( TRACER_FIELD_ANTI_REVERSE_MOSFET_SHORTED, "Anti-Reverse MOSFET Shorted", TRACER_WORD_CHARGING_STATUS, TRACER_CHG_ANTI_REVERSE_MOSFET_SHORTED, 11, TRUE, antiReverseMOSFETShorted, YESNO ),
+    FIELD( TRACER_FIELD_CHARGING_MOSFET_OPEN,       "Charging MOSFET Open",     TRACER_WORD_CHARGING_STATUS,    TRACER_CHG_CHARGING_MOSFET_OPEN,    12, TRUE,   chargingMOSFETOpen,         YESNO ),
+    FIELD( TRACER_FIELD_CHARGING_MOSFET_SHORTED,    "Charging MOSFET Shorted",  TRACER_WORD_CHARGING_STATUS,    TRACER_CHG_CHARGING_MOSFET_SHORTED, 13, TRUE,   chargingMOSFETShorted,      YESNO ),
+    FIELD( TRACER_FIELD_PV_INPUT_STATUS,            "PV Input Voltage",         TRACER_WORD_CHARGING_STATUS,    TRACER_CHG_INPUT_VOLTAGE_STATUS,    14, FALSE,  pvInputStatus,              pvInputLabels ),
+
+    FIELD( TRACER_FIELD_DISCHARGING_RUNNING,        "Discharging Running",      TRACER_WORD_DISCHARGING_STATUS, TRACER_DCHG_RUNNING,                0,  FALSE,  dischargingRunning,         YESNO ),
+    FIELD( TRACER_FIELD_DISCHARGING_FAULT_BIT,      "Discharging D1",           TRACER_WORD_DISCHARGING_STATUS, TRACER_DCHG_FAULT,                  1,  FALSE,  dischargingFaultBit,        YESNO ),
+    FIELD( TRACER_FIELD_OUTPUT_OVER_VOLTAGE,        "Output Over Voltage",      TRACER_WORD_DISCHARGING_STATUS, TRACER_DCHG_OUTPUT_OVER_VOLTAGE,    4,  TRUE,   outputOverVoltage,          YESNO ),
+    FIELD( TRACER_FIELD_BOOST_OVER_VOLTAGE,         "Boost Over Voltage",       TRACER_WORD_DISCHARGING_STATUS, TRACER_DCHG_BOOST_OVER_VOLTAGE,     5,  TRUE,   boostOverVoltage,           YESNO ),
+    FIELD( TRACER_FIELD_SHORTED_HIGH_VOLTAGE_SIDE,  "Shorted In High Voltage Side", TRACER_WORD_DISCHARGING_STATUS, TRACER_DCHG_SHORTED_HIGH_VOLTAGE, 6, TRUE,   shortedHighVoltageSide,     YESNO ),
+    FIELD( TRACER_FIELD_INPUT_OVER_VOLTAGE,         "Input Over Voltage",       TRACER_WORD_DISCHARGING_STATUS, TRACER_DCHG_INPUT_OVER_VOLTAGE,     7,  TRUE,   inputOverVoltage,           YESNO ),
+    FIELD( TRACER_FIELD_OUTPUT_VOLTAGE_ABNORMAL,    "Output Voltage Abnormal",  TRACER_WORD_DISCHARGING_STATUS, TRACER_DCHG_OUTPUT_VOLTAGE_ABNORMAL, 8,  TRUE,   outputVoltageAbnormal,      YESNO ),
+    FIELD( TRACER_FIELD_UNABLE_TO_STOP_DISCHARGING, "Unable To Stop Discharging", TRACER_WORD_DISCHARGING_STATUS, TRACER_DCHG_UNABLE_TO_STOP,     9,  TRUE,   unableToStopDischarging,    YESNO ),
+    FIELD( TRACER_FIELD_UNABLE_TO_DISCHARGE,        "Unable To Discharge",      TRACER_WORD_DISCHARGING_STATUS, TRACER_DCHG_UNABLE_TO_DISCHARGE,    10, TRUE,   unableToDischarge,          YESNO ),
+    FIELD( TRACER_FIELD_DISCHARGING_SHORTED,        "Discharging Shorted",      TRACER_WORD_DISCHARGING_STATUS, TRACER_DCHG_SHORTED,                11, TRUE,   dischargingShorted,         YESNO ),
+    FIELD( TRACER_FIELD_LOAD_LEVEL,                 "Load Level",               TRACER_WORD_DISCHARGING_STATUS, TRACER_DCHG_OUTPUT_POWER,           12, FALSE,  loadLevel,                  loadLevelLabels ),
+    FIELD( TRACER_FIELD_DISCHARGE_INPUT_STATUS,     "Discharge Input Voltage",  TRACER_WORD_DISCHARGING_STATUS, TRACER_DCHG_INPUT_VOLTAGE_STATUS,   14, FALSE,  dischargeInputStatus,       dischargeInputLabels ),
+};
+
+// -----------------------------------------------------------------------------
+void    tracerDecodeStatus (const uint16_t batteryBits, const uint16_t chargingBits, const uint16_t dischargingBits, tracerDecodedStatus_t *decoded)
+{
+    //
+    //  One trip down the table. Battery voltage and temperature codes past
+    //  the documented ones count as faults too.
+    const uint16_t  words[ TRACER_NUM_STATUS_WORDS ] = { batteryBits, chargingBits, dischargingBits };
+    uint8_t         *out = (uint8_t *) decoded;
+    uint8_t         anyFault = 0;
+
+    assert( decoded != NULL );
+
+    for (int f = 0; f < TRACER_NUM_STATUS_FIELDS; f += 1) {
+        const statusFieldDescriptor_t *field = &statusFields[ f ];
+        uint8_t value = (uint8_t) ((words[ field->word ] & field->mask) >> field->shift);
+
+        out[ field->offset ] = value;
+        if (field->isFault)
+            anyFault |= value;
+    }
+
+    decoded->anyFault = (anyFault != 0 || decoded->batteryVoltage >= TRACER_BATT_FAULT || decoded->batteryTemperature > TRACER_TEMP_LOW);
+}
+
+// -----------------------------------------------------------------------------
+int     tracerStatusFieldValue (const tracerDecodedStatus_t *decoded, const int field)
+{
+    assert( decoded != NULL );
+    if (field < 0 || field >= TRACER_NUM_STATUS_FIELDS)
+        return -1;
+
+    return ((const uint8_t *) decoded)[ statusFields[ field ].offset ];
+}
+
+// -----------------------------------------------------------------------------
+const char  *tracerStatusFieldName (const int field)
+{
+    if (field < 0 || field >= TRACER_NUM_STATUS_FIELDS)
+        return "???";
+
+    return statusFields[ field ].name;
+}
+
+// -----------------------------------------------------------------------------
+const char  *tracerStatusFieldLabel (const int field, const int value)
+{
+    if (field < 0 || field >= TRACER_NUM_STATUS_FIELDS)
+        return "???";
+
+    const statusFieldDescriptor_t *descriptor = &statusFields[ field ];
+    if (descriptor->labels == NULL)
+        return (value ? "Yes" : "No");
+    if (value < 0 || value >= descriptor->numLabels)
+        return "???";
+
+    return descriptor->labels[ value ];
+}
+
 // -----------------------------------------------------------------------------
 float getMaximumPVVoltageToday (modbus_t *ctx)
 {
-    return float_read_input_register( ctx, 0x3300, 1, "Maximum PV Voltage Today", -1.0 );
+    return readRegisterAsFloat( ctx, TRACER_MAXIMUM_PV_VOLTAGE_TODAY );
 }
 
 // -----------------------------------------------------------------------------
 float getMinimumPVVoltageToday (modbus_t *ctx)
 {
-    return float_read_input_register( ctx, 0x3301, 1, "Minimum PV Voltage Today", -1.0 );
+    return readRegisterAsFloat( ctx, TRACER_MINIMUM_PV_VOLTAGE_TODAY );
 }
 // -----------------------------------------------------------------------------
 float getMaximumBatteryVoltageToday (modbus_t *ctx)
 {
-    return float_read_input_register( ctx, 0x3302, 1, "Maximum Battery Voltage Today", -1.0 );
+    return readRegisterAsFloat( ctx, TRACER_MAXIMUM_BATTERY_VOLTAGE_TODAY );
 }
 
 // -----------------------------------------------------------------------------
 float getMinimumBatteryVoltageToday (modbus_t *ctx)
 {
-    return float_read_input_register( ctx, 0x3303, 1, "Minimum Battery Voltage Today", -1.0 );
+    return readRegisterAsFloat( ctx, TRACER_MINIMUM_BATTERY_VOLTAGE_TODAY );
 }
 
 // -----------------------------------------------------------------------------
 float getConsumedEnergyToday (modbus_t *ctx)
 {
-    return float_read_input_register( ctx, 0x3304, 2, "Consumed Energy Today", -1.0 );
+    return readRegisterAsFloat( ctx, TRACER_CONSUMED_ENERGY_TODAY );
 }
 
 // -----------------------------------------------------------------------------
 float getConsumedEnergyMonth (modbus_t *ctx)
 {
-    return float_read_input_register( ctx, 0x3306, 2, "Consumed Energy This Month", -1.0 );
+    return readRegisterAsFloat( ctx, TRACER_CONSUMED_ENERGY_MONTH );
 }
 
 // -----------------------------------------------------------------------------
 float getConsumedEnergyYear (modbus_t *ctx)
 {
-    return float_read_input_register( ctx, 0x3308, 2, "Consumed Energy This Year", -1.0 );
+    return readRegisterAsFloat( ctx, TRACER_CONSUMED_ENERGY_YEAR );
 }
 
 // -----------------------------------------------------------------------------
 float getConsumedEnergyTotal (modbus_t *ctx)
 {
-    return float_read_input_register( ctx, 0x330A, 2, "Total Consumed Energyr", -1.0 );
+    return readRegisterAsFloat( ctx, TRACER_CONSUMED_ENERGY_TOTAL );
 }
 
 // -----------------------------------------------------------------------------
 float getGeneratedEnergyToday (modbus_t *ctx)
 {
-    return float_read_input_register( ctx, 0x330C, 2, "Generated Energy Today", -1.0 );
+    return readRegisterAsFloat( ctx, TRACER_GENERATED_ENERGY_TODAY );
 }
 
 // -----------------------------------------------------------------------------
 float getGeneratedEnergyMonth (modbus_t *ctx)
 {
-    return float_read_input_register( ctx, 0x330E, 2, "Generated Energy This Month", -1.0 );
+    return readRegisterAsFloat( ctx, TRACER_GENERATED_ENERGY_MONTH );
 }
 
 // -----------------------------------------------------------------------------
 float getGeneratedEnergyYear (modbus_t *ctx)
 {
-    return float_read_input_register( ctx, 0x3310, 2, "Generated Energy This Year", -1.0 );
+    return readRegisterAsFloat( ctx, TRACER_GENERATED_ENERGY_YEAR );
 }
 
 // -----------------------------------------------------------------------------
 float getGeneratedEnergyTotal (modbus_t *ctx)
 {
-    return float_read_input_register( ctx, 0x3312, 2, "Total Generated Energyr", -1.0 );
+    return readRegisterAsFloat( ctx, TRACER_GENERATED_ENERGY_TOTAL );
 }
 
 // -----------------------------------------------------------------------------
 float getBatteryVoltage (modbus_t *ctx)
 {
-    return float_read_input_register( ctx, 0x331A, 1, "Battery Voltage", -1.0 );
+    return readRegisterAsFloat( ctx, TRACER_BATTERY_VOLTAGE );
 }
 
 // -----------------------------------------------------------------------------
 float getBatteryCurrent (modbus_t *ctx)
 {
-    return float_read_input_register( ctx, 0x331B, 2, "Battery Current", -1.0 );
+    return readRegisterAsFloat( ctx, TRACER_BATTERY_CURRENT );
 }
 
 // -----------------------------------------------------------------------------
 float getRatedChargingCurrent (modbus_t *ctx)
 {
-    return float_read_input_register( ctx, 0x3005, 1, "Rated Current to Battery", -1.0 );
+    return readRegisterAsFloat( ctx, TRACER_RATED_CHARGING_CURRENT );
 }
 
 // -----------------------------------------------------------------------------
 float getRatedLoadCurrent (modbus_t *ctx)
 {
-    return float_read_input_register( ctx, 0x300E, 1, "Rated Current to Load", -1.0 );
+    return readRegisterAsFloat( ctx, TRACER_RATED_LOAD_CURRENT );
 }
 
 // -----------------------------------------------------------------------------
 int getBoostDuration (modbus_t *ctx)
 {
-    return int_read_register( ctx, 0x906C, 1, "Boost Duration", -1 );
+    return readRegisterAsInt( ctx, TRACER_BOOST_DURATION );
 }
 
 // -----------------------------------------------------------------------------
 int getEqualizeDuration (modbus_t *ctx)
 {
-    return int_read_register( ctx, 0x906B, 1, "Equalize Duration", -1 );
+    return readRegisterAsInt( ctx, TRACER_EQUALIZE_DURATION );
 }
 
 // -----------------------------------------------------------------------------
 char *getBatteryType (modbus_t *ctx)
 {
-    int bt = int_read_register( ctx, 0x9000, 1, "Battery Type", -1 );
+    int bt = readRegisterAsInt( ctx, TRACER_BATTERY_TYPE );
     switch (bt) {
         case 0: return "User   ";
             break;
@@ -680,7 +1029,7 @@ void setBatteryType (modbus_t *ctx, int batteryTypeCode)
 //------------------------------------------------------------------------------
 int getBatteryCapacity (modbus_t *ctx)
 {
-    return int_read_register( ctx, 0x9001, 1, "Battery Capacity", -1 );
+    return readRegisterAsInt( ctx, TRACER_BATTERY_CAPACITY );
 }
 
 //------------------------------------------------------------------------------
@@ -694,7 +1043,7 @@ void setBatteryCapacity (modbus_t *ctx, int batteryCapacityAH)
 /******* why is one float and the other int? */
 float getTemperatureCompensationCoefficient (modbus_t *ctx)
 {
-    return float_read_register( ctx, 0x9002, 1, "Temperature Compensation Coefficient", -1.0 );
+    return readRegisterAsFloat( ctx, TRACER_TEMPERATURE_COMPENSATION_COEFFICIENT );
 }
 
 // ------------------------------------------------------------------------------
@@ -707,7 +1056,7 @@ void setTemperatureCompensationCoefficient (modbus_t *ctx, int value)
 // ------------------------------------------------------------------------------
 float getHighVoltageDisconnect (modbus_t *ctx)
 {
-    return float_read_register( ctx, 0x9003, 1, "High Voltage Disconnect", -1.0 );
+    return readRegisterAsFloat( ctx, TRACER_HIGH_VOLTAGE_DISCONNECT );
 }
 
 // ------------------------------------------------------------------------------
@@ -720,7 +1069,7 @@ void setHighVoltageDisconnect (modbus_t *ctx, double value)
 // ------------------------------------------------------------------------------
 float getChargingLimitVoltage (modbus_t *ctx)
 {
-    return float_read_register( ctx, 0x9004, 1, "Charging Limit Voltage", -1.0 );
+    return readRegisterAsFloat( ctx, TRACER_CHARGING_LIMIT_VOLTAGE );
 }
 
 // ------------------------------------------------------------------------------
@@ -733,7 +1082,7 @@ void setChargingLimitVoltage (modbus_t *ctx, double value)
 // ------------------------------------------------------------------------------
 float getOverVoltageReconnect (modbus_t *ctx)
 {
-    return float_read_register( ctx, 0x9005, 1, "Over Voltage Reconnect", -1.0 );
+    return readRegisterAsFloat( ctx, TRACER_OVER_VOLTAGE_RECONNECT );
 }
 
 // ------------------------------------------------------------------------------
@@ -746,7 +1095,7 @@ void setOverVoltageReconnect (modbus_t *ctx, double value)
 // ------------------------------------------------------------------------------
 float getEqualizationVoltage (modbus_t *ctx)
 {
-    return float_read_register( ctx, 0x9006, 1, "Equalization Voltage", -1.0 );
+    return readRegisterAsFloat( ctx, TRACER_EQUALIZATION_VOLTAGE );
 }
 
 // ------------------------------------------------------------------------------
@@ -759,7 +1108,7 @@ void setEqualizationVoltage (modbus_t *ctx, double value)
 // ------------------------------------------------------------------------------
 float getBoostingVoltage (modbus_t *ctx)
 {
-    return float_read_register( ctx, 0x9007, 1, "Boosting Voltage", -1.0 );
+    return readRegisterAsFloat( ctx, TRACER_BOOSTING_VOLTAGE );
 }
 
 // ------------------------------------------------------------------------------
@@ -772,7 +1121,7 @@ void setBoostingVoltage (modbus_t *ctx, double value)
 // ------------------------------------------------------------------------------
 float getFloatingVoltage (modbus_t *ctx)
 {
-    return float_read_register( ctx, 0x9008, 1, "Floating Voltage", -1.0 );
+    return readRegisterAsFloat( ctx, TRACER_FLOATING_VOLTAGE );
 }
 
 // ------------------------------------------------------------------------------
@@ -785,7 +1134,7 @@ void setFloatingVoltage (modbus_t *ctx, double value)
 // ------------------------------------------------------------------------------
 float getBoostReconnectVoltage (modbus_t *ctx)
 {
-    return float_read_register( ctx, 0x9009, 1, "Boost Reconnect Voltage", -1.0 );
+    return readRegisterAsFloat( ctx, TRACER_BOOST_RECONNECT_VOLTAGE );
 }
 
 // ------------------------------------------------------------------------------
@@ -798,7 +1147,7 @@ void setBoostReconnectVoltage (modbus_t *ctx, double value)
 // ------------------------------------------------------------------------------
 float getLowVoltageReconnectVoltage (modbus_t *ctx)
 {
-    return float_read_register( ctx, 0x900A, 1, "Low Voltage Reconnect Voltage", -1.0 );
+    return readRegisterAsFloat( ctx, TRACER_LOW_VOLTAGE_RECONNECT_VOLTAGE );
 }
 
 void setLowVoltageReconnectVoltage (modbus_t *ctx, double value)
@@ -810,7 +1159,7 @@ void setLowVoltageReconnectVoltage (modbus_t *ctx, double value)
 // ------------------------------------------------------------------------------
 float getUnderVoltageWarningRecoverVoltage (modbus_t *ctx)
 {
-    return float_read_register( ctx, 0x900B, 1, "Under Voltage Warning Recover Voltage", -1.0 );
+    return readRegisterAsFloat( ctx, TRACER_UNDER_VOLTAGE_WARNING_RECOVER_VOLTAGE );
 }
 
 // ------------------------------------------------------------------------------
@@ -823,7 +1172,7 @@ void setUnderVoltageWarningRecoverVoltage (modbus_t *ctx, double value)
 // ------------------------------------------------------------------------------
 float getUnderVoltageWarningVoltage (modbus_t *ctx)
 {
-    return float_read_register( ctx, 0x900C, 1, "Under Voltage Warning Voltage", -1.0 );
+    return readRegisterAsFloat( ctx, TRACER_UNDER_VOLTAGE_WARNING_VOLTAGE );
 }
 
 // ------------------------------------------------------------------------------
@@ -835,7 +1184,7 @@ void setUnderVoltageWarningVoltage (modbus_t *ctx, double value)
 // ------------------------------------------------------------------------------
 float getLowVoltageDisconnectVoltage (modbus_t *ctx)
 {
-    return float_read_register( ctx, 0x900D, 1, "Low Voltage Disconnect Voltage", -1.0 );
+    return readRegisterAsFloat( ctx, TRACER_LOW_VOLTAGE_DISCONNECT_VOLTAGE );
 }
 
 // ------------------------------------------------------------------------------
@@ -847,7 +1196,7 @@ void setLowVoltageDisconnectVoltage (modbus_t *ctx, double value)
 // ------------------------------------------------------------------------------
 float getDischargingLimitVoltage (modbus_t *ctx)
 {
-    return float_read_register( ctx, 0x900E, 1, "Discharging Limit Voltage", -1.0 );
+    return readRegisterAsFloat( ctx, TRACER_DISCHARGING_LIMIT_VOLTAGE );
 }
 
 // ------------------------------------------------------------------------------
@@ -856,36 +1205,193 @@ void setDischargingLimitVoltage (modbus_t *ctx, double value)
     float_write_registers( ctx, 0x900E, (float) value );
 }
 
+// ------------------------------------------------------------------------------
+int validateBatterySettings (const tracerBatterySettings_t *settings)
+{
+    //
+    //  The controller insists the voltages stay in this order. Writing them one
+    //  at a time can trip over it halfway through a profile change, which is
+    //  one reason to write the whole block at once.
+    //      HVD > Charging Limit >= Equalize >= Boost >= Float > Boost Reconnect > LVR
+    //      HVD > Over Voltage Reconnect
+    //      LVR > LVD >= Discharging Limit
+    //      UVW Recover > UVW >= Discharging Limit
+    const tracerBatterySettings_t *b = settings;
+
+    if (b->batteryType < 0x00 || b->batteryType > 0x03) {
+        Logger_LogError( "validateBatterySettings - battery type %d is out of range\n", b->batteryType );
+        return FALSE;
+    }
+    if (!(b->highVoltageDisconnect > b->chargingLimitVoltage &&
+          b->chargingLimitVoltage >= b->equalizationVoltage &&
+          b->equalizationVoltage >= b->boostingVoltage &&
+          b->boostingVoltage >= b->floatingVoltage &&
+          b->floatingVoltage > b->boostReconnectVoltage &&
+          b->boostReconnectVoltage > b->lowVoltageReconnectVoltage)) {
+        Logger_LogError( "validateBatterySettings - charging voltages are out of order\n" );
+        return FALSE;
+    }
+    if (!(b->highVoltageDisconnect > b->overVoltageReconnect)) {
+        Logger_LogError( "validateBatterySettings - over voltage reconnect must be below high voltage disconnect\n" );
+        return FALSE;
+    }
+    if (!(b->lowVoltageReconnectVoltage > b->lowVoltageDisconnectVoltage &&
+          b->lowVoltageDisconnectVoltage >= b->dischargingLimitVoltage)) {
+        Logger_LogError( "validateBatterySettings - low voltage disconnect/reconnect are out of order\n" );
+        return FALSE;
+    }
+    if (!(b->underVoltageWarningRecoverVoltage > b->underVoltageWarningVoltage &&
+          b->underVoltageWarningVoltage >= b->dischargingLimitVoltage)) {
+        Logger_LogError( "validateBatterySettings - under voltage warning/recover are out of order\n" );
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+// ------------------------------------------------------------------------------
+static
+void battery_settings_to_words (const tracerBatterySettings_t *settings, uint16_t *words)
+{
+    words[ 0x00 ] = (uint16_t) settings->batteryType;
+    words[ 0x01 ] = (uint16_t) settings->batteryCapacity;
+    words[ 0x02 ] = float_to_register_word( settings->temperatureCompensationCoefficient );
+    words[ 0x03 ] = float_to_register_word( settings->highVoltageDisconnect );
+    words[ 0x04 ] = float_to_register_word( settings->chargingLimitVoltage );
+    words[ 0x05 ] = float_to_register_word( settings->overVoltageReconnect );
+    words[ 0x06 ] = float_to_register_word( settings->equalizationVoltage );
+    words[ 0x07 ] = float_to_register_word( settings->boostingVoltage );
+    words[ 0x08 ] = float_to_register_word( settings->floatingVoltage );
+    words[ 0x09 ] = float_to_register_word( settings->boostReconnectVoltage );
+    words[ 0x0A ] = float_to_register_word( settings->lowVoltageReconnectVoltage );
+    words[ 0x0B ] = float_to_register_word( settings->underVoltageWarningRecoverVoltage );
+    words[ 0x0C ] = float_to_register_word( settings->underVoltageWarningVoltage );
+    words[ 0x0D ] = float_to_register_word( settings->lowVoltageDisconnectVoltage );
+    words[ 0x0E ] = float_to_register_word( settings->dischargingLimitVoltage );
+}
+
+// ------------------------------------------------------------------------------
+static
+int read_battery_settings_words (modbus_t *ctx, uint16_t *words)
+{
+    //
+    //  TRACER_BATTERY_TYPE .. TRACER_DISCHARGING_LIMIT_VOLTAGE are 0x9000..0x900E
+    //  in order, so the planner turns this into a single request
+    int                 regIds[ 0x0F ];
+    tracerReadPlan_t    plan;
+    tracerReadResult_t  result;
+
+    for (int i = 0; i < 0x0F; i += 1) {
+        regIds[ i ] = TRACER_BATTERY_TYPE + i;
+        assert( getRegisterDescriptor( regIds[ i ] )->address == 0x9000 + i );
+    }
+
+    if (!planRegisterReads( regIds, 0x0F, 0, &plan ))
+        return FALSE;
+    assert( plan.numRequests == 1 );
+
+    if (!executeReadPlan( ctx, &plan, &result ))
+        return FALSE;
+
+    memcpy( words, planResultWords( &plan, &result, TRACER_BATTERY_TYPE ), 0x0F * sizeof( uint16_t ) );
+    return TRUE;
+}
+
+// ------------------------------------------------------------------------------
+int getBatterySettings (modbus_t *ctx, tracerBatterySettings_t *settings)
+{
+    uint16_t words[ 0x0F ];
+
+    memset( settings, '\0', sizeof( tracerBatterySettings_t ) );
+    if (!read_battery_settings_words( ctx, words ))
+        return FALSE;
+
+    settings->batteryType = decodeRegisterAsInt( TRACER_BATTERY_TYPE, &words[ 0x00 ] );
+    settings->batteryCapacity = decodeRegisterAsInt( TRACER_BATTERY_CAPACITY, &words[ 0x01 ] );
+    settings->temperatureCompensationCoefficient = decodeRegisterAsFloat( TRACER_TEMPERATURE_COMPENSATION_COEFFICIENT, &words[ 0x02 ] );
+    settings->highVoltageDisconnect = decodeRegisterAsFloat( TRACER_HIGH_VOLTAGE_DISCONNECT, &words[ 0x03 ] );
+    settings->chargingLimitVoltage = decodeRegisterAsFloat( TRACER_CHARGING_LIMIT_VOLTAGE, &words[ 0x04 ] );
+    settings->overVoltageReconnect = decodeRegisterAsFloat( TRACER_OVER_VOLTAGE_RECONNECT, &words[ 0x05 ] );
+    settings->equalizationVoltage = decodeRegisterAsFloat( TRACER_EQUALIZATION_VOLTAGE, &words[ 0x06 ] );
+    settings->boostingVoltage = decodeRegisterAsFloat( TRACER_BOOSTING_VOLTAGE, &words[ 0x07 ] );
+    settings->floatingVoltage = decodeRegisterAsFloat( TRACER_FLOATING_VOLTAGE, &words[ 0x08 ] );
+    settings->boostReconnectVoltage = decodeRegisterAsFloat( TRACER_BOOST_RECONNECT_VOLTAGE, &words[ 0x09 ] );
+    settings->lowVoltageReconnectVoltage = decodeRegisterAsFloat( TRACER_LOW_VOLTAGE_RECONNECT_VOLTAGE, &words[ 0x0A ] );
+    settings->underVoltageWarningRecoverVoltage = decodeRegisterAsFloat( TRACER_UNDER_VOLTAGE_WARNING_RECOVER_VOLTAGE, &words[ 0x0B ] );
+    settings->underVoltageWarningVoltage = decodeRegisterAsFloat( TRACER_UNDER_VOLTAGE_WARNING_VOLTAGE, &words[ 0x0C ] );
+    settings->lowVoltageDisconnectVoltage = decodeRegisterAsFloat( TRACER_LOW_VOLTAGE_DISCONNECT_VOLTAGE, &words[ 0x0D ] );
+    settings->dischargingLimitVoltage = decodeRegisterAsFloat( TRACER_DISCHARGING_LIMIT_VOLTAGE, &words[ 0x0E ] );
+
+    return TRUE;
+}
+
+// ------------------------------------------------------------------------------
+int setBatterySettings (modbus_t *ctx, const tracerBatterySettings_t *settings)
+{
+    //
+    //  One function 0x10 write for all fifteen registers, then one block read
+    //  to make sure the controller took every value.
+    uint16_t words[ 0x0F ];
+    uint16_t readBack[ 0x0F ];
+
+    assert( ctx != NULL );
+    if (!validateBatterySettings( settings ))
+        return FALSE;
+
+    battery_settings_to_words( settings, words );
+
+    busState_t *bus = lock_bus( ctx );
+    int status = modbus_write_words( bus, ctx, 0x9000, 0x0F, words );
+    //
+    //  Also makes sure the read back below goes to the controller
+    cache_invalidate( bus, ctx, 0x03, 0x9000, 0x0F );
+    unlock_bus( bus );
+
+    if (status == -1) {
+        Logger_LogError( "setBatterySettings() - write of 0x9000..0x900E failed: %s\n", modbus_strerror( errno ) );
+        return FALSE;
+    }
+
+    if (!read_battery_settings_words( ctx, readBack )) {
+        Logger_LogError( "setBatterySettings() - unable to read back 0x9000..0x900E\n" );
+        return FALSE;
+    }
+
+    for (int i = 0; i < 0x0F; i += 1) {
+        if (readBack[ i ] != words[ i ]) {
+            Logger_LogError( "setBatterySettings() - register %X wrote [%X] but reads back [%X]\n", 0x9000 + i, words[ i ], readBack[ i ] );
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
 //------------------------------------------------------------------------------
 float getDischargingPercentage (modbus_t *ctx)
 {
-    return (float_read_register( ctx, 0x906D, 1, "Discharging Percentage", -1.0) * 100.0 );
+    return readRegisterAsFloat( ctx, TRACER_DISCHARGING_PERCENTAGE );
 }
 
 float getChargingPercentage (modbus_t *ctx)
 {
-    return (float_read_register( ctx, 0x906E, 1, "Charging Percentage", -1.0) * 100.0 );
+    return readRegisterAsFloat( ctx, TRACER_CHARGING_PERCENTAGE );
 }
 
 // -----------------------------------------------------------------------------
 void getRealtimeClock (modbus_t *ctx, int *seconds, int *minutes, int *hour, int *day, int *month, int *year)
 {
-    int registerAddress = 0x9013;
-    int numBytes = 0x03;
     uint16_t buffer[ 32 ];
 
-    assert( ctx != NULL );
-    memset(buffer, '\0', sizeof buffer );
-
-    pthread_mutex_lock( &aMutex );
-
     //
-    //  Modbus Function 0x03
-    if ( modbus_read_registers( ctx, registerAddress, numBytes, buffer) == -1) {
-        Logger_LogError("getRealtimeClock() - Read of 3 at 0x9013 failed: %s\n", modbus_strerror(errno) );
-    }
-    pthread_mutex_unlock( &aMutex );
+    //  Failed reads are logged and leave the buffer zeroed
+    read_register_words( ctx, getRegisterDescriptor( TRACER_REALTIME_CLOCK ), buffer );
+    decodeRealtimeClock( buffer, seconds, minutes, hour, day, month, year );
+}
 
+// -----------------------------------------------------------------------------
+void decodeRealtimeClock (const uint16_t *buffer, int *seconds, int *minutes, int *hour, int *day, int *month, int *year)
+{
     //
     // Failed read sets these all to zero - which is ok
     *seconds = (buffer[ 0 ] & 0x00FF );
@@ -898,10 +1404,19 @@ void getRealtimeClock (modbus_t *ctx, int *seconds, int *minutes, int *hour, int
 
 // -----------------------------------------------------------------------------
 char *getRealtimeClockStr (modbus_t *ctx, char *buffer, const int buffSize)
+{
+    uint16_t words[ 32 ];
+
+    read_register_words( ctx, getRegisterDescriptor( TRACER_REALTIME_CLOCK ), words );
+    return decodeRealtimeClockStr( words, buffer, buffSize );
+}
+
+// -----------------------------------------------------------------------------
+char *decodeRealtimeClockStr (const uint16_t *words, char *buffer, const int buffSize)
 {
     int seconds, minutes, hour, day, month, year;
 
-    getRealtimeClock( ctx, &seconds, &minutes, &hour, &day, &month, &year );
+    decodeRealtimeClock( words, &seconds, &minutes, &hour, &day, &month, &year );
     snprintf(buffer, buffSize, "%02d/%02d/%02d %02d:%02d:%02d", month, day, year, hour, minutes, seconds );
     return buffer;
 }
@@ -940,9 +1455,12 @@ void setRealtimeClock (modbus_t *ctx, const int seconds, const int minutes, cons
 
     int registerAddress = 0x9013;
     int numBytes = 0x03;
-    if ( modbus_write_registers( ctx, registerAddress, numBytes, buffer) == -1) {
+    busState_t *bus = lock_bus( ctx );
+    if ( modbus_write_words( bus, ctx, registerAddress, numBytes, buffer) == -1) {
         Logger_LogError("setRealTimeClock() - write failed: %s\n", modbus_strerror(errno) );
     }
+    cache_invalidate( bus, ctx, 0x03, registerAddress, numBytes );
+    unlock_bus( bus );
 }
 
 // -----------------------------------------------------------------------------
@@ -973,7 +1491,7 @@ void setBatteryTemperatureWarningUpperLimit (modbus_t *ctx, float value)
 //------------------------------------------------------------------------------
 float getBatteryTemperatureWarningUpperLimit (modbus_t *ctx)
 {
-    return C2F(float_read_register( ctx, 0x9017, 1, "Battery Temp Upper Limit", -1.0) );
+    return C2F(readRegisterAsFloat( ctx, TRACER_BATTERY_TEMPERATURE_WARNING_UPPER_LIMIT ) );
 }
 
 //------------------------------------------------------------------------------
@@ -986,7 +1504,7 @@ void setBatteryTemperatureWarningLowerLimit (modbus_t *ctx, float value)
 //------------------------------------------------------------------------------
 float getBatteryTemperatureWarningLowerLimit (modbus_t *ctx)
 {
-    return C2F(float_read_register( ctx, 0x9018, 1, "Battery Temp Lower Limit", -1.0) );
+    return C2F(readRegisterAsFloat( ctx, TRACER_BATTERY_TEMPERATURE_WARNING_LOWER_LIMIT ) );
 }
 
 //------------------------------------------------------------------------------
@@ -999,7 +1517,7 @@ void setControllerInnerTemperatureUpperLimit (modbus_t *ctx, double value)
 //------------------------------------------------------------------------------
 float getControllerInnerTemperatureUpperLimit (modbus_t *ctx)
 {
-    return C2F(float_read_register( ctx, 0x9019, 1, "Controller Temp Upper Limit", -1.0) );
+    return C2F(readRegisterAsFloat( ctx, TRACER_CONTROLLER_TEMPERATURE_UPPER_LIMIT ) );
 }
 
 //------------------------------------------------------------------------------
@@ -1012,7 +1530,7 @@ void setControllerInnerTemperatureUpperLimitRecover (modbus_t *ctx, double value
 //------------------------------------------------------------------------------
 float getControllerInnerTemperatureUpperLimitRecover (modbus_t *ctx)
 {
-    return C2F(float_read_register( ctx, 0x901A, 1, "Controller Temp Upper Limit Recovery", -1.0) );
+    return C2F(readRegisterAsFloat( ctx, TRACER_CONTROLLER_TEMPERATURE_UPPER_LIMIT_RECOVER ) );
 }
 
 //------------------------------------------------------------------------------
@@ -1024,7 +1542,7 @@ void setDayTimeThresholdVoltage (modbus_t *ctx, double value)
 // -----------------------------------------------------------------------------
 float getDayTimeThresholdVoltage (modbus_t *ctx)
 {
-    return float_read_register( ctx, 0x901E, 1, "Daytime Threshold Voltage", -1.0 );
+    return readRegisterAsFloat( ctx, TRACER_DAY_TIME_THRESHOLD_VOLTAGE );
 }
 
 //------------------------------------------------------------------------------
@@ -1036,7 +1554,7 @@ void setLightSignalStartupDelayTime (modbus_t *ctx, const int value)
 //------------------------------------------------------------------------------
 int getLightSignalStartupDelayTime (modbus_t *ctx)
 {
-    return int_read_register( ctx, 0x901F, 1, "Light Signal Startup Delay", -1 );
+    return readRegisterAsInt( ctx, TRACER_LIGHT_SIGNAL_STARTUP_DELAY_TIME );
 }
 
 //------------------------------------------------------------------------------
@@ -1048,7 +1566,7 @@ void setNightTimeThresholdVoltage (modbus_t *ctx, float value)
 // -----------------------------------------------------------------------------
 float getNightTimeThresholdVoltage (modbus_t *ctx)
 {
-    return float_read_register( ctx, 0x9020, 1, "Nighttime Threshold Voltage", -1.0 );
+    return readRegisterAsFloat( ctx, TRACER_NIGHT_TIME_THRESHOLD_VOLTAGE );
 }
 
 //------------------------------------------------------------------------------
@@ -1060,7 +1578,7 @@ void setLightSignalCloseDelayTime (modbus_t *ctx, const int value)
 //------------------------------------------------------------------------------
 int getLightSignalCloseDelayTime (modbus_t *ctx)
 {
-    return int_read_register( ctx, 0x9021, 1, "Light Signal Close Delay", -1 );
+    return readRegisterAsInt( ctx, TRACER_LIGHT_SIGNAL_CLOSE_DELAY_TIME );
 }
 
 //------------------------------------------------------------------------------
@@ -1073,7 +1591,7 @@ void setLoadControllingMode (modbus_t *ctx, const int value)
 //------------------------------------------------------------------------------
 int getLoadControllingMode (modbus_t *ctx)
 {
-    return int_read_register( ctx, 0x903D, 1, "Load Controlling Mode", -1 );
+    return readRegisterAsInt( ctx, TRACER_LOAD_CONTROLLING_MODE );
 }
 
 //------------------------------------------------------------------------------
@@ -1154,7 +1672,7 @@ void setLengthOfNight (modbus_t *ctx, const int hour, const int minute)
 void getLengthOfNight (modbus_t *ctx, int *hour, int *minute)
 {
     int value = 0xFFFF;
-    value = int_read_register( ctx, 0x9065, 1, "Length of Night", 0xFFFF );
+    value = readRegisterAsInt( ctx, TRACER_LENGTH_OF_NIGHT );
 
     *minute = (value & 0x0F);
     *hour = (value >> 8);
@@ -1164,7 +1682,7 @@ void getLengthOfNight (modbus_t *ctx, int *hour, int *minute)
 // -----------------------------------------------------------------------------
 int getBacklightTime (modbus_t *ctx)
 {
-    return int_read_register( ctx, 0x9063, 1, "Backlight time", -1 );
+    return readRegisterAsInt( ctx, TRACER_BACKLIGHT_TIME );
 }
 
 // -----------------------------------------------------------------------------
@@ -1173,9 +1691,9 @@ void getTurnOnTiming2 (modbus_t *ctx, int *hour, int *minute, int *second)
     *hour = 1;
     *minute = 2;
     *second = 3;
-    *second = int_read_register( ctx, 0x9048, 1, "Turn On T2 - Second", -1 );
-    *minute = int_read_register( ctx, 0x9049, 1, "Turn On T2 - Minute", -1 );
-    *hour = int_read_register( ctx, 0x904A, 1, "Turn On T2 - Hour", -1 );
+    *second = readRegisterAsInt( ctx, TRACER_TURN_ON_TIMING_2_SECOND );
+    *minute = readRegisterAsInt( ctx, TRACER_TURN_ON_TIMING_2_MINUTE );
+    *hour = readRegisterAsInt( ctx, TRACER_TURN_ON_TIMING_2_HOUR );
 }
 
 // -----------------------------------------------------------------------------
@@ -1184,9 +1702,9 @@ void getTurnOffTiming2 (modbus_t *ctx, int *hour, int *minute, int *second)
     *hour = 3;
     *minute = 4;
     *second = 5;
-    *second = int_read_register( ctx, 0x904B, 1, "Turn Off T2 - Second", -1 );
-    *minute = int_read_register( ctx, 0x904C, 1, "Turn Off T2 - Minute", -1 );
-    *hour = int_read_register( ctx, 0x904D, 1, "Turn Off T2 - Hour", -1 );
+    *second = readRegisterAsInt( ctx, TRACER_TURN_OFF_TIMING_2_SECOND );
+    *minute = readRegisterAsInt( ctx, TRACER_TURN_OFF_TIMING_2_MINUTE );
+    *hour = readRegisterAsInt( ctx, TRACER_TURN_OFF_TIMING_2_HOUR );
 }
 
 // -----------------------------------------------------------------------------
@@ -1195,9 +1713,9 @@ void getTurnOnTiming1 (modbus_t *ctx, int *hour, int *minute, int *second)
     *hour = 11;
     *minute = 12;
     *second = 13;
-    *second = int_read_register( ctx, 0x9042, 1, "Turn On T1 - Second", -1 );
-    *minute = int_read_register( ctx, 0x9043, 1, "Turn On T1 - Minute", -1 );
-    *hour = int_read_register( ctx, 0x9044, 1, "Turn On T1 - Hour", -1 );
+    *second = readRegisterAsInt( ctx, TRACER_TURN_ON_TIMING_1_SECOND );
+    *minute = readRegisterAsInt( ctx, TRACER_TURN_ON_TIMING_1_MINUTE );
+    *hour = readRegisterAsInt( ctx, TRACER_TURN_ON_TIMING_1_HOUR );
 }
 
 // -----------------------------------------------------------------------------
@@ -1206,9 +1724,9 @@ void getTurnOffTiming1 (modbus_t *ctx, int *hour, int *minute, int *second)
     *hour = 13;
     *minute = 14;
     *second = 15;
-    *second = int_read_register( ctx, 0x9045, 1, "Turn Off T1 - Second", -1 );
-    *minute = int_read_register( ctx, 0x9046, 1, "Turn Off T1 - Minute", -1 );
-    *hour = int_read_register( ctx, 0x9047, 1, "Turn Off T1 - Hour", -1 );
+    *second = readRegisterAsInt( ctx, TRACER_TURN_OFF_TIMING_1_SECOND );
+    *minute = readRegisterAsInt( ctx, TRACER_TURN_OFF_TIMING_1_MINUTE );
+    *hour = readRegisterAsInt( ctx, TRACER_TURN_OFF_TIMING_1_HOUR );
 }
 
 // -----------------------------------------------------------------------------
@@ -1216,7 +1734,7 @@ void getWorkingTimeLength1 (modbus_t *ctx, int *hour, int *minute)
 {
     *hour = 20;
     *minute = 21;
-    int value = int_read_register( ctx, 0x903E, 1, "Working Time 1 Length", 0xFFFF );
+    int value = readRegisterAsInt( ctx, TRACER_WORKING_TIME_LENGTH_1 );
 
     *minute = (value & 0x0F);
     *hour = (value >> 8);
@@ -1228,7 +1746,7 @@ void getWorkingTimeLength2 (modbus_t *ctx, int *hour, int *minute)
 {
     *hour = 22;
     *minute = 23;
-    int value = int_read_register( ctx, 0x903F, 1, "Working Time 1 Length", 0xFFFF );
+    int value = readRegisterAsInt( ctx, TRACER_WORKING_TIME_LENGTH_2 );
 
     *minute = (value & 0x0F);
     *hour = (value >> 8);
@@ -1294,7 +1812,7 @@ void setManagementModesOfBatteryChargingAndDischarging (modbus_t *ctx, const int
 //------------------------------------------------------------------------------
 char *getManagementModesOfBatteryChargingAndDischarging (modbus_t *ctx)
 {
-    int value = int_read_register( ctx, 0x9070, 1, "Charging Mode", -1 );
+    int value = readRegisterAsInt( ctx, TRACER_BATTERY_MANAGEMENT_MODE );
     if (value == 0)
         return "Volt Comp";
     else if (value == 1)
@@ -1306,8 +1824,7 @@ char *getManagementModesOfBatteryChargingAndDischarging (modbus_t *ctx)
 // -----------------------------------------------------------------------------
 int getChargingDeviceStatus (modbus_t *ctx)
 {
-    int coilNum = 0;
-    return (get_coil_value( ctx, coilNum, "Charging Device Status (Coil 0)") );
+    return readRegisterAsInt( ctx, TRACER_CHARGING_DEVICE_STATUS );
 }
 
 // -----------------------------------------------------------------------------
@@ -1320,8 +1837,7 @@ void setChargingDeviceStatus (modbus_t *ctx, const int value)
 // -----------------------------------------------------------------------------
 int getOutputControlMode (modbus_t *ctx)
 {
-    int coilNum = 1;
-    return (get_coil_value( ctx, coilNum, "Output Control Mode (Coil 1)") );
+    return readRegisterAsInt( ctx, TRACER_OUTPUT_CONTROL_MODE );
 }
 
 // -----------------------------------------------------------------------------
@@ -1334,8 +1850,7 @@ void setOutputControlMode (modbus_t *ctx, const int value)
 // -----------------------------------------------------------------------------
 int getManualLoadControlMode (modbus_t *ctx)
 {
-    int coilNum = 2;
-    return (get_coil_value( ctx, coilNum, "Manual Load Control Mode (Coil 2)") );
+    return readRegisterAsInt( ctx, TRACER_MANUAL_LOAD_CONTROL_MODE );
 }
 
 // -----------------------------------------------------------------------------
@@ -1348,8 +1863,7 @@ void setManualLoadControlMode (modbus_t *ctx, const int value)
 // -----------------------------------------------------------------------------
 int getDefaultLoadControlMode (modbus_t *ctx)
 {
-    int coilNum = 3;
-    return (get_coil_value( ctx, coilNum, "Default Load Control Mode (Coil 3)") );
+    return readRegisterAsInt( ctx, TRACER_DEFAULT_LOAD_CONTROL_MODE );
 }
 
 // -----------------------------------------------------------------------------
@@ -1362,8 +1876,7 @@ void setDefaultLoadControlMode (modbus_t *ctx, const int value)
 // -----------------------------------------------------------------------------
 int getEnableLoadTestMode (modbus_t *ctx)
 {
-    int coilNum = 5;
-    return (get_coil_value( ctx, coilNum, "Enable Load Test Mode (Coil 5)") );
+    return readRegisterAsInt( ctx, TRACER_ENABLE_LOAD_TEST_MODE );
 }
 
 // -----------------------------------------------------------------------------
@@ -1492,282 +2005,1544 @@ void    setLoadOnOffTimers (modbus_t *ctx,
     Logger_LogInfo( "LoadOnOff Helper complete!" );
 }
 
-// *****************************************************************************
-// **
-// ** Little bit of libmodbus doc
-//
-//  Modbus Library Call         Function    Description         Used in EPSolar?
-//  modbus_read_bits()          0x01        read coil status    Yes
-//  modbus_read_input_bits      0x02        read input status   Yes
-//  modbus_read_registers       0x03        read holding regs   Yes
-//  modbus_read_input_registers 0x04        read input regs     Yes
-//  modbus_write_bit            0x05        force single coil   Yes
-//  modbus_write_register       0x06        preset single register  No
-//  modbus_write_bits           0x0F        orce multiple coils     No
-//  modbus_write_registers      0x10        preset multiple registers   Yes
-//  modbus_write_and_read_registers 0x17    read/write multiples        No
-//
-//  **
-// *****************************************************************************
-
-
 // -----------------------------------------------------------------------------
-static
-int get_coil_value (modbus_t *ctx, const int coilNum, const char *description)
+const tracerRegister_t *getRegisterDescriptor (const int regId)
 {
-    int numBits = 1;
-    uint8_t value = 0;
-
-    assert( ctx != NULL );
-    pthread_mutex_lock( &aMutex );
-
-    //
-    //  Modbux Function 0x01 - read coil status
-    //
-    if (modbus_read_bits( ctx, coilNum, numBits, &value ) == -1) {
-        Logger_LogError("%s -- read_bits on coil %d failed: %s\n", description, coilNum, modbus_strerror(errno) );
-    }
-    pthread_mutex_unlock( &aMutex );
+    assert((regId >= 0) && (regId < TRACER_REGISTER_COUNT) );
+    return &registerMap[ regId ];
+}
 
+// -----------------------------------------------------------------------------
+int decodeRegisterAsInt (const int regId, const uint16_t *words)
+{
     //
-    // Mask off the top 7 just in case
-    return ( value & 0b00000001 );
+    //  Raw register value, unscaled
+    return (int) decode_register_words( getRegisterDescriptor( regId ), words );
 }
 
 // -----------------------------------------------------------------------------
-static
-void set_coil_value (modbus_t *ctx, const int coilNum, const int value, const char *description)
+float decodeRegisterAsFloat (const int regId, const uint16_t *words)
 {
-    assert( ctx != NULL );
-    assert((value == TRUE) || (value == FALSE) );
-
-    //Logger_LogDebug( "%s - setting %d to %d\n", description, coilNum, value );
     //
-    // Modbus function 0x05
-    pthread_mutex_lock( &aMutex );
-    if (modbus_write_bit( ctx, coilNum, value ) == -1) {
-        Logger_LogError("write_bit on coil %d failed: %s\n", coilNum, modbus_strerror(errno) );
-    }
-    pthread_mutex_unlock( &aMutex );
+    //  Scaled from the full width value, so an unsigned two word counter
+    //  past 0x7FFFFFFF doesn't come out negative
+    const tracerRegister_t *reg = getRegisterDescriptor( regId );
+    return ((float) decode_register_words( reg, words ) / reg->scale );
 }
 
 // -----------------------------------------------------------------------------
 static
-void float_write_registers (modbus_t *ctx, const int registerAddress, const float floatValue)
+long long decode_register_words (const tracerRegister_t *reg, const uint16_t *words)
 {
-    uint16_t buffer[ 2 ];
-
-    assert( ctx != NULL );
-    memset(buffer, '\0', sizeof buffer );
-
-    if (floatValue >= 0.0)
-        buffer[ 0 ] = (uint16_t) (floatValue * 100.0 );
-    else {
+    //
+    //  Signed registers are two's complement, the same as
+    //  float_to_register_word() puts on the wire
+    if (reg->numRegisters == 2) {
         //
-        // Shenanigans for negative numbers
-        float temp = floatValue * 100.0; // -40 becomes -4000
-        temp *= -1.0; // -4000 becomes 4000 (0x0F9F)
-        uint16_t bits = (uint16_t) temp; // 0xF9F
-        bits = (bits ^ 0xFFFF ); // exclusive OR 0x0F9F -> 0xF060
-        buffer[ 0 ] = bits; // and that's what we write back
-
-        Logger_LogDebug("float_write_regsiters - negative number coming in [%f]\n", floatValue );
-        Logger_LogDebug("      - temp [%f]    bits [%X] [%d]   buf[0] [%X]\n", temp, bits, bits, buffer[0] );
+        //  Assemble in 32 bits rather than in a long - long is only 32 bits
+        //  wide on the Pi, where 0x100000000L doesn't fit
+        uint32_t raw = ((uint32_t) words[ 0x01 ] << 16) | words[ 0x00 ];
+        return reg->isSigned ? (long long) (int32_t) raw : (long long) raw;
     }
 
-    //
-    //  This is Modbus Function 0x10
-    //
-    pthread_mutex_lock( &aMutex );
-    if (modbus_write_registers( ctx, registerAddress, 0x01, buffer ) == -1) {
-        Logger_LogError("float_write_registers() - write of value %0.2f to register %X failed: %s\n", floatValue, registerAddress, modbus_strerror(errno) );
-    }
-    pthread_mutex_unlock( &aMutex );
+    return reg->isSigned ? (long long) (int16_t) words[ 0x00 ] : (long long) words[ 0x00 ];
 }
 
 // -----------------------------------------------------------------------------
-static
-void int_write_registers (modbus_t *ctx, const int registerAddress, const int intValue)
+float readRegisterAsFloat (modbus_t *ctx, const int regId)
 {
-    uint16_t buffer[ 2 ];
-    
-    assert( ctx != NULL );
-    memset(buffer, '\0', sizeof buffer );
-    buffer[ 0 ] = (uint16_t) intValue;
+    const tracerRegister_t *reg = getRegisterDescriptor( regId );
+    uint16_t words[ 4 ];
 
-    pthread_mutex_lock( &aMutex );
-    if (modbus_write_registers( ctx, registerAddress, 0x01, buffer ) == -1) {
-        Logger_LogError("int_write_registers() - write of value %d to register %X failed: %s\n", intValue, registerAddress, modbus_strerror(errno) );
-    }
-    pthread_mutex_unlock( &aMutex );
+    if (!read_register_words( ctx, reg, words ))
+        return reg->badReadValue;
+
+    return decodeRegisterAsFloat( regId, words );
 }
 
-// ----------------------------------------------------------------------------
-static
-float float_read_input_register (modbus_t *ctx,
-        const int registerAddress,
-        const int numBytes,
-        const char *description,
-        const float badReadValue)
+// -----------------------------------------------------------------------------
+int readRegisterAsInt (modbus_t *ctx, const int regId)
 {
-    assert( ctx != NULL );
-    assert((numBytes == 1) || (numBytes == 2) );
+    const tracerRegister_t *reg = getRegisterDescriptor( regId );
+    uint16_t words[ 4 ];
 
-    uint16_t buffer[ 32 ];
-    memset(buffer, '\0', sizeof buffer );
+    if (!read_register_words( ctx, reg, words ))
+        return (int) reg->badReadValue;
 
-    float returnValue = badReadValue;
-    int status = 0;
+    return decodeRegisterAsInt( regId, words );
+}
 
-    pthread_mutex_lock( &aMutex );
+// -----------------------------------------------------------------------------
+int planRegisterReads (const int *regIds, const int numIds, const int gapFill, tracerReadPlan_t *plan)
+{
     //
-    // Modbus function 0x04
-    status = modbus_read_input_registers( ctx, registerAddress, numBytes, buffer );
-    pthread_mutex_unlock( &aMutex );
-
-    if (status == -1) {
-        Logger_LogError("%s - Read of %d bytes at address %X failed: %s\n", description, numBytes, registerAddress, modbus_strerror(errno) );
-    } else {
-        if (numBytes == 2) {
-            long temp = buffer[ 0x01 ] << 16;
-            temp |= buffer[ 0x00 ];
-            returnValue = (float) temp / 100.0;
-        } else {
-            returnValue = buffer[ 0x00 ] / 100.0;
+    //  Work out the fewest requests that cover every register asked for.
+    //  Sort by function code and address, then walk the list extending the
+    //  current request as long as: the function code matches, no more than
+    //  'gapFill' unwanted registers sit in between, the request stays under the
+    //  PDU limit and it doesn't cross a hole in the map. Greedy is optimal here
+    //  since anything that can reach a register can also reach the ones before it.
+    int     sorted[ TRACER_REGISTER_COUNT ];
+    int     seen[ TRACER_REGISTER_COUNT ];
+    int     numSorted = 0;
+
+    assert( plan != NULL );
+    memset( plan, '\0', sizeof( tracerReadPlan_t ) );
+    memset( seen, '\0', sizeof seen );
+    for (int i = 0; i < TRACER_REGISTER_COUNT; i += 1)
+        plan->fieldRequest[ i ] = -1;
+
+    for (int i = 0; i < numIds; i += 1) {
+        int regId = regIds[ i ];
+        assert((regId >= 0) && (regId < TRACER_REGISTER_COUNT) );
+        if (seen[ regId ])
+            continue;
+        seen[ regId ] = TRUE;
+
+        const tracerRegister_t *reg = getRegisterDescriptor( regId );
+        int j = numSorted;
+        while (j > 0) {
+            const tracerRegister_t *prev = getRegisterDescriptor( sorted[ j - 1 ] );
+            if (prev->functionCode < reg->functionCode ||
+                (prev->functionCode == reg->functionCode && prev->address <= reg->address))
+                break;
+            sorted[ j ] = sorted[ j - 1 ];
+            j -= 1;
         }
+        sorted[ j ] = regId;
+        numSorted += 1;
     }
 
-    return returnValue;
-}
-
-// ----------------------------------------------------------------------------
-static
-int int_read_input_register (modbus_t *ctx,
-        const int registerAddress,
-        const int numBytes,
-        const char *description,
-        const int badReadValue)
-{
-    assert( ctx != NULL );
-    assert((numBytes == 1) || (numBytes == 2) );
-
-    uint16_t buffer[ 32 ];
-    memset(buffer, '\0', sizeof buffer );
+    for (int i = 0; i < numSorted; i += 1) {
+        const tracerRegister_t *reg = getRegisterDescriptor( sorted[ i ] );
+        int last = reg->address + reg->numRegisters - 1;
+
+        if (plan->numRequests > 0) {
+            tracerReadRequest_t *req = &plan->requests[ plan->numRequests - 1 ];
+            int reqLast = req->address + req->numRegisters - 1;
+            int newLast = (last > reqLast ? last : reqLast);
+            int maxCount = ((reg->functionCode == 0x01 || reg->functionCode == 0x02) ? MODBUS_MAX_READ_BITS : MODBUS_MAX_READ_REGISTERS);
+
+            if (req->functionCode == reg->functionCode &&
+                (reg->address - reqLast - 1) <= gapFill &&
+                (newLast - req->address + 1) <= maxCount &&
+                is_readable_range( reg->functionCode, req->address, newLast )) {
+                req->numRegisters = newLast - req->address + 1;
+                plan->fieldRequest[ sorted[ i ] ] = plan->numRequests - 1;
+                continue;
+            }
+        }
 
-    int status = 0;
-    int returnValue = badReadValue;
-    
-    pthread_mutex_lock( &aMutex );
+        if (plan->numRequests >= TRACER_MAX_PLAN_REQUESTS) {
+            Logger_LogError( "planRegisterReads - more than %d requests needed\n", TRACER_MAX_PLAN_REQUESTS );
+            return FALSE;
+        }
 
-    //
-    //  Modbus function 0x04
-    status = modbus_read_input_registers( ctx, registerAddress, numBytes, buffer );
-    pthread_mutex_unlock( &aMutex );
+        tracerReadRequest_t *req = &plan->requests[ plan->numRequests ];
+        req->functionCode = reg->functionCode;
+        req->address = reg->address;
+        req->numRegisters = reg->numRegisters;
+        plan->fieldRequest[ sorted[ i ] ] = plan->numRequests;
+        plan->numRequests += 1;
+    }
 
-    if (status == -1) {
-        Logger_LogError("%s - Read of %d bytes at address %X failed: %s\n", description, numBytes, registerAddress, modbus_strerror(errno) );
-        returnValue = badReadValue;
+    for (int i = 0; i < plan->numRequests; i += 1) {
+        plan->requests[ i ].offset = plan->numWords;
+        plan->numWords += plan->requests[ i ].numRegisters;
+    }
 
-    } else {
-        if (numBytes == 2) {
-            long temp = buffer[ 0x01 ] << 16;
-            temp |= buffer[ 0x00 ];
-            returnValue = (int) temp;
-        } else {
-            returnValue = ((int) buffer[ 0x00 ] );
-        }
+    if (plan->numWords > TRACER_MAX_PLAN_WORDS) {
+        Logger_LogError( "planRegisterReads - plan needs %d words, more than %d\n", plan->numWords, TRACER_MAX_PLAN_WORDS );
+        return FALSE;
     }
 
-    return returnValue;
+    return TRUE;
 }
 
-// ----------------------------------------------------------------------------
-static
-float float_read_register (modbus_t *ctx,
-        const int registerAddress,
-        const int numBytes,
-        const char *description,
-        const float badReadValue)
+// -----------------------------------------------------------------------------
+int executeReadPlan (modbus_t *ctx, const tracerReadPlan_t *plan, tracerReadResult_t *result)
 {
-    assert( ctx != NULL );
-    assert((numBytes == 1) || (numBytes == 2) );
-
-    uint16_t buffer[ 32 ];
-    memset(buffer, '\0', sizeof buffer );
-
-    float returnValue = badReadValue;
-    int status = 0;
-
-    pthread_mutex_lock( &aMutex );
-
     //
-    //  Modbus Function 0x03
-    status = modbus_read_registers( ctx, registerAddress, numBytes, buffer );
-    pthread_mutex_unlock( &aMutex );
+    //  Run the whole plan back to back with one trip through the mutex, so
+    //  another thread can't wedge its requests in between and the snapshot
+    //  is as close to a single point in time as the bus allows.
+    int failures = 0;
 
-    if (status == -1) {
-        Logger_LogError("%s - Read of %d bytes at address %X failed: %s\n", description, numBytes, registerAddress, modbus_strerror(errno) );
-        returnValue = badReadValue;
-    } else {
+    assert( ctx != NULL );
+    assert( plan != NULL );
+    assert( result != NULL );
+    memset( result, '\0', sizeof( tracerReadResult_t ) );
+
+    busState_t *bus = lock_bus( ctx );
+    if (bus->pipelineDepth > 1) {
+        failures = pipelined_read_plan( bus, ctx, plan, result );
+        unlock_bus( bus );
+        return (failures == 0);
+    }
 
-        if (numBytes == 2) {
-            long temp = buffer[ 0x01 ] << 16;
-            temp |= buffer[ 0x00 ];
-            returnValue = (float) temp / 100.0;
+    for (int i = 0; i < plan->numRequests; i += 1) {
+        const tracerReadRequest_t *req = &plan->requests[ i ];
+        if (cached_read( bus, ctx, req->functionCode, req->address, req->numRegisters, &result->words[ req->offset ] ) == -1) {
+            Logger_LogError( "executeReadPlan - Read of %d at address %X (function 0x%02X) failed: %s\n",
+                    req->numRegisters, req->address, req->functionCode, modbus_strerror( errno ) );
+            failures += 1;
         } else {
-            //
-            // Add experimental Negative Value handling - from looking at GitHub
-            //  Sources
-            long temp = buffer[ 0x00 ];
-            if (temp > 0x7FFF) {
-                //Logger_LogDebug( "Floating point value @buffer[0x00] > 0x7FFF: [%x] [%ld]\n", buffer[ 0x00 ], temp );
-                temp = (0xFFFF - temp) * -1.0;
-                //Logger_LogDebug( " temp is now calculated to be: %ld\n", temp );
-            }
-            returnValue = (temp / 100.0 );
+            result->requestOK[ i ] = TRUE;
         }
+        result->requestStatus[ i ] = lastStatus;
     }
+    unlock_bus( bus );
 
-    return returnValue;
+    return (failures == 0);
 }
 
-// ----------------------------------------------------------------------------
+// -----------------------------------------------------------------------------
 static
-int int_read_register (modbus_t *ctx,
-        const int registerAddress,
-        const int numBytes,
-        const char *description,
-        const int badReadValue)
+int pipelined_read_plan (busState_t *bus, modbus_t *ctx, const tracerReadPlan_t *plan, tracerReadResult_t *result)
 {
-    assert( ctx != NULL );
-    assert((numBytes == 1) || (numBytes == 2) );
-
-    uint16_t buffer[ 32 ];
-    memset(buffer, '\0', sizeof buffer );
-
-    int status = 0;
-    int returnValue = badReadValue;
-    
-    pthread_mutex_lock( &aMutex );
-
     //
-    //  Modbus function 0x03
-    status = modbus_read_registers( ctx, registerAddress, numBytes, buffer );
-    pthread_mutex_unlock( &aMutex );
-
-    if (status == -1) {
-        Logger_LogError("%s - Read of %d bytes at address %X failed: %s\n", description, numBytes, registerAddress, modbus_strerror(errno) );
-        returnValue = badReadValue;
-    } else {
-
-        if (numBytes == 2) {
-            long temp = buffer[ 0x01 ] << 16;
-            temp |= buffer[ 0x00 ];
-            returnValue = (int) temp;
+    //  Caller holds the bus lock, and ctx is Modbus TCP. Whatever the cache
+    //  can answer comes from the cache. The rest goes out pipelineDepth
+    //  requests at a time, straight onto libmodbus' socket, and the replies are
+    //  matched up by transaction ID in whatever order they arrive - so a plan
+    //  costs about one network round trip plus the bus time at the gateway,
+    //  rather than a round trip per request. A request that gets no reply in
+    //  time, or a garbled one, is tried again through libmodbus if the retry
+    //  policy says so. Returns how many requests failed.
+    enum { QUEUED, IN_FLIGHT, DONE, RETRY };
+    int         state[ TRACER_MAX_PLAN_REQUESTS ];
+    uint16_t    transactionId[ TRACER_MAX_PLAN_REQUESTS ];
+    long long   sentAt[ TRACER_MAX_PLAN_REQUESTS ];
+    uint8_t     buffer[ 2 * MODBUS_TCP_MAX_ADU_LENGTH ];
+    int         buffered = 0;
+    int         inFlight = 0;
+    int         queued = 0;
+    int         failures = 0;
+    int         brokenErr = 0;              // the socket's gone, with this errno
+    long        responseMicros, byteMicros;
+
+    int sock = modbus_get_socket( ctx );
+    int slave = modbus_get_slave( ctx );
+    get_modbus_timeouts( ctx, &responseMicros, &byteMicros );
+
+    for (int i = 0; i < plan->numRequests; i += 1) {
+        const tracerReadRequest_t *req = &plan->requests[ i ];
+        if (cache_lookup( bus, ctx, req->functionCode, req->address, req->numRegisters, &result->words[ req->offset ] )) {
+            state[ i ] = DONE;
+            result->requestOK[ i ] = TRUE;
+            result->requestStatus[ i ] = TRACER_STATUS_OK;
         } else {
-            returnValue = ((int) buffer[ 0x00 ] );
+            state[ i ] = QUEUED;
+            queued += 1;
         }
     }
 
-    return returnValue;
+    int next = 0;
+    while (queued > 0 || inFlight > 0) {
+        //
+        //  Top up the pipeline
+        while (queued > 0 && inFlight < bus->pipelineDepth && brokenErr == 0) {
+            while (state[ next ] != QUEUED)
+                next += 1;
+
+            const tracerReadRequest_t *req = &plan->requests[ next ];
+            uint16_t tid = bus->nextTransactionId++;
+            uint8_t request[ 12 ] = {
+                tid >> 8, tid & 0xFF, 0x00, 0x00, 0x00, 0x06, slave & 0xFF, req->functionCode,
+                req->address >> 8, req->address & 0xFF, req->numRegisters >> 8, req->numRegisters & 0xFF
+            };
+
+            sentAt[ next ] = monotonic_micros();
+            if (send( sock, request, sizeof( request ), MSG_NOSIGNAL ) != (ssize_t) sizeof( request )) {
+                brokenErr = (errno != 0 ? errno : EPIPE);
+                break;
+            }
+            transactionId[ next ] = tid;
+            state[ next ] = IN_FLIGHT;
+            queued -= 1;
+            inFlight += 1;
+        }
+
+        //
+        //  A dead socket fails everything that hasn't been answered. It won't
+        //  come back on its own, so there's no point retrying.
+        if (brokenErr != 0) {
+            for (int i = 0; i < plan->numRequests; i += 1) {
+                if (state[ i ] != QUEUED && state[ i ] != IN_FLIGHT)
+                    continue;
+                const tracerReadRequest_t *req = &plan->requests[ i ];
+                errno = brokenErr;
+                end_attempt( bus, ctx, req->functionCode, req->address, req->numRegisters,
+                             (state[ i ] == IN_FLIGHT ? sentAt[ i ] : monotonic_micros()), -1, retryPolicy.maxAttempts );
+                state[ i ] = DONE;
+                result->requestStatus[ i ] = lastStatus;
+                failures += 1;
+            }
+            Logger_LogError( "pipelined_read_plan - lost the connection: %s\n", strerror( brokenErr ) );
+            break;
+        }
+
+        //
+        //  Wait for a reply, or for the oldest request to run out of time
+        long long oldest = 0;
+        for (int i = 0; i < plan->numRequests; i += 1) {
+            if (state[ i ] == IN_FLIGHT && (oldest == 0 || sentAt[ i ] < oldest))
+                oldest = sentAt[ i ];
+        }
+        long long waitMicros = (oldest + responseMicros) - monotonic_micros();
+        struct pollfd pfd = { .fd = sock, .events = POLLIN };
+        int ready = (waitMicros > 0 ? poll( &pfd, 1, (int) ((waitMicros + 999) / 1000) ) : 0);
+
+        if (ready < 0 && errno == EINTR)
+            continue;
+        if (ready > 0) {
+            ssize_t got = recv( sock, &buffer[ buffered ], sizeof( buffer ) - buffered, MSG_DONTWAIT );
+            if (got == 0 || (got < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+                brokenErr = (got == 0 ? ECONNRESET : errno);
+                continue;
+            }
+            if (got > 0)
+                buffered += got;
+        }
+
+        //
+        //  Every complete reply in the buffer. One for a transaction we've
+        //  given up on, or nobody's, is dropped.
+        while (buffered >= 7) {
+            int length = (buffer[ 4 ] << 8) | buffer[ 5 ];
+            if (length < 2 || length > MODBUS_TCP_MAX_ADU_LENGTH - 6) {
+                buffered = 0;           // lost the framing - whatever's in flight will time out
+                break;
+            }
+            if (buffered < 6 + length)
+                break;
+
+            uint16_t tid = (buffer[ 0 ] << 8) | buffer[ 1 ];
+            for (int i = 0; i < plan->numRequests; i += 1) {
+                if (state[ i ] != IN_FLIGHT || transactionId[ i ] != tid)
+                    continue;
+
+                const tracerReadRequest_t *req = &plan->requests[ i ];
+                int err = decode_pipelined_reply( req, slave, buffer, 6 + length, &result->words[ req->offset ] );
+                errno = err;
+                int retry = end_attempt( bus, ctx, req->functionCode, req->address, req->numRegisters, sentAt[ i ], (err == 0 ? 0 : -1), 1 );
+
+                inFlight -= 1;
+                state[ i ] = (retry ? RETRY : DONE);
+                if (state[ i ] == DONE) {
+                    result->requestStatus[ i ] = lastStatus;
+                    if (err == 0) {
+                        result->requestOK[ i ] = TRUE;
+                        cache_store( bus, ctx, req->functionCode, req->address, req->numRegisters, &result->words[ req->offset ], monotonic_millis() );
+                    } else {
+                        failures += 1;
+                    }
+                }
+                break;
+            }
+
+            memmove( buffer, &buffer[ 6 + length ], buffered - (6 + length) );
+            buffered -= (6 + length);
+        }
+
+        //
+        //  Anything that's been out too long has timed out
+        long long nowMicros = monotonic_micros();
+        for (int i = 0; i < plan->numRequests; i += 1) {
+            if (state[ i ] != IN_FLIGHT || nowMicros - sentAt[ i ] < responseMicros)
+                continue;
+
+            const tracerReadRequest_t *req = &plan->requests[ i ];
+            errno = ETIMEDOUT;
+            int retry = end_attempt( bus, ctx, req->functionCode, req->address, req->numRegisters, sentAt[ i ], -1, 1 );
+            inFlight -= 1;
+            state[ i ] = (retry ? RETRY : DONE);
+            if (!retry) {
+                result->requestStatus[ i ] = lastStatus;
+                failures += 1;
+            }
+        }
+    }
+
+    //
+    //  Second goes, one at a time the ordinary way. The pipelined send was the
+    //  first attempt, so these only get what's left of maxAttempts. Late
+    //  replies to the first ones are flushed first so libmodbus doesn't take
+    //  them for its own.
+    int flushed = FALSE;
+    for (int i = 0; i < plan->numRequests; i += 1) {
+        if (state[ i ] != RETRY)
+            continue;
+        if (!flushed) {
+            modbus_flush( ctx );
+            flushed = TRUE;
+        }
+
+        const tracerReadRequest_t *req = &plan->requests[ i ];
+        if (modbus_read_any( bus, ctx, req->functionCode, req->address, req->numRegisters, &result->words[ req->offset ], 1 ) == -1) {
+            Logger_LogError( "pipelined_read_plan - Read of %d at address %X (function 0x%02X) failed: %s\n",
+                    req->numRegisters, req->address, req->functionCode, modbus_strerror( errno ) );
+            failures += 1;
+        } else {
+            result->requestOK[ i ] = TRUE;
+            cache_store( bus, ctx, req->functionCode, req->address, req->numRegisters, &result->words[ req->offset ], monotonic_millis() );
+        }
+        result->requestStatus[ i ] = lastStatus;
+    }
+
+    return failures;
+}
+
+// -----------------------------------------------------------------------------
+static
+int decode_pipelined_reply (const tracerReadRequest_t *req, const int slave, const uint8_t *adu, const int len, uint16_t *words)
+{
+    //
+    //  Zero, or the errno libmodbus would have set for the same reply.
+    //  Coils and discrete inputs come back one bit per word, as from
+    //  modbus_read_any().
+    int functionCode = adu[ 7 ];
+    int isBits = (req->functionCode == 0x01 || req->functionCode == 0x02);
+    int expected = (isBits ? (req->numRegisters + 7) / 8 : req->numRegisters * 2);
+
+    if (adu[ 6 ] != slave)
+        return EMBBADSLAVE;
+    if (functionCode == (req->functionCode | 0x80))
+        return (len >= 9 ? MODBUS_ENOBASE + adu[ 8 ] : EMBBADDATA);
+    if (functionCode != req->functionCode || len < 9 || adu[ 8 ] != expected || len != 9 + expected)
+        return EMBBADDATA;
+
+    const uint8_t *data = &adu[ 9 ];
+    for (int i = 0; i < req->numRegisters; i += 1)
+        words[ i ] = (isBits ? (data[ i / 8 ] >> (i % 8)) & 0x01 : (data[ 2 * i ] << 8) | data[ (2 * i) + 1 ]);
+
+    return 0;
+}
+
+// -----------------------------------------------------------------------------
+const uint16_t *planResultWords (const tracerReadPlan_t *plan, const tracerReadResult_t *result, const int regId)
+{
+    //
+    //  NULL if the field wasn't planned or its request failed
+    const tracerRegister_t *reg = getRegisterDescriptor( regId );
+    int r = plan->fieldRequest[ regId ];
+
+    if (r < 0 || !result->requestOK[ r ])
+        return NULL;
+
+    return &result->words[ plan->requests[ r ].offset + (reg->address - plan->requests[ r ].address) ];
+}
+
+// -----------------------------------------------------------------------------
+float planResultAsFloat (const tracerReadPlan_t *plan, const tracerReadResult_t *result, const int regId)
+{
+    const uint16_t *words = planResultWords( plan, result, regId );
+    return (words == NULL ? getRegisterDescriptor( regId )->badReadValue : decodeRegisterAsFloat( regId, words ));
+}
+
+// -----------------------------------------------------------------------------
+int planResultAsInt (const tracerReadPlan_t *plan, const tracerReadResult_t *result, const int regId)
+{
+    const uint16_t *words = planResultWords( plan, result, regId );
+    return (words == NULL ? (int) getRegisterDescriptor( regId )->badReadValue : decodeRegisterAsInt( regId, words ));
+}
+
+// -----------------------------------------------------------------------------
+int readRegisterList (modbus_t *ctx, const int *regIds, const int numIds, const int gapFill, float *values)
+{
+    //
+    //  Convenience wrapper: plan, execute and decode in one call. Values come
+    //  back in the same order as regIds. Returns FALSE if any request failed,
+    //  in which case the affected values hold their bad read values.
+    tracerReadPlan_t    plan;
+    tracerReadResult_t  result;
+
+    if (!planRegisterReads( regIds, numIds, gapFill, &plan ))
+        return FALSE;
+
+    int status = executeReadPlan( ctx, &plan, &result );
+    for (int i = 0; i < numIds; i += 1)
+        values[ i ] = planResultAsFloat( &plan, &result, regIds[ i ] );
+
+    return status;
+}
+
+// -----------------------------------------------------------------------------
+int readInputRegisterBlock (modbus_t *ctx, const int registerAddress, const int numRegisters, uint16_t *buffer)
+{
+    //
+    //  Pull a contiguous run of input registers in one go. Every register read
+    //  costs a full round trip to the controller, so fetching 0x3100..0x3112
+    //  in one request is a lot cheaper than nineteen separate ones.
+    assert( ctx != NULL );
+    assert( buffer != NULL );
+    assert((numRegisters >= 1) && (numRegisters <= MODBUS_MAX_READ_REGISTERS) );
+
+    memset( buffer, '\0', numRegisters * sizeof( uint16_t ) );
+
+    busState_t *bus = lock_bus( ctx );
+    //
+    // Modbus function 0x04
+    int status = cached_read( bus, ctx, 0x04, registerAddress, numRegisters, buffer );
+    unlock_bus( bus );
+
+    if (status == -1) {
+        Logger_LogError( "Block read of %d registers at address %X failed: %s\n", numRegisters, registerAddress, modbus_strerror( errno ) );
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+// -----------------------------------------------------------------------------
+float decodeTemperatureRegister (const int regId, const uint16_t *words)
+{
+    //
+    //  A temperature sitting in a buffer that's already been read, in
+    //  Fahrenheit like the getters - signed, so a frosty battery doesn't come
+    //  out at 655C
+    return C2F( decodeRegisterAsFloat( regId, words ) );
+}
+
+// -----------------------------------------------------------------------------
+int getRegisterClass (const int functionCode, const int address)
+{
+    switch (functionCode) {
+        case 0x01:  return TRACER_CLASS_SETTINGS;
+        case 0x02:  return TRACER_CLASS_REALTIME;
+        case 0x03:
+            //
+            // The clock is a holding register but it ticks
+            return ((address >= 0x9013 && address <= 0x9015) ? TRACER_CLASS_REALTIME : TRACER_CLASS_SETTINGS);
+        default:
+            break;
+    }
+
+    if (address >= 0x3000 && address <= 0x30FF)
+        return TRACER_CLASS_RATED;
+    if (address >= 0x3300 && address <= 0x3313)
+        return TRACER_CLASS_STATISTICS;
+    return TRACER_CLASS_REALTIME;
+}
+
+// -----------------------------------------------------------------------------
+void setRegisterCacheTTL (const int registerClass, const long milliseconds)
+{
+    assert((registerClass >= 0) && (registerClass < TRACER_CLASS_COUNT) );
+
+    cacheTTL[ registerClass ] = milliseconds;
+}
+
+// -----------------------------------------------------------------------------
+long getRegisterCacheTTL (const int registerClass)
+{
+    assert((registerClass >= 0) && (registerClass < TRACER_CLASS_COUNT) );
+    return cacheTTL[ registerClass ];
+}
+
+// -----------------------------------------------------------------------------
+void invalidateRegisterCache ()
+{
+    //
+    //  Every bus, attached or not
+    pthread_rwlock_rdlock( &registryLock );
+    for (int i = -1; i < TRACER_MAX_CONTEXTS; i += 1) {
+        busState_t *bus = (i < 0 ? &defaultBus : attachedBuses[ i ]);
+        if (bus != NULL) {
+            pthread_mutex_lock( &bus->lock );
+            memset( bus->caches, '\0', sizeof bus->caches );
+            pthread_mutex_unlock( &bus->lock );
+        }
+    }
+    pthread_rwlock_unlock( &registryLock );
+}
+
+// -----------------------------------------------------------------------------
+int tracerAttachContext (modbus_t *ctx)
+{
+    //
+    //  Give ctx a lock and cache of its own. Calls on it stop contending with
+    //  calls on every other context.
+    assert( ctx != NULL );
+    int status = FALSE;
+
+    pthread_rwlock_wrlock( &registryLock );
+    for (int i = 0; i < TRACER_MAX_CONTEXTS && !status; i += 1)
+        status = (attachedBuses[ i ] != NULL && attachedBuses[ i ]->ctx == ctx);
+
+    for (int i = 0; i < TRACER_MAX_CONTEXTS && !status; i += 1) {
+        if (attachedBuses[ i ] == NULL) {
+            busState_t *bus = calloc( 1, sizeof( busState_t ) );
+            if (bus == NULL)
+                break;
+            bus->ctx = ctx;
+            pthread_mutex_init( &bus->lock, NULL );
+            attachedBuses[ i ] = bus;
+            status = TRUE;
+        }
+    }
+    pthread_rwlock_unlock( &registryLock );
+
+    if (!status)
+        Logger_LogWarning( "tracerAttachContext - no room for another context, it will share the default lock\n" );
+    return status;
+}
+
+// -----------------------------------------------------------------------------
+void tracerDetachContext (modbus_t *ctx)
+{
+    //
+    //  Only once every call on ctx has returned. Nobody can look the bus up
+    //  while we hold the registry, and taking its lock waits out anyone who
+    //  found it before we did.
+    pthread_rwlock_wrlock( &registryLock );
+    for (int i = 0; i < TRACER_MAX_CONTEXTS; i += 1) {
+        if (attachedBuses[ i ] != NULL && attachedBuses[ i ]->ctx == ctx) {
+            pthread_mutex_lock( &attachedBuses[ i ]->lock );
+            merge_stats( &retiredStats, &attachedBuses[ i ]->stats );
+            pthread_mutex_unlock( &attachedBuses[ i ]->lock );
+            pthread_mutex_destroy( &attachedBuses[ i ]->lock );
+            free( attachedBuses[ i ] );
+            attachedBuses[ i ] = NULL;
+        }
+    }
+    pthread_rwlock_unlock( &registryLock );
+}
+
+// -----------------------------------------------------------------------------
+tracerBus_t *tracerLockContext (modbus_t *ctx)
+{
+    assert( ctx != NULL );
+    return lock_bus( ctx );
+}
+
+// -----------------------------------------------------------------------------
+void tracerUnlockContext (tracerBus_t *bus)
+{
+    assert( bus != NULL );
+    unlock_bus( bus );
+}
+
+// -----------------------------------------------------------------------------
+int tracerClassifyError (const int err)
+{
+    if (err == 0)
+        return TRACER_STATUS_OK;
+    if (err == ETIMEDOUT)
+        return TRACER_STATUS_TIMEOUT;
+    if (err > MODBUS_ENOBASE && err <= EMBXGTAR)
+        return TRACER_STATUS_EXCEPTION;
+    if (err == EMBMDATA || err == EINVAL)
+        return TRACER_STATUS_BAD_REQUEST;
+    if (err == EMBBADCRC || err == EMBBADDATA || err == EMBBADEXC || err == EMBUNKEXC || err == EMBBADSLAVE)
+        return TRACER_STATUS_CRC_ERROR;
+
+    return TRACER_STATUS_IO_ERROR;
+}
+
+// -----------------------------------------------------------------------------
+const char *tracerStatusToString (const int status)
+{
+    switch (status) {
+        case TRACER_STATUS_OK:          return "OK";
+        case TRACER_STATUS_TIMEOUT:     return "Timeout";
+        case TRACER_STATUS_CRC_ERROR:   return "CRC Error";
+        case TRACER_STATUS_EXCEPTION:   return "Exception";
+        case TRACER_STATUS_IO_ERROR:    return "I/O Error";
+        case TRACER_STATUS_BAD_REQUEST: return "Bad Request";
+    }
+    return "???";
+}
+
+// -----------------------------------------------------------------------------
+void tracerSetRetryPolicy (const tracerRetryPolicy_t *policy)
+{
+    assert( policy != NULL );
+    assert( policy->maxAttempts >= 1 );
+
+    retryPolicy = *policy;
+    retryPolicy.retry[ TRACER_STATUS_OK ] = FALSE;
+}
+
+// -----------------------------------------------------------------------------
+void tracerGetRetryPolicy (tracerRetryPolicy_t *policy)
+{
+    assert( policy != NULL );
+    *policy = retryPolicy;
+}
+
+// -----------------------------------------------------------------------------
+int tracerGetLastStatus ()
+{
+    return lastStatus;
+}
+
+// -----------------------------------------------------------------------------
+int tracerGetFirstFailure ()
+{
+    return firstFailure;
+}
+
+// -----------------------------------------------------------------------------
+void tracerClearStatus ()
+{
+    lastStatus = TRACER_STATUS_OK;
+    firstFailure = TRACER_STATUS_OK;
+}
+
+// -----------------------------------------------------------------------------
+int tracerSetAdaptiveTimeouts (modbus_t *ctx, const tracerTimeoutPolicy_t *policy)
+{
+    //
+    //  NULL policy turns it off again and puts back the timeouts libmodbus had.
+    //  Only for attached contexts - the shared default bus mixes everybody's
+    //  round trips together, which would make the numbers meaningless.
+    assert( ctx != NULL );
+
+    busState_t *bus = acquire_bus( ctx, TRUE );
+    if (bus == NULL) {
+        Logger_LogWarning( "tracerSetAdaptiveTimeouts - context isn't attached, leaving its timeouts alone\n" );
+        return FALSE;
+    }
+
+    adaptiveTimeouts_t *at = &bus->timeouts;
+    if (policy == NULL) {
+        if (at->enabled)
+            set_modbus_timeouts( ctx, at->savedResponseMicros, at->savedByteMicros );
+        at->enabled = FALSE;
+    } else {
+        assert( policy->minMicros > 0 && policy->minMicros <= policy->maxMicros );
+        if (!at->enabled)
+            get_modbus_timeouts( ctx, &at->savedResponseMicros, &at->savedByteMicros );
+        at->policy = *policy;
+        at->numSamples = 0;
+        at->next = 0;
+        at->sinceUpdate = 0;
+        at->consecutiveTimeouts = 0;
+        at->enabled = TRUE;
+        apply_timeouts( bus, ctx );
+    }
+    pthread_mutex_unlock( &bus->lock );
+
+    return TRUE;
+}
+
+// -----------------------------------------------------------------------------
+int tracerSetPipelining (modbus_t *ctx, const int maxInFlight)
+{
+    //
+    //  Modbus TCP contexts only - RTU has no transaction IDs to sort the
+    //  replies out by. Attached contexts only, like adaptive timeouts.
+    assert( ctx != NULL );
+
+    busState_t *bus = acquire_bus( ctx, TRUE );
+    if (bus == NULL) {
+        Logger_LogWarning( "tracerSetPipelining - context isn't attached, leaving it one request at a time\n" );
+        return FALSE;
+    }
+
+    bus->pipelineDepth = (maxInFlight > TRACER_MAX_PLAN_REQUESTS ? TRACER_MAX_PLAN_REQUESTS : maxInFlight);
+    if (bus->nextTransactionId == 0)
+        bus->nextTransactionId = 0x8000;        // well away from libmodbus' own, which start at zero
+    pthread_mutex_unlock( &bus->lock );
+
+    return TRUE;
+}
+
+// -----------------------------------------------------------------------------
+int tracerGetPipelining (modbus_t *ctx)
+{
+    assert( ctx != NULL );
+
+    int depth = 0;
+
+    busState_t *bus = acquire_bus( ctx, TRUE );
+    if (bus != NULL) {
+        depth = bus->pipelineDepth;
+        pthread_mutex_unlock( &bus->lock );
+    }
+    return depth;
+}
+
+// -----------------------------------------------------------------------------
+long tracerGetResponseTimeout (modbus_t *ctx)
+{
+    //
+    //  Microseconds, whether or not it's adaptive
+    long    responseMicros, byteMicros;
+
+    assert( ctx != NULL );
+    busState_t *bus = lock_bus( ctx );
+    get_modbus_timeouts( ctx, &responseMicros, &byteMicros );
+    unlock_bus( bus );
+
+    return responseMicros;
+}
+
+// -----------------------------------------------------------------------------
+void tracerGetStats (tracerStats_t *copy)
+{
+    //
+    //  Every bus counts its own under its own lock - add them all up, along
+    //  with whatever the detached ones left behind
+    assert( copy != NULL );
+
+    pthread_rwlock_rdlock( &registryLock );
+    memcpy( copy, &retiredStats, sizeof( tracerStats_t ) );
+    for (int i = -1; i < TRACER_MAX_CONTEXTS; i += 1) {
+        busState_t *bus = (i < 0 ? &defaultBus : attachedBuses[ i ]);
+        if (bus != NULL) {
+            pthread_mutex_lock( &bus->lock );
+            merge_stats( copy, &bus->stats );
+            pthread_mutex_unlock( &bus->lock );
+        }
+    }
+    pthread_rwlock_unlock( &registryLock );
+}
+
+// -----------------------------------------------------------------------------
+void tracerResetStats ()
+{
+    pthread_rwlock_wrlock( &registryLock );
+    memset( &retiredStats, '\0', sizeof( tracerStats_t ) );
+    for (int i = -1; i < TRACER_MAX_CONTEXTS; i += 1) {
+        busState_t *bus = (i < 0 ? &defaultBus : attachedBuses[ i ]);
+        if (bus != NULL) {
+            pthread_mutex_lock( &bus->lock );
+            memset( &bus->stats, '\0', sizeof( tracerStats_t ) );
+            pthread_mutex_unlock( &bus->lock );
+        }
+    }
+    pthread_rwlock_unlock( &registryLock );
+}
+
+// -----------------------------------------------------------------------------
+unsigned long tracerHistogramPercentile (const unsigned long *histogram, const double percentile)
+{
+    //
+    //  Upper edge, in microseconds, of the bucket holding the given percentile
+    //  (0.0 .. 100.0). Zero for an empty histogram.
+    unsigned long total = 0;
+    unsigned long seen = 0;
+
+    for (int i = 0; i < TRACER_LATENCY_BUCKETS; i += 1)
+        total += histogram[ i ];
+    if (total == 0)
+        return 0;
+
+    for (int i = 0; i < TRACER_LATENCY_BUCKETS; i += 1) {
+        seen += histogram[ i ];
+        if ((double) seen >= (percentile / 100.0) * total)
+            return (1UL << (i + 1));
+    }
+
+    return (1UL << TRACER_LATENCY_BUCKETS);
+}
+
+// *****************************************************************************
+// **
+// ** Little bit of libmodbus doc
+//
+//  Modbus Library Call         Function    Description         Used in EPSolar?
+//  modbus_read_bits()          0x01        read coil status    Yes
+//  modbus_read_input_bits      0x02        read input status   Yes
+//  modbus_read_registers       0x03        read holding regs   Yes
+//  modbus_read_input_registers 0x04        read input regs     Yes
+//  modbus_write_bit            0x05        force single coil   Yes
+//  modbus_write_register       0x06        preset single register  No
+//  modbus_write_bits           0x0F        orce multiple coils     No
+//  modbus_write_registers      0x10        preset multiple registers   Yes
+//  modbus_write_and_read_registers 0x17    read/write multiples        No
+//
+//  **
+// *****************************************************************************
+
+
+// -----------------------------------------------------------------------------
+static
+void set_coil_value (modbus_t *ctx, const int coilNum, const int value, const char *description)
+{
+    assert( ctx != NULL );
+    assert((value == TRUE) || (value == FALSE) );
+
+    //Logger_LogDebug( "%s - setting %d to %d\n", description, coilNum, value );
+    //
+    // Modbus function 0x05
+    busState_t *bus = lock_bus( ctx );
+    if (modbus_write_coil( bus, ctx, coilNum, value ) == -1) {
+        Logger_LogError("write_bit on coil %d failed: %s\n", coilNum, modbus_strerror(errno) );
+    }
+    //
+    //  Coils have side effects all over the place (load on/off, restore
+    //  defaults, clear statistics) so drop everything cached for this slave
+    memset( cache_for( bus, ctx ), '\0', CACHE_SLOTS * sizeof( cachedWord_t ) );
+    unlock_bus( bus );
+}
+
+// -----------------------------------------------------------------------------
+static
+void float_write_registers (modbus_t *ctx, const int registerAddress, const float floatValue)
+{
+    uint16_t buffer[ 2 ];
+
+    assert( ctx != NULL );
+    memset(buffer, '\0', sizeof buffer );
+    buffer[ 0 ] = float_to_register_word( floatValue );
+
+    //
+    //  This is Modbus Function 0x10
+    //
+    busState_t *bus = lock_bus( ctx );
+    if (modbus_write_words( bus, ctx, registerAddress, 0x01, buffer ) == -1) {
+        Logger_LogError("float_write_registers() - write of value %0.2f to register %X failed: %s\n", floatValue, registerAddress, modbus_strerror(errno) );
+    }
+    cache_invalidate( bus, ctx, 0x03, registerAddress, 1 );
+    unlock_bus( bus );
+}
+
+// -----------------------------------------------------------------------------
+static
+uint16_t float_to_register_word (const float floatValue)
+{
+    //
+    //  Round rather than truncate - 14.4 is 1439.99996 once it's been through
+    //  a float, and the controller would end up with 14.39. Negative numbers
+    //  go out as two's complement: -40.00 is 0xF060, which is what the
+    //  controller reads as -40.00 and what decodeRegisterAsInt() reads back.
+    return (uint16_t) (int16_t) lroundf( floatValue * 100.0f );
+}
+
+// -----------------------------------------------------------------------------
+static
+void int_write_registers (modbus_t *ctx, const int registerAddress, const int intValue)
+{
+    uint16_t buffer[ 2 ];
+    
+    assert( ctx != NULL );
+    memset(buffer, '\0', sizeof buffer );
+    buffer[ 0 ] = (uint16_t) intValue;
+
+    busState_t *bus = lock_bus( ctx );
+    if (modbus_write_words( bus, ctx, registerAddress, 0x01, buffer ) == -1) {
+        Logger_LogError("int_write_registers() - write of value %d to register %X failed: %s\n", intValue, registerAddress, modbus_strerror(errno) );
+    }
+    cache_invalidate( bus, ctx, 0x03, registerAddress, 1 );
+    unlock_bus( bus );
+}
+
+// ----------------------------------------------------------------------------
+static
+int read_register_words (modbus_t *ctx, const tracerRegister_t *reg, uint16_t *words)
+{
+    //
+    //  The one place single register map reads go to the wire (or the cache).
+    assert( ctx != NULL );
+    assert( reg != NULL );
+
+    busState_t *bus = lock_bus( ctx );
+    int status = cached_read( bus, ctx, reg->functionCode, reg->address, reg->numRegisters, words );
+    unlock_bus( bus );
+
+    if (status == -1) {
+        Logger_LogError("%s - Read of %d registers at address %X failed: %s\n", reg->description, reg->numRegisters, reg->address, modbus_strerror(errno) );
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+// ----------------------------------------------------------------------------
+static
+int modbus_read_any (busState_t *bus, modbus_t *ctx, const int functionCode, const int address, const int count, uint16_t *words, const int attemptsUsed)
+{
+    //
+    //  Caller holds the bus lock. Coils and discrete inputs come back one bit per
+    //  word so everything downstream can treat the result the same way.
+    //  attemptsUsed is how many goes the caller has already had at this read
+    //  elsewhere - they count against the retry policy's maxAttempts.
+    uint8_t bits[ MODBUS_MAX_READ_BITS ];
+    int status = -1;
+    int attempt = attemptsUsed;
+    long long started;
+
+    memset( words, '\0', count * sizeof( uint16_t ) );
+
+    do {
+        attempt += 1;
+        started = monotonic_micros();
+        switch (functionCode) {
+            case 0x01:  status = modbus_read_bits( ctx, address, count, bits );
+                break;
+            case 0x02:  status = modbus_read_input_bits( ctx, address, count, bits );
+                break;
+            case 0x03:  status = modbus_read_registers( ctx, address, count, words );
+                break;
+            case 0x04:  status = modbus_read_input_registers( ctx, address, count, words );
+                break;
+            default:    assert( FALSE );
+                break;
+        }
+    } while (end_attempt( bus, ctx, functionCode, address, count, started, status, attempt ));
+
+    if (status != -1 && (functionCode == 0x01 || functionCode == 0x02)) {
+        //
+        // Mask off the top 7 just in case
+        for (int i = 0; i < count; i += 1)
+            words[ i ] = (bits[ i ] & 0b00000001);
+    }
+
+    return status;
+}
+
+// ----------------------------------------------------------------------------
+static
+int is_readable_range (const int functionCode, const int first, const int last)
+{
+    for (size_t i = 0; i < sizeof( readableRanges ) / sizeof( readableRanges[ 0 ] ); i += 1) {
+        if (readableRanges[ i ].functionCode == functionCode &&
+            readableRanges[ i ].first <= first && last <= readableRanges[ i ].last)
+            return TRUE;
+    }
+
+    return FALSE;
+}
+
+// ----------------------------------------------------------------------------
+static
+int cached_read (busState_t *bus, modbus_t *ctx, const int functionCode, const int address, const int count, uint16_t *words)
+{
+    //
+    //  Caller holds the bus lock. Serve the whole run from the cache if every word
+    //  in it is still fresh, otherwise go to the wire and refresh all of it.
+    //  Same return convention as modbus_read_any().
+    long long now = monotonic_millis();
+
+    if (cache_lookup( bus, ctx, functionCode, address, count, words ))
+        return count;
+
+    int status = modbus_read_any( bus, ctx, functionCode, address, count, words, 0 );
+    if (status != -1)
+        cache_store( bus, ctx, functionCode, address, count, words, now );
+
+    return status;
+}
+
+// ----------------------------------------------------------------------------
+static
+int cache_lookup (busState_t *bus, modbus_t *ctx, const int functionCode, const int address, const int count, uint16_t *words)
+{
+    //
+    //  Caller holds the bus lock. TRUE, and the words filled in, only if every
+    //  one of them is in the cache and still fresh.
+    long long now = monotonic_millis();
+    cachedWord_t *cache = cache_for( bus, ctx );
+    int fresh = TRUE;
+
+    for (int i = 0; i < count && fresh; i += 1) {
+        int slot = cache_slot( functionCode, address + i );
+        long ttl = cacheTTL[ getRegisterClass( functionCode, address + i ) ];
+
+        fresh = (slot >= 0 && ttl != 0 && cache[ slot ].valid &&
+                 (ttl < 0 || (now - cache[ slot ].fetchedAt) <= ttl));
+    }
+
+    if (!fresh)
+        return FALSE;
+
+    bus->stats.cacheHits += 1;
+
+    for (int i = 0; i < count; i += 1)
+        words[ i ] = cache[ cache_slot( functionCode, address + i ) ].value;
+    lastStatus = TRACER_STATUS_OK;
+    return TRUE;
+}
+
+// ----------------------------------------------------------------------------
+static
+void cache_store (busState_t *bus, modbus_t *ctx, const int functionCode, const int address, const int count, const uint16_t *words, const long long now)
+{
+    //
+    //  Caller holds the bus lock
+    cachedWord_t *cache = cache_for( bus, ctx );
+
+    for (int i = 0; i < count; i += 1) {
+        int slot = cache_slot( functionCode, address + i );
+        if (slot >= 0) {
+            cache[ slot ].valid = TRUE;
+            cache[ slot ].value = words[ i ];
+            cache[ slot ].fetchedAt = now;
+        }
+    }
+}
+
+// ----------------------------------------------------------------------------
+static
+cachedWord_t *cache_for (busState_t *bus, modbus_t *ctx)
+{
+    //
+    //  Caller holds the bus lock. The words cached for ctx and the slave it's
+    //  set to now - a fresh, empty cache if there isn't one yet.
+    int slave = modbus_get_slave( ctx );
+    slaveCache_t *oldest = &bus->caches[ 0 ];
+
+    bus->cacheUses += 1;
+    for (int i = 0; i < CACHES_PER_BUS; i += 1) {
+        slaveCache_t *cache = &bus->caches[ i ];
+        if (cache->owner == ctx && cache->slave == slave) {
+            cache->lastUsed = bus->cacheUses;
+            return cache->words;
+        }
+        if (cache->lastUsed < oldest->lastUsed)
+            oldest = cache;
+    }
+
+    memset( oldest->words, '\0', sizeof oldest->words );
+    oldest->owner = ctx;
+    oldest->slave = slave;
+    oldest->lastUsed = bus->cacheUses;
+    return oldest->words;
+}
+
+// ----------------------------------------------------------------------------
+static
+int cache_slot (const int functionCode, const int address)
+{
+    //
+    //  -1 for anything outside readableRanges - those never get cached
+    int base = 0;
+
+    for (size_t i = 0; i < sizeof( readableRanges ) / sizeof( readableRanges[ 0 ] ); i += 1) {
+        const readableRange_t *range = &readableRanges[ i ];
+        if (range->functionCode == functionCode && range->first <= address && address <= range->last) {
+            assert( base + (address - range->first) < CACHE_SLOTS );
+            return base + (address - range->first);
+        }
+        base += (range->last - range->first + 1);
+    }
+
+    return -1;
+}
+
+// ----------------------------------------------------------------------------
+static
+void cache_invalidate (busState_t *bus, modbus_t *ctx, const int functionCode, const int address, const int count)
+{
+    //
+    //  Caller holds the bus lock
+    cachedWord_t *cache = cache_for( bus, ctx );
+
+    for (int i = 0; i < count; i += 1) {
+        int slot = cache_slot( functionCode, address + i );
+        if (slot >= 0)
+            cache[ slot ].valid = FALSE;
+    }
+}
+
+// ----------------------------------------------------------------------------
+static
+long long monotonic_millis ()
+{
+    return (monotonic_micros() / 1000LL);
+}
+
+// ----------------------------------------------------------------------------
+static
+long long monotonic_micros ()
+{
+    struct timespec ts;
+
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return ((long long) ts.tv_sec * 1000000LL) + (ts.tv_nsec / 1000L);
+}
+
+// ----------------------------------------------------------------------------
+static
+busState_t *lock_bus (modbus_t *ctx)
+{
+    long long started = monotonic_micros();
+    busState_t *bus = acquire_bus( ctx, FALSE );
+    long long waited = monotonic_micros() - started;
+
+    //
+    //  We hold the bus lock now, which is all its counters need
+    bus->stats.lockAcquisitions += 1;
+    bus->stats.lockWaitMicros += waited;
+    if (waited > (long long) bus->stats.maxLockWaitMicros)
+        bus->stats.maxLockWaitMicros = waited;
+    record_histogram( bus->stats.lockWaitHistogram, waited );
+
+    //
+    //  A backed off timeout belongs to the slave that ran it up. The others
+    //  sharing the bus go back to the plain one rather than wait on a dead
+    //  neighbour's account.
+    adaptiveTimeouts_t *at = &bus->timeouts;
+    if (at->enabled && at->consecutiveTimeouts > 0 && modbus_get_slave( ctx ) != at->backoffSlave) {
+        at->consecutiveTimeouts = 0;
+        apply_timeouts( bus, ctx );
+    }
+
+    return bus;
+}
+
+// ----------------------------------------------------------------------------
+static
+void unlock_bus (busState_t *bus)
+{
+    pthread_mutex_unlock( &bus->lock );
+}
+
+// ----------------------------------------------------------------------------
+static
+int modbus_write_words (busState_t *bus, modbus_t *ctx, const int address, const int count, const uint16_t *words)
+{
+    //
+    //  Function 0x10, timed. Caller holds the bus lock. Writing the same
+    //  values twice does no harm, so these get retried like reads.
+    int status;
+    int attempt = 0;
+    long long started;
+
+    do {
+        attempt += 1;
+        started = monotonic_micros();
+        status = modbus_write_registers( ctx, address, count, words );
+    } while (end_attempt( bus, ctx, 0x10, address, count, started, status, attempt ));
+
+    return status;
+}
+
+// ----------------------------------------------------------------------------
+static
+int modbus_write_coil (busState_t *bus, modbus_t *ctx, const int coilNum, const int value)
+{
+    //
+    //  Function 0x05, timed. Caller holds the bus lock.
+    int status;
+    int attempt = 0;
+    long long started;
+
+    do {
+        attempt += 1;
+        started = monotonic_micros();
+        status = modbus_write_bit( ctx, coilNum, value );
+    } while (end_attempt( bus, ctx, 0x05, coilNum, 1, started, status, attempt ));
+
+    return status;
+}
+
+// ----------------------------------------------------------------------------
+static
+void record_transaction (busState_t *bus, const int functionCode, const int address, const int count, const long long micros, const int status, const int err)
+{
+    //
+    //  Caller holds the bus lock
+    tracerStats_t *stats = &bus->stats;
+    tracerTransactionStats_t *entry = NULL;
+
+    for (int i = 0; i < stats->numEntries && entry == NULL; i += 1) {
+        if (stats->entries[ i ].functionCode == functionCode && stats->entries[ i ].address == address)
+            entry = &stats->entries[ i ];
+    }
+
+    if (entry == NULL && stats->numEntries < TRACER_MAX_STAT_ENTRIES) {
+        entry = &stats->entries[ stats->numEntries++ ];
+        entry->functionCode = functionCode;
+        entry->address = address;
+    }
+
+    if (entry == NULL) {
+        stats->untrackedTransactions += 1;
+    } else {
+        entry->transactions += 1;
+        entry->registers += count;
+        entry->totalMicros += micros;
+        if (micros > (long long) entry->maxMicros)
+            entry->maxMicros = micros;
+        record_histogram( entry->histogram, micros );
+
+        if (status == -1) {
+            entry->failures += 1;
+            switch (tracerClassifyError( err )) {
+                case TRACER_STATUS_TIMEOUT:     entry->timeouts += 1;
+                    break;
+                case TRACER_STATUS_CRC_ERROR:   entry->crcErrors += 1;
+                    break;
+                case TRACER_STATUS_EXCEPTION:   entry->exceptions += 1;
+                    break;
+            }
+        }
+    }
+}
+
+// ----------------------------------------------------------------------------
+static
+void record_histogram (unsigned long *histogram, const long long micros)
+{
+    //
+    //  Bucket n holds [2^n, 2^(n+1)) microseconds, bucket 0 anything under 2
+    int bucket = 0;
+
+    while (bucket < TRACER_LATENCY_BUCKETS - 1 && (micros >> (bucket + 1)) > 0)
+        bucket += 1;
+    histogram[ bucket ] += 1;
+}
+
+// ----------------------------------------------------------------------------
+static
+void merge_stats (tracerStats_t *into, const tracerStats_t *from)
+{
+    //
+    //  Adds from's counts to into's, entry by entry. Keys into hasn't room
+    //  for end up untracked, same as they would have counting them live.
+    for (int i = 0; i < from->numEntries; i += 1) {
+        const tracerTransactionStats_t *src = &from->entries[ i ];
+        tracerTransactionStats_t *entry = NULL;
+
+        for (int j = 0; j < into->numEntries && entry == NULL; j += 1) {
+            if (into->entries[ j ].functionCode == src->functionCode && into->entries[ j ].address == src->address)
+                entry = &into->entries[ j ];
+        }
+        if (entry == NULL && into->numEntries < TRACER_MAX_STAT_ENTRIES) {
+            entry = &into->entries[ into->numEntries++ ];
+            entry->functionCode = src->functionCode;
+            entry->address = src->address;
+        }
+
+        if (entry == NULL) {
+            into->untrackedTransactions += src->transactions;
+        } else {
+            entry->transactions += src->transactions;
+            entry->registers += src->registers;
+            entry->failures += src->failures;
+            entry->timeouts += src->timeouts;
+            entry->crcErrors += src->crcErrors;
+            entry->exceptions += src->exceptions;
+            entry->totalMicros += src->totalMicros;
+            if (src->maxMicros > entry->maxMicros)
+                entry->maxMicros = src->maxMicros;
+            for (int b = 0; b < TRACER_LATENCY_BUCKETS; b += 1)
+                entry->histogram[ b ] += src->histogram[ b ];
+        }
+    }
+
+    into->untrackedTransactions += from->untrackedTransactions;
+    into->retries += from->retries;
+    into->retriesRecovered += from->retriesRecovered;
+    into->cacheHits += from->cacheHits;
+    into->lockAcquisitions += from->lockAcquisitions;
+    into->lockWaitMicros += from->lockWaitMicros;
+    if (from->maxLockWaitMicros > into->maxLockWaitMicros)
+        into->maxLockWaitMicros = from->maxLockWaitMicros;
+    for (int b = 0; b < TRACER_LATENCY_BUCKETS; b += 1)
+        into->lockWaitHistogram[ b ] += from->lockWaitHistogram[ b ];
+}
+
+// ----------------------------------------------------------------------------
+static
+int end_attempt (busState_t *bus, modbus_t *ctx, const int functionCode, const int address, const int count, const long long started, const int status, const int attempt)
+{
+    //
+    //  Caller holds the bus lock. Books one attempt at a transaction and says
+    //  whether to have another go. errno comes back the way libmodbus left it.
+    long long elapsed = monotonic_micros() - started;
+    int err = (status == -1 ? errno : 0);
+    int retry = FALSE;
+
+    record_transaction( bus, functionCode, address, count, elapsed, status, err );
+    observe_round_trip( bus, ctx, elapsed, status, err );
+
+    lastStatus = tracerClassifyError( err );
+    if (lastStatus != TRACER_STATUS_OK) {
+        retry = (retryPolicy.retry[ lastStatus ] && attempt < retryPolicy.maxAttempts);
+        if (!retry && firstFailure == TRACER_STATUS_OK)
+            firstFailure = lastStatus;
+    }
+
+    if (retry || (status != -1 && attempt > 1)) {
+        if (retry)
+            bus->stats.retries += 1;
+        else
+            bus->stats.retriesRecovered += 1;
+    }
+
+    if (retry) {
+        Logger_LogDebug( "end_attempt - %s on function 0x%02X at %X, attempt %d of %d\n",
+                tracerStatusToString( lastStatus ), functionCode, address, attempt, retryPolicy.maxAttempts );
+        //
+        //  Whatever is left of a garbled or late reply would be taken for
+        //  the answer to the retry
+        modbus_flush( ctx );
+        if (retryPolicy.delayMicros > 0) {
+            struct timespec pause = { .tv_sec = retryPolicy.delayMicros / 1000000L, .tv_nsec = (retryPolicy.delayMicros % 1000000L) * 1000L };
+            nanosleep( &pause, NULL );
+        }
+    }
+
+    errno = err;
+    return retry;
+}
+
+// ----------------------------------------------------------------------------
+static
+void observe_round_trip (busState_t *bus, modbus_t *ctx, const long long micros, const int status, const int err)
+{
+    //
+    //  Caller holds the bus lock. Successful round trips go in the window and
+    //  every few of them the timeout is worked out again. A timeout backs off
+    //  straight away. Other errors (CRC, exceptions) did get an answer back,
+    //  so they say nothing about how long to wait.
+    adaptiveTimeouts_t *at = &bus->timeouts;
+
+    if (!at->enabled)
+        return;
+
+    if (status == -1) {
+        if (err == ETIMEDOUT) {
+            int slave = modbus_get_slave( ctx );
+            if (slave != at->backoffSlave)
+                at->consecutiveTimeouts = 0;
+            at->backoffSlave = slave;
+            at->consecutiveTimeouts += 1;
+            apply_timeouts( bus, ctx );
+        }
+        return;
+    }
+
+    at->samples[ at->next ] = (long) micros;
+    at->next = (at->next + 1) % RTT_WINDOW;
+    if (at->numSamples < RTT_WINDOW)
+        at->numSamples += 1;
+    at->sinceUpdate += 1;
+
+    if (at->consecutiveTimeouts > 0 || at->sinceUpdate >= RTT_UPDATE_EVERY) {
+        at->consecutiveTimeouts = 0;
+        apply_timeouts( bus, ctx );
+    }
+}
+
+// ----------------------------------------------------------------------------
+static
+void apply_timeouts (busState_t *bus, modbus_t *ctx)
+{
+    //
+    //  Caller holds the bus lock
+    adaptiveTimeouts_t *at = &bus->timeouts;
+    const tracerTimeoutPolicy_t *policy = &at->policy;
+    long    sorted[ RTT_WINDOW ];
+    long    timeout = policy->maxMicros;
+
+    if (at->numSamples >= RTT_MIN_SAMPLES) {
+        for (int i = 0; i < at->numSamples; i += 1) {
+            int j = i;
+            while (j > 0 && sorted[ j - 1 ] > at->samples[ i ]) {
+                sorted[ j ] = sorted[ j - 1 ];
+                j -= 1;
+            }
+            sorted[ j ] = at->samples[ i ];
+        }
+
+        int index = (int) ((policy->percentile / 100.0) * at->numSamples + 0.999) - 1;
+        if (index < 0)
+            index = 0;
+        if (index >= at->numSamples)
+            index = at->numSamples - 1;
+
+        timeout = sorted[ index ] + policy->marginMicros;
+        for (int i = 0; i < at->consecutiveTimeouts && i < policy->maxBackoff && timeout < policy->maxMicros; i += 1)
+            timeout *= 2;
+    }
+
+    if (timeout < policy->minMicros)
+        timeout = policy->minMicros;
+    if (timeout > policy->maxMicros)
+        timeout = policy->maxMicros;
+
+    at->sinceUpdate = 0;
+    if (timeout != at->responseMicros) {
+        Logger_LogDebug( "apply_timeouts - response timeout now %ld us after %d round trips and %d timeouts in a row\n",
+                timeout, at->numSamples, at->consecutiveTimeouts );
+        at->responseMicros = timeout;
+        set_modbus_timeouts( ctx, timeout, policy->byteMicros );
+    }
+}
+
+// ----------------------------------------------------------------------------
+static
+void set_modbus_timeouts (modbus_t *ctx, const long responseMicros, const long byteMicros)
+{
+    //
+    //  byteMicros of zero leaves the byte timeout as it is
+#ifdef RPI
+    modbus_set_response_timeout( ctx, responseMicros / 1000000L, responseMicros % 1000000L );
+    if (byteMicros > 0)
+        modbus_set_byte_timeout( ctx, byteMicros / 1000000L, byteMicros % 1000000L );
+#else
+    struct timeval  timeout;
+
+    timeout.tv_sec = responseMicros / 1000000L;
+    timeout.tv_usec = responseMicros % 1000000L;
+    modbus_set_response_timeout( ctx, &timeout );
+    if (byteMicros > 0) {
+        timeout.tv_sec = byteMicros / 1000000L;
+        timeout.tv_usec = byteMicros % 1000000L;
+        modbus_set_byte_timeout( ctx, &timeout );
+    }
+#endif
+}
+
+// ----------------------------------------------------------------------------
+static
+void get_modbus_timeouts (modbus_t *ctx, long *responseMicros, long *byteMicros)
+{
+#ifdef RPI
+    uint32_t    sec, usec;
+
+    modbus_get_response_timeout( ctx, &sec, &usec );
+    *responseMicros = ((long) sec * 1000000L) + usec;
+    modbus_get_byte_timeout( ctx, &sec, &usec );
+    *byteMicros = ((long) sec * 1000000L) + usec;
+#else
+    struct timeval  timeout;
+
+    modbus_get_response_timeout( ctx, &timeout );
+    *responseMicros = ((long) timeout.tv_sec * 1000000L) + timeout.tv_usec;
+    modbus_get_byte_timeout( ctx, &timeout );
+    *byteMicros = ((long) timeout.tv_sec * 1000000L) + timeout.tv_usec;
+#endif
+}
+
+// ----------------------------------------------------------------------------
+static
+busState_t *find_attached_bus (modbus_t *ctx)
+{
+    //
+    //  NULL if ctx shares the default bus. Caller holds registryLock, and the
+    //  answer is only good for as long as it does.
+    busState_t *bus = NULL;
+
+    for (int i = 0; i < TRACER_MAX_CONTEXTS && bus == NULL; i += 1) {
+        if (attachedBuses[ i ] != NULL && attachedBuses[ i ]->ctx == ctx)
+            bus = attachedBuses[ i ];
+    }
+
+    return bus;
+}
+
+// ----------------------------------------------------------------------------
+static
+busState_t *acquire_bus (modbus_t *ctx, const int attachedOnly)
+{
+    //
+    //  Look ctx's bus up and lock it. The registry stays read locked until
+    //  the bus lock is held, so tracerDetachContext() can't free the bus in
+    //  between. NULL if ctx isn't attached and attachedOnly is set.
+    pthread_rwlock_rdlock( &registryLock );
+    busState_t *bus = find_attached_bus( ctx );
+    if (bus == NULL && !attachedOnly)
+        bus = &defaultBus;
+    if (bus != NULL)
+        pthread_mutex_lock( &bus->lock );
+    pthread_rwlock_unlock( &registryLock );
+
+    return bus;
 }
@@ -20,6 +20,298 @@ extern "C" {
 #include <modbus/modbus.h>
     
     
+//
+// Every value the library reads from the controller has an entry in the
+// register map. The getters below are lookups into that table.
+typedef enum tracerRegisterId {
+    TRACER_CHARGING_DEVICE_STATUS = 0,                  // Coils (0x01)
+    TRACER_OUTPUT_CONTROL_MODE,
+    TRACER_MANUAL_LOAD_CONTROL_MODE,
+    TRACER_DEFAULT_LOAD_CONTROL_MODE,
+    TRACER_ENABLE_LOAD_TEST_MODE,
+
+    TRACER_DEVICE_OVER_TEMPERATURE,                     // Discrete Inputs (0x02)
+    TRACER_NIGHT_TIME,
+
+    TRACER_RATED_CHARGING_CURRENT,                      // Input Registers (0x04)
+    TRACER_RATED_LOAD_CURRENT,
+    TRACER_PV_ARRAY_INPUT_VOLTAGE,
+    TRACER_PV_ARRAY_INPUT_CURRENT,
+    TRACER_PV_ARRAY_INPUT_POWER,
+    TRACER_LOAD_VOLTAGE,
+    TRACER_LOAD_CURRENT,
+    TRACER_LOAD_POWER,
+    TRACER_BATTERY_TEMPERATURE,
+    TRACER_DEVICE_TEMPERATURE,
+    TRACER_BATTERY_STATE_OF_CHARGE,
+    TRACER_BATTERY_REAL_RATED_VOLTAGE,
+    TRACER_BATTERY_STATUS,
+    TRACER_CHARGING_EQUIPMENT_STATUS,
+    TRACER_DISCHARGING_EQUIPMENT_STATUS,
+    TRACER_MAXIMUM_PV_VOLTAGE_TODAY,
+    TRACER_MINIMUM_PV_VOLTAGE_TODAY,
+    TRACER_MAXIMUM_BATTERY_VOLTAGE_TODAY,
+    TRACER_MINIMUM_BATTERY_VOLTAGE_TODAY,
+    TRACER_CONSUMED_ENERGY_TODAY,
+    TRACER_CONSUMED_ENERGY_MONTH,
+    TRACER_CONSUMED_ENERGY_YEAR,
+    TRACER_CONSUMED_ENERGY_TOTAL,
+    TRACER_GENERATED_ENERGY_TODAY,
+    TRACER_GENERATED_ENERGY_MONTH,
+    TRACER_GENERATED_ENERGY_YEAR,
+    TRACER_GENERATED_ENERGY_TOTAL,
+    TRACER_BATTERY_VOLTAGE,
+    TRACER_BATTERY_CURRENT,
+
+    TRACER_BATTERY_TYPE,                                // Holding Registers (0x03)
+    TRACER_BATTERY_CAPACITY,
+    TRACER_TEMPERATURE_COMPENSATION_COEFFICIENT,
+    TRACER_HIGH_VOLTAGE_DISCONNECT,
+    TRACER_CHARGING_LIMIT_VOLTAGE,
+    TRACER_OVER_VOLTAGE_RECONNECT,
+    TRACER_EQUALIZATION_VOLTAGE,
+    TRACER_BOOSTING_VOLTAGE,
+    TRACER_FLOATING_VOLTAGE,
+    TRACER_BOOST_RECONNECT_VOLTAGE,
+    TRACER_LOW_VOLTAGE_RECONNECT_VOLTAGE,
+    TRACER_UNDER_VOLTAGE_WARNING_RECOVER_VOLTAGE,
+    TRACER_UNDER_VOLTAGE_WARNING_VOLTAGE,
+    TRACER_LOW_VOLTAGE_DISCONNECT_VOLTAGE,
+    TRACER_DISCHARGING_LIMIT_VOLTAGE,
+    TRACER_REALTIME_CLOCK,
+    TRACER_BATTERY_TEMPERATURE_WARNING_UPPER_LIMIT,
+    TRACER_BATTERY_TEMPERATURE_WARNING_LOWER_LIMIT,
+    TRACER_CONTROLLER_TEMPERATURE_UPPER_LIMIT,
+    TRACER_CONTROLLER_TEMPERATURE_UPPER_LIMIT_RECOVER,
+    TRACER_DAY_TIME_THRESHOLD_VOLTAGE,
+    TRACER_LIGHT_SIGNAL_STARTUP_DELAY_TIME,
+    TRACER_NIGHT_TIME_THRESHOLD_VOLTAGE,
+    TRACER_LIGHT_SIGNAL_CLOSE_DELAY_TIME,
+    TRACER_LOAD_CONTROLLING_MODE,
+    TRACER_WORKING_TIME_LENGTH_1,
+    TRACER_WORKING_TIME_LENGTH_2,
+    TRACER_TURN_ON_TIMING_1_SECOND,
+    TRACER_TURN_ON_TIMING_1_MINUTE,
+    TRACER_TURN_ON_TIMING_1_HOUR,
+    TRACER_TURN_OFF_TIMING_1_SECOND,
+    TRACER_TURN_OFF_TIMING_1_MINUTE,
+    TRACER_TURN_OFF_TIMING_1_HOUR,
+    TRACER_TURN_ON_TIMING_2_SECOND,
+    TRACER_TURN_ON_TIMING_2_MINUTE,
+    TRACER_TURN_ON_TIMING_2_HOUR,
+    TRACER_TURN_OFF_TIMING_2_SECOND,
+    TRACER_TURN_OFF_TIMING_2_MINUTE,
+    TRACER_TURN_OFF_TIMING_2_HOUR,
+    TRACER_BACKLIGHT_TIME,
+    TRACER_LENGTH_OF_NIGHT,
+    TRACER_BATTERY_RATED_VOLTAGE_CODE,
+    TRACER_EQUALIZE_DURATION,
+    TRACER_BOOST_DURATION,
+    TRACER_DISCHARGING_PERCENTAGE,
+    TRACER_CHARGING_PERCENTAGE,
+    TRACER_BATTERY_MANAGEMENT_MODE,
+
+    TRACER_REGISTER_COUNT
+} tracerRegisterId_t;
+
+typedef struct tracerRegister {
+    int         address;
+    int         functionCode;           // 0x01, 0x02, 0x03 or 0x04
+    int         numRegisters;           // words on the wire, low word first
+    float       scale;                  // raw value is divided by this
+    int         isSigned;
+    float       badReadValue;           // what a getter returns if the read fails
+    const char  *units;
+    const char  *description;
+} tracerRegister_t;
+
+extern  const tracerRegister_t  *getRegisterDescriptor( const int regId );
+extern  float       readRegisterAsFloat( modbus_t *ctx, const int regId );
+extern  int         readRegisterAsInt( modbus_t *ctx, const int regId );
+extern  float       decodeRegisterAsFloat( const int regId, const uint16_t *words );
+extern  int         decodeRegisterAsInt( const int regId, const uint16_t *words );
+
+//
+// Read planning - group any set of registers into as few requests as possible
+#define     TRACER_MAX_PLAN_REQUESTS    32
+#define     TRACER_MAX_PLAN_WORDS       1024
+#define     TRACER_DEFAULT_GAP_FILL     8           // unwanted registers worth reading to save a round trip
+
+typedef struct tracerReadRequest {
+    int         functionCode;
+    int         address;
+    int         numRegisters;           // registers, or bits for function 0x01 and 0x02
+    int         offset;                 // where this request lands in tracerReadResult_t.words
+} tracerReadRequest_t;
+
+typedef struct tracerReadPlan {
+    int                 numRequests;
+    int                 numWords;
+    tracerReadRequest_t requests[ TRACER_MAX_PLAN_REQUESTS ];
+    int                 fieldRequest[ TRACER_REGISTER_COUNT ];      // -1 if the field isn't in the plan
+} tracerReadPlan_t;
+
+typedef struct tracerReadResult {
+    int         requestOK[ TRACER_MAX_PLAN_REQUESTS ];
+    int         requestStatus[ TRACER_MAX_PLAN_REQUESTS ];      // tracerStatus_t, after any retries
+    uint16_t    words[ TRACER_MAX_PLAN_WORDS ];
+} tracerReadResult_t;
+
+extern  int         planRegisterReads( const int *regIds, const int numIds, const int gapFill, tracerReadPlan_t *plan );
+extern  int         executeReadPlan( modbus_t *ctx, const tracerReadPlan_t *plan, tracerReadResult_t *result );
+extern  const uint16_t  *planResultWords( const tracerReadPlan_t *plan, const tracerReadResult_t *result, const int regId );
+extern  float       planResultAsFloat( const tracerReadPlan_t *plan, const tracerReadResult_t *result, const int regId );
+extern  int         planResultAsInt( const tracerReadPlan_t *plan, const tracerReadResult_t *result, const int regId );
+extern  int         readRegisterList( modbus_t *ctx, const int *regIds, const int numIds, const int gapFill, float *values );
+
+//
+// Every read goes through a small cache, keyed by function code and address.
+//  Each class of register gets its own freshness window in milliseconds: zero
+//  turns caching off for the class, TRACER_CACHE_FOREVER means the value never
+//  goes stale on its own. Writes made through this library drop whatever they
+//  touch. Each context and slave ID is cached separately, a few to a bus.
+typedef enum tracerRegisterClass {
+    TRACER_CLASS_RATED = 0,         // 0x3000..0x300E - fixed at the factory
+    TRACER_CLASS_REALTIME,          // 0x3100.., 0x3200.., 0x331A.., discrete inputs, clock
+    TRACER_CLASS_STATISTICS,        // 0x3300..0x3313 - daily and cumulative
+    TRACER_CLASS_SETTINGS,          // 0x9000.. and the coils
+    TRACER_CLASS_COUNT
+} tracerRegisterClass_t;
+
+#define TRACER_CACHE_FOREVER        (-1L)
+
+extern  int         getRegisterClass( const int functionCode, const int address );
+extern  void        setRegisterCacheTTL( const int registerClass, const long milliseconds );
+extern  long        getRegisterCacheTTL( const int registerClass );
+extern  void        invalidateRegisterCache( void );
+
+//
+// Calls on a context are serialized by a lock. By default every context shares
+//  one; attach a context to give it a lock and read cache of its own, so
+//  controllers on separate ports can be talked to at the same time.
+#define TRACER_MAX_CONTEXTS         16
+
+extern  int         tracerAttachContext( modbus_t *ctx );
+extern  void        tracerDetachContext( modbus_t *ctx );
+
+//
+// Hold a context's lock across something that isn't a register call - closing
+//  and reopening its connection, say. Nothing else can use the context until
+//  it's unlocked, and no tracer call may be made on it in between.
+typedef struct busState tracerBus_t;
+
+extern  tracerBus_t *tracerLockContext( modbus_t *ctx );
+extern  void        tracerUnlockContext( tracerBus_t *bus );
+
+//
+// What became of a transaction. libmodbus' errno sorted by what can be done
+//  about it: timeouts and garbled replies are usually line noise and worth
+//  another go, an exception is the controller saying no, an I/O error
+//  means the port itself is in trouble, and a bad request is a bug on our
+//  side that no amount of retrying will fix. Reads and writes that fail in a
+//  class the retry policy covers are flushed and tried again, up to
+//  maxAttempts in all. The policy applies to every bus and isn't locked, so
+//  set it up front.
+typedef enum tracerStatus {
+    TRACER_STATUS_OK = 0,
+    TRACER_STATUS_TIMEOUT,
+    TRACER_STATUS_CRC_ERROR,            // bad CRC, or a short or garbled reply
+    TRACER_STATUS_EXCEPTION,            // the controller answered with an exception
+    TRACER_STATUS_IO_ERROR,             // anything else - port gone, not connected...
+    TRACER_STATUS_BAD_REQUEST,          // the caller asked for too much or for nonsense
+    TRACER_STATUS_COUNT
+} tracerStatus_t;
+
+typedef struct tracerRetryPolicy {
+    int     maxAttempts;                        // 1 turns retrying off
+    int     retry[ TRACER_STATUS_COUNT ];       // TRUE for the classes worth another go
+    long    delayMicros;                        // pause before each retry
+} tracerRetryPolicy_t;
+
+extern  int         tracerClassifyError( const int err );
+extern  const char  *tracerStatusToString( const int status );
+extern  void        tracerSetRetryPolicy( const tracerRetryPolicy_t *policy );
+extern  void        tracerGetRetryPolicy( tracerRetryPolicy_t *policy );
+
+//
+// The getters still hand back their bad read values when all else fails, and
+//  these say why. Both are per thread: the last status is the calling thread's
+//  most recent read or write, the first failure is the first one that went
+//  wrong since tracerClearStatus().
+extern  int         tracerGetLastStatus( void );
+extern  int         tracerGetFirstFailure( void );
+extern  void        tracerClearStatus( void );
+
+//
+// Adaptive timeouts for an attached context. Off by default, so libmodbus' own
+//  fixed timeouts apply (about half a second). Once on, the response timeout
+//  tracks a high percentile of that context's recent successful round trips
+//  plus a margin, and doubles on each consecutive timeout up to 2^maxBackoff
+//  times. A dead controller then costs a few tens of milliseconds, not seconds.
+//  The doubling is for the slave ID that timed out; the next call for another
+//  slave on the bus starts from the plain timeout again.
+typedef struct tracerTimeoutPolicy {
+    double  percentile;                 // of recent round trips, 0.0 .. 100.0
+    long    marginMicros;               // added on top of it
+    long    minMicros;                  // response timeout never goes below this
+    long    maxMicros;                  // or above this - also used until we've seen enough
+    long    byteMicros;                 // byte timeout, 0 leaves libmodbus' alone
+    int     maxBackoff;
+} tracerTimeoutPolicy_t;
+
+extern  int         tracerSetAdaptiveTimeouts( modbus_t *ctx, const tracerTimeoutPolicy_t *policy );
+extern  long        tracerGetResponseTimeout( modbus_t *ctx );
+
+//
+// Pipelining for an attached Modbus TCP context. Off by default. Once on, a
+//  read plan's requests go out up to maxInFlight at a time without waiting for
+//  the replies in between, and the replies are matched up by transaction ID.
+//  Over a slow link to a gateway a plan then costs about one round trip plus
+//  the bus time, instead of a round trip per request. Gateways that can't
+//  queue requests drop the extras; those time out once and are retried one
+//  at a time. 0 or 1 turns it off.
+extern  int         tracerSetPipelining( modbus_t *ctx, const int maxInFlight );
+extern  int         tracerGetPipelining( modbus_t *ctx );
+
+//
+// Instrumentation. Every Modbus transaction is counted and timed, keyed by its
+//  function code and starting address, along with how long callers waited for
+//  the bus lock. Latency histograms are log2: bucket n counts round trips of
+//  2^n up to 2^(n+1) microseconds.
+#define TRACER_LATENCY_BUCKETS      24
+#define TRACER_MAX_STAT_ENTRIES     128
+
+typedef struct tracerTransactionStats {
+    int                 functionCode;
+    int                 address;                // first register or coil of the request
+    unsigned long       transactions;
+    unsigned long       registers;              // registers or bits moved
+    unsigned long       failures;               // all of them, including the three below
+    unsigned long       timeouts;
+    unsigned long       crcErrors;
+    unsigned long       exceptions;             // controller answered with an exception
+    unsigned long long  totalMicros;
+    unsigned long       maxMicros;
+    unsigned long       histogram[ TRACER_LATENCY_BUCKETS ];
+} tracerTransactionStats_t;
+
+typedef struct tracerStats {
+    int                 numEntries;
+    tracerTransactionStats_t entries[ TRACER_MAX_STAT_ENTRIES ];
+    unsigned long       untrackedTransactions;  // keys that didn't fit in entries[]
+    unsigned long       retries;                // transactions sent again after a failure
+    unsigned long       retriesRecovered;       // ... that went through on a retry
+    unsigned long       cacheHits;              // reads answered without the bus
+    unsigned long       lockAcquisitions;
+    unsigned long long  lockWaitMicros;
+    unsigned long       maxLockWaitMicros;
+    unsigned long       lockWaitHistogram[ TRACER_LATENCY_BUCKETS ];
+} tracerStats_t;
+
+extern  void        tracerGetStats( tracerStats_t *stats );
+extern  void        tracerResetStats( void );
+extern  unsigned long   tracerHistogramPercentile( const unsigned long *histogram, const double percentile );
+
 
 extern  float       getBatteryTemperature( modbus_t *ctx );
 extern  float       getBatteryRealRatedVoltage( modbus_t *ctx );
@@ -131,6 +423,32 @@ extern  void        setRealtimeClock( modbus_t *ctx, const int seconds, const in
 
 extern  char        *getRealtimeClockStr( modbus_t *ctx,char *buffer, const int buffSize );
 extern  void        getRealtimeClock( modbus_t *ctx, int *seconds, int *minutes, int *hour, int *day, int *month, int *year );
+extern  char        *decodeRealtimeClockStr( const uint16_t *words, char *buffer, const int buffSize );
+extern  void        decodeRealtimeClock( const uint16_t *words, int *seconds, int *minutes, int *hour, int *day, int *month, int *year );
+
+//
+// The battery parameter block, 0x9000..0x900E, as one unit
+typedef struct tracerBatterySettings {
+    int     batteryType;                            // 0x9000  0 User, 1 Sealed, 2 Gel, 3 Flooded
+    int     batteryCapacity;                        // 0x9001  Ah
+    float   temperatureCompensationCoefficient;     // 0x9002  mV/C/2V
+    float   highVoltageDisconnect;                  // 0x9003  Volts from here on
+    float   chargingLimitVoltage;                   // 0x9004
+    float   overVoltageReconnect;                   // 0x9005
+    float   equalizationVoltage;                    // 0x9006
+    float   boostingVoltage;                        // 0x9007
+    float   floatingVoltage;                        // 0x9008
+    float   boostReconnectVoltage;                  // 0x9009
+    float   lowVoltageReconnectVoltage;             // 0x900A
+    float   underVoltageWarningRecoverVoltage;      // 0x900B
+    float   underVoltageWarningVoltage;             // 0x900C
+    float   lowVoltageDisconnectVoltage;            // 0x900D
+    float   dischargingLimitVoltage;                // 0x900E
+} tracerBatterySettings_t;
+
+extern  int         getBatterySettings( modbus_t *ctx, tracerBatterySettings_t *settings );
+extern  int         setBatterySettings( modbus_t *ctx, const tracerBatterySettings_t *settings );
+extern  int         validateBatterySettings( const tracerBatterySettings_t *settings );
 
 extern  void        setDischargingLimitVoltage( modbus_t *ctx,double value );
 extern  float       getDischargingLimitVoltage( modbus_t *ctx );
@@ -197,6 +515,140 @@ extern  float       getMaximumBatteryVoltageToday( modbus_t *ctx );
 extern  float       getMinimumPVVoltageToday( modbus_t *ctx );
 extern  float       getMaximumPVVoltageToday( modbus_t *ctx );
 
+//
+// Where each field sits in the three status words - the same bits the is*()
+//  and get*Status*() helpers below test, for callers that want masks
+#define TRACER_BATT_VOLTAGE_STATUS          0x000F      // 0x3200 D3-D0
+#define TRACER_BATT_TEMPERATURE_STATUS      0x00F0      //        D7-D4
+#define TRACER_BATT_INNER_RESISTANCE        0x0100      //        D8
+#define TRACER_BATT_WRONG_RATED_VOLTAGE     0x8000      //        D15
+
+#define TRACER_CHG_RUNNING                  0x0001      // 0x3201 D0
+#define TRACER_CHG_FAULT                    0x0002      //        D1
+#define TRACER_CHG_CHARGING_STAGE           0x000C      //        D3-D2 none, float, boost, equalize
+#define TRACER_CHG_PV_INPUT_SHORTED         0x0010      //        D4
+#define TRACER_CHG_DISEQUILIBRIUM           0x0040      //        D6
+#define TRACER_CHG_LOAD_MOSFET_SHORTED      0x0080      //        D7
+#define TRACER_CHG_LOAD_SHORTED             0x0100      //        D8
+#define TRACER_CHG_LOAD_OVER_CURRENT        0x0200      //        D9
+#define TRACER_CHG_INPUT_OVER_CURRENT       0x0400      //        D10
+#define TRACER_CHG_ANTI_REVERSE_MOSFET_SHORTED  0x0800  //        D11
+#define TRACER_CHG_CHARGING_MOSFET_OPEN     0x1000      //        D12
+#define TRACER_CHG_CHARGING_MOSFET_SHORTED  0x2000      //        D13
+#define TRACER_CHG_INPUT_VOLTAGE_STATUS     0xC000      //        D15-D14
+
+#define TRACER_DCHG_RUNNING                 0x0001      // 0x3202 D0
+#define TRACER_DCHG_FAULT                   0x0002      //        D1
+#define TRACER_DCHG_OUTPUT_OVER_VOLTAGE     0x0010      //        D4
+#define TRACER_DCHG_BOOST_OVER_VOLTAGE      0x0020      //        D5
+#define TRACER_DCHG_SHORTED_HIGH_VOLTAGE    0x0040      //        D6
+#define TRACER_DCHG_INPUT_OVER_VOLTAGE      0x0080      //        D7
+#define TRACER_DCHG_OUTPUT_VOLTAGE_ABNORMAL 0x0100      //        D8
+#define TRACER_DCHG_UNABLE_TO_STOP          0x0200      //        D9
+#define TRACER_DCHG_UNABLE_TO_DISCHARGE     0x0400      //        D10
+#define TRACER_DCHG_SHORTED                 0x0800      //        D11
+#define TRACER_DCHG_OUTPUT_POWER            0x3000      //        D13-D12 light, moderate, rated, overload
+#define TRACER_DCHG_INPUT_VOLTAGE_STATUS    0xC000      //        D15-D14
+
+#define TRACER_BATT_FAULTS                  (TRACER_BATT_INNER_RESISTANCE | TRACER_BATT_WRONG_RATED_VOLTAGE)
+#define TRACER_CHG_FAULTS                   0x3FD0      // D4, D6-D13
+#define TRACER_DCHG_FAULTS                  0x0FF0      // D4-D11
+
+//
+// All three status words decoded in one pass, from a table of where each field
+//  sits, into small integers - so a fault check is a compare, not a string
+//  compare. The labels are only looked up when asked for.
+typedef enum tracerStatusWord {
+    TRACER_WORD_BATTERY_STATUS = 0,         // 0x3200
+    TRACER_WORD_CHARGING_STATUS,            // 0x3201
+    TRACER_WORD_DISCHARGING_STATUS,         // 0x3202
+    TRACER_NUM_STATUS_WORDS
+} tracerStatusWord_t;
+
+typedef enum { TRACER_BATT_NORMAL = 0, TRACER_BATT_OVER_VOLTAGE, TRACER_BATT_UNDER_VOLTAGE, TRACER_BATT_OVER_DISCHARGE, TRACER_BATT_FAULT } tracerBatteryVoltageStatus_t;
+typedef enum { TRACER_TEMP_NORMAL = 0, TRACER_TEMP_HIGH, TRACER_TEMP_LOW } tracerTemperatureStatus_t;
+typedef enum { TRACER_PV_NORMAL = 0, TRACER_PV_NO_INPUT, TRACER_PV_HIGH_VOLTAGE, TRACER_PV_VOLTAGE_ERROR } tracerPVInputStatus_t;
+typedef enum { TRACER_STAGE_NOT_CHARGING = 0, TRACER_STAGE_FLOAT, TRACER_STAGE_BOOST, TRACER_STAGE_EQUALIZE } tracerChargingStage_t;
+typedef enum { TRACER_DCHG_INPUT_NORMAL = 0, TRACER_DCHG_INPUT_LOW, TRACER_DCHG_INPUT_HIGH, TRACER_DCHG_INPUT_NO_ACCESS } tracerDischargeInputStatus_t;
+typedef enum { TRACER_LOAD_LIGHT = 0, TRACER_LOAD_MODERATE, TRACER_LOAD_RATED, TRACER_LOAD_OVERLOAD } tracerLoadLevel_t;
+
+//
+// One byte a field, in the same order as tracerStatusField_t. The D1 "fault"
+//  bits are kept raw - see isChargingStatusNormal() for why.
+typedef struct tracerDecodedStatus {
+    uint8_t     batteryVoltage;             // tracerBatteryVoltageStatus_t
+    uint8_t     batteryTemperature;         // tracerTemperatureStatus_t
+    uint8_t     batteryInnerResistanceAbnormal;
+    uint8_t     batteryWrongRatedVoltage;
+
+    uint8_t     chargingRunning;
+    uint8_t     chargingFaultBit;
+    uint8_t     chargingStage;              // tracerChargingStage_t
+    uint8_t     pvInputShorted;
+    uint8_t     disequilibrium;
+    uint8_t     loadMOSFETShorted;
+    uint8_t     loadShorted;
+    uint8_t     loadOverCurrent;
+    uint8_t     inputOverCurrent;
+    uint8_t     antiReverseMOSFETShorted;
+    uint8_t     chargingMOSFETOpen;
+    uint8_t     chargingMOSFETShorted;
+    uint8_t     pvInputStatus;              // tracerPVInputStatus_t
+
+    uint8_t     dischargingRunning;
+    uint8_t     dischargingFaultBit;
+    uint8_t     outputOverVoltage;
+    uint8_t     boostOverVoltage;
+    uint8_t     shortedHighVoltageSide;
+    uint8_t     inputOverVoltage;
+    uint8_t     outputVoltageAbnormal;
+    uint8_t     unableToStopDischarging;
+    uint8_t     unableToDischarge;
+    uint8_t     dischargingShorted;
+    uint8_t     loadLevel;                  // tracerLoadLevel_t
+    uint8_t     dischargeInputStatus;       // tracerDischargeInputStatus_t
+
+    uint8_t     anyFault;                   // any of the shorts, over currents, over voltages...
+} tracerDecodedStatus_t;
+
+typedef enum tracerStatusField {
+    TRACER_FIELD_BATTERY_VOLTAGE = 0,
+    TRACER_FIELD_BATTERY_TEMPERATURE,
+    TRACER_FIELD_BATTERY_INNER_RESISTANCE,
+    TRACER_FIELD_BATTERY_WRONG_RATED_VOLTAGE,
+    TRACER_FIELD_CHARGING_RUNNING,
+    TRACER_FIELD_CHARGING_FAULT_BIT,
+    TRACER_FIELD_CHARGING_STAGE,
+    TRACER_FIELD_PV_INPUT_SHORTED,
+    TRACER_FIELD_DISEQUILIBRIUM,
+    TRACER_FIELD_LOAD_MOSFET_SHORTED,
+    TRACER_FIELD_LOAD_SHORTED,
+    TRACER_FIELD_LOAD_OVER_CURRENT,
+    TRACER_FIELD_INPUT_OVER_CURRENT,
+    TRACER_FIELD_ANTI_REVERSE_MOSFET_SHORTED,
+    TRACER_FIELD_CHARGING_MOSFET_OPEN,
+    TRACER_FIELD_CHARGING_MOSFET_SHORTED,
+    TRACER_FIELD_PV_INPUT_STATUS,
+    TRACER_FIELD_DISCHARGING_RUNNING,
+    TRACER_FIELD_DISCHARGING_FAULT_BIT,
+    TRACER_FIELD_OUTPUT_OVER_VOLTAGE,
+    TRACER_FIELD_BOOST_OVER_VOLTAGE,
+    TRACER_FIELD_SHORTED_HIGH_VOLTAGE_SIDE,
+    TRACER_FIELD_INPUT_OVER_VOLTAGE,
+    TRACER_FIELD_OUTPUT_VOLTAGE_ABNORMAL,
+    TRACER_FIELD_UNABLE_TO_STOP_DISCHARGING,
+    TRACER_FIELD_UNABLE_TO_DISCHARGE,
+    TRACER_FIELD_DISCHARGING_SHORTED,
+    TRACER_FIELD_LOAD_LEVEL,
+    TRACER_FIELD_DISCHARGE_INPUT_STATUS,
+    TRACER_NUM_STATUS_FIELDS
+} tracerStatusField_t;
+
+extern  void        tracerDecodeStatus( const uint16_t batteryBits, const uint16_t chargingBits, const uint16_t dischargingBits, tracerDecodedStatus_t *decoded );
+extern  int         tracerStatusFieldValue( const tracerDecodedStatus_t *decoded, const int field );
+extern  const char  *tracerStatusFieldName( const int field );
+extern  const char  *tracerStatusFieldLabel( const int field, const int value );
+
 extern  int         isDischargeStatusRunning( const uint16_t statusBits );
 extern  int         isDischargeStatusNormal( const uint16_t statusBits );
 extern  int         isDischargeStatusOutputOverVoltage( const uint16_t statusBits );
@@ -249,6 +701,9 @@ extern  void    setLoadOnOffTimers( modbus_t *ctx,
                                     const int offHour, const int offMin, const int offSec,
                                     const int onHour, const int onMin, const int onSec );
 
+extern  int         readInputRegisterBlock( modbus_t *ctx, const int registerAddress, const int numRegisters, uint16_t *buffer );
+extern  float       decodeTemperatureRegister( const int regId, const uint16_t *words );
+
 #ifdef __cplusplus
 }
 #endif